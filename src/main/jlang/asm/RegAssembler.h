@@ -0,0 +1,333 @@
+
+#ifndef JLANG_ASM_REGASSEMBLER_H
+#define JLANG_ASM_REGASSEMBLER_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "jlang/lang/Error.h"
+#include "jlang/asm/Assembler.h"
+#include "jlang/vm/RegOpCode.h"
+#include "jlang/vm/VectorReg.h"
+
+namespace jlang {
+
+//
+// The assembler mode of the register machine (v5), one instruction per line:
+//
+//   fib:
+//       cmp_br_lt   r0, 3, leaf     ; if (n < 3) goto leaf
+//       sub         r1, r0, 1
+//       call        r1, fib         ; r1 = fib(n - 1)
+//
+// The immediate forms are selected by the operands, "add r1, r2, 1" is addi,
+// "mov r1, 5" is movi, "cmp_br_lt r1, 3, L" is cmp_br_lti, "ret 1" is reti.
+// The vector registers are v0 .. v15, "vadd v0, v1, v2". The comments start
+// with ';' or '#'.
+//
+class RegAssembler : public Assembler {
+private:
+    struct Operand {
+        enum Kind {
+            Register,
+            VectorRegister,
+            Immediate,
+            Label
+        };
+        uint32_t    kind;
+        int32_t     value;
+        std::string label;
+    };
+
+    struct Fixup {
+        uint32_t    word;
+        uint32_t    line;
+        std::string label;
+    };
+
+    std::string                         source_;
+    std::vector<uint32_t>               code_;
+    std::map<std::string, uint32_t>     labels_;
+    std::vector<Fixup>                  fixups_;
+    uint32_t                            line_;
+    uint32_t                            errorLine_;
+
+public:
+    RegAssembler() : line_(0), errorLine_(0) {}
+    RegAssembler(const char * source) : source_(source), line_(0), errorLine_(0) {}
+    ~RegAssembler() {}
+
+    void setSource(const char * source) {
+        source_ = source;
+    }
+
+    const std::vector<uint32_t> & getCode() const { return code_; }
+
+    // The line the last error was found in, it starts from 1.
+    uint32_t getErrorLine() const { return errorLine_; }
+
+    //
+    // Return the word index of the label, or -1 if it's not defined.
+    //
+    int32_t getLabel(const char * label) const {
+        std::map<std::string, uint32_t>::const_iterator iter = labels_.find(label);
+        if (iter != labels_.end())
+            return (int32_t)iter->second;
+        else
+            return -1;
+    }
+
+    int parse() {
+        code_.clear();
+        labels_.clear();
+        fixups_.clear();
+        line_ = 0;
+        errorLine_ = 0;
+
+        size_t pos = 0;
+        while (pos < source_.size()) {
+            size_t end = source_.find('\n', pos);
+            if (end == std::string::npos)
+                end = source_.size();
+            line_++;
+            int ec = parseLine(source_.substr(pos, end - pos));
+            if (ec != Error::Ok) {
+                errorLine_ = line_;
+                return ec;
+            }
+            pos = end + 1;
+        }
+
+        // Resolve the forward references.
+        for (size_t i = 0; i < fixups_.size(); i++) {
+            int32_t target = getLabel(fixups_[i].label.c_str());
+            if (target < 0) {
+                errorLine_ = fixups_[i].line;
+                return Error::IllegalIdentifer;
+            }
+            code_[fixups_[i].word] = (uint32_t)target;
+        }
+        return Error::Ok;
+    }
+
+private:
+    static bool isSpace(char ch) {
+        return (ch == ' ' || ch == '\t' || ch == '\r');
+    }
+
+    static bool isIdentChar(char ch) {
+        return ((ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z')
+             || (ch >= '0' && ch <= '9') || ch == '_' || ch == '.');
+    }
+
+    static std::string trim(const std::string & str) {
+        size_t first = 0, last = str.size();
+        while (first < last && isSpace(str[first]))
+            first++;
+        while (last > first && isSpace(str[last - 1]))
+            last--;
+        return str.substr(first, last - first);
+    }
+
+    int parseLine(std::string line) {
+        size_t comment = line.find_first_of(";#");
+        if (comment != std::string::npos)
+            line.erase(comment);
+        line = trim(line);
+
+        // label:
+        size_t colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string label = trim(line.substr(0, colon));
+            if (label.empty() || labels_.count(label) != 0)
+                return Error::IllegalIdentifer;
+            for (size_t i = 0; i < label.size(); i++) {
+                if (!isIdentChar(label[i]))
+                    return Error::IllegalIdentifer;
+            }
+            labels_[label] = (uint32_t)code_.size();
+            line = trim(line.substr(colon + 1));
+        }
+        if (line.empty())
+            return Error::Ok;
+
+        size_t space = 0;
+        while (space < line.size() && !isSpace(line[space]))
+            space++;
+        std::string mnemonic = line.substr(0, space);
+
+        std::vector<Operand> operands;
+        std::string rest = trim(line.substr(space));
+        size_t pos = 0;
+        while (pos < rest.size()) {
+            size_t comma = rest.find(',', pos);
+            if (comma == std::string::npos)
+                comma = rest.size();
+            Operand operand;
+            int ec = parseOperand(trim(rest.substr(pos, comma - pos)), operand);
+            if (ec != Error::Ok)
+                return ec;
+            operands.push_back(operand);
+            pos = comma + 1;
+        }
+
+        return emit(mnemonic, operands);
+    }
+
+    static int parseOperand(const std::string & text, Operand & operand) {
+        if (text.empty())
+            return Error::IllegalOperand;
+
+        char first = text[0];
+        if ((first == 'r' || first == 'R') && text.size() > 1
+            && text[1] >= '0' && text[1] <= '9') {
+            char * end = nullptr;
+            unsigned long reg = strtoul(text.c_str() + 1, &end, 10);
+            if (*end != '\0' || reg >= v5::RegOp::kMaxRegs)
+                return Error::IllegalOperand;
+            operand.kind = Operand::Register;
+            operand.value = (int32_t)reg;
+        }
+        else if ((first == 'v' || first == 'V') && text.size() > 1
+                 && text[1] >= '0' && text[1] <= '9') {
+            char * end = nullptr;
+            unsigned long reg = strtoul(text.c_str() + 1, &end, 10);
+            if (*end != '\0' || reg >= vmVectorFile::kMaxRegs)
+                return Error::IllegalOperand;
+            operand.kind = Operand::VectorRegister;
+            operand.value = (int32_t)reg;
+        }
+        else if ((first >= '0' && first <= '9') || first == '-' || first == '+') {
+            char * end = nullptr;
+            long long value = strtoll(text.c_str(), &end, 0);
+            if (*end != '\0' || value < INT32_MIN || value > (long long)UINT32_MAX)
+                return Error::IllegalNumber;
+            operand.kind = Operand::Immediate;
+            operand.value = (int32_t)value;
+        }
+        else {
+            for (size_t i = 0; i < text.size(); i++) {
+                if (!isIdentChar(text[i]))
+                    return Error::IllegalOperand;
+            }
+            operand.kind = Operand::Label;
+            operand.value = 0;
+            operand.label = text;
+        }
+        return Error::Ok;
+    }
+
+    //
+    // Select the instruction form by the mnemonic and the operand kinds.
+    //
+    static uint32_t selectOp(const std::string & mnemonic, const std::vector<Operand> & operands) {
+        using v5::RegOp;
+        bool lastIsImm = (!operands.empty() && operands.back().kind == Operand::Immediate);
+        bool secondIsImm = (operands.size() >= 2 && operands[1].kind == Operand::Immediate);
+
+        if (mnemonic == "nop")          return RegOp::nop;
+        if (mnemonic == "mov")          return (lastIsImm ? RegOp::movi : RegOp::mov);
+        if (mnemonic == "movi")         return RegOp::movi;
+        if (mnemonic == "add")          return (lastIsImm ? RegOp::addi : RegOp::add);
+        if (mnemonic == "addi")         return RegOp::addi;
+        if (mnemonic == "sub")          return (lastIsImm ? RegOp::subi : RegOp::sub);
+        if (mnemonic == "subi")         return RegOp::subi;
+        if (mnemonic == "cmp_br_lt")    return (secondIsImm ? RegOp::cmp_br_lti : RegOp::cmp_br_lt);
+        if (mnemonic == "cmp_br_ge")    return (secondIsImm ? RegOp::cmp_br_gei : RegOp::cmp_br_ge);
+        if (mnemonic == "cmp_br_lti")   return RegOp::cmp_br_lti;
+        if (mnemonic == "cmp_br_gei")   return RegOp::cmp_br_gei;
+        if (mnemonic == "jmp")          return RegOp::jmp;
+        if (mnemonic == "call")         return RegOp::call;
+        if (mnemonic == "ret")          return (lastIsImm ? RegOp::reti : RegOp::ret);
+        if (mnemonic == "reti")         return RegOp::reti;
+        if (mnemonic == "exit")         return RegOp::exit;
+        if (mnemonic == "ld")           return RegOp::ld;
+        if (mnemonic == "st")           return RegOp::st;
+        if (mnemonic == "vld")          return RegOp::vld;
+        if (mnemonic == "vst")          return RegOp::vst;
+        if (mnemonic == "vsplat")       return RegOp::vsplat;
+        if (mnemonic == "vadd")         return RegOp::vadd;
+        if (mnemonic == "vmul")         return RegOp::vmul;
+        if (mnemonic == "vand")         return RegOp::vand;
+        if (mnemonic == "vcmp_eq")      return RegOp::vcmp_eq;
+        if (mnemonic == "vcmp_lt")      return RegOp::vcmp_lt;
+        if (mnemonic == "vshuf")        return RegOp::vshuf;
+        if (mnemonic == "vsum")         return RegOp::vsum;
+        return RegOp::last;
+    }
+
+    int emit(const std::string & mnemonic, const std::vector<Operand> & operands) {
+        using v5::RegOp;
+        uint32_t op = selectOp(mnemonic, operands);
+        if (op == RegOp::last)
+            return Error::UnsupportedInstruction;
+
+        // The expected operand kinds of the format.
+        static const char * s_formats[] = {
+            "", "R", "I", "L", "RR", "RI", "RL", "RRR", "RRI", "RRL", "RIL",
+            "VR", "VVV", "VVI", "RV"
+        };
+        const char * format = s_formats[RegOp::getFormat(op)];
+        if (operands.size() != strlen(format))
+            return Error::IllegalOperandNumber;
+
+        uint32_t regs[3] = { 0, 0, 0 };
+        uint32_t numRegs = 0;
+        std::vector<uint32_t> extra;
+        for (size_t i = 0; i < operands.size(); i++) {
+            const Operand & operand = operands[i];
+            switch (format[i]) {
+            case 'R':
+                if (operand.kind != Operand::Register)
+                    return Error::IllegalOperand;
+                regs[numRegs++] = (uint32_t)operand.value;
+                break;
+            case 'V':
+                if (operand.kind != Operand::VectorRegister)
+                    return Error::IllegalOperand;
+                regs[numRegs++] = (uint32_t)operand.value;
+                break;
+            case 'I':
+                if (operand.kind != Operand::Immediate)
+                    return Error::IllegalOperand;
+                extra.push_back((uint32_t)operand.value);
+                break;
+            case 'L':
+                if (operand.kind != Operand::Label)
+                    return Error::IllegalOperand;
+                {
+                    Fixup fixup;
+                    fixup.word = (uint32_t)(code_.size() + 1 + extra.size());
+                    fixup.line = line_;
+                    fixup.label = operand.label;
+                    fixups_.push_back(fixup);
+                }
+                extra.push_back(0);
+                break;
+            default:
+                assert(false);
+                break;
+            }
+        }
+
+        code_.push_back(RegOp::encode(op, regs[0], regs[1], regs[2]));
+        code_.insert(code_.end(), extra.begin(), extra.end());
+        assert(1 + extra.size() == RegOp::getLength(op));
+        return Error::Ok;
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_ASM_REGASSEMBLER_H
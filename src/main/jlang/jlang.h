@@ -33,10 +33,17 @@
 #include "jlang/vm/Interpreter_v2.h"
 #include "jlang/vm/Interpreter_v3.h"
 #include "jlang/vm/Interpreter_v4.h"
+#include "jlang/vm/Thread_v4.h"
+#include "jlang/vm/Scheduler_v4.h"
+#include "jlang/vm/Fiber_v4.h"
+#include "jlang/vm/ContextPool_v4.h"
+#include "jlang/vm/Batch_v4.h"
+#include "jlang/vm/Interpreter_v5.h"
 
 #include "jlang/asm/Parser.h"
 #include "jlang/asm/AsmParser.h"
 #include "jlang/asm/Assembler.h"
+#include "jlang/asm/RegAssembler.h"
 
 #include "jlang/support/StopWatch.h"
 
@@ -0,0 +1,190 @@
+
+#ifndef JSTD_CHASELEVDEQUE_H
+#define JSTD_CHASELEVDEQUE_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <atomic>
+#include <vector>
+#include <type_traits>
+
+namespace jstd {
+
+//
+// The work-stealing deque of Chase and Lev ("Dynamic Circular Work-Stealing
+// Deque", 2005), with the C11 memory orders of Le, Pop, Cohen and Nardelli
+// ("Correct and Efficient Work-Stealing for Weak Memory Models", 2013).
+//
+// Only the owner thread may push() and pop(), at the bottom. Any thread
+// may steal() from the top. The ring grows when it's full, the old rings
+// are kept until the deque is destroyed, a thief may still read them.
+//
+template <typename T>
+class ChaseLevDeque {
+public:
+    typedef T               value_type;
+    typedef std::size_t     size_type;
+    typedef ChaseLevDeque<T> this_type;
+
+    static const size_type kDefaultCapacity = 256;
+    static const size_type kCacheLineSize = 64;
+
+private:
+    struct Ring {
+        int64_t                 capacity;
+        int64_t                 mask;
+        std::atomic<T> *        items;
+
+        explicit Ring(int64_t _capacity)
+            : capacity(_capacity), mask(_capacity - 1),
+              items(new std::atomic<T>[(size_t)_capacity]) {
+            assert((_capacity & (_capacity - 1)) == 0);
+        }
+        ~Ring() {
+            delete[] items;
+        }
+
+        T get(int64_t index) const {
+            return items[index & mask].load(std::memory_order_relaxed);
+        }
+
+        void put(int64_t index, T value) {
+            items[index & mask].store(value, std::memory_order_relaxed);
+        }
+    };
+
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "ChaseLevDeque<T>: T must be trivially copyable.");
+
+    // The top is written by the thieves, the bottom by the owner only.
+    std::atomic<int64_t>    top_;
+    char                    padding1_[kCacheLineSize - sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t>    bottom_;
+    std::atomic<Ring *>     ring_;
+    char                    padding2_[kCacheLineSize - sizeof(std::atomic<int64_t>)
+                                      - sizeof(std::atomic<Ring *>)];
+    std::vector<Ring *>     retired_;
+
+public:
+    explicit ChaseLevDeque(size_type capacity = kDefaultCapacity)
+        : top_(0), bottom_(0), ring_(new Ring((int64_t)roundToPow2(capacity))) {
+    }
+
+    ~ChaseLevDeque() {
+        delete ring_.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < retired_.size(); i++) {
+            delete retired_[i];
+        }
+    }
+
+    //
+    // An estimate, it may be stale by the time it's read.
+    //
+    size_type size() const {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top = top_.load(std::memory_order_relaxed);
+        return (size_type)((bottom > top) ? (bottom - top) : 0);
+    }
+
+    bool empty() const {
+        return (size() == 0);
+    }
+
+    //
+    // Push at the bottom (the owner only).
+    //
+    void push(T value) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed);
+        int64_t top = top_.load(std::memory_order_acquire);
+        Ring * ring = ring_.load(std::memory_order_relaxed);
+        if (unlikely(bottom - top > ring->capacity - 1)) {
+            ring = grow(ring, bottom, top);
+        }
+        ring->put(bottom, value);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+
+    //
+    // Pop from the bottom (the owner only), return false if it's empty
+    // or a thief took the last item.
+    //
+    bool pop(T & value) {
+        int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+        Ring * ring = ring_.load(std::memory_order_relaxed);
+        bottom_.store(bottom, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t top = top_.load(std::memory_order_relaxed);
+
+        if (likely(top <= bottom)) {
+            value = ring->get(bottom);
+            if (top == bottom) {
+                // The last item, race the thieves for it.
+                bool won = top_.compare_exchange_strong(top, top + 1,
+                                                        std::memory_order_seq_cst,
+                                                        std::memory_order_relaxed);
+                bottom_.store(bottom + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
+        }
+        else {
+            bottom_.store(bottom + 1, std::memory_order_relaxed);
+            return false;
+        }
+    }
+
+    //
+    // Steal from the top (any thread), return false if it's empty or
+    // another thread took the item first.
+    //
+    bool steal(T & value) {
+        int64_t top = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t bottom = bottom_.load(std::memory_order_acquire);
+
+        if (top < bottom) {
+            Ring * ring = ring_.load(std::memory_order_acquire);
+            T item = ring->get(top);
+            if (!top_.compare_exchange_strong(top, top + 1,
+                                              std::memory_order_seq_cst,
+                                              std::memory_order_relaxed)) {
+                return false;
+            }
+            value = item;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    static size_type roundToPow2(size_type capacity) {
+        size_type pow2 = 2;
+        while (pow2 < capacity) {
+            pow2 <<= 1;
+        }
+        return pow2;
+    }
+
+    Ring * grow(Ring * ring, int64_t bottom, int64_t top) {
+        Ring * newRing = new Ring(ring->capacity * 2);
+        for (int64_t i = top; i < bottom; i++) {
+            newRing->put(i, ring->get(i));
+        }
+        retired_.push_back(ring);
+        ring_.store(newRing, std::memory_order_release);
+        return newRing;
+    }
+};
+
+} // namespace jstd
+
+#endif // JSTD_CHASELEVDEQUE_H
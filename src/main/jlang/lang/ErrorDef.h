@@ -133,6 +133,51 @@
 
     // vmBinary
     _Err(BinaryFile_Read_Failed)
+    _Err(BinaryFile_Open_Failed)
+    _Err(BinaryFile_Bad_Format)
+    _Err(BinaryFile_Bad_Version)
+    _Err(BinaryFile_Write_Failed)
+    _Err(BinaryFile_Not_Writable)
+
+    // vmStack
+    _Err(Stack_Overflow)
+
+    // vmPredecoder
+    _Err(Predecode_Alloc_Failed)
+    _Err(Predecode_Truncated_Instruction)
+    _Err(Predecode_Illegal_Branch_Target)
+
+    // vmVerifier
+    _Err(Verify_Unknown_Opcode)
+    _Err(Verify_Bad_Call)
+    _Err(Verify_Bad_Slot)
+    _Err(Verify_Stack_Mismatch)
+    _Err(Verify_Falls_Off_End)
+
+    // vmStackMaps
+    _Err(StackMap_Bad_Reference)
+    _Err(StackMap_Bad_Call)
+
+    // vmJitCompiler
+    _Err(Jit_Not_Supported)
+    _Err(Jit_Unsupported_Opcode)
+    _Err(Jit_Alloc_Failed)
+
+    // vmMemoizer
+    _Err(Memo_Image_Fused)
+
+    // vmExecProfiler
+    _Err(Profile_Write_Failed)
+
+    // vmSampler
+    _Err(Sampler_Not_Supported)
+
+    // vmProcess
+    _Err(Invoke_Bad_Entry)
+    _Err(Thread_Start_Failed)
+
+    // v5 data memory
+    _Err(Data_Out_Of_Range)
 
     #undef _Err
 
@@ -147,11 +147,21 @@ public:
 #if USE_DEBUG_PRINT
         va_list args;
         va_start(args, fmt);
-        this->outputln(LogLevel::Trace, fmt, args);
+        this->vtrace(fmt, args);
         va_end(args);
 #endif
     }
 
+    //
+    // It isn't gated by USE_DEBUG_PRINT, see vmConsoleTrace.
+    //
+    void vtrace(const char * fmt, va_list args) {
+        if (LogLevel::Trace <= this->level_) {
+            this->print(sLevelPrefix[LogLevel::Trace]);
+            this->vfprintln(fmt, args);
+        }
+    }
+
     void debug(const char * fmt, ...) {
         va_list args;
         va_start(args, fmt);
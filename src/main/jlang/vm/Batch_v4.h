@@ -0,0 +1,1080 @@
+
+#ifndef JLANG_VM_BATCH_V4_H
+#define JLANG_VM_BATCH_V4_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Interpreter_v4.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/vm/TracePolicy.h"
+#include "jlang/lang/Error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace jlang {
+namespace v4 {
+
+//
+// Eight 32-bit lanes: one AVX2 vector when the target has it, two SSE2
+// halves on the other x86-64 targets, else plain loops. A mask is a
+// vector that is all ones in the lanes it selects.
+//
+struct vmLanes {
+    static const uint32_t kCount = 8;
+    static const uint32_t kAll = 0xFFU;
+
+#if defined(__AVX2__)
+    typedef __m256i vec;
+
+    static JM_FORCEINLINE vec set1(uint32_t value) { return _mm256_set1_epi32((int)value); }
+    static JM_FORCEINLINE vec index() { return _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7); }
+
+    static JM_FORCEINLINE vec loadu(const uint32_t * src) {
+        return _mm256_loadu_si256((const __m256i *)src);
+    }
+    static JM_FORCEINLINE void storeu(uint32_t * dest, vec v) {
+        _mm256_storeu_si256((__m256i *)dest, v);
+    }
+
+    static JM_FORCEINLINE vec maskOf(uint32_t bits) {
+        const vec lane = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+        return _mm256_cmpeq_epi32(_mm256_and_si256(set1(bits), lane), lane);
+    }
+    static JM_FORCEINLINE uint32_t bitsOf(vec mask) {
+        return (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(mask));
+    }
+
+    // The lanes of the mask take b, the others keep a.
+    static JM_FORCEINLINE vec select(vec mask, vec a, vec b) { return _mm256_blendv_epi8(a, b, mask); }
+
+    static JM_FORCEINLINE vec add(vec a, vec b) { return _mm256_add_epi32(a, b); }
+    static JM_FORCEINLINE vec sub(vec a, vec b) { return _mm256_sub_epi32(a, b); }
+    static JM_FORCEINLINE vec shl3(vec a) { return _mm256_slli_epi32(a, 3); }
+    static JM_FORCEINLINE vec and_(vec a, vec b) { return _mm256_and_si256(a, b); }
+    static JM_FORCEINLINE vec or_(vec a, vec b) { return _mm256_or_si256(a, b); }
+    static JM_FORCEINLINE vec not_(vec a) { return _mm256_xor_si256(a, _mm256_set1_epi32(-1)); }
+
+    static JM_FORCEINLINE vec eq(vec a, vec b) { return _mm256_cmpeq_epi32(a, b); }
+    static JM_FORCEINLINE vec gt_i32(vec a, vec b) { return _mm256_cmpgt_epi32(a, b); }
+    static JM_FORCEINLINE vec gt_u32(vec a, vec b) {
+        const vec sign = _mm256_set1_epi32((int)0x80000000U);
+        return _mm256_cmpgt_epi32(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+    }
+
+    // The masked lanes of a row of the stack, the others read as 0.
+    static JM_FORCEINLINE vec maskload(const uint32_t * row, vec mask) {
+        return _mm256_maskload_epi32((const int *)row, mask);
+    }
+    static JM_FORCEINLINE void maskstore(uint32_t * row, vec mask, vec v) {
+        _mm256_maskstore_epi32((int *)row, mask, v);
+    }
+    static JM_FORCEINLINE vec gather(const uint32_t * base, vec index, vec mask) {
+        return _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), (const int *)base,
+                                           index, mask, 4);
+    }
+
+#if defined(__AVX512VL__)
+    static JM_FORCEINLINE void scatter(uint32_t * base, vec index, vec mask, vec v) {
+        _mm256_mask_i32scatter_epi32((int *)base, (__mmask8)bitsOf(mask), index, v, 4);
+    }
+#else
+    // No scatter on AVX2.
+    static JM_FORCEINLINE void scatter(uint32_t * base, vec index, vec mask, vec v) {
+        uint32_t indexes[kCount], values[kCount];
+        _mm256_storeu_si256((__m256i *)indexes, index);
+        _mm256_storeu_si256((__m256i *)values, v);
+        for (uint32_t bits = bitsOf(mask); bits != 0; bits &= bits - 1) {
+            uint32_t i = firstOf(bits);
+            base[indexes[i]] = values[i];
+        }
+    }
+#endif // __AVX512VL__
+#elif defined(__SSE2__) || defined(_M_X64)
+    // Two halves of four lanes.
+    struct vec {
+        __m128i lo, hi;
+    };
+
+    static JM_FORCEINLINE vec make(__m128i lo, __m128i hi) {
+        vec r;
+        r.lo = lo;
+        r.hi = hi;
+        return r;
+    }
+
+    static JM_FORCEINLINE vec set1(uint32_t value) {
+        __m128i v = _mm_set1_epi32((int)value);
+        return make(v, v);
+    }
+    static JM_FORCEINLINE vec index() { return make(_mm_setr_epi32(0, 1, 2, 3), _mm_setr_epi32(4, 5, 6, 7)); }
+
+    static JM_FORCEINLINE vec loadu(const uint32_t * src) {
+        return make(_mm_loadu_si128((const __m128i *)src), _mm_loadu_si128((const __m128i *)(src + 4)));
+    }
+    static JM_FORCEINLINE void storeu(uint32_t * dest, vec v) {
+        _mm_storeu_si128((__m128i *)dest, v.lo);
+        _mm_storeu_si128((__m128i *)(dest + 4), v.hi);
+    }
+
+    static JM_FORCEINLINE vec maskOf(uint32_t bits) {
+        const __m128i lo = _mm_setr_epi32(1, 2, 4, 8);
+        const __m128i hi = _mm_setr_epi32(16, 32, 64, 128);
+        __m128i v = _mm_set1_epi32((int)bits);
+        return make(_mm_cmpeq_epi32(_mm_and_si128(v, lo), lo), _mm_cmpeq_epi32(_mm_and_si128(v, hi), hi));
+    }
+    static JM_FORCEINLINE uint32_t bitsOf(vec mask) {
+        return (uint32_t)(_mm_movemask_ps(_mm_castsi128_ps(mask.lo)) |
+                          (_mm_movemask_ps(_mm_castsi128_ps(mask.hi)) << 4));
+    }
+
+    static JM_FORCEINLINE __m128i select(__m128i mask, __m128i a, __m128i b) {
+        return _mm_or_si128(_mm_and_si128(mask, b), _mm_andnot_si128(mask, a));
+    }
+    static JM_FORCEINLINE vec select(vec mask, vec a, vec b) {
+        return make(select(mask.lo, a.lo, b.lo), select(mask.hi, a.hi, b.hi));
+    }
+
+#define VM_LANES_BINARY(name, expr) \
+    static JM_FORCEINLINE vec name(vec a, vec b) { \
+        return make(expr(a.lo, b.lo), expr(a.hi, b.hi)); \
+    }
+
+    static JM_FORCEINLINE __m128i gt_u32(__m128i a, __m128i b) {
+        const __m128i sign = _mm_set1_epi32((int)0x80000000U);
+        return _mm_cmpgt_epi32(_mm_xor_si128(a, sign), _mm_xor_si128(b, sign));
+    }
+
+    VM_LANES_BINARY(add, _mm_add_epi32)
+    VM_LANES_BINARY(sub, _mm_sub_epi32)
+    VM_LANES_BINARY(and_, _mm_and_si128)
+    VM_LANES_BINARY(or_, _mm_or_si128)
+    VM_LANES_BINARY(eq, _mm_cmpeq_epi32)
+    VM_LANES_BINARY(gt_i32, _mm_cmpgt_epi32)
+    VM_LANES_BINARY(gt_u32, gt_u32)
+
+#undef VM_LANES_BINARY
+
+    static JM_FORCEINLINE vec shl3(vec a) { return make(_mm_slli_epi32(a.lo, 3), _mm_slli_epi32(a.hi, 3)); }
+    static JM_FORCEINLINE vec not_(vec a) {
+        const __m128i ones = _mm_set1_epi32(-1);
+        return make(_mm_xor_si128(a.lo, ones), _mm_xor_si128(a.hi, ones));
+    }
+
+    // A row always has its eight slots, the others are read and kept.
+    static JM_FORCEINLINE vec maskload(const uint32_t * row, vec mask) {
+        return and_(loadu(row), mask);
+    }
+    static JM_FORCEINLINE void maskstore(uint32_t * row, vec mask, vec v) {
+        storeu(row, select(mask, loadu(row), v));
+    }
+
+    static JM_FORCEINLINE vec gather(const uint32_t * base, vec index, vec mask) {
+        uint32_t indexes[kCount], values[kCount];
+        storeu(indexes, index);
+        uint32_t bits = bitsOf(mask);
+        for (uint32_t i = 0; i < kCount; i++) {
+            values[i] = ((bits >> i) & 1U) ? base[indexes[i]] : 0;
+        }
+        return loadu(values);
+    }
+    static JM_FORCEINLINE void scatter(uint32_t * base, vec index, vec mask, vec v) {
+        uint32_t indexes[kCount], values[kCount];
+        storeu(indexes, index);
+        storeu(values, v);
+        for (uint32_t bits = bitsOf(mask); bits != 0; bits &= bits - 1) {
+            uint32_t i = firstOf(bits);
+            base[indexes[i]] = values[i];
+        }
+    }
+#else
+    struct vec {
+        uint32_t u[kCount];
+    };
+
+    static JM_FORCEINLINE vec set1(uint32_t value) {
+        vec r;
+        for (uint32_t i = 0; i < kCount; i++) r.u[i] = value;
+        return r;
+    }
+    static JM_FORCEINLINE vec index() {
+        vec r;
+        for (uint32_t i = 0; i < kCount; i++) r.u[i] = i;
+        return r;
+    }
+
+    static JM_FORCEINLINE vec loadu(const uint32_t * src) {
+        vec r;
+        memcpy((void *)&r.u[0], (const void *)src, sizeof(r.u));
+        return r;
+    }
+    static JM_FORCEINLINE void storeu(uint32_t * dest, vec v) {
+        memcpy((void *)dest, (const void *)&v.u[0], sizeof(v.u));
+    }
+
+    static JM_FORCEINLINE vec maskOf(uint32_t bits) {
+        vec r;
+        for (uint32_t i = 0; i < kCount; i++) r.u[i] = ((bits >> i) & 1U) ? 0xFFFFFFFFU : 0;
+        return r;
+    }
+    static JM_FORCEINLINE uint32_t bitsOf(vec mask) {
+        uint32_t bits = 0;
+        for (uint32_t i = 0; i < kCount; i++) bits |= (mask.u[i] >> 31) << i;
+        return bits;
+    }
+
+    static JM_FORCEINLINE vec select(vec mask, vec a, vec b) {
+        vec r;
+        for (uint32_t i = 0; i < kCount; i++) r.u[i] = (a.u[i] & ~mask.u[i]) | (b.u[i] & mask.u[i]);
+        return r;
+    }
+
+#define VM_LANES_BINARY(name, expr) \
+    static JM_FORCEINLINE vec name(vec a, vec b) { \
+        vec r; \
+        for (uint32_t i = 0; i < kCount; i++) r.u[i] = (expr); \
+        return r; \
+    }
+
+    VM_LANES_BINARY(add, a.u[i] + b.u[i])
+    VM_LANES_BINARY(sub, a.u[i] - b.u[i])
+    VM_LANES_BINARY(and_, a.u[i] & b.u[i])
+    VM_LANES_BINARY(or_, a.u[i] | b.u[i])
+    VM_LANES_BINARY(eq, (a.u[i] == b.u[i]) ? 0xFFFFFFFFU : 0)
+    VM_LANES_BINARY(gt_i32, ((int32_t)a.u[i] > (int32_t)b.u[i]) ? 0xFFFFFFFFU : 0)
+    VM_LANES_BINARY(gt_u32, (a.u[i] > b.u[i]) ? 0xFFFFFFFFU : 0)
+
+#undef VM_LANES_BINARY
+
+    static JM_FORCEINLINE vec shl3(vec a) {
+        vec r;
+        for (uint32_t i = 0; i < kCount; i++) r.u[i] = a.u[i] << 3;
+        return r;
+    }
+    static JM_FORCEINLINE vec not_(vec a) {
+        vec r;
+        for (uint32_t i = 0; i < kCount; i++) r.u[i] = ~a.u[i];
+        return r;
+    }
+
+    static JM_FORCEINLINE vec maskload(const uint32_t * row, vec mask) {
+        vec r;
+        for (uint32_t i = 0; i < kCount; i++) r.u[i] = row[i] & mask.u[i];
+        return r;
+    }
+    static JM_FORCEINLINE void maskstore(uint32_t * row, vec mask, vec v) {
+        for (uint32_t i = 0; i < kCount; i++) {
+            if (mask.u[i] != 0) row[i] = v.u[i];
+        }
+    }
+    static JM_FORCEINLINE vec gather(const uint32_t * base, vec index, vec mask) {
+        vec r;
+        for (uint32_t i = 0; i < kCount; i++) r.u[i] = (mask.u[i] != 0) ? base[index.u[i]] : 0;
+        return r;
+    }
+    static JM_FORCEINLINE void scatter(uint32_t * base, vec index, vec mask, vec v) {
+        for (uint32_t i = 0; i < kCount; i++) {
+            if (mask.u[i] != 0) base[index.u[i]] = v.u[i];
+        }
+    }
+#endif // __AVX2__
+
+    static JM_FORCEINLINE uint32_t countOf(uint32_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+        return (uint32_t)__builtin_popcount(bits);
+#else
+        uint32_t count = 0;
+        for (; bits != 0; bits &= bits - 1) count++;
+        return count;
+#endif
+    }
+
+    // The lowest lane of the bits, they must not be 0.
+    static JM_FORCEINLINE uint32_t firstOf(uint32_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+        return (uint32_t)__builtin_ctz(bits);
+#else
+        uint32_t first = 0;
+        while ((bits & (1U << first)) == 0) first++;
+        return first;
+#endif
+    }
+
+    static JM_FORCEINLINE uint32_t lane(vec v, uint32_t i) {
+#if defined(__AVX2__)
+        return (uint32_t)_mm256_cvtsi256_si32(_mm256_permutevar8x32_epi32(v, set1(i)));
+#elif defined(__SSE2__) || defined(_M_X64)
+        uint32_t u[kCount];
+        storeu(u, v);
+        return u[i];
+#else
+        return v.u[i];
+#endif
+    }
+
+    //
+    // The jump condition of each lane, as getCondition() has it.
+    //
+    static JM_FORCEINLINE vec condition(vec v1, vec v2, uint8_t cmpType, bool isSigned) {
+        const vec zero = set1(0);
+        switch (cmpType) {
+        case OpCode::jz:
+            return and_(eq(v1, zero), eq(v2, zero));
+        case OpCode::jnz:
+            return not_(or_(eq(v1, zero), eq(v2, zero)));
+        case OpCode::je:
+            return eq(v1, v2);
+        case OpCode::jne:
+            return not_(eq(v1, v2));
+        case OpCode::jl:
+        case OpCode::jl_near:
+        case OpCode::jl_short:
+        case OpCode::jl_long:
+            return (isSigned ? gt_i32(v2, v1) : gt_u32(v2, v1));
+        case OpCode::jle:
+            return not_(isSigned ? gt_i32(v1, v2) : gt_u32(v1, v2));
+        case OpCode::jg:
+            return (isSigned ? gt_i32(v1, v2) : gt_u32(v1, v2));
+        case OpCode::jge:
+            return not_(isSigned ? gt_i32(v2, v1) : gt_u32(v2, v1));
+        case OpCode::js:
+            return (isSigned ? gt_i32(v1, zero) : not_(eq(v1, zero)));
+        case OpCode::jns:
+            return not_(isSigned ? gt_i32(v1, zero) : not_(eq(v1, zero)));
+        case OpCode::jmp:
+        case OpCode::jmp_near:
+        case OpCode::jmp_short:
+        case OpCode::jmp_long:
+            return set1(0xFFFFFFFFU);
+        default:
+            return zero;
+        }
+    }
+};
+
+//
+// Run one function of an image over many inputs at once, a lane of the
+// vector per input.
+//
+// The lanes of a group of eight share the predecoded stream, each has
+// its own pc, frame pointer, eax and flag. The stack is interleaved, the
+// slot s of lane l is at s * 8 + l, so the lanes that are in frames at
+// the same depth read and write a slot as one row; the others gather.
+// The frames have the layout of the scalar ones in 32-bit slots: the
+// saved frame pointer and the return point are slot indexes.
+//
+// Each step runs the instruction of one pc for the lanes that are at it,
+// the deepest frame first, so the lanes that branch apart meet again
+// when they return. When the lanes that run per step fall below the
+// occupancy limit, or a lane meets an instruction without a lane form
+// (the fused and memo ones), the lanes that are not done are handed to
+// the scalar executor where they are: their frames are laid on a scalar
+// stack and execute_slice() goes on from their pc. A lane that fails
+// there is run again by the scalar invoke() to get its error, the guest
+// functions have no side effects, so it gives the same result.
+//
+// The image must be bound already, as vmProcess::create() leaves it.
+//
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class vmBatchExecutor {
+public:
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionContext<basic_type, trace_policy>  context_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef vmLanes::vec                                vec;
+    typedef vmBatchExecutor<basic_type, trace_policy>   this_type;
+
+    static const uint32_t  kLanes = vmLanes::kCount;
+    static const uint32_t  kMaxArgs = 8;
+    // The slots of a lane, and the margin around them for the slot
+    // indexes of the instructions (see create()).
+    static const uint32_t  kDefaultLaneSlots = 16 * 1024U;
+    static const int32_t   kSlotMargin = 256;
+    static const uint32_t  kDefaultOccupancy = 50;
+    // The steps the occupancy is measured over. A lane that is handed off
+    // keeps its work, so it's short: the lanes are let go early.
+    static const uint32_t  kOccupancyWindow = 16;
+    static const size_type kContextStackSize = 256 * 1024U;
+    // The slice budget of a handed lane, it's run to the end.
+    static const int64_t   kHandOffBudget = INT64_MAX;
+
+    // The return slot of the entry frame, it's the exit.
+    static const uint32_t  kExitReturn = 0;
+    static const uint32_t  kLaneDone = 0xFFFFFFFFU;
+
+private:
+    vmDecodedImage *    decoded_;
+    uint32_t *          stack_;
+    uint32_t            laneSlots_;
+    uint32_t            occupancy_;
+    bool                batchable_;
+    context_type        context_;
+    // The scalar stack of a handed lane.
+    vmStack<basic_type, false>  handStack_;
+
+    uint64_t            groups_;
+    uint64_t            steps_;
+    uint64_t            laneSteps_;
+    uint64_t            fallbacks_;
+    uint64_t            handOffs_;
+
+public:
+    vmBatchExecutor() : decoded_(nullptr), stack_(nullptr), laneSlots_(0),
+                        occupancy_(kDefaultOccupancy), batchable_(false),
+                        groups_(0), steps_(0), laneSteps_(0), fallbacks_(0),
+                        handOffs_(0) {}
+    ~vmBatchExecutor() {
+        destroy();
+    }
+
+    bool isInited() const { return (stack_ != nullptr); }
+
+    // The image has no slot index the lanes can't reach.
+    bool isBatchable() const { return batchable_; }
+
+    uint64_t getGroupCount() const { return groups_; }
+    uint64_t getStepCount() const { return steps_; }
+    uint64_t getLaneStepCount() const { return laneSteps_; }
+
+    // The inputs that were run by the scalar invoke().
+    uint64_t getFallbackCount() const { return fallbacks_; }
+
+    // The inputs that the scalar executor finished from where their lane was.
+    uint64_t getHandOffCount() const { return handOffs_; }
+
+    // The mean of the lanes that ran per step, in percent.
+    double getOccupancy() const {
+        return ((steps_ != 0) ? (100.0 * laneSteps_ / (steps_ * kLanes)) : 0.0);
+    }
+
+    void resetCounters() {
+        groups_ = 0;
+        steps_ = 0;
+        laneSteps_ = 0;
+        fallbacks_ = 0;
+        handOffs_ = 0;
+    }
+
+    //
+    // The lanes of a group are handed to the scalar executor when less
+    // than this percent of the eight run per step, a step costs about
+    // half of eight scalar ones. A group of fewer inputs than that isn't
+    // started.
+    //
+    void setOccupancy(uint32_t percent) {
+        occupancy_ = (percent <= 100) ? percent : 100;
+    }
+
+    int create(vmBinaryFile * binary, uint32_t laneSlots = kDefaultLaneSlots) {
+        if (binary == nullptr || binary->getDecodedImage() == nullptr)
+            return Error::Error_NullPtr;
+        destroy();
+
+        decoded_ = binary->getDecodedImage();
+        context_.setImageInfo(binary->getImagePtr(), binary->getImageSize(),
+                              binary->getImageEntry());
+        context_.setDecodedImage(decoded_);
+        context_.create(kContextStackSize);
+        handStack_.create(kContextStackSize);
+        if (!context_.isInited() || !handStack_.isInited())
+            return Error::MainProcess_Create_Failed;
+
+        laneSlots_ = laneSlots;
+        size_t allocSize = sizeof(uint32_t) * kLanes * (laneSlots_ + 2 * kSlotMargin);
+#if defined(_WIN32)
+        stack_ = (uint32_t *)_aligned_malloc(allocSize, 64);
+#else
+        int ret = posix_memalign((void **)&stack_, 64, allocSize);
+        if (ret != 0)
+            stack_ = nullptr;
+#endif // _WIN32
+        if (stack_ == nullptr) {
+            context_.destroy();
+            return Error::MainProcess_Create_Failed;
+        }
+        batchable_ = checkSlotIndexes();
+        return Error::Ok;
+    }
+
+    void destroy() {
+        if (stack_ != nullptr) {
+#if defined(_WIN32)
+            _aligned_free(stack_);
+#else
+            free(stack_);
+#endif
+            stack_ = nullptr;
+        }
+        handStack_.destroy();
+        context_.destroy();
+        decoded_ = nullptr;
+        batchable_ = false;
+    }
+
+    //
+    // Call the function at the offset once per input, args[i * argc + k]
+    // is the argk of the input i. The errors may be nullptr, a failed
+    // input has the error of the scalar run.
+    //
+    int run(uint32_t entryOffset, const uint32_t * args, uint32_t argc, size_t count,
+            uintptr_t * results, int * errors = nullptr) {
+        if (!isInited() || argc > kMaxArgs || (args == nullptr && argc != 0) ||
+            results == nullptr)
+            return Error::Invoke_Bad_Entry;
+        vmDecodedInst * entry = decoded_->atOffset(entryOffset);
+        if (entry == nullptr || entry == decoded_->end())
+            return Error::Invoke_Bad_Entry;
+
+        bool fastEntry = context_.isFastCallee(entry);
+        int ec = Error::Ok;
+        for (size_t first = 0; first < count; first += kLanes) {
+            uint32_t lanes = (uint32_t)(((count - first) < kLanes) ? (count - first) : kLanes);
+            uint32_t fallback = 0;
+            if (batchable_ && lanes * 100 >= kLanes * occupancy_)
+                fallback = runGroup(entry, fastEntry, args + first * argc, argc, lanes,
+                                    results + first);
+            else
+                fallback = (1U << lanes) - 1;
+
+            // The scalar runs of the lanes that gave up.
+            for (uint32_t l = 0; l < lanes; l++) {
+                int laneError = Error::Ok;
+                if ((fallback & (1U << l)) != 0) {
+                    return_type retVal;
+                    retVal.setDataType(return_type::Basic);
+                    laneError = context_.invoke(entryOffset, args + (first + l) * argc,
+                                                argc, retVal);
+                    results[first + l] = retVal.getValue();
+                    if (laneError != Error::Ok)
+                        ec = laneError;
+                    fallbacks_++;
+                }
+                if (errors != nullptr)
+                    errors[first + l] = laneError;
+            }
+        }
+        return ec;
+    }
+
+private:
+    uint32_t getIndex(const vmDecodedInst * inst) const {
+        return (uint32_t)(inst - decoded_->begin());
+    }
+
+    //
+    // The slot indexes of the instructions are in the margin of the lanes'
+    // stack, so a lane can't reach the slots of another one.
+    //
+    bool checkSlotIndexes() const {
+        for (const vmDecodedInst * inst = decoded_->begin(); inst != decoded_->end(); ++inst) {
+            bool hasSlot2 = false;
+            switch (inst->opcode) {
+            case OpCode::move:
+            case OpCode::cmp_i32:
+            case OpCode::cmp_u32:
+            case OpCode::add:
+            case OpCode::sub:
+                hasSlot2 = true;
+                // Fall through
+            case OpCode::store:
+            case OpCode::copy_from_eax:
+            case OpCode::cmp_imm_i32:
+            case OpCode::cmp_imm_u32:
+            case OpCode::inc:
+            case OpCode::dec:
+            case OpCode::add_imm:
+            case OpCode::add_eax:
+            case OpCode::sub_imm:
+            case OpCode::sub_eax:
+                if (inst->operand1 <= -kSlotMargin || inst->operand1 >= kSlotMargin)
+                    return false;
+                if (hasSlot2 && ((int32_t)inst->operand2 <= -kSlotMargin ||
+                                 (int32_t)inst->operand2 >= kSlotMargin))
+                    return false;
+                break;
+            case OpCode::call:
+            case OpCode::call_short:
+            case OpCode::call_long:
+            case OpCode::fast_call_short:
+            case OpCode::fast_tail_call_short:
+            case OpCode::ret_n_sm:
+            case OpCode::ret_n:
+            case OpCode::ret_eax_n:
+                if ((inst->aux & 0x03) != 0 || (int32_t)(inst->aux / 4) >= kSlotMargin)
+                    return false;
+                break;
+            default:
+                break;
+            }
+        }
+        return true;
+    }
+
+    //
+    // The lanes of a step: the ones at its pc, and whether their frames
+    // are at the same depth (a row of the stack).
+    //
+    struct Step {
+        vec         mask;
+        vec         fp;
+        uint32_t *  stack;
+        int32_t     rowFp;
+        bool        isRow;
+        bool        isFull;
+
+        JM_FORCEINLINE vec read(int32_t slot) const {
+            if (likely(isRow)) {
+                const uint32_t * row = stack + (rowFp + slot) * (int32_t)kLanes;
+                return (likely(isFull) ? vmLanes::loadu(row) : vmLanes::maskload(row, mask));
+            }
+            return vmLanes::gather(stack, indexOf(slot), mask);
+        }
+
+        JM_FORCEINLINE void write(int32_t slot, vec value) const {
+            if (likely(isRow)) {
+                uint32_t * row = stack + (rowFp + slot) * (int32_t)kLanes;
+                if (likely(isFull))
+                    vmLanes::storeu(row, value);
+                else
+                    vmLanes::maskstore(row, mask, value);
+                return;
+            }
+            vmLanes::scatter(stack, indexOf(slot), mask, value);
+        }
+
+        // The slot of each lane's frame, in the interleaved stack.
+        JM_FORCEINLINE vec indexOf(int32_t slot) const {
+            return vmLanes::add(vmLanes::shl3(vmLanes::add(fp, vmLanes::set1((uint32_t)slot))),
+                                vmLanes::index());
+        }
+    };
+
+    //
+    // Run up to eight inputs, return the lanes that are left to invoke().
+    //
+    uint32_t runGroup(const vmDecodedInst * entry, bool fastEntry, const uint32_t * args,
+                      uint32_t argc, uint32_t lanes, uintptr_t * results) {
+        const vmDecodedInst * code = decoded_->begin();
+        uint32_t * stack = stack_ + kSlotMargin * kLanes;
+        const int32_t limit = (int32_t)laneSlots_ - kSlotMargin;
+
+        // The entry frames, as invoke() lays them.
+        uint32_t fps[kLanes], pcs[kLanes];
+        for (uint32_t l = 0; l < kLanes; l++) {
+            uint32_t slot = 0;
+            if (l < lanes) {
+                for (uint32_t i = 0; i < argc; i++) {
+                    stack[(argc - 1 - i) * kLanes + l] = args[l * argc + i];
+                }
+            }
+            slot = argc;
+            if (!fastEntry) {
+                stack[slot * kLanes + l] = 0;
+                slot += 2;
+            }
+            stack[slot * kLanes + l] = kExitReturn;
+            slot += 2;
+            fps[l] = slot;
+            pcs[l] = (l < lanes) ? getIndex(entry) : kLaneDone;
+        }
+
+        vec fp = vmLanes::loadu(fps);
+        vec pc = vmLanes::loadu(pcs);
+        vec eax = vmLanes::set1(0);
+        vec flag = vmLanes::set1(0);
+        uint32_t live = (1U << lanes) - 1;
+        uint32_t fallback = 0;
+
+        // The lane the step is chosen by, its pc and frame are kept in
+        // scalars too, so the dispatch doesn't wait for the vectors.
+        uint32_t leader = 0;
+        uint32_t leaderPc = pcs[0];
+        int32_t leaderFp = (int32_t)fps[0];
+
+        uint32_t window = 0, windowLanes = 0;
+        uint64_t steps = 0, laneSteps = 0;
+
+        while (live != 0) {
+            // The lanes at the pc of the deepest frame.
+            uint32_t mask = vmLanes::bitsOf(vmLanes::eq(pc, vmLanes::set1(leaderPc))) & live;
+            if (unlikely(mask != live)) {
+                vmLanes::storeu(fps, fp);
+                vmLanes::storeu(pcs, pc);
+                leader = vmLanes::firstOf(live);
+                for (uint32_t l = leader + 1; l < kLanes; l++) {
+                    if ((live & (1U << l)) != 0 &&
+                        ((int32_t)fps[l] > (int32_t)fps[leader] ||
+                         (fps[l] == fps[leader] && pcs[l] < pcs[leader]))) {
+                        leader = l;
+                    }
+                }
+                leaderPc = pcs[leader];
+                leaderFp = (int32_t)fps[leader];
+                mask = vmLanes::bitsOf(vmLanes::eq(pc, vmLanes::set1(leaderPc))) & live;
+            }
+
+            Step step;
+            step.stack = stack;
+            step.fp = fp;
+            step.mask = vmLanes::maskOf(mask);
+            step.rowFp = leaderFp;
+            step.isRow = ((vmLanes::bitsOf(vmLanes::eq(fp, vmLanes::set1((uint32_t)leaderFp))) & mask) == mask);
+            step.isFull = (mask == vmLanes::kAll);
+
+            uint32_t active = vmLanes::countOf(mask);
+            steps++;
+            laneSteps += active;
+
+            // Hand the group off when too few of its lanes run per step.
+            window++;
+            windowLanes += active;
+            if (window == kOccupancyWindow) {
+                if (windowLanes * 100 < kOccupancyWindow * kLanes * occupancy_) {
+                    handOff(live, fp, pc, eax, flag, fastEntry, live, fallback, results);
+                    break;
+                }
+                window = windowLanes = 0;
+            }
+
+            const vmDecodedInst * inst = code + leaderPc;
+            const vec & m = step.mask;
+            vec next = vmLanes::set1(leaderPc + 1);
+            switch (inst->opcode) {
+            case OpCode::load_eax:
+                eax = vmLanes::select(m, eax, vmLanes::set1(inst->operand2));
+                break;
+
+            case OpCode::store:
+                step.write(inst->operand1, vmLanes::set1(inst->operand2));
+                break;
+
+            case OpCode::move:
+                step.write(inst->operand1, step.read((int32_t)inst->operand2));
+                break;
+
+            case OpCode::copy_from_eax:
+                step.write(inst->operand1, eax);
+                break;
+
+            case OpCode::cmp_i32:
+            case OpCode::cmp_u32: {
+                vec cond = vmLanes::condition(step.read(inst->operand1),
+                                              step.read((int32_t)inst->operand2),
+                                              (uint8_t)inst->aux,
+                                              (inst->opcode == OpCode::cmp_i32));
+                flag = vmLanes::select(m, flag, cond);
+                break;
+            }
+
+            case OpCode::cmp_imm_i32:
+            case OpCode::cmp_imm_u32: {
+                vec cond = vmLanes::condition(step.read(inst->operand1),
+                                              vmLanes::set1(inst->operand2),
+                                              (uint8_t)inst->aux,
+                                              (inst->opcode == OpCode::cmp_imm_i32));
+                flag = vmLanes::select(m, flag, cond);
+                break;
+            }
+
+            case OpCode::jl_near:
+            case OpCode::jl_short:
+            case OpCode::jl_long: {
+                // The lanes may part here.
+                uint32_t target = getIndex(inst->target);
+                pc = vmLanes::select(m, pc, vmLanes::select(flag, next, vmLanes::set1(target)));
+                leaderPc = (((vmLanes::bitsOf(flag) >> leader) & 1U) != 0) ? target : (leaderPc + 1);
+                continue;
+            }
+
+            case OpCode::jmp:
+            case OpCode::jmp_near:
+            case OpCode::jmp_short:
+            case OpCode::jmp_long:
+                leaderPc = getIndex(inst->target);
+                pc = vmLanes::select(m, pc, vmLanes::set1(leaderPc));
+                continue;
+
+            case OpCode::call:
+            case OpCode::call_short:
+            case OpCode::call_long:
+            case OpCode::fast_call_short: {
+                bool isFast = (inst->opcode == OpCode::fast_call_short);
+                int32_t localSlots = (int32_t)(inst->aux / 4);
+                int32_t frameSlots = localSlots + (isFast ? 2 : 4);
+                if (!fitsCall(fp, mask, frameSlots, limit)) {
+                    // The scalar stack is deeper, or invoke() reports the overflow.
+                    handOff(mask, fp, pc, eax, flag, fastEntry, live, fallback, results);
+                    continue;
+                }
+                vmDecodedInst * returnInst = decoded_->atOffset(inst->operand2);
+                uint32_t returnSlot = (returnInst != nullptr) ? (getIndex(returnInst) + 1) : kExitReturn;
+                if (!isFast)
+                    step.write(localSlots, fp);
+                step.write(frameSlots - 2, vmLanes::set1(returnSlot));
+                fp = vmLanes::select(m, fp, vmLanes::add(fp, vmLanes::set1((uint32_t)frameSlots)));
+                leaderFp += frameSlots;
+                leaderPc = getIndex(inst->target);
+                pc = vmLanes::select(m, pc, vmLanes::set1(leaderPc));
+                continue;
+            }
+
+            case OpCode::fast_tail_call_short: {
+                // Move the outgoing arguments (the top operand1 bytes of the
+                // locals) down over the incoming ones.
+                int32_t localSlots = (int32_t)(inst->aux / 4);
+                for (int32_t i = localSlots - inst->operand1 / 4; i < localSlots; i++) {
+                    step.write(i - 2 - localSlots, step.read(i));
+                }
+                leaderPc = getIndex(inst->target);
+                pc = vmLanes::select(m, pc, vmLanes::set1(leaderPc));
+                continue;
+            }
+
+            case OpCode::ret_eax:
+            case OpCode::ret_eax_n:
+                eax = vmLanes::select(m, eax, vmLanes::set1(inst->operand2));
+                // Fall through
+            case OpCode::ret:
+            case OpCode::ret_n_sm:
+            case OpCode::ret_n: {
+                vec returnSlot = step.read(-2);
+                if (inst->opcode == OpCode::ret || inst->opcode == OpCode::ret_eax) {
+                    fp = vmLanes::select(m, fp, step.read(-4));
+                    leaderFp = (int32_t)vmLanes::lane(fp, leader);
+                }
+                else {
+                    uint32_t frameSlots = 2 + inst->aux / 4;
+                    fp = vmLanes::select(m, fp, vmLanes::sub(fp, vmLanes::set1(frameSlots)));
+                    leaderFp -= (int32_t)frameSlots;
+                }
+                pc = vmLanes::select(m, pc, vmLanes::sub(returnSlot, vmLanes::set1(1)));
+                leaderPc = vmLanes::lane(returnSlot, leader) - 1;
+                uint32_t exited = vmLanes::bitsOf(vmLanes::eq(returnSlot, vmLanes::set1(kExitReturn))) & mask;
+                if (exited != 0)
+                    finishLanes(exited, eax, pc, live, results);
+                continue;
+            }
+
+            case OpCode::error:
+            case OpCode::move_to_eax:
+            case OpCode::cmp:
+            case OpCode::jl:
+            case OpCode::nop:
+            case OpCode::nop_n:
+                break;
+
+            case OpCode::inc:
+            case OpCode::dec:
+            case OpCode::add_imm:
+            case OpCode::sub_imm: {
+                uint32_t imm = (inst->opcode == OpCode::inc) ? 1U :
+                               ((inst->opcode == OpCode::dec) ? (uint32_t)-1 :
+                               ((inst->opcode == OpCode::add_imm) ? inst->operand2 : (0U - inst->operand2)));
+                step.write(inst->operand1, vmLanes::add(step.read(inst->operand1), vmLanes::set1(imm)));
+                break;
+            }
+
+            case OpCode::add:
+                step.write(inst->operand1, vmLanes::add(step.read(inst->operand1),
+                                                        step.read((int32_t)inst->operand2)));
+                break;
+
+            case OpCode::sub:
+                step.write(inst->operand1, vmLanes::sub(step.read(inst->operand1),
+                                                        step.read((int32_t)inst->operand2)));
+                break;
+
+            case OpCode::add_eax:
+                eax = vmLanes::select(m, eax, vmLanes::add(eax, step.read(inst->operand1)));
+                break;
+
+            case OpCode::add_eax_imm:
+                eax = vmLanes::select(m, eax, vmLanes::add(eax, vmLanes::set1(inst->operand2)));
+                break;
+
+            case OpCode::sub_eax:
+                eax = vmLanes::select(m, eax, vmLanes::sub(eax, step.read(inst->operand1)));
+                break;
+
+            case OpCode::sub_eax_imm:
+                eax = vmLanes::select(m, eax, vmLanes::sub(eax, vmLanes::set1(inst->operand2)));
+                break;
+
+            case OpCode::exit:
+                finishLanes(mask, eax, pc, live, results);
+                continue;
+
+            default:
+                // No lane form (the fused and the memo instructions).
+                handOff(mask, fp, pc, eax, flag, fastEntry, live, fallback, results);
+                continue;
+            }
+
+            // The instructions that go on to the next one.
+            pc = vmLanes::select(m, pc, next);
+            leaderPc++;
+        }
+        groups_++;
+        steps_ += steps;
+        laneSteps_ += laneSteps;
+        return fallback;
+    }
+
+    //
+    // Whether the lanes of the mask can push a frame of the slots.
+    //
+    JM_FORCEINLINE bool fitsCall(vec fp, uint32_t mask, int32_t slots, int32_t limit) const {
+        vec over = vmLanes::gt_i32(vmLanes::add(fp, vmLanes::set1((uint32_t)slots)),
+                                   vmLanes::set1((uint32_t)limit));
+        return ((vmLanes::bitsOf(over) & mask) == 0);
+    }
+
+    void dropLanes(uint32_t mask, vec & pc, uint32_t & live, uint32_t & fallback) {
+        fallback |= mask;
+        live &= ~mask;
+        pc = vmLanes::select(vmLanes::maskOf(mask), pc, vmLanes::set1(kLaneDone));
+    }
+
+    //
+    // Run the lanes of the mask to the end with the scalar executor, from
+    // their pc. The ones it fails are left to invoke().
+    //
+    void handOff(uint32_t mask, vec fp, vec & pc, vec eax, vec flag, bool fastEntry,
+                 uint32_t & live, uint32_t & fallback, uintptr_t * results) {
+#if USE_FORWARD_STACK_PTR
+        uint32_t fps[kLanes], pcs[kLanes], eaxs[kLanes], flags[kLanes];
+        vmLanes::storeu(fps, fp);
+        vmLanes::storeu(pcs, pc);
+        vmLanes::storeu(eaxs, eax);
+        vmLanes::storeu(flags, flag);
+        uint32_t failed = 0;
+        for (uint32_t l = 0; l < kLanes; l++) {
+            if ((mask & (1U << l)) == 0)
+                continue;
+            vmContextRegs regs;
+            if (!layFrames(l, fps[l], fastEntry, regs)) {
+                failed |= 1U << l;
+                continue;
+            }
+            regs.ip_.set(const_cast<unsigned char *>(decoded_->getImage())
+                         + decoded_->begin()[pcs[l]].offset);
+            regs.regs_.eax.u32 = eaxs[l];
+            regs.flags.u32.low = (flags[l] != 0) ? 1U : 0U;
+
+            return_type retVal;
+            retVal.setDataType(return_type::Basic);
+            int ec = context_.execute_slice(regs, handStack_, vmSliceMode::BackEdges,
+                                            kHandOffBudget, retVal);
+            if (ec == Error::Ok) {
+                results[l] = retVal.getValue();
+                handOffs_++;
+            }
+            else {
+                failed |= 1U << l;
+            }
+        }
+        live &= ~mask;
+        fallback |= failed;
+        pc = vmLanes::select(vmLanes::maskOf(mask), pc, vmLanes::set1(kLaneDone));
+#else
+        (void)fp;
+        (void)eax;
+        (void)flag;
+        (void)fastEntry;
+        (void)results;
+        dropLanes(mask, pc, live, fallback);
+#endif
+    }
+
+    //
+    // Lay the frames of lane l on the scalar stack, as the scalar calls
+    // would have: a slot s is at byte s * 4, the return slots become return
+    // IPs and the saved frame slots become pointers. The locals of the
+    // innermost frame are above its fp, up to kSlotMargin slots. False if
+    // the frames don't lead down to the entry or don't fit.
+    //
+    bool layFrames(uint32_t l, uint32_t laneFp, bool fastEntry, vmContextRegs & regs) {
+        const uint32_t * stack = stack_ + kSlotMargin * kLanes;
+        const vmDecodedInst * code = decoded_->begin();
+        const unsigned char * image = decoded_->getImage();
+        unsigned char * base = handStack_.first();
+        uint32_t top = laneFp + kSlotMargin;
+        if (top > laneSlots_ + kSlotMargin ||
+            (size_t)top * sizeof(uint32_t) >= (size_t)(handStack_.last() - base))
+            return false;
+
+        uint32_t * slots = (uint32_t *)base;
+        for (uint32_t s = 0; s < top; s++) {
+            slots[s] = stack[s * kLanes + l];
+        }
+        regs.fp_.set(base + laneFp * sizeof(uint32_t));
+
+        int32_t fp = (int32_t)laneFp;
+        while (fp >= 2) {
+            uint32_t returnSlot = slots[fp - 2];
+            bool isFast = fastEntry;
+            int32_t localSlots = 0;
+            if (returnSlot == kExitReturn) {
+                *(void **)(slots + fp - 2) = nullptr;
+            }
+            else {
+                if (returnSlot < 2 || returnSlot > decoded_->size())
+                    return false;
+                const vmDecodedInst * returnInst = code + returnSlot - 1;
+                const vmDecodedInst * call = returnInst - 1;
+                *(const void **)(slots + fp - 2) = image + returnInst->offset;
+                isFast = (call->opcode == OpCode::fast_call_short
+                          || call->opcode == OpCode::fast_tail_call_short);
+                localSlots = (int32_t)(call->aux / 4);
+            }
+
+            int32_t callerFp;
+            if (!isFast) {
+                if (fp < 4)
+                    return false;
+                callerFp = (int32_t)slots[fp - 4];
+                *(unsigned char **)(slots + fp - 4) = base + callerFp * sizeof(uint32_t);
+            }
+            else {
+                callerFp = fp - 2 - localSlots;
+            }
+            if (returnSlot == kExitReturn)
+                return true;
+            if (callerFp < 0 || callerFp >= fp)
+                return false;
+            fp = callerFp;
+        }
+        return false;
+    }
+
+    void finishLanes(uint32_t exited, vec eax, vec & pc, uint32_t & live, uintptr_t * results) {
+        uint32_t values[kLanes];
+        vmLanes::storeu(values, eax);
+        for (uint32_t l = 0; l < kLanes; l++) {
+            if ((exited & (1U << l)) != 0)
+                results[l] = values[l];
+        }
+        live &= ~exited;
+        pc = vmLanes::select(vmLanes::maskOf(exited), pc, vmLanes::set1(kLaneDone));
+    }
+};
+
+} // namespace v4
+} // namespace jlang
+
+#endif // JLANG_VM_BATCH_V4_H
@@ -0,0 +1,185 @@
+
+#ifndef JLANG_VM_CONTEXTPOOL_V4_H
+#define JLANG_VM_CONTEXTPOOL_V4_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Interpreter_v4.h"
+#include "jlang/vm/TracePolicy.h"
+#include "jlang/lang/Error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+namespace jlang {
+namespace v4 {
+
+//
+// A pool of the execution contexts of one image, for the short runs.
+//
+// A context is made the first time it's needed, and when a run gives it
+// back it's reset in place and kept: the next run doesn't map stacks or
+// look for the entry's frame kind again. acquire() and release() may be
+// called from any thread, a context is only used by one run at a time.
+//
+// The image must be bound already, as vmProcess::create() leaves it.
+//
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class vmContextPool {
+public:
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionContext<basic_type, trace_policy>  context_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef vmContextPool<basic_type, trace_policy>     this_type;
+
+    static const size_type kDefaultStackSize = 256 * 1024U;
+    static const size_type kDefaultMaxIdle = 64;
+
+private:
+    vmBinaryFile *                  binary_;
+    std::vector<context_type *>     idle_;
+    std::mutex                      mutex_;
+    size_type                       stackSize_;
+    size_type                       maxIdle_;
+    std::atomic<size_t>             active_;
+    std::atomic<uint64_t>           created_;
+    std::atomic<uint64_t>           reused_;
+
+public:
+    vmContextPool() : binary_(nullptr), stackSize_(kDefaultStackSize),
+                      maxIdle_(kDefaultMaxIdle), active_(0), created_(0), reused_(0) {}
+    ~vmContextPool() {
+        destroy();
+    }
+
+    bool isInited() const { return (binary_ != nullptr); }
+
+    // The contexts that are out now.
+    size_t getActiveCount() const { return active_.load(std::memory_order_relaxed); }
+
+    uint64_t getCreatedCount() const { return created_.load(std::memory_order_relaxed); }
+    uint64_t getReusedCount() const { return reused_.load(std::memory_order_relaxed); }
+
+    size_t getIdleCount() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return idle_.size();
+    }
+
+    //
+    // Keep at most maxIdle contexts, and make prewarm of them now.
+    //
+    int create(vmBinaryFile * binary, size_type stackSize = kDefaultStackSize,
+               size_type maxIdle = kDefaultMaxIdle, size_type prewarm = 0) {
+        if (binary == nullptr)
+            return Error::Error_NullPtr;
+        destroy();
+        binary_ = binary;
+        stackSize_ = stackSize;
+        maxIdle_ = maxIdle;
+        if (prewarm > maxIdle)
+            prewarm = maxIdle;
+        for (size_type i = 0; i < prewarm; i++) {
+            context_type * context = newContext();
+            if (context == nullptr)
+                return Error::MainProcess_Create_Failed;
+            idle_.push_back(context);
+        }
+        return Error::Ok;
+    }
+
+    //
+    // Free the idle contexts, every context must be given back first.
+    //
+    void destroy() {
+        assert(getActiveCount() == 0);
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < idle_.size(); i++) {
+            delete idle_[i];
+        }
+        idle_.clear();
+        binary_ = nullptr;
+    }
+
+    //
+    // A reset context, or nullptr if a new one can't be made.
+    //
+    context_type * acquire() {
+        context_type * context = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!idle_.empty()) {
+                context = idle_.back();
+                idle_.pop_back();
+            }
+        }
+        if (context != nullptr) {
+            reused_.fetch_add(1, std::memory_order_relaxed);
+        }
+        else {
+            context = newContext();
+            if (context == nullptr)
+                return nullptr;
+        }
+        active_.fetch_add(1, std::memory_order_relaxed);
+        return context;
+    }
+
+    void release(context_type * context) {
+        if (context == nullptr)
+            return;
+        active_.fetch_sub(1, std::memory_order_relaxed);
+        context->reset();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (idle_.size() < maxIdle_) {
+                idle_.push_back(context);
+                return;
+            }
+        }
+        delete context;
+    }
+
+    //
+    // Call the guest function at the offset on a pooled context.
+    //
+    int invoke(uint32_t entryOffset, const uint32_t * args, uint32_t argc,
+               return_type & retVal) {
+        context_type * context = acquire();
+        if (context == nullptr)
+            return Error::MainProcess_Create_Failed;
+        int ec = context->invoke(entryOffset, args, argc, retVal);
+        release(context);
+        return ec;
+    }
+
+private:
+    context_type * newContext() {
+        context_type * context = new context_type();
+        context->setImageInfo(binary_->getImagePtr(), binary_->getImageSize(),
+                              binary_->getImageEntry());
+        context->setDecodedImage(binary_->getDecodedImage());
+        context->create(stackSize_);
+        if (!context->isInited()) {
+            delete context;
+            return nullptr;
+        }
+        created_.fetch_add(1, std::memory_order_relaxed);
+        return context;
+    }
+};
+
+} // namespace v4
+} // namespace jlang
+
+#endif // JLANG_VM_CONTEXTPOOL_V4_H
@@ -0,0 +1,242 @@
+
+#ifndef JLANG_VM_FIBER_V4_H
+#define JLANG_VM_FIBER_V4_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Interpreter_v4.h"
+#include "jlang/vm/TracePolicy.h"
+#include "jlang/lang/Error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+#include <deque>
+
+namespace jlang {
+namespace v4 {
+
+struct vmFiberState {
+    enum Type {
+        Ready,
+        Finished,
+        Failed
+    };
+};
+
+//
+// A guest fiber: a small stack and the saved registers, it's run by
+// the execution context of its scheduler, one slice at a time.
+//
+template <typename BasicType = uintptr_t>
+class vmFiber {
+public:
+    typedef BasicType   basic_type;
+    typedef size_t      size_type;
+
+    static const size_type kDefaultStackSize = 16 * 1024U;
+
+private:
+    vmStack<basic_type, false>  stack_;
+    vmContextRegs               regs_;
+    uint32_t                    id_;
+    uint32_t                    state_;
+    int                         error_;
+    uintptr_t                   result_;
+    uint64_t                    slices_;
+
+public:
+    vmFiber() : id_(0), state_(vmFiberState::Ready), error_(Error::Ok),
+                result_(0), slices_(0) {}
+    ~vmFiber() {
+        stack_.destroy();
+    }
+
+    bool isInited() const { return stack_.isInited(); }
+    bool isDone() const { return (state_ != vmFiberState::Ready); }
+
+    uint32_t getId() const { return id_; }
+    uint32_t getState() const { return state_; }
+    int getError() const { return error_; }
+    uintptr_t getResult() const { return result_; }
+
+    // The slices it took, the last one included.
+    uint64_t getSliceCount() const { return slices_; }
+
+    vmContextRegs & getRegs() { return regs_; }
+
+    const vmStack<basic_type, false> & getStack() const { return stack_; }
+    unsigned char * getStackFirst() const { return stack_.first(); }
+
+    void create(uint32_t id, size_type stackSize) {
+        id_ = id;
+        stack_.create(stackSize);
+        regs_.clear();
+        state_ = vmFiberState::Ready;
+        error_ = Error::Ok;
+        result_ = 0;
+        slices_ = 0;
+    }
+
+    void onSlice() {
+        slices_++;
+    }
+
+    void finish(int error, uintptr_t result) {
+        state_ = (error == Error::Ok) ? vmFiberState::Finished : vmFiberState::Failed;
+        error_ = error;
+        result_ = result;
+    }
+};
+
+//
+// The fibers of one OS thread, on one execution context.
+//
+// A fiber is run until it has spent its budget of instructions, or of
+// back edges and calls (see vmSliceMode), then it goes to the end of the
+// ready queue and the next one is run. A switch only swaps the registers
+// of the context (ip, fp, eax and the flags), the frames stay on the
+// fiber's stack. So a long loop can't starve the others, and thousands
+// of guest scripts can share a core.
+//
+// The image must be bound already, as vmProcess::create() leaves it.
+//
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class vmFiberScheduler {
+public:
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionContext<basic_type, trace_policy>  context_type;
+    typedef vmFiber<basic_type>                         fiber_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef vmFiberScheduler<basic_type, trace_policy>  this_type;
+
+    static const int64_t   kDefaultBudget = 10000;
+    // The context's own stack isn't used, the fibers run on theirs.
+    static const size_type kContextStackSize = 4096;
+
+private:
+    context_type                context_;
+    std::vector<fiber_type *>   fibers_;
+    std::deque<fiber_type *>    ready_;
+    uint32_t                    mode_;
+    int64_t                     budget_;
+    uint32_t                    nextId_;
+    uint64_t                    switches_;
+
+public:
+    vmFiberScheduler() : mode_(vmSliceMode::Instructions), budget_(kDefaultBudget),
+                         nextId_(1), switches_(0) {}
+    ~vmFiberScheduler() {
+        destroy();
+    }
+
+    bool isInited() const { return context_.isInited(); }
+    bool isIdle() const { return ready_.empty(); }
+
+    size_t getFiberCount() const { return fibers_.size(); }
+    size_t getReadyCount() const { return ready_.size(); }
+    fiber_type * getFiber(size_t index) const { return fibers_[index]; }
+
+    // The slices that were run, each is a switch in and out.
+    uint64_t getSwitchCount() const { return switches_; }
+
+    int create(vmBinaryFile * binary, uint32_t mode = vmSliceMode::Instructions,
+               int64_t budget = kDefaultBudget) {
+        context_.setImageInfo(binary->getImagePtr(), binary->getImageSize(),
+                              binary->getImageEntry());
+        context_.setDecodedImage(binary->getDecodedImage());
+        context_.create(kContextStackSize);
+        if (!context_.isInited())
+            return Error::MainProcess_Create_Failed;
+        setBudget(mode, budget);
+        return Error::Ok;
+    }
+
+    void destroy() {
+        reap();
+        context_.destroy();
+    }
+
+    void setBudget(uint32_t mode, int64_t budget) {
+        mode_ = (mode == vmSliceMode::BackEdges) ? mode : (uint32_t)vmSliceMode::Instructions;
+        budget_ = (budget > 0) ? budget : 1;
+    }
+
+    //
+    // Make a fiber that calls the function at the offset with the
+    // arguments, it's run by run(). Return nullptr if it can't be made.
+    //
+    fiber_type * spawn(uint32_t entryOffset, const uint32_t * args, uint32_t argc,
+                       size_type stackSize = fiber_type::kDefaultStackSize) {
+        if (!isInited())
+            return nullptr;
+        fiber_type * fiber = new fiber_type();
+        fiber->create(nextId_, stackSize);
+        if (!fiber->isInited() ||
+            context_.prepare_slice(fiber->getRegs(), fiber->getStackFirst(),
+                                   entryOffset, args, argc) != Error::Ok) {
+            delete fiber;
+            return nullptr;
+        }
+        nextId_++;
+        fibers_.push_back(fiber);
+        ready_.push_back(fiber);
+        return fiber;
+    }
+
+    //
+    // Run the next fiber for a slice, return false if none is ready.
+    //
+    bool runOnce() {
+        if (ready_.empty())
+            return false;
+        fiber_type * fiber = ready_.front();
+        ready_.pop_front();
+
+        return_type retVal;
+        retVal.setDataType(return_type::Basic);
+        int ec = context_.execute_slice(fiber->getRegs(), fiber->getStack(),
+                                        mode_, budget_, retVal);
+        fiber->onSlice();
+        switches_++;
+        if (ec == context_type::kSlicePreempted)
+            ready_.push_back(fiber);
+        else
+            fiber->finish(ec, retVal.getValue());
+        return true;
+    }
+
+    //
+    // Run the fibers round robin until all of them are done.
+    //
+    void run() {
+        while (runOnce()) {
+            // Next slice.
+        }
+    }
+
+    //
+    // Forget the fibers, the ones that are not done are dropped.
+    //
+    void reap() {
+        for (size_t i = 0; i < fibers_.size(); i++) {
+            delete fibers_[i];
+        }
+        fibers_.clear();
+        ready_.clear();
+        nextId_ = 1;
+        switches_ = 0;
+    }
+};
+
+} // namespace v4
+} // namespace jlang
+
+#endif // JLANG_VM_FIBER_V4_H
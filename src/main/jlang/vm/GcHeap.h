@@ -0,0 +1,652 @@
+
+#ifndef JLANG_VM_GCHEAP_H
+#define JLANG_VM_GCHEAP_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <vector>
+#include <chrono>
+
+namespace jlang {
+
+//
+// The header of a collected object, its 32-bit fields follow it. The
+// first refs fields are references (0 is null), the others are values.
+//
+struct vmGcObject {
+    uint8_t     fields;
+    uint8_t     refs;
+    uint8_t     age;        // The minor collections it survived
+    uint8_t     flags;
+    uint32_t    forward;    // The new reference, once it's copied
+    uint32_t    data[1];
+
+    static const uint8_t kOld        = 0x01;
+    static const uint8_t kMarked     = 0x02;
+    static const uint8_t kRemembered = 0x04;
+    static const uint8_t kForwarded  = 0x08;
+
+    static const uint32_t kHeaderSize = 8;
+
+    static uint32_t sizeOf(uint32_t fields) {
+        return ((kHeaderSize + fields * sizeof(uint32_t) + 7) & ~7U);
+    }
+
+    uint32_t size() const { return sizeOf(fields); }
+};
+
+struct vmGcStats {
+    uint64_t    allocs;
+    uint64_t    allocatedBytes;
+    // Allocated in the old generation, the stack couldn't be walked.
+    uint64_t    deferredAllocs;
+    uint64_t    failedAllocs;
+    // The loads and stores through a null or not an object reference.
+    uint64_t    badAccesses;
+
+    uint64_t    minorCollections;
+    uint64_t    survivedBytes;
+    uint64_t    promotedBytes;
+    uint64_t    majorCycles;
+    uint64_t    markSlices;
+    uint64_t    sweepSlices;
+    uint64_t    freedBytes;
+
+    // The pauses, a collection with the slice of old generation work
+    // that goes with it is one pause.
+    uint64_t    pauses;
+    uint64_t    totalPauseNs;
+    uint64_t    maxPauseNs;
+    uint64_t    lastPauseNs;
+    // Under 10 us, 100 us, 1 ms, 10 ms, and the longer ones.
+    uint64_t    pauseHistogram[5];
+
+    size_t      oldBytes;
+    size_t      oldObjects;
+    size_t      rememberedObjects;
+};
+
+//
+// A generational collector for the objects of new_obj, on top of the
+// guest heap of a context.
+//
+// The young objects are bump allocated in the eden of the nursery. A
+// minor collection copies the live ones (Cheney) to a survivor space,
+// and promotes the ones that survived kPromoteAge collections to the
+// old generation, where they're vmHeap blocks and never move. The old
+// objects that point to young ones are kept in a remembered set, by the
+// barrier of storeRef().
+//
+// The old generation is marked and swept in slices, one slice after each
+// minor collection, so no pause is longer than a minor collection and a
+// slice. The barrier shades the old objects stored while it's marked,
+// and the last slice scans the roots and the young objects again.
+//
+// The roots come from the executor at a safepoint, see collect(): it's
+// a RootSet with visit(visitor), which calls visitor(uint32_t * slot)
+// for each slot that holds a reference.
+//
+template <typename BasicType>
+class vmGcHeap {
+public:
+    typedef BasicType   basic_type;
+    typedef size_t      size_type;
+
+    static const uint32_t  kEdenSize = 512 * 1024U;
+    static const uint32_t  kSurvivorSize = 128 * 1024U;
+    static const uint32_t  kNurserySize = kEdenSize + kSurvivorSize * 2;
+    static const uint8_t   kPromoteAge = 2;
+    // The old bytes that start the first major cycle.
+    static const size_type kMinMajorBytes = 4 * 1048576U;
+    // The old objects marked, or swept, by one slice.
+    static const size_t    kMarkBudget = 4096;
+    static const size_t    kSweepBudget = 8192;
+    // And this many more for each object the minor collection promoted,
+    // so that a cycle ends before the promotions outgrow it.
+    static const size_t    kPacing = 8;
+
+    struct Phase {
+        enum Type {
+            Idle,
+            Marking,
+            Sweeping
+        };
+    };
+
+private:
+    vmHeap<basic_type> *    heap_;
+    unsigned char *         base_;
+    uint32_t                edenCur_;
+    uint32_t                edenEnd_;
+    uint32_t                nurseryStart_;
+    uint32_t                survivorStart_[2];
+    uint32_t                survivorCur_;
+    uint32_t                from_;
+    uint32_t                phase_;
+    size_type               nextMajorAt_;
+    size_t                  sweepIndex_;
+    size_t                  sweepEnd_;
+    size_t                  sweepKept_;
+    std::vector<uint32_t>   oldObjects_;
+    std::vector<uint32_t>   remembered_;
+    std::vector<uint32_t>   promoted_;
+    std::vector<uint32_t>   markStack_;
+    vmGcStats               stats_;
+
+public:
+    vmGcHeap(vmHeap<basic_type> & heap) : heap_(&heap) {
+        clear();
+    }
+    ~vmGcHeap() {}
+
+    bool isInited() const { return (nurseryStart_ != 0); }
+    uint32_t getPhase() const { return phase_; }
+
+    vmGcStats getStats() const {
+        vmGcStats stats = stats_;
+        stats.oldObjects = oldObjects_.size();
+        stats.rememberedObjects = remembered_.size();
+        return stats;
+    }
+
+    bool isYoung(uint32_t ref) const {
+        return ((uint32_t)(ref - nurseryStart_) < kNurserySize);
+    }
+
+    vmGcObject * at(uint32_t ref) const {
+        return (vmGcObject *)(base_ + ref);
+    }
+
+    //
+    // Allocate a young object in the eden, return 0 if it's full (or not
+    // there yet), then it's allocSlow() that's called.
+    //
+    JM_FORCEINLINE uint32_t alloc(uint32_t fields, uint32_t refs) {
+        uint32_t size = vmGcObject::sizeOf(fields);
+        if (likely(size <= edenEnd_ - edenCur_)) {
+            uint32_t ref = edenCur_;
+            edenCur_ += size;
+            vmGcObject * object = at(ref);
+            initObject(object, fields, refs, size);
+            stats_.allocs++;
+            stats_.allocatedBytes += size;
+            return ref;
+        }
+        return 0;
+    }
+
+    //
+    // The eden is full: collect it, with the roots of the safepoint, and
+    // allocate again. canCollect is false if the roots can't be found,
+    // then the object is allocated in the old generation.
+    //
+    template <typename RootSet>
+    JM_NOINLINE uint32_t allocSlow(uint32_t fields, uint32_t refs,
+                                   RootSet & roots, bool canCollect) {
+        if (!isInited()) {
+            if (!init()) {
+                stats_.failedAllocs++;
+                return 0;
+            }
+            uint32_t ref = alloc(fields, refs);
+            if (ref != 0)
+                return ref;
+        }
+        if (canCollect) {
+            if (collect(roots)) {
+                uint32_t ref = alloc(fields, refs);
+                if (ref != 0)
+                    return ref;
+            }
+        }
+        else {
+            stats_.deferredAllocs++;
+        }
+
+        uint32_t size = vmGcObject::sizeOf(fields);
+        uint32_t ref = allocOld(size);
+        if (ref == 0) {
+            stats_.failedAllocs++;
+            return 0;
+        }
+        initObject(at(ref), fields, refs, size);
+        at(ref)->flags = vmGcObject::kOld |
+                         ((phase_ == Phase::Marking) ? vmGcObject::kMarked : 0);
+        stats_.allocs++;
+        stats_.allocatedBytes += size;
+        return ref;
+    }
+
+    //
+    // The object of the reference, nullptr if the reference can't be one.
+    //
+    JM_FORCEINLINE vmGcObject * objectOf(uint32_t ref) const {
+        if (likely(ref != 0 && (ref & 7) == 0 && ref < heap_->getTop()))
+            return at(ref);
+        return nullptr;
+    }
+
+    JM_FORCEINLINE uint32_t loadRef(uint32_t ref, uint32_t index) {
+        vmGcObject * object = objectOf(ref);
+        if (likely(object != nullptr && index < object->refs))
+            return object->data[index];
+        stats_.badAccesses++;
+        return 0;
+    }
+
+    JM_FORCEINLINE uint32_t loadValue(uint32_t ref, uint32_t index) {
+        vmGcObject * object = objectOf(ref);
+        if (likely(object != nullptr && index >= object->refs && index < object->fields))
+            return object->data[index];
+        stats_.badAccesses++;
+        return 0;
+    }
+
+    //
+    // Store a reference, with the barrier: an old object that gets a young
+    // one is remembered, and while the old generation is marked the old
+    // one it gets is shaded.
+    //
+    JM_FORCEINLINE void storeRef(uint32_t ref, uint32_t index, uint32_t value) {
+        vmGcObject * object = objectOf(ref);
+        if (likely(object != nullptr && index < object->refs)) {
+            object->data[index] = value;
+            if ((object->flags & vmGcObject::kOld) != 0 && value != 0) {
+                if (isYoung(value)) {
+                    if ((object->flags & vmGcObject::kRemembered) == 0) {
+                        object->flags |= vmGcObject::kRemembered;
+                        remembered_.push_back(ref);
+                    }
+                }
+                else if (phase_ == Phase::Marking) {
+                    shade(value);
+                }
+            }
+        }
+        else {
+            stats_.badAccesses++;
+        }
+    }
+
+    JM_FORCEINLINE void storeValue(uint32_t ref, uint32_t index, uint32_t value) {
+        vmGcObject * object = objectOf(ref);
+        if (likely(object != nullptr && index >= object->refs && index < object->fields))
+            object->data[index] = value;
+        else
+            stats_.badAccesses++;
+    }
+
+    //
+    // Forget every object, they're freed with the heap.
+    //
+    void reset() {
+        clear();
+    }
+
+private:
+    void clear() {
+        base_ = nullptr;
+        edenCur_ = edenEnd_ = 0;
+        nurseryStart_ = 0;
+        survivorStart_[0] = survivorStart_[1] = 0;
+        survivorCur_ = 0;
+        from_ = 0;
+        phase_ = Phase::Idle;
+        nextMajorAt_ = kMinMajorBytes;
+        sweepIndex_ = sweepEnd_ = sweepKept_ = 0;
+        oldObjects_.clear();
+        remembered_.clear();
+        promoted_.clear();
+        markStack_.clear();
+        memset((void *)&stats_, 0, sizeof(stats_));
+    }
+
+    bool init() {
+        uint32_t nursery = heap_->alloc(kNurserySize);
+        if (nursery == 0)
+            return false;
+        base_ = heap_->getBase();
+        nurseryStart_ = nursery;
+        edenCur_ = nursery;
+        edenEnd_ = nursery + kEdenSize;
+        survivorStart_[0] = edenEnd_;
+        survivorStart_[1] = edenEnd_ + kSurvivorSize;
+        survivorCur_ = survivorStart_[0];
+        from_ = 0;
+        return true;
+    }
+
+    static JM_FORCEINLINE void initObject(vmGcObject * object, uint32_t fields,
+                                          uint32_t refs, uint32_t size) {
+        object->fields = (uint8_t)fields;
+        object->refs = (uint8_t)refs;
+        object->age = 0;
+        object->flags = 0;
+        object->forward = 0;
+        memset((void *)object->data, 0, size - vmGcObject::kHeaderSize);
+    }
+
+    uint32_t allocOld(uint32_t size) {
+        uint32_t ref = heap_->alloc(size);
+        if (ref != 0) {
+            oldObjects_.push_back(ref);
+            stats_.oldBytes += size;
+        }
+        return ref;
+    }
+
+    static uint64_t nowNs() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void onPause(uint64_t startNs) {
+        uint64_t pauseNs = nowNs() - startNs;
+        stats_.pauses++;
+        stats_.totalPauseNs += pauseNs;
+        stats_.lastPauseNs = pauseNs;
+        if (pauseNs > stats_.maxPauseNs)
+            stats_.maxPauseNs = pauseNs;
+        size_t bucket = (pauseNs < 10000) ? 0 : (pauseNs < 100000) ? 1 :
+                        (pauseNs < 1000000) ? 2 : (pauseNs < 10000000) ? 3 : 4;
+        stats_.pauseHistogram[bucket]++;
+    }
+
+    //
+    // One pause: a minor collection, then a slice of the old generation.
+    // Return false if there's no room to promote into.
+    //
+    template <typename RootSet>
+    bool collect(RootSet & roots) {
+        uint64_t startNs = nowNs();
+        uint32_t used = (edenCur_ - nurseryStart_) + kSurvivorSize;
+        if (heap_->getHeadroom() < used) {
+            // Free what the old generation can give back first.
+            finishMajor(roots);
+            if (heap_->getHeadroom() < used) {
+                onPause(startNs);
+                return false;
+            }
+        }
+
+        size_t paced = collectYoung(roots) * kPacing;
+        if (phase_ == Phase::Idle) {
+            if (stats_.oldBytes >= nextMajorAt_)
+                startMarking(roots);
+        }
+        else if (phase_ == Phase::Marking) {
+            if (markSlice(kMarkBudget + paced))
+                finishMarking(roots);
+        }
+        else {
+            sweepSlice(kSweepBudget + paced);
+        }
+        onPause(startNs);
+        return true;
+    }
+
+    //
+    // Copy a young object out of the nursery, or find where it went.
+    //
+    void evacuate(uint32_t * slot) {
+        uint32_t ref = *slot;
+        uint32_t to = survivorStart_[from_ ^ 1];
+        if (!isYoung(ref) || (uint32_t)(ref - to) < kSurvivorSize)
+            return;
+        vmGcObject * object = at(ref);
+        if ((object->flags & vmGcObject::kForwarded) != 0) {
+            *slot = object->forward;
+            return;
+        }
+
+        uint32_t size = object->size();
+        uint32_t toEnd = to + kSurvivorSize;
+        uint32_t newRef;
+        vmGcObject * copy;
+        if (object->age + 1 < kPromoteAge && size <= toEnd - survivorCur_) {
+            newRef = survivorCur_;
+            survivorCur_ += size;
+            copy = at(newRef);
+            memcpy((void *)copy, (const void *)object, size);
+            copy->age++;
+            stats_.survivedBytes += size;
+        }
+        else {
+            // There's the headroom for it, see collect().
+            newRef = allocOld(size);
+            copy = at(newRef);
+            memcpy((void *)copy, (const void *)object, size);
+            copy->flags = vmGcObject::kOld |
+                          ((phase_ == Phase::Marking) ? vmGcObject::kMarked : 0);
+            promoted_.push_back(newRef);
+            stats_.promotedBytes += size;
+        }
+        object->flags |= vmGcObject::kForwarded;
+        object->forward = newRef;
+        *slot = newRef;
+    }
+
+    struct Evacuator {
+        vmGcHeap * gc;
+        void operator () (uint32_t * slot) { gc->evacuate(slot); }
+    };
+
+    struct Shader {
+        vmGcHeap * gc;
+        void operator () (uint32_t * slot) { gc->shade(*slot); }
+    };
+
+    void evacuateFields(uint32_t ref) {
+        vmGcObject * object = at(ref);
+        for (uint32_t i = 0; i < object->refs; i++) {
+            evacuate(&object->data[i]);
+        }
+    }
+
+    bool hasYoungField(uint32_t ref) const {
+        const vmGcObject * object = at(ref);
+        for (uint32_t i = 0; i < object->refs; i++) {
+            if (isYoung(object->data[i]))
+                return true;
+        }
+        return false;
+    }
+
+    //
+    // The minor collection, return how many objects it promoted.
+    //
+    template <typename RootSet>
+    size_t collectYoung(RootSet & roots) {
+        uint32_t to = from_ ^ 1;
+        uint32_t scan = survivorStart_[to];
+        survivorCur_ = scan;
+        promoted_.clear();
+
+        Evacuator evacuator = { this };
+        roots.visit(evacuator);
+        for (size_t i = 0; i < remembered_.size(); i++) {
+            evacuateFields(remembered_[i]);
+        }
+
+        // The copies are scanned in turn, the promoted ones as well.
+        size_t promotedScan = 0;
+        while (scan < survivorCur_ || promotedScan < promoted_.size()) {
+            while (scan < survivorCur_) {
+                evacuateFields(scan);
+                scan += at(scan)->size();
+            }
+            while (promotedScan < promoted_.size()) {
+                evacuateFields(promoted_[promotedScan++]);
+            }
+        }
+
+        // The old objects that still point into the nursery.
+        size_t kept = 0;
+        for (size_t i = 0; i < remembered_.size(); i++) {
+            uint32_t ref = remembered_[i];
+            if (hasYoungField(ref))
+                remembered_[kept++] = ref;
+            else
+                at(ref)->flags &= (uint8_t)~vmGcObject::kRemembered;
+        }
+        remembered_.resize(kept);
+        for (size_t i = 0; i < promoted_.size(); i++) {
+            uint32_t ref = promoted_[i];
+            if (hasYoungField(ref)) {
+                at(ref)->flags |= vmGcObject::kRemembered;
+                remembered_.push_back(ref);
+            }
+            // Promoted black, what they point to is shaded.
+            if (phase_ == Phase::Marking)
+                shadeFields(ref);
+        }
+        size_t promoted = promoted_.size();
+        promoted_.clear();
+
+        from_ = to;
+        edenCur_ = nurseryStart_;
+        stats_.minorCollections++;
+        return promoted;
+    }
+
+    JM_FORCEINLINE void shade(uint32_t ref) {
+        if (ref == 0 || isYoung(ref))
+            return;
+        vmGcObject * object = at(ref);
+        if ((object->flags & vmGcObject::kMarked) == 0) {
+            object->flags |= vmGcObject::kMarked;
+            markStack_.push_back(ref);
+        }
+    }
+
+    void shadeFields(uint32_t ref) {
+        vmGcObject * object = at(ref);
+        for (uint32_t i = 0; i < object->refs; i++) {
+            shade(object->data[i]);
+        }
+    }
+
+    //
+    // The roots of the old generation: the stack, and the young objects,
+    // the dead ones too.
+    //
+    template <typename RootSet>
+    void shadeRoots(RootSet & roots) {
+        Shader shader = { this };
+        roots.visit(shader);
+        uint32_t ref = survivorStart_[from_];
+        while (ref < survivorCur_) {
+            shadeFields(ref);
+            ref += at(ref)->size();
+        }
+        ref = nurseryStart_;
+        while (ref < edenCur_) {
+            shadeFields(ref);
+            ref += at(ref)->size();
+        }
+    }
+
+    template <typename RootSet>
+    void startMarking(RootSet & roots) {
+        phase_ = Phase::Marking;
+        markStack_.clear();
+        shadeRoots(roots);
+        stats_.majorCycles++;
+    }
+
+    //
+    // Return true if nothing is left to mark.
+    //
+    bool markSlice(size_t budget) {
+        stats_.markSlices++;
+        while (!markStack_.empty() && budget != 0) {
+            uint32_t ref = markStack_.back();
+            markStack_.pop_back();
+            shadeFields(ref);
+            budget--;
+        }
+        return markStack_.empty();
+    }
+
+    template <typename RootSet>
+    void finishMarking(RootSet & roots) {
+        shadeRoots(roots);
+        markSlice((size_t)-1);
+        phase_ = Phase::Sweeping;
+        sweepIndex_ = 0;
+        sweepKept_ = 0;
+        sweepEnd_ = oldObjects_.size();
+    }
+
+    void forget(uint32_t ref) {
+        for (size_t i = 0; i < remembered_.size(); i++) {
+            if (remembered_[i] == ref) {
+                remembered_[i] = remembered_.back();
+                remembered_.pop_back();
+                break;
+            }
+        }
+    }
+
+    //
+    // The objects promoted while it's swept are after sweepEnd_, they
+    // are kept.
+    //
+    void sweepSlice(size_t budget) {
+        stats_.sweepSlices++;
+        while (sweepIndex_ < sweepEnd_ && budget != 0) {
+            uint32_t ref = oldObjects_[sweepIndex_++];
+            vmGcObject * object = at(ref);
+            if ((object->flags & vmGcObject::kMarked) != 0) {
+                object->flags &= (uint8_t)~vmGcObject::kMarked;
+                oldObjects_[sweepKept_++] = ref;
+            }
+            else {
+                if ((object->flags & vmGcObject::kRemembered) != 0)
+                    forget(ref);
+                uint32_t size = object->size();
+                stats_.oldBytes -= size;
+                stats_.freedBytes += size;
+                heap_->free(ref);
+            }
+            budget--;
+        }
+        if (sweepIndex_ == sweepEnd_) {
+            size_t tail = oldObjects_.size() - sweepEnd_;
+            if (tail != 0) {
+                memmove((void *)&oldObjects_[sweepKept_], (const void *)&oldObjects_[sweepEnd_],
+                        tail * sizeof(uint32_t));
+            }
+            oldObjects_.resize(sweepKept_ + tail);
+            phase_ = Phase::Idle;
+            nextMajorAt_ = stats_.oldBytes * 2;
+            if (nextMajorAt_ < kMinMajorBytes)
+                nextMajorAt_ = kMinMajorBytes;
+        }
+    }
+
+    //
+    // The whole major cycle in this pause, when the heap runs short.
+    //
+    template <typename RootSet>
+    void finishMajor(RootSet & roots) {
+        if (phase_ == Phase::Idle)
+            startMarking(roots);
+        if (phase_ == Phase::Marking)
+            finishMarking(roots);
+        sweepSlice((size_t)-1);
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_GCHEAP_H
@@ -0,0 +1,385 @@
+
+#ifndef JLANG_VM_IMAGEFILE_H
+#define JLANG_VM_IMAGEFILE_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/SymbolTable.h"
+#include "jlang/lang/Error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>    // For MapViewOfFile()
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace jlang {
+
+//
+// The file of a compiled image, it's mapped and read in place.
+//
+//   header     vmImageHeader, at 0
+//   sections   vmImageSection[sectionCount], at sectionOffset
+//   .code      the bytecode, aligned to 256 bytes as the executors want
+//   .strings   the read-only data, the names of the symbols are in it
+//   .symbols   vmImageSymbol[], by their offsets in .code
+//
+// Every field is little-endian. A reader refuses another major version,
+// and skips the sections of a type it doesn't know.
+//
+struct vmImageFormat {
+    static const uint32_t kMagic = 0x43424C4AU;     // "JLBC"
+    static const uint16_t kVersion = 1;
+    static const uint32_t kCodeAlign = 256;
+
+    enum SectionType {
+        kCode = 1,
+        kStrings,
+        kSymbols
+    };
+};
+
+struct vmImageHeader {
+    uint32_t    magic;
+    uint16_t    version;
+    uint16_t    headerSize;
+    uint32_t    flags;
+    uint32_t    fileSize;
+    uint32_t    entryOffset;        // In .code
+    uint32_t    sectionCount;
+    uint32_t    sectionOffset;
+    uint32_t    reserved;
+};
+
+struct vmImageSection {
+    uint32_t    type;
+    uint32_t    offset;
+    uint32_t    size;
+    uint32_t    align;
+};
+
+struct vmImageSymbol {
+    static const uint32_t kFunction = 1;
+
+    uint32_t    offset;             // In .code
+    uint32_t    name;               // In .strings, ends with a '\0'
+    uint32_t    flags;
+};
+
+//
+// A file mapped read-only and private: the pages are shared with every
+// process that maps it, until one of them is made writable, which gets
+// a copy of its own.
+//
+class vmMappedFile {
+private:
+    unsigned char * data_;
+    size_t          size_;
+#if defined(_WIN32)
+    HANDLE          mapping_;
+#endif
+
+public:
+#if defined(_WIN32)
+    vmMappedFile() : data_(nullptr), size_(0), mapping_(NULL) {}
+#else
+    vmMappedFile() : data_(nullptr), size_(0) {}
+#endif
+    ~vmMappedFile() {
+        close();
+    }
+
+    bool isOpen() const { return (data_ != nullptr); }
+
+    const unsigned char * data() const { return data_; }
+    size_t size() const { return size_; }
+
+    int open(const char * filename) {
+        close();
+        if (filename == nullptr)
+            return Error::Error_NullPtr;
+#if defined(_WIN32)
+        HANDLE file = ::CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                                    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE)
+            return Error::BinaryFile_Open_Failed;
+        LARGE_INTEGER fileSize;
+        if (!::GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0
+            || fileSize.QuadPart > 0x7FFFFFFF) {
+            ::CloseHandle(file);
+            return Error::BinaryFile_Bad_Format;
+        }
+        HANDLE mapping = ::CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+        ::CloseHandle(file);
+        if (mapping == NULL)
+            return Error::BinaryFile_Open_Failed;
+        // A copy-on-write view, makeWritable() can give a page a copy of its own.
+        void * data = ::MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+        if (data == NULL) {
+            ::CloseHandle(mapping);
+            return Error::BinaryFile_Open_Failed;
+        }
+        mapping_ = mapping;
+        data_ = (unsigned char *)data;
+        size_ = (size_t)fileSize.QuadPart;
+#else
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0)
+            return Error::BinaryFile_Open_Failed;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > 0x7FFFFFFF) {
+            ::close(fd);
+            return Error::BinaryFile_Bad_Format;
+        }
+        void * data = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        // The mapping keeps the file, the descriptor isn't needed.
+        ::close(fd);
+        if (data == MAP_FAILED)
+            return Error::BinaryFile_Open_Failed;
+        data_ = (unsigned char *)data;
+        size_ = (size_t)st.st_size;
+#endif
+        return Error::Ok;
+    }
+
+    void close() {
+        if (data_ != nullptr) {
+#if defined(_WIN32)
+            ::UnmapViewOfFile(data_);
+            ::CloseHandle(mapping_);
+            mapping_ = NULL;
+#else
+            ::munmap(data_, size_);
+#endif
+            data_ = nullptr;
+        }
+        size_ = 0;
+    }
+
+    //
+    // Make the pages of a range writable, they're copied on the first write.
+    //
+    bool makeWritable(const void * ptr, size_t size) {
+        const unsigned char * first = (const unsigned char *)ptr;
+        if (data_ == nullptr || first < data_ || size > (size_t)(data_ + size_ - first))
+            return false;
+#if defined(_WIN32)
+        DWORD oldProtect;
+        return (::VirtualProtect((LPVOID)first, size, PAGE_WRITECOPY, &oldProtect) != 0);
+#else
+        size_t pageSize = (size_t)::sysconf(_SC_PAGESIZE);
+        uintptr_t start = (uintptr_t)first & ~(uintptr_t)(pageSize - 1);
+        uintptr_t end = (uintptr_t)first + size;
+        return (::mprotect((void *)start, (size_t)(end - start), PROT_READ | PROT_WRITE) == 0);
+#endif
+    }
+};
+
+//
+// An image file: open() maps it and checks its header and sections, the
+// code, the strings and the symbols are then read where they are.
+//
+class vmImageFile {
+private:
+    vmMappedFile            file_;
+    const unsigned char *   code_;
+    uint32_t                codeSize_;
+    uint32_t                entryOffset_;
+    const char *            strings_;
+    uint32_t                stringsSize_;
+    const vmImageSymbol *   symbols_;
+    uint32_t                symbolCount_;
+
+public:
+    vmImageFile() {
+        clear();
+    }
+    ~vmImageFile() {}
+
+    bool isOpen() const { return file_.isOpen(); }
+
+    const unsigned char * code() const { return code_; }
+    uint32_t codeSize() const { return codeSize_; }
+    uint32_t entryOffset() const { return entryOffset_; }
+
+    const char * strings() const { return strings_; }
+    uint32_t stringsSize() const { return stringsSize_; }
+
+    uint32_t symbolCount() const { return symbolCount_; }
+    const vmImageSymbol & symbol(uint32_t index) const { return symbols_[index]; }
+    const char * nameOf(const vmImageSymbol & symbol) const { return (strings_ + symbol.name); }
+
+    vmMappedFile & getMappedFile() { return file_; }
+
+    int open(const char * filename) {
+        close();
+        int ec = file_.open(filename);
+        if (ec != Error::Ok)
+            return ec;
+        ec = parse();
+        if (ec != Error::Ok)
+            close();
+        return ec;
+    }
+
+    void close() {
+        file_.close();
+        clear();
+    }
+
+    //
+    // Write the code, with its entry and symbols, as an image file.
+    //
+    static int write(const char * filename, const void * code, uint32_t codeSize,
+                     uint32_t entryOffset, const vmSymbolTable & symbols) {
+        if (filename == nullptr || code == nullptr)
+            return Error::Error_NullPtr;
+        if (entryOffset >= codeSize)
+            return Error::BinaryFile_Bad_Format;
+
+        // The names, and the symbols that point to them.
+        std::string strings;
+        std::vector<vmImageSymbol> table(symbols.size());
+        for (size_t i = 0; i < symbols.size(); i++) {
+            const vmSymbolTable::Symbol & symbol = symbols[i];
+            table[i].offset = symbol.offset;
+            table[i].name = (uint32_t)strings.size();
+            table[i].flags = symbol.isFunction ? vmImageSymbol::kFunction : 0;
+            strings.append(symbol.name.c_str(), symbol.name.size() + 1);
+        }
+
+        static const uint32_t kSectionCount = 3;
+        vmImageSection sections[kSectionCount];
+        uint32_t offset = sizeof(vmImageHeader) + sizeof(sections);
+        offset = placeSection(sections[0], vmImageFormat::kCode, offset, codeSize,
+                              vmImageFormat::kCodeAlign);
+        offset = placeSection(sections[1], vmImageFormat::kStrings, offset,
+                              (uint32_t)strings.size(), 1);
+        offset = placeSection(sections[2], vmImageFormat::kSymbols, offset,
+                              (uint32_t)(table.size() * sizeof(vmImageSymbol)), 4);
+
+        vmImageHeader header;
+        memset((void *)&header, 0, sizeof(header));
+        header.magic = vmImageFormat::kMagic;
+        header.version = vmImageFormat::kVersion;
+        header.headerSize = (uint16_t)sizeof(vmImageHeader);
+        header.fileSize = offset;
+        header.entryOffset = entryOffset;
+        header.sectionCount = kSectionCount;
+        header.sectionOffset = sizeof(vmImageHeader);
+
+        std::vector<unsigned char> image(offset, 0);
+        memcpy(&image[0], &header, sizeof(header));
+        memcpy(&image[header.sectionOffset], sections, sizeof(sections));
+        memcpy(&image[sections[0].offset], code, codeSize);
+        if (!strings.empty())
+            memcpy(&image[sections[1].offset], strings.data(), strings.size());
+        if (!table.empty())
+            memcpy(&image[sections[2].offset], &table[0], table.size() * sizeof(vmImageSymbol));
+
+        FILE * fp = fopen(filename, "wb");
+        if (fp == nullptr)
+            return Error::BinaryFile_Write_Failed;
+        size_t written = fwrite(&image[0], 1, image.size(), fp);
+        int closed = fclose(fp);
+        if (written != image.size() || closed != 0)
+            return Error::BinaryFile_Write_Failed;
+        return Error::Ok;
+    }
+
+private:
+    void clear() {
+        code_ = nullptr;
+        codeSize_ = 0;
+        entryOffset_ = 0;
+        strings_ = nullptr;
+        stringsSize_ = 0;
+        symbols_ = nullptr;
+        symbolCount_ = 0;
+    }
+
+    static uint32_t placeSection(vmImageSection & section, uint32_t type, uint32_t offset,
+                                 uint32_t size, uint32_t align) {
+        section.type = type;
+        section.offset = (offset + align - 1) & ~(align - 1);
+        section.size = size;
+        section.align = align;
+        return (section.offset + size);
+    }
+
+    int parse() {
+        const unsigned char * data = file_.data();
+        size_t size = file_.size();
+        if (size < sizeof(vmImageHeader))
+            return Error::BinaryFile_Bad_Format;
+        const vmImageHeader * header = (const vmImageHeader *)data;
+        if (header->magic != vmImageFormat::kMagic)
+            return Error::BinaryFile_Bad_Format;
+        if (header->version != vmImageFormat::kVersion)
+            return Error::BinaryFile_Bad_Version;
+        if (header->headerSize < sizeof(vmImageHeader) || header->fileSize != size
+            || header->sectionOffset < header->headerSize || header->sectionOffset > size
+            || (header->sectionOffset & 3) != 0
+            || header->sectionCount > (size - header->sectionOffset) / sizeof(vmImageSection))
+            return Error::BinaryFile_Bad_Format;
+
+        const vmImageSection * sections = (const vmImageSection *)(data + header->sectionOffset);
+        for (uint32_t i = 0; i < header->sectionCount; i++) {
+            const vmImageSection & section = sections[i];
+            if (section.offset > size || section.size > size - section.offset
+                || section.align == 0 || (section.align & (section.align - 1)) != 0
+                || (section.offset & (section.align - 1)) != 0)
+                return Error::BinaryFile_Bad_Format;
+            switch (section.type) {
+            case vmImageFormat::kCode:
+                if (section.align < vmImageFormat::kCodeAlign)
+                    return Error::BinaryFile_Bad_Format;
+                code_ = data + section.offset;
+                codeSize_ = section.size;
+                break;
+            case vmImageFormat::kStrings:
+                strings_ = (const char *)(data + section.offset);
+                stringsSize_ = section.size;
+                break;
+            case vmImageFormat::kSymbols:
+                if (section.align < 4 || (section.size % sizeof(vmImageSymbol)) != 0)
+                    return Error::BinaryFile_Bad_Format;
+                symbols_ = (const vmImageSymbol *)(data + section.offset);
+                symbolCount_ = section.size / sizeof(vmImageSymbol);
+                break;
+            default:
+                break;
+            }
+        }
+
+        if (code_ == nullptr || codeSize_ == 0 || header->entryOffset >= codeSize_)
+            return Error::BinaryFile_Bad_Format;
+        entryOffset_ = header->entryOffset;
+
+        // A symbol is in the code, and its name ends in the strings.
+        for (uint32_t i = 0; i < symbolCount_; i++) {
+            uint32_t name = symbols_[i].name;
+            if (symbols_[i].offset > codeSize_ || name >= stringsSize_ || memchr(strings_ + name, '\0', stringsSize_ - name) == nullptr)
+                return Error::BinaryFile_Bad_Format;
+        }
+        return Error::Ok;
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_IMAGEFILE_H
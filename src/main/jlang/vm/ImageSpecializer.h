@@ -0,0 +1,184 @@
+
+#ifndef JLANG_VM_IMAGESPECIALIZER_H
+#define JLANG_VM_IMAGESPECIALIZER_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/vm/SuperInstruction.h"
+#include "jlang/lang/Error.h"
+#include "jlang/support/Console.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <vector>
+#include <algorithm>
+
+namespace jlang {
+
+//
+// The direct-jump execution plan of an image, what execute_inline() does
+// by hand for the fibonacci image, built for any image:
+//
+//   - Every call site gets a numeric return tag, it's stored in the
+//     operand1 of the call instruction and pushed on the call stack.
+//   - A return pops the tag and jumps to returnSite(tag) directly,
+//     tag 0 is the program exit.
+//   - All the fusable sequences are fused up front, the whole image is
+//     known, so no profiling is needed (see SuperInstruction.h).
+//
+// The frames are the same as in the other execution modes, they still
+// hold the bytecode return IPs.
+//
+class vmExecPlan {
+private:
+    vmDecodedImage                  code_;
+    std::vector<vmDecodedInst *>    returnSites_;
+    std::vector<uint32_t>           functions_;
+    size_t                          fusedCount_;
+
+    friend class vmImageSpecializer;
+
+public:
+    vmExecPlan() : fusedCount_(0) {}
+    ~vmExecPlan() {
+        destroy();
+    }
+
+    bool isInited() const { return code_.isInited(); }
+
+    vmDecodedImage * getCode() { return &code_; }
+
+    vmDecodedInst * begin() const { return code_.begin(); }
+    vmDecodedInst * end() const { return code_.end(); }
+    vmDecodedInst * entry() const { return code_.entry(); }
+
+    JM_FORCEINLINE vmDecodedInst * returnSite(int32_t tag) const {
+        assert(tag > 0 && tag < (int32_t)returnSites_.size());
+        return returnSites_[tag];
+    }
+
+    // The number of return tags, include the exit tag 0.
+    size_t getReturnTagCount() const { return returnSites_.size(); }
+    size_t getFunctionCount() const { return functions_.size(); }
+    size_t getFusedCount() const { return fusedCount_; }
+
+    void destroy() {
+        code_.destroy();
+        returnSites_.clear();
+        functions_.clear();
+        fusedCount_ = 0;
+    }
+
+    //
+    // Decode the instruction at the bytecode offset again after its
+    // immediate was patched, the return tag of a call is kept.
+    //
+    int refresh(uint32_t offset) {
+        vmDecodedInst * inst = code_.atOffset(offset);
+        if (inst == nullptr || inst == code_.end())
+            return Error::Predecode_Illegal_Branch_Target;
+
+        int32_t returnTag = inst->operand1;
+        bool isCall = vmFusedOp::isCall(inst->opcode);
+        int ec = code_.refresh(offset);
+        if (isCall && vmFusedOp::isCall(inst->opcode))
+            inst->operand1 = returnTag;
+        return ec;
+    }
+
+    void dump() const {
+        console.printf("  exec plan: %u instructions, %u functions, %u return tags, %u fused\n",
+                       (uint32_t)code_.size(), (uint32_t)functions_.size(),
+                       (uint32_t)(returnSites_.size() - 1), (uint32_t)fusedCount_);
+        for (size_t i = 0; i < functions_.size(); i++) {
+            console.printf("    function %u:  %08X\n", (uint32_t)i, functions_[i]);
+        }
+        for (size_t tag = 1; tag < returnSites_.size(); tag++) {
+            console.printf("    ret_%02u:      %08X\n", (uint32_t)tag, returnSites_[tag]->offset);
+        }
+    }
+};
+
+class vmImageSpecializer {
+public:
+    //
+    // Build the execution plan of the image, it's run once at load time.
+    //
+    static int specialize(const void * image, size_t imageSize, size_t entryOffset,
+                          vmExecPlan & plan) {
+        plan.destroy();
+
+        vmDecodedImage & code = plan.code_;
+        int ec = code.decode(image, imageSize, entryOffset);
+        if (ec != Error::Ok)
+            return ec;
+
+        vmDecodedInst * first = code.begin();
+        size_t count = code.size();
+
+        // The instructions a jump, call or return can land on.
+        std::vector<uint8_t> isLabel(count + 1, 0);
+        isLabel[code.entry() - first] = 1;
+
+        // Tag 0 is the program exit.
+        plan.returnSites_.push_back(nullptr);
+        plan.functions_.push_back(code.entry()->offset);
+
+        for (size_t i = 0; i < count; i++) {
+            vmDecodedInst * inst = &first[i];
+            if (inst->target != nullptr)
+                isLabel[inst->target - first] = 1;
+
+            if (vmFusedOp::isCall(inst->opcode)) {
+                vmDecodedInst * returnSite = code.atOffset(inst->operand2);
+                if (returnSite == nullptr) {
+                    plan.destroy();
+                    return Error::Predecode_Illegal_Branch_Target;
+                }
+                isLabel[returnSite - first] = 1;
+                inst->operand1 = (int32_t)plan.returnSites_.size();
+                plan.returnSites_.push_back(returnSite);
+                plan.functions_.push_back(inst->target->offset);
+            }
+            else if (inst->opcode == OpCode::fast_tail_call_short) {
+                // No return site, the callee returns with the caller's tag.
+                plan.functions_.push_back(inst->target->offset);
+            }
+        }
+
+        std::sort(plan.functions_.begin(), plan.functions_.end());
+        plan.functions_.erase(std::unique(plan.functions_.begin(), plan.functions_.end()),
+                              plan.functions_.end());
+
+        // Fuse every sequence no label lands inside.
+        size_t i = 0;
+        while (i + 1 < count) {
+            uint32_t fusedOp = 0;
+            if (i + 2 < count && !isLabel[i + 1] && !isLabel[i + 2])
+                fusedOp = vmFusedOp::matchTriple(&first[i]);
+            if (fusedOp == 0 && !isLabel[i + 1])
+                fusedOp = vmFusedOp::matchPair(&first[i]);
+            if (fusedOp != 0) {
+                vmFusedOp::rewrite(&first[i], fusedOp);
+                plan.fusedCount_++;
+                i += vmFusedOp::getLength(fusedOp);
+            }
+            else {
+                i++;
+            }
+        }
+
+        return Error::Ok;
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_IMAGESPECIALIZER_H
@@ -8,19 +8,32 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <assert.h>
 #include <string.h>
 
 #include <cstdint>
-#include <list>
+#include <string>
+#include <vector>
 #include <memory>
 #include <atomic>
 
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#include <windows.h>    // For VirtualAlloc()
+#endif // !_WIN32
+
+#include "jlang/basic/stddef.h"
 #include "jlang/support/Console.h"
+#include "jlang/vm/SymbolTable.h"
 
 //////////////////////////////////////////////////////////////
 
+#ifndef USE_VMSTACK_CALLSTACK
 #define USE_VMSTACK_CALLSTACK       1
+#endif
 
 #define USE_TEST_IMAGE              0
 #define USE_FACTORIAL_IMAGE         1
@@ -36,6 +49,33 @@
 
 //////////////////////////////////////////////////////////////
 
+//
+// Threaded dispatch (computed goto) needs the "labels as values" extension
+// of GCC and clang, the other compilers use the switch dispatch loop.
+//
+#if defined(__GNUC__) || defined(__clang__)
+#define USE_THREADED_DISPATCH   1
+#else
+#define USE_THREADED_DISPATCH   0
+#endif
+
+//
+// Profile the predecoded stream and fuse the hot instruction sequences
+// into superinstructions (see SuperInstruction.h).
+//
+#define USE_SUPER_INSTRUCTIONS  1
+
+//
+// The copy-and-patch JIT only emits x86-64 code (see JitCompiler.h).
+//
+#if defined(_M_X64) || defined(_M_AMD64) || defined(__amd64__) || defined(__x86_64__)
+#define USE_JIT_COMPILER        1
+#else
+#define USE_JIT_COMPILER        0
+#endif
+
+//////////////////////////////////////////////////////////////
+
 #define MakeComboType(t1, t2)   (((t1) * 16) | (t2))
 
 #define VM_STACK_PUSH(sp, type) \
@@ -259,6 +299,7 @@ public:
         fast_call_near,
         fast_call_short,
         fast_call_long,
+        fast_tail_call_short,
         ret,
         ret_n_sm,
         ret_n,
@@ -280,6 +321,13 @@ public:
         imul,
         div,
         idiv,
+        alloc,
+        free,
+        new_obj,
+        ld_ref,
+        st_ref,
+        ld_field,
+        st_field,
         push_all,
         pop_all,
         exit,
@@ -641,9 +689,10 @@ private:
     void * data_;
     size_t size_;
     void * entry_;
+    bool   owned_;
 
 public:
-    vmBinImage() : data_(nullptr), size_(0), entry_(nullptr) {}
+    vmBinImage() : data_(nullptr), size_(0), entry_(nullptr), owned_(false) {}
     ~vmBinImage() {
         this->deallocate();
     }
@@ -657,7 +706,20 @@ public:
         entry_ = (void *)((char *)data_ + entryOffset);
     }
 
+    // The image is in place, e.g. in a mapped file, it isn't freed.
+    bool isAttached() const { return (data_ != nullptr && !owned_); }
+
+    void attach(void * imageData, size_t imageSize) {
+        this->deallocate();
+        data_ = imageData;
+        size_ = imageSize;
+        entry_ = imageData;
+    }
+
     void allocate(size_t imageSize) {
+        if (!owned_) {
+            data_ = nullptr;
+        }
 #if defined(_WIN32)
         if (data_) {
             _aligned_free(data_);
@@ -672,9 +734,13 @@ public:
         int ret = posix_memalign((void **)&data_, 256, imageSize);
 #endif // _WIN32
         size_ = imageSize;
+        owned_ = true;
     }
 
     void deallocate() {
+        if (!owned_) {
+            data_ = nullptr;
+        }
         if (data_) {
 #if defined(_WIN32)
             _aligned_free(data_);
@@ -684,6 +750,7 @@ public:
             data_ = nullptr;
         }
         size_ = 0;
+        owned_ = false;
     }
 };
 
@@ -701,152 +768,531 @@ public:
     }
 };
 
-class vmCallStackDebugInfo {
-#ifndef NDEBUG
+//
+// A record of the shadow call stack: the call instruction, its return
+// point and the caller's stack pointer. It has no names, a trace looks
+// them up in the function metadata of the image (vmSymbolTable).
+//
+struct vmCallRecord {
+    unsigned char * callIP;
+    unsigned char * returnIP;
+    unsigned char * frame;
+};
+
+//
+// The shadow call stack of vmFrame, when the return points aren't kept on
+// the vmStack (USE_VMSTACK_CALLSTACK is 0). The records are one array,
+// allocated by create(), so a call doesn't allocate, and a release build
+// can still print the guest stack when something goes wrong.
+//
+class vmCallStack {
+public:
+    static const size_t kDefaultCapacity = 4096;
+
 private:
-    char * moduleName;      // Module name, example: Nt.dll
-    char * methodName;      // Method name, example: GetPos()
-    char * filename;        // Source code filename, example: ErrorCode.h
-    uint32_t line;          // Source line no, example: Line 108
-#endif
+    vmCallRecord *  records_;
+    size_t          size_;
+    size_t          capacity_;
 
 public:
-#ifndef NDEBUG
-    vmCallStackDebugInfo()
-        : moduleName(nullptr), methodName(nullptr),
-          filename(nullptr), line(0) {}
-#else
-    vmCallStackDebugInfo() {}
-#endif
+    vmCallStack() : records_(nullptr), size_(0), capacity_(0) {}
+    ~vmCallStack() {
+        destroy();
+    }
+
+    bool isInited() const { return (records_ != nullptr); }
+    bool isEmpty() const { return (size_ == 0); }
+    bool isFull() const { return (size_ >= capacity_); }
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
 
-    ~vmCallStackDebugInfo() {
+    bool create(size_t capacity = kDefaultCapacity) {
         destroy();
+        assert(capacity > 0);
+        records_ = new vmCallRecord[capacity];
+        capacity_ = capacity;
+        return (records_ != nullptr);
     }
 
     void destroy() {
-#ifndef NDEBUG
-        if (moduleName) {
-            delete moduleName;
-            moduleName = nullptr;
-        }
-        if (methodName) {
-            delete methodName;
-            methodName = nullptr;
+        if (records_) {
+            delete[] records_;
+            records_ = nullptr;
         }
-        if (filename) {
-            delete filename;
-            filename = nullptr;
-        }
-#endif
+        size_ = 0;
+        capacity_ = 0;
     }
 
-#ifndef NDEBUG
-    bool isDebug() const { return true; }
-
-    const char * getModuleName() const {
-        return moduleName;
+    void clear() {
+        size_ = 0;
     }
 
-    const char * getMethodName() const {
-        return methodName;
+    // The record of depth, 0 is the innermost call.
+    const vmCallRecord & operator [] (size_t depth) const {
+        assert(depth < size_);
+        return records_[size_ - 1 - depth];
     }
 
-    const char * getFileName() const {
-        return filename;
+    //
+    // Returns false if the stack is full, the caller reports the guest's
+    // stack overflow.
+    //
+    bool push(unsigned char * callIP, unsigned char * returnIP, unsigned char * frame) {
+        if (isFull())
+            return false;
+        vmCallRecord & record = records_[size_++];
+        record.callIP = callIP;
+        record.returnIP = returnIP;
+        record.frame = frame;
+        return true;
     }
 
-    uint32_t getLine() const {
-        return line;
+    unsigned char * pop() {
+        if (size_ == 0)
+            return nullptr;
+        size_--;
+        assert(records_[size_].returnIP != nullptr);
+        return records_[size_].returnIP;
+    }
+
+    //
+    // Appends the stack to trace, innermost call first, a line per record
+    // with the function of the call and the call's offset in the image.
+    //
+    void backtrace(std::string & trace, const unsigned char * imageStart,
+                   const vmSymbolTable * symbols, size_t maxDepth = (size_t)-1) const {
+        char buf[96];
+        size_t count = (size_ < maxDepth) ? size_ : maxDepth;
+        for (size_t depth = 0; depth < count; depth++) {
+            const vmCallRecord & record = (*this)[depth];
+            if (record.callIP == nullptr) {
+                snprintf(buf, sizeof(buf), "  #%-3u <entry>\n", (uint32_t)depth);
+                trace += buf;
+                continue;
+            }
+            uint32_t offset = (uint32_t)(record.callIP - imageStart);
+            const vmSymbolTable::Symbol * function = nullptr;
+            if (symbols != nullptr)
+                function = symbols->findFunction(offset);
+            if (function != nullptr) {
+                snprintf(buf, sizeof(buf), "  #%-3u %08X  ", (uint32_t)depth, offset);
+                trace += buf;
+                trace += function->name;
+                snprintf(buf, sizeof(buf), "+0x%X\n", offset - function->offset);
+                trace += buf;
+            }
+            else {
+                snprintf(buf, sizeof(buf), "  #%-3u %08X  sub_%08X\n",
+                         (uint32_t)depth, offset, offset);
+                trace += buf;
+            }
+        }
     }
+};
+
+typedef unsigned int vmThreadId;
+typedef unsigned int vmProcessId;
+
+template <typename BasicType, bool IsBackwardPtr>
+class vmStack;
+
+#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
+ || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
+#define VM_X64_SELECT(x64, x86)     x64
 #else
-    bool isDebug() const { return false; }
+#define VM_X64_SELECT(x64, x86)     x86
+#endif
 
-    const char * getModuleName() const {
-        return nullptr;
-    }
+//
+// The widths of the register operations: the part of the register a
+// reg_t names (see vmReg::getType()), its C type, and the type the
+// operation is done in.
+//
+template <uint32_t RegType>
+struct vmRegWidth;
+
+template <>
+struct vmRegWidth<vmRegType::r8> {
+    typedef uint8_t     type;
+    typedef uint32_t    wide_type;
+    static type & ref(Register & reg) { return reg.ax.u8.low; }
+};
 
-    const char * getMethodName() const {
-        return nullptr;
-    }
+template <>
+struct vmRegWidth<vmRegType::r8_high> {
+    typedef uint8_t     type;
+    typedef uint32_t    wide_type;
+    static type & ref(Register & reg) { return reg.ax.u8.high; }
+};
 
-    const char * getFileName() const {
-        return nullptr;
-    }
+template <>
+struct vmRegWidth<vmRegType::r16> {
+    typedef uint16_t    type;
+    typedef uint32_t    wide_type;
+    static type & ref(Register & reg) { return reg.ax.u16; }
+};
 
-    uint32_t getLine() const {
-        return 0;
-    }
+template <>
+struct vmRegWidth<vmRegType::r32> {
+    typedef uint32_t    type;
+    typedef uint32_t    wide_type;
+    static type & ref(Register & reg) { return reg.eax.u32; }
+};
+
+#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
+ || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
+template <>
+struct vmRegWidth<vmRegType::r64> {
+    typedef uint64_t    type;
+    typedef uint64_t    wide_type;
+    static type & ref(Register & reg) { return reg.rax.u64; }
+};
 #endif
+
+//
+// The data types of the compares and the immediates, one row each:
+// the data type, its C type, and the part of the register it's in.
+//
+#define VM_DATA_TYPE_TABLE(X)                                   \
+    X(Int8,     int8_t,     vmRegType::r8)                      \
+    X(UInt8,    uint8_t,    vmRegType::r8)                      \
+    X(Int16,    int16_t,    vmRegType::r16)                     \
+    X(UInt16,   uint16_t,   vmRegType::r16)                     \
+    X(Int32,    int32_t,    vmRegType::r32)                     \
+    X(UInt32,   uint32_t,   vmRegType::r32)                     \
+    X(Int64,    int64_t,    vmRegType::r64)                     \
+    X(UInt64,   uint64_t,   vmRegType::r64)                     \
+    X(Pointer,  uintptr_t,  VM_X64_SELECT(vmRegType::r64, vmRegType::r32))
+
+template <uint32_t DataType>
+struct vmDataWidth;
+
+#define VM_DATA_WIDTH(dataType, T, regType)                     \
+    template <>                                                 \
+    struct vmDataWidth<vmDataType::dataType> {                  \
+        typedef T type;                                         \
+        static const uint32_t kRegType = regType;               \
+    };
+
+VM_DATA_TYPE_TABLE(VM_DATA_WIDTH)
+#undef VM_DATA_WIDTH
+
+struct vmRegOperand {
+    enum Type {
+        None,
+        Reg,
+        Imm
+    };
 };
 
-class vmCallStackInfo {
-private:
-    unsigned char * callFP_;
-    unsigned char * returnFP_;
+//
+// The register operations, one row each: the name, the second operand
+// (none, a register or an immediate), if the result is written to the
+// first register, and the result of a (the first register) and b (the
+// second operand).
+//
+// Each row is made a handler per register width, numbered op * kWidths +
+// regType (vmRegOp::make). A decoder that keeps that number has resolved the
+// width once; vmRegOpDispatch switches on it and inlines the handler. An
+// operation of all widths is one more row.
+//
+#define VM_REG_OP_TABLE(X)                                      \
+    X(get,      None,   false,  a)                              \
+    X(set,      Imm,    true,   b)                              \
+    X(move,     Reg,    true,   b)                              \
+    X(inc,      None,   true,   a + 1)                          \
+    X(dec,      None,   true,   a - 1)                          \
+    X(add,      Reg,    true,   a + b)                          \
+    X(add_ri,   Imm,    true,   a + b)                          \
+    X(sub,      Reg,    true,   a - b)                          \
+    X(sub_ri,   Imm,    true,   a - b)                          \
+    X(mul,      Reg,    true,   a * b)                          \
+    X(mul_ri,   Imm,    true,   a * b)
+
+#define VM_REG_OP_DEFINE(name, operand, writes, expr)           \
+    struct vmRegOp_##name {                                     \
+        static const uint32_t kOperand = vmRegOperand::operand; \
+        static const bool kWrites = writes;                     \
+        template <typename W>                                   \
+        static W apply(W a, W b) {                              \
+            (void)a;                                            \
+            (void)b;                                            \
+            return (W)(expr);                                   \
+        }                                                       \
+    };
 
-public:
-    vmCallStackDebugInfo debugInfo;
+VM_REG_OP_TABLE(VM_REG_OP_DEFINE)
+#undef VM_REG_OP_DEFINE
 
-public:
-    vmCallStackInfo() : callFP_(nullptr), returnFP_(nullptr) {}
-    vmCallStackInfo(unsigned char * callFP, unsigned char * returnFP)
-        : callFP_(callFP), returnFP_(returnFP) {}
-    ~vmCallStackInfo() {}
+struct vmRegOp {
+    enum Type {
+#define VM_REG_OP_ENUM(name, operand, writes, expr)     name,
+        VM_REG_OP_TABLE(VM_REG_OP_ENUM)
+#undef VM_REG_OP_ENUM
+        last
+    };
 
-    unsigned char * getCallFP() const { return callFP_; }
-    unsigned char * getReturnFP() const { return returnFP_; }
+    // r8, r8_high, r16, r32 and r64.
+    static const uint32_t kWidths = vmRegType::r64 + 1;
+    static const uint32_t kHandlers = last * kWidths;
 
-    void setCallFP(unsigned char * callFP) { callFP_ = callFP; }
-    void setReturnFP(unsigned char * returnFP) { returnFP_ = returnFP; }
+    // The handler number of an operation and width.
+    static uint32_t make(uint32_t op, uint32_t regType) {
+        assert(op < last && regType < kWidths);
+        return (op * kWidths + regType);
+    }
 };
 
-class vmCallStack {
-private:
-    ::std::list<vmCallStackInfo *> stack_;
+template <typename Op, uint32_t RegType>
+struct vmRegOpHandlerOf {
+    static JM_FORCEINLINE uintptr_t run(Register * regs, uint32_t index, uintptr_t operand) {
+        typedef typename vmRegWidth<RegType>::type      T;
+        typedef typename vmRegWidth<RegType>::wide_type W;
+        assert(index < vmReg::kMaxRegs);
+        T & a = vmRegWidth<RegType>::ref(regs[index]);
+        W b;
+        if (Op::kOperand == vmRegOperand::Reg) {
+            assert(operand < vmReg::kMaxRegs);
+            b = (W)vmRegWidth<RegType>::ref(regs[operand]);
+        }
+        else {
+            b = (W)operand;
+        }
+        T value = (T)Op::apply((W)a, b);
+        if (Op::kWrites)
+            a = value;
+        return (uintptr_t)value;
+    }
+};
 
-public:
-    vmCallStack() {}
-    ~vmCallStack() {}
+inline uintptr_t vmRegOpUnsupported(Register * regs, uint32_t index, uintptr_t operand) {
+    (void)regs;
+    (void)index;
+    (void)operand;
+    assert(false);
+    return (uintptr_t)0xCCCCCCCCCCCCCCCCULL;
+}
 
-    void destroy() {
-        ::std::list<vmCallStackInfo *>::iterator iter;
-        for (iter = stack_.begin(); iter != stack_.end(); ++iter) {
-            vmCallStackInfo * info = *iter;
-            if (info) {
-                delete info;
-                *iter = nullptr;
-            }
+//
+// Runs operation Op at width regType, a switch over the width like the
+// per-width functions had, the handler of each width is inlined.
+//
+template <typename Op>
+struct vmRegOpWidths {
+    static JM_FORCEINLINE uintptr_t run(uint32_t regType, Register * regs,
+                                        uint32_t index, uintptr_t operand) {
+        switch (regType) {
+        case vmRegType::r8:
+            return vmRegOpHandlerOf<Op, vmRegType::r8>::run(regs, index, operand);
+        case vmRegType::r8_high:
+            return vmRegOpHandlerOf<Op, vmRegType::r8_high>::run(regs, index, operand);
+        case vmRegType::r16:
+            return vmRegOpHandlerOf<Op, vmRegType::r16>::run(regs, index, operand);
+        case vmRegType::r32:
+            return vmRegOpHandlerOf<Op, vmRegType::r32>::run(regs, index, operand);
+#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
+ || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
+        case vmRegType::r64:
+            return vmRegOpHandlerOf<Op, vmRegType::r64>::run(regs, index, operand);
+#endif
+        default:
+            return vmRegOpUnsupported(regs, index, operand);
         }
-        stack_.clear();
     }
+};
 
-    int push(unsigned char * callFP, unsigned char * returnFP) {
-        vmCallStackInfo * info = new vmCallStackInfo(callFP, returnFP);
-        assert(info != nullptr);
-        stack_.push_back(info);
-        return 1;
+//
+// Runs handler number handler, for a caller that kept the number. There's
+// no call through a pointer, every handler is inlined.
+//
+struct vmRegOpDispatch {
+    static JM_FORCEINLINE uintptr_t run(uint32_t handler, Register * regs,
+                                        uint32_t index, uintptr_t operand) {
+        switch (handler) {
+#define VM_REG_OP_CASE(name, operand_, writes, expr)                    \
+        case vmRegOp::name * vmRegOp::kWidths + vmRegType::r8:          \
+        case vmRegOp::name * vmRegOp::kWidths + vmRegType::r8_high:     \
+        case vmRegOp::name * vmRegOp::kWidths + vmRegType::r16:         \
+        case vmRegOp::name * vmRegOp::kWidths + vmRegType::r32:         \
+        case vmRegOp::name * vmRegOp::kWidths + vmRegType::r64:         \
+            return vmRegOpWidths<vmRegOp_##name>::run(                  \
+                handler - vmRegOp::name * vmRegOp::kWidths, regs, index, operand);
+            VM_REG_OP_TABLE(VM_REG_OP_CASE)
+#undef VM_REG_OP_CASE
+        default:
+            return vmRegOpUnsupported(regs, index, operand);
+        }
     }
+};
 
-    unsigned char * pop() {
-        unsigned char * returnFP = nullptr;
-        if (!stack_.empty()) {
-            vmCallStackInfo * info = stack_.back();
-            if (info) {
-                returnFP = info->getReturnFP();
-                assert(returnFP != nullptr);
-                delete info;
-            }
-            stack_.pop_back();
+//
+// The conditions of the conditional jumps, in the order of vmCondType.
+//
+#define VM_COND_TABLE(X)                                        \
+    X(jz,   (a == 0 && b == 0))                                 \
+    X(jnz,  (a != 0 && b != 0))                                 \
+    X(je,   (a == b))                                           \
+    X(jne,  (a != b))                                           \
+    X(jl,   (a < b))                                            \
+    X(jle,  (a <= b))                                           \
+    X(jg,   (a > b))                                            \
+    X(jge,  (a >= b))
+
+#define VM_COND_DEFINE(name, expr)                              \
+    struct vmCond_##name {                                      \
+        template <typename T>                                   \
+        static bool test(T a, T b) { return (expr); }           \
+    };
+
+VM_COND_TABLE(VM_COND_DEFINE)
+#undef VM_COND_DEFINE
+
+struct vmCondOp {
+    // The data types of a compare, Int8 .. Pointer.
+    static const uint32_t kDataTypes = vmDataType::Pointer + 1;
+    static const uint32_t kConds = vmCondType::cond_last + 1;
+
+    // The handler of a condition and data type is handlers[cond * kDataTypes + dataType].
+    static uint32_t make(uint32_t cond, uint32_t dataType) {
+        assert(cond < kConds && dataType < kDataTypes);
+        return (cond * kDataTypes + dataType);
+    }
+
+    // The condition of a conditional jump opcode.
+    static uint32_t fromOpCode(uint32_t condJmp) {
+        switch (condJmp) {
+        case OpCode::jz:        return vmCondType::jz;
+        case OpCode::jnz:       return vmCondType::jnz;
+        case OpCode::je:        return vmCondType::je;
+        case OpCode::jne:       return vmCondType::jne;
+        case OpCode::jl:        return vmCondType::jl;
+        case OpCode::jle:       return vmCondType::jle;
+        case OpCode::jg:        return vmCondType::jg;
+        case OpCode::jge:       return vmCondType::jge;
+        default:                return vmCondType::last;
         }
-        return returnFP;
     }
 };
 
-typedef unsigned int vmThreadId;
-typedef unsigned int vmProcessId;
+typedef bool (*vmCondHandler)(Register * regs, uint32_t index, uintptr_t operand);
+
+template <typename Cond, uint32_t DataType, uint32_t Operand>
+struct vmCondHandlerOf {
+    static bool run(Register * regs, uint32_t index, uintptr_t operand) {
+        typedef typename vmDataWidth<DataType>::type T;
+        static const uint32_t kRegType = vmDataWidth<DataType>::kRegType;
+        assert(index < vmReg::kMaxRegs);
+        T a = (T)vmRegWidth<kRegType>::ref(regs[index]);
+        T b;
+        if (Operand == vmRegOperand::Reg) {
+            assert(operand < vmReg::kMaxRegs);
+            b = (T)vmRegWidth<kRegType>::ref(regs[operand]);
+        }
+        else {
+            b = (T)operand;
+        }
+        return Cond::test(a, b);
+    }
+};
 
-template <typename BasicType, bool IsBackwardPtr>
-class vmStack;
+inline bool vmCondUnsupported(Register * regs, uint32_t index, uintptr_t operand) {
+    (void)regs;
+    (void)index;
+    (void)operand;
+    assert(false);
+    return false;
+}
+
+//
+// The compares of two registers (vmRegOperand::Reg) or of a register and
+// an immediate (vmRegOperand::Imm).
+//
+template <uint32_t Operand>
+struct vmCondTable {
+    static const vmCondHandler handlers[vmCondOp::kConds * vmCondOp::kDataTypes];
+};
+
+template <uint32_t Operand>
+const vmCondHandler vmCondTable<Operand>::handlers[vmCondOp::kConds * vmCondOp::kDataTypes] = {
+#define VM_COND_ROW(name, expr)                                                         \
+    &vmCondHandlerOf<vmCond_##name, vmDataType::Int8, Operand>::run,                    \
+    &vmCondHandlerOf<vmCond_##name, vmDataType::UInt8, Operand>::run,                   \
+    &vmCondHandlerOf<vmCond_##name, vmDataType::Int16, Operand>::run,                   \
+    &vmCondHandlerOf<vmCond_##name, vmDataType::UInt16, Operand>::run,                  \
+    &vmCondHandlerOf<vmCond_##name, vmDataType::Int32, Operand>::run,                   \
+    &vmCondHandlerOf<vmCond_##name, vmDataType::UInt32, Operand>::run,                  \
+    VM_X64_SELECT((&vmCondHandlerOf<vmCond_##name, vmDataType::Int64, Operand>::run),   \
+                  (&vmCondUnsupported)),                                                \
+    VM_X64_SELECT((&vmCondHandlerOf<vmCond_##name, vmDataType::UInt64, Operand>::run),  \
+                  (&vmCondUnsupported)),                                                \
+    &vmCondHandlerOf<vmCond_##name, vmDataType::Pointer, Operand>::run,
+    VM_COND_TABLE(VM_COND_ROW)
+#undef VM_COND_ROW
+};
+
+//
+// The immediates of the instruction stream, read and written by their
+// data type, or by the width of the register they're loaded to.
+//
+typedef uintptr_t (*vmImmReader)(const unsigned char * ptr);
+typedef void (*vmImmWriter)(unsigned char * ptr, uintptr_t value);
+
+template <typename T>
+struct vmImmValue {
+    static uintptr_t read(const unsigned char * ptr) {
+        return (uintptr_t)(*(const T *)ptr);
+    }
+
+    static void write(unsigned char * ptr, uintptr_t value) {
+        *(T *)ptr = (T)value;
+    }
+};
+
+template <typename Dummy = void>
+struct vmImmTable {
+    static const vmImmReader    readers[vmCondOp::kDataTypes];
+    static const vmImmWriter    writers[vmCondOp::kDataTypes];
+    static const uint8_t        sizes[vmCondOp::kDataTypes];
+
+    static const vmImmReader    regReaders[vmRegOp::kWidths];
+    static const uint8_t        regSizes[vmRegOp::kWidths];
+};
+
+template <typename Dummy>
+const vmImmReader vmImmTable<Dummy>::readers[vmCondOp::kDataTypes] = {
+#define VM_IMM_READER(dataType, T, regType)     &vmImmValue<T>::read,
+    VM_DATA_TYPE_TABLE(VM_IMM_READER)
+#undef VM_IMM_READER
+};
+
+template <typename Dummy>
+const vmImmWriter vmImmTable<Dummy>::writers[vmCondOp::kDataTypes] = {
+#define VM_IMM_WRITER(dataType, T, regType)     &vmImmValue<T>::write,
+    VM_DATA_TYPE_TABLE(VM_IMM_WRITER)
+#undef VM_IMM_WRITER
+};
+
+template <typename Dummy>
+const uint8_t vmImmTable<Dummy>::sizes[vmCondOp::kDataTypes] = {
+#define VM_IMM_SIZE(dataType, T, regType)       (uint8_t)sizeof(T),
+    VM_DATA_TYPE_TABLE(VM_IMM_SIZE)
+#undef VM_IMM_SIZE
+};
+
+template <typename Dummy>
+const vmImmReader vmImmTable<Dummy>::regReaders[vmRegOp::kWidths] = {
+    &vmImmValue<uint8_t>::read,
+    &vmImmValue<uint8_t>::read,
+    &vmImmValue<uint16_t>::read,
+    &vmImmValue<uint32_t>::read,
+    &vmImmValue<uint64_t>::read
+};
+
+template <typename Dummy>
+const uint8_t vmImmTable<Dummy>::regSizes[vmRegOp::kWidths] = {
+    sizeof(uint8_t), sizeof(uint8_t), sizeof(uint16_t), sizeof(uint32_t), sizeof(uint64_t)
+};
 
 template <typename BasicType>
 class vmFrame {
@@ -862,6 +1308,9 @@ private:
     unsigned char * fp_limit_;
     unsigned char * fp_start_;
 
+    // The names of a backtrace, the image's vmSymbolTable.
+    const vmSymbolTable * symbols_;
+
     Register regs_[kMaxRegs];
 
 #if USE_VMSTACK_CALLSTACK
@@ -873,8 +1322,11 @@ private:
 public:
     vmFrame(stack_type * stack = nullptr)
       : fp_(nullptr), stack_(stack),
-        fp_limit_(nullptr), fp_start_(nullptr) {
+        fp_limit_(nullptr), fp_start_(nullptr), symbols_(nullptr) {
         initRegs();
+#if !USE_VMSTACK_CALLSTACK
+        callStack_.create();
+#endif
     }
     ~vmFrame() {
         destroy();
@@ -948,6 +1400,9 @@ public:
         this->fp_ = nullptr;
         this->fp_limit_ = nullptr;
         this->fp_start_ = nullptr;
+#if !USE_VMSTACK_CALLSTACK
+        callStack_.clear();
+#endif
     }
 
     void reset() {
@@ -1001,106 +1456,23 @@ public:
     }
 
     basic_type getValue(uint32_t dataType) const {
-        switch (dataType) {
-        case vmDataType::Int8:
-            return (basic_type)getInt8();
-
-        case vmDataType::UInt8:
-            return (basic_type)getUInt8();
-
-        case vmDataType::Int16:
-            return (basic_type)getInt16();
-
-        case vmDataType::UInt16:
-            return (basic_type)getUInt16();
-
-        case vmDataType::Int32:
-            return (basic_type)getInt32();
-
-        case vmDataType::UInt32:
-            return (basic_type)getUInt32();
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmDataType::Int64:
-            return (basic_type)getInt64();
-
-        case vmDataType::UInt64:
-            return (basic_type)getUInt64();
-#endif
-        case vmDataType::Pointer:
-            return (basic_type)(uintptr_t)getPointer();
-
-        default:
-            assert(false);
-            return (basic_type)(uintptr_t)getPointer();
-        }
+        assert(dataType < vmCondOp::kDataTypes);
+        return (basic_type)vmImmTable<>::readers[dataType](fp_);
     }
 
     uint32_t getValue32(uint32_t dataType) const {
-        switch (dataType) {
-        case vmDataType::Int8:
-            return (uint32_t)getInt8();
-
-        case vmDataType::UInt8:
-            return (uint32_t)getUInt8();
-
-        case vmDataType::Int16:
-            return (uint32_t)getInt16();
-
-        case vmDataType::UInt16:
-            return (uint32_t)getUInt16();
-
-        case vmDataType::Int32:
-            return (uint32_t)getInt32();
-
-        case vmDataType::UInt32:
-            return (uint32_t)getUInt32();
-
-        case vmDataType::Pointer:
-            return (basic_type)(uintptr_t)getPointer();
-
-        default:
-            assert(false);
-            return (basic_type)(uintptr_t)getPointer();
-        }
+        assert(dataType != vmDataType::Int64 && dataType != vmDataType::UInt64);
+        return (uint32_t)getValue(dataType);
     }
 
     uint64_t getValue64(uint32_t dataType) const {
-        switch (dataType) {
-        case vmDataType::Int64:
-            return (uint64_t)getInt64();
-
-        case vmDataType::UInt64:
-            return (uint64_t)getUInt64();
-
-        default:
-            assert(false);
-            return (uint64_t)getUInt64();
-        }
+        assert(dataType == vmDataType::Int64 || dataType == vmDataType::UInt64);
+        return getUInt64();
     }
 
     basic_type getValueByReg(uint32_t regType) const {
-        switch (regType) {
-        case vmRegType::r8:
-        case vmRegType::r8_high:
-            return (basic_type)getUInt8();
-
-        case vmRegType::r16:
-            return (basic_type)getUInt16();
-
-        case vmRegType::r32:
-            return (basic_type)getUInt32();
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)getUInt64();
-#endif
-        default:
-            assert(false);
-            return (basic_type)getUInt64();
-        }
+        assert(regType < vmRegOp::kWidths);
+        return (basic_type)vmImmTable<>::regReaders[regType](fp_);
     }
 
     void setInt8(int8_t value) {
@@ -1140,133 +1512,47 @@ public:
     }
 
     void setValue(uint32_t dataType, basic_type value) {
-        switch (dataType) {
-        case vmDataType::Int8:
-            setInt8((int8_t)value);
-            break;
-
-        case vmDataType::UInt8:
-            setUInt8((uint8_t)value);
-            break;
+        assert(dataType < vmCondOp::kDataTypes);
+        vmImmTable<>::writers[dataType](fp_, (uintptr_t)value);
+    }
 
-        case vmDataType::Int16:
-            setInt16((int16_t)value);
-            break;
+    void setValue32(uint32_t dataType, uint32_t value) {
+        assert(dataType != vmDataType::Int64 && dataType != vmDataType::UInt64);
+        setValue(dataType, (basic_type)value);
+    }
 
-        case vmDataType::UInt16:
-            setUInt16((uint16_t)value);
-            break;
+    void setValue64(uint32_t dataType, uint64_t value) {
+        assert(dataType == vmDataType::Int64 || dataType == vmDataType::UInt64);
+        setUInt64(value);
+    }
 
-        case vmDataType::Int32:
-            setInt32((int32_t)value);
-            break;
+    void back() {
+        this->fp_--;
+    }
 
-        case vmDataType::UInt32:
-            setUInt32((uint32_t)value);
-            break;
+    void back(int offset) {
+        this->fp_ -= offset;
+    }
 
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmDataType::Int64:
-            setInt64((int64_t)value);
-            break;
+    void backInt8() {
+        this->fp_ -= sizeof(int8_t);
+    }
 
-        case vmDataType::UInt64:
-            setUInt64((uint64_t)value);
-            break;
-#endif
-        case vmDataType::Pointer:
-            setPointer((void *)(uintptr_t)value);
-            break;
+    void backUInt8() {
+        this->fp_ -= sizeof(uint8_t);
+    }
 
-        default:
-            assert(false);
-            setPointer((void *)(uintptr_t)value);
-            break;
-        }
+    void backInt16() {
+        this->fp_ -= sizeof(int16_t);
     }
 
-    void setValue32(uint32_t dataType, uint32_t value) {
-        switch (dataType) {
-        case vmDataType::Int8:
-            setInt8((int8_t)value);
-            break;
+    void backUInt16() {
+        this->fp_ += sizeof(uint16_t);
+    }
 
-        case vmDataType::UInt8:
-            setUInt8((uint8_t)value);
-            break;
-
-        case vmDataType::Int16:
-            setInt16((int16_t)value);
-            break;
-
-        case vmDataType::UInt16:
-            setUInt16((uint16_t)value);
-            break;
-
-        case vmDataType::Int32:
-            setInt32((int32_t)value);
-            break;
-
-        case vmDataType::UInt32:
-            setUInt32((uint32_t)value);
-            break;
-
-        case vmDataType::Pointer:
-            setPointer((void *)(uintptr_t)value);
-            break;
-
-        default:
-            assert(false);
-            setPointer((void *)(uintptr_t)value);
-            break;
-        }
-    }
-
-    void setValue64(uint32_t dataType, uint64_t value) {
-        switch (dataType) {
-        case vmDataType::Int64:
-            setInt64((int64_t)value);
-            break;
-
-        case vmDataType::UInt64:
-            setUInt64((uint64_t)value);
-            break;
-
-        default:
-            assert(false);
-            setUInt64((uint64_t)value);
-            break;
-        }
-    }
-
-    void back() {
-        this->fp_--;
-    }
-
-    void back(int offset) {
-        this->fp_ -= offset;
-    }
-
-    void backInt8() {
-        this->fp_ -= sizeof(int8_t);
-    }
-
-    void backUInt8() {
-        this->fp_ -= sizeof(uint8_t);
-    }
-
-    void backInt16() {
-        this->fp_ -= sizeof(int16_t);
-    }
-
-    void backUInt16() {
-        this->fp_ += sizeof(uint16_t);
-    }
-
-    void backInt32() {
-        this->fp_ -= sizeof(int32_t);
-    }
+    void backInt32() {
+        this->fp_ -= sizeof(int32_t);
+    }
 
     void backUInt32() {
         this->fp_ -= sizeof(uint32_t);
@@ -1329,74 +1615,13 @@ public:
     }
 
     void nextValue(uint32_t dataType) {
-        switch (dataType) {
-        case vmDataType::Int8:
-            nextInt8();
-            break;
-
-        case vmDataType::UInt8:
-            nextUInt8();
-            break;
-
-        case vmDataType::Int16:
-            nextInt16();
-            break;
-
-        case vmDataType::UInt16:
-            nextUInt16();
-            break;
-
-        case vmDataType::Int32:
-            nextInt32();
-            break;
-
-        case vmDataType::UInt32:
-            nextUInt32();
-            break;
-
-        case vmDataType::Int64:
-            nextInt64();
-            break;
-
-        case vmDataType::UInt64:
-            nextUInt64();
-            break;
-
-        case vmDataType::Pointer:
-            nextPointer();
-            break;
-
-        default:
-            assert(false);
-            nextPointer();
-            break;
-        }
+        assert(dataType < vmCondOp::kDataTypes);
+        this->fp_ += vmImmTable<>::sizes[dataType];
     }
 
     void nextValueByReg(uint32_t regType) {
-        switch (regType) {
-        case vmRegType::r8:
-        case vmRegType::r8_high:
-            nextUInt8();
-            break;
-
-        case vmRegType::r16:
-            nextUInt16();
-            break;
-
-        case vmRegType::r32:
-            nextUInt32();
-            break;
-
-        case vmRegType::r64:
-            nextUInt64();
-            break;
-
-        default:
-            assert(false);
-            nextUInt64();
-            break;
-        }
+        assert(regType < vmRegOp::kWidths);
+        this->fp_ += vmImmTable<>::regSizes[regType];
     }
 
     uint8_t getRegValue8L(uint8_t regIndex) {
@@ -1427,37 +1652,6 @@ public:
     }
 #endif
 
-    basic_type getRegValue(uint32_t regType, uint32_t regIndex) {
-        switch (regType) {
-        case vmRegType::r8:
-            return getRegValue8L(regIndex);
-
-        case vmRegType::r8_high:
-            return getRegValue8H(regIndex);
-
-        case vmRegType::r16:
-            return getRegValue16(regIndex);
-
-        case vmRegType::r32:
-            return getRegValue32(regIndex);
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return getRegValue64(regIndex);
-#endif
-        default:
-            assert(false);
-            return (basic_type)0xCCCCCCCCCCCCCCCCULL;
-        }
-    }
-
-    basic_type getRegValue(reg_t reg) {
-        uint32_t regType = vmReg::getType(reg);
-        uint32_t regIndex = vmReg::getIndex(reg);
-        return getRegValue(regType, regIndex);
-    }
-
     void setRegValue8L(uint32_t regIndex, uint8_t value) {
         regs_[regIndex].ax.u8.low = value;
     }
@@ -1481,101 +1675,61 @@ public:
     }
 #endif
 
-    void setRegValue(uint32_t regType, uint32_t regIndex, basic_type value) {
-        switch (regType) {
-        case vmRegType::r8:
-            setRegValue8L((uint8_t)value);
-            break;
-        case vmRegType::r8_high:
-            setRegValue8H((uint8_t)value);
-            break;
-        case vmRegType::r16:
-            setRegValue16((uint16_t)value);
-            break;
-        case vmRegType::r32:
-            setRegValue32((uint32_t)value);
-            break;
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            setRegValue64((uint64_t)value);
-            break;
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            break;
-        }
+    //
+    // Runs handler number handler on register regIndex, the operand is the
+    // index of the second register or the immediate.
+    //
+    basic_type runRegOp(uint32_t handler, uint32_t regIndex, uintptr_t operand) {
+        assert(handler < vmRegOp::kHandlers);
+        return (basic_type)vmRegOpDispatch::run(handler, &regs_[0], regIndex, operand);
     }
 
-    void setRegValue(reg_t reg, basic_type value) {
-        uint32_t regType = vmReg::getType(reg);
-        uint32_t regIndex = vmReg::getIndex(reg);
-        setRegValue(regType, regIndex, value);
+    //
+    // For a caller that knows the width at compile time, no dispatch at all.
+    //
+    template <typename Op, uint32_t RegType>
+    basic_type runRegOp(uint32_t regIndex, uintptr_t operand) {
+        return (basic_type)vmRegOpHandlerOf<Op, RegType>::run(&regs_[0], regIndex, operand);
     }
 
-    int8_t loadRegValue8L(uint32_t regIndex) {
-        int8_t value = getInt8();
-        regs_[regIndex].ax.i8.low = value;
-        nextInt8();
-        return value;
+    basic_type regOp(uint32_t op, reg_t reg, uintptr_t operand) {
+        uint32_t handler = vmRegOp::make(op, vmReg::getType(reg));
+        return runRegOp(handler, vmReg::getIndex(reg), operand);
     }
 
-    int8_t loadRegValue8H(uint32_t regIndex) {
-        int8_t value = getInt8();
-        regs_[regIndex].ax.i8.high = value;
-        nextInt8();
-        return value;
+    //
+    // Runs operation Op, a vmRegOp_xxx, on register regIndex of width regType.
+    //
+    template <typename Op>
+    basic_type regOp(uint32_t regType, uint32_t regIndex, uintptr_t operand) {
+        return (basic_type)vmRegOpWidths<Op>::run(regType, &regs_[0], regIndex, operand);
     }
 
-    int16_t loadRegValue16(uint32_t regIndex) {
-        int16_t value = getInt16();
-        regs_[regIndex].ax.i16 = value;
-        nextInt16();
-        return value;
+    template <typename Op>
+    basic_type regOp(reg_t reg, uintptr_t operand) {
+        return regOp<Op>(vmReg::getType(reg), vmReg::getIndex(reg), operand);
     }
 
-    int32_t loadRegValue32(uint32_t regIndex) {
-        int32_t value = getInt32();
-        regs_[regIndex].eax.i32 = value;
-        nextInt32();
-        return value;
+    basic_type getRegValue(uint32_t regType, uint32_t regIndex) {
+        return regOp<vmRegOp_get>(regType, regIndex, 0);
     }
 
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    int64_t loadRegValue64(uint32_t regIndex) {
-        int64_t value = getInt64();
-        regs_[regIndex].rax.i64 = value;
-        nextInt64();
-        return value;
+    basic_type getRegValue(reg_t reg) {
+        return regOp<vmRegOp_get>(reg, 0);
     }
-#endif
 
-    basic_type loadRegValue(uint32_t regType, uint32_t regIndex) {
-        switch (regType) {
-        case vmRegType::r8:
-            return (basic_type)loadRegValue8L(regIndex);
-
-        case vmRegType::r8_high:
-            return (basic_type)loadRegValue8H(regIndex);
-
-        case vmRegType::r16:
-            return (basic_type)loadRegValue16(regIndex);
+    void setRegValue(uint32_t regType, uint32_t regIndex, basic_type value) {
+        regOp<vmRegOp_set>(regType, regIndex, (uintptr_t)value);
+    }
 
-        case vmRegType::r32:
-            return (basic_type)loadRegValue32(regIndex);
+    void setRegValue(reg_t reg, basic_type value) {
+        regOp<vmRegOp_set>(reg, (uintptr_t)value);
+    }
 
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)loadRegValue64(regIndex);
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            return (basic_type)0xCCCCCCCCCCCCCCCCULL;
-        }
+    basic_type loadRegValue(uint32_t regType, uint32_t regIndex) {
+        basic_type value = getValueByReg(regType);
+        nextValueByReg(regType);
+        return regOp<vmRegOp_set>(regType, regIndex, (uintptr_t)value);
     }
 
     basic_type loadRegValue(reg_t reg) {
@@ -1584,596 +1738,89 @@ public:
         return loadRegValue(regType, regIndex);
     }
 
-    uint8_t moveRegValue8L(uint32_t regIndex1, uint32_t regIndex2) {
-        uint8_t value = getRegValue8L(regIndex2);
-        setRegValue8L(regIndex1, value);
-        return value;
-    }
-
-    uint8_t moveRegValue8H(uint32_t regIndex1, uint32_t regIndex2) {
-        uint8_t value = getRegValue8H(regIndex2);
-        setRegValue8H(regIndex1, value);
-        return value;
-    }
-
-    uint16_t moveRegValue16(uint32_t regIndex1, uint32_t regIndex2) {
-        uint16_t value = getRegValue16(regIndex2);
-        setRegValue16(regIndex1, value);
-        return value;
-    }
-
-    uint32_t moveRegValue32(uint32_t regIndex1, uint32_t regIndex2) {
-        uint32_t value = getRegValue32(regIndex2);
-        setRegValue32(regIndex1, value);
-        return value;
-    }
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    uint64_t moveRegValue64(uint32_t regIndex1, uint32_t regIndex2) {
-        uint64_t value = getRegValue64(regIndex2);
-        setRegValue64(regIndex1, value);
-        return value;
-    }
-#endif
-
     basic_type moveRegValue(uint32_t regType1, uint32_t regIndex1,
                             uint32_t regType2, uint32_t regIndex2) {
-        switch (regType1) {
-        case vmRegType::r8:
-            return (basic_type)moveRegValue8L(regIndex1, regIndex2);
-
-        case vmRegType::r8_high:
-            return (basic_type)moveRegValue8H(regIndex1, regIndex2);
-
-        case vmRegType::r16:
-            return (basic_type)moveRegValue16(regIndex1, regIndex2);
-
-        case vmRegType::r32:
-            return (basic_type)moveRegValue32(regIndex1, regIndex2);
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)moveRegValue64(regIndex1, regIndex2);
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            return (basic_type)0xCCCCCCCCCCCCCCCCULL;
-        }
+        assert(regType1 == regType2);
+        return regOp<vmRegOp_move>(regType1, regIndex1, regIndex2);
     }
 
     basic_type moveRegValue(reg_t reg1, reg_t reg2) {
-        uint32_t regType1  = vmReg::getType(reg1);
-        uint32_t regIndex1 = vmReg::getIndex(reg1);
-        uint32_t regType2  = vmReg::getType(reg2);
-        uint32_t regIndex2 = vmReg::getIndex(reg2);
-        return moveRegValue(regType1, regIndex1, regType2, regIndex2);
+        return regOp<vmRegOp_move>(reg1, vmReg::getIndex(reg2));
     }
 
-    uint8_t incRegValue8L(uint32_t regIndex) {
-        uint8_t value = getRegValue8L(regIndex);
-        value++;
-        setRegValue8L(regIndex, value);
-        return value;
-    }
-
-    uint8_t incRegValue8H(uint32_t regIndex) {
-        uint8_t value = getRegValue8H(regIndex);
-        value++;
-        setRegValue8H(regIndex, value);
-        return value;
-    }
-
-    uint16_t incRegValue16(uint32_t regIndex) {
-        uint16_t value = getRegValue16(regIndex);
-        value++;
-        setRegValue16(regIndex, value);
-        return value;
-    }
-
-    uint32_t incRegValue32(uint32_t regIndex) {
-        uint32_t value = getRegValue32(regIndex);
-        value++;
-        setRegValue32(regIndex, value);
-        return value;
-    }
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    uint64_t incRegValue64(uint32_t regIndex) {
-        uint64_t value = getRegValue64(regIndex);
-        value++;
-        setRegValue64(regIndex, value);
-        return value;
-    }
-#endif
-
     basic_type incRegValue(uint32_t regType, uint32_t regIndex) {
-        switch (regType) {
-        case vmRegType::r8:
-            return (basic_type)incRegValue8L(regIndex);
-
-        case vmRegType::r8_high:
-            return (basic_type)incRegValue8H(regIndex);
-
-        case vmRegType::r16:
-            return (basic_type)incRegValue16(regIndex);
-
-        case vmRegType::r32:
-            return (basic_type)incRegValue32(regIndex);
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)incRegValue64(regIndex);
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            return (basic_type)-1;
-        }
-    }
-
-    basic_type incRegValue(reg_t reg) {
-        uint32_t regType  = vmReg::getType(reg);
-        uint32_t regIndex = vmReg::getIndex(reg);
-        return incRegValue(regType, regIndex);
-    }
-
-    uint8_t decRegValue8L(uint32_t regIndex) {
-        uint8_t value = getRegValue8L(regIndex);
-        value--;
-        setRegValue8L(regIndex, value);
-        return value;
-    }
-
-    uint8_t decRegValue8H(uint32_t regIndex) {
-        uint8_t value = getRegValue8H(regIndex);
-        value--;
-        setRegValue8H(regIndex, value);
-        return value;
-    }
-
-    uint16_t decRegValue16(uint32_t regIndex) {
-        uint16_t value = getRegValue16(regIndex);
-        value--;
-        setRegValue16(regIndex, value);
-        return value;
-    }
-
-    uint32_t decRegValue32(uint32_t regIndex) {
-        uint32_t value = getRegValue32(regIndex);
-        value--;
-        setRegValue32(regIndex, value);
-        return value;
-    }
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    uint64_t decRegValue64(uint32_t regIndex) {
-        uint64_t value = getRegValue64(regIndex);
-        value--;
-        setRegValue64(regIndex, value);
-        return value;
-    }
-#endif
-
-    basic_type decRegValue(uint32_t regType, uint32_t regIndex) {
-        switch (regType) {
-        case vmRegType::r8:
-            return (basic_type)decRegValue8L(regIndex);
-
-        case vmRegType::r8_high:
-            return (basic_type)decRegValue8H(regIndex);
-
-        case vmRegType::r16:
-            return (basic_type)decRegValue16(regIndex);
-
-        case vmRegType::r32:
-            return (basic_type)decRegValue32(regIndex);
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)decRegValue64(regIndex);
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            return (basic_type)-1;
-        }
-    }
-
-    basic_type decRegValue(reg_t reg) {
-        uint32_t regType  = vmReg::getType(reg);
-        uint32_t regIndex = vmReg::getIndex(reg);
-        return decRegValue(regType, regIndex);
-    }
-
-    uint8_t addRegValue8L(uint32_t regIndex1, uint32_t regIndex2) {
-        uint8_t value2 = getRegValue8L(regIndex2);
-        uint8_t value1 = getRegValue8L(regIndex1);
-        uint8_t value = value1 + value2;
-        setRegValue8L(regIndex1, value);
-        return value;
-    }
-
-    uint8_t addRegValue8H(uint32_t regIndex1, uint32_t regIndex2) {
-        uint8_t value2 = getRegValue8H(regIndex2);
-        uint8_t value1 = getRegValue8H(regIndex1);
-        uint8_t value = value1 + value2;
-        setRegValue8H(regIndex1, value);
-        return value;
-    }
-
-    uint16_t addRegValue16(uint32_t regIndex1, uint32_t regIndex2) {
-        uint16_t value2 = getRegValue16(regIndex2);
-        uint16_t value1 = getRegValue16(regIndex1);
-        uint16_t value = value1 + value2;
-        setRegValue16(regIndex1, value);
-        return value;
-    }
-
-    uint32_t addRegValue32(uint32_t regIndex1, uint32_t regIndex2) {
-        uint32_t value2 = getRegValue32(regIndex2);
-        uint32_t value1 = getRegValue32(regIndex1);
-        uint32_t value = value1 + value2;
-        setRegValue32(regIndex1, value);
-        return value;
-    }
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    uint64_t addRegValue64(uint32_t regIndex1, uint32_t regIndex2) {
-        uint64_t value2 = getRegValue64(regIndex2);
-        uint64_t value1 = getRegValue64(regIndex1);
-        uint64_t value = value1 + value2;
-        setRegValue64(regIndex1, value);
-        return value;
-    }
-#endif
-
-    basic_type addRegValue(uint32_t regType1, uint32_t regIndex1,
-                           uint32_t regType2, uint32_t regIndex2) {
-        switch (regType1) {
-        case vmRegType::r8:
-            return (basic_type)addRegValue8L(regIndex1, regIndex2);
-
-        case vmRegType::r8_high:
-            return (basic_type)addRegValue8H(regIndex1, regIndex2);
-
-        case vmRegType::r16:
-            return (basic_type)addRegValue16(regIndex1, regIndex2);
-
-        case vmRegType::r32:
-            return (basic_type)addRegValue32(regIndex1, regIndex2);
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)addRegValue64(regIndex1, regIndex2);
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            return (basic_type)0xCCCCCCCCCCCCCCCCULL;
-        }
-    }
-
-    basic_type addRegValue(reg_t reg1, reg_t reg2) {
-        uint32_t regType1  = vmReg::getType(reg1);
-        uint32_t regIndex1 = vmReg::getIndex(reg1);
-        uint32_t regType2  = vmReg::getType(reg2);
-        uint32_t regIndex2 = vmReg::getIndex(reg2);
-        return addRegValue(regType1, regIndex1, regType2, regIndex2);
-    }
-
-    uint8_t addRegValue8L_ri(uint32_t regIndex, uint8_t value) {
-        uint8_t oldValue = getRegValue8L(regIndex);
-        uint8_t newValue = oldValue + value;
-        setRegValue8L(regIndex, newValue);
-        return newValue;
-    }
-
-    uint8_t addRegValue8H_ri(uint32_t regIndex, uint8_t value) {
-        uint8_t oldValue = getRegValue8H(regIndex);
-        uint8_t newValue = oldValue + value;
-        setRegValue8H(regIndex, newValue);
-        return newValue;
-    }
-
-    uint16_t addRegValue16_ri(uint32_t regIndex, uint16_t value) {
-        uint16_t oldValue = getRegValue16(regIndex);
-        uint16_t newValue = oldValue + value;
-        setRegValue16(regIndex, newValue);
-        return newValue;
-    }
-
-    uint32_t addRegValue32_ri(uint32_t regIndex, uint32_t value) {
-        uint32_t oldValue = getRegValue32(regIndex);
-        uint32_t newValue = oldValue + value;
-        setRegValue32(regIndex, newValue);
-        return newValue;
-    }
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    uint64_t addRegValue64_ri(uint32_t regIndex, uint64_t value) {
-        uint64_t oldValue = getRegValue64(regIndex);
-        uint64_t newValue = oldValue + value;
-        setRegValue64(regIndex, newValue);
-        return newValue;
-    }
-#endif
-
-    basic_type addRegValue_ri(uint32_t regType, uint32_t regIndex,
-                              basic_type value) {
-        switch (regType) {
-        case vmRegType::r8:
-            return (basic_type)addRegValue8L_ri(regIndex, (uint8_t)value);
-
-        case vmRegType::r8_high:
-            return (basic_type)addRegValue8H_ri(regIndex, (uint8_t)value);
-
-        case vmRegType::r16:
-            return (basic_type)addRegValue16_ri(regIndex, (uint16_t)value);
-
-        case vmRegType::r32:
-            return (basic_type)addRegValue32_ri(regIndex, (uint32_t)value);
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)addRegValue64_ri(regIndex, (uint64_t)value);
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            return (basic_type)0xCCCCCCCCCCCCCCCCULL;
-        }
-    }
-
-    basic_type addRegValue_ri(reg_t reg, basic_type value) {
-        uint32_t regType  = vmReg::getType(reg);
-        uint32_t regIndex = vmReg::getIndex(reg);
-        return addRegValue_ri(regType, regIndex, value);
-    }
-
-    uint8_t subRegValue8L(uint32_t regIndex1, uint32_t regIndex2) {
-        uint8_t value2 = getRegValue8L(regIndex2);
-        uint8_t value1 = getRegValue32(regIndex1);
-        uint8_t value = value1 - value2;
-        setRegValue8L(regIndex1, value);
-        return value;
-    }
-
-    uint8_t subRegValue8H(uint32_t regIndex1, uint32_t regIndex2) {
-        uint8_t value2 = getRegValue8H(regIndex2);
-        uint8_t value1 = getRegValue32(regIndex1);
-        uint8_t value = value1 - value2;
-        setRegValue8H(regIndex1, value);
-        return value;
-    }
-
-    uint16_t subRegValue16(uint32_t regIndex1, uint32_t regIndex2) {
-        uint16_t value2 = getRegValue16(regIndex2);
-        uint16_t value1 = getRegValue32(regIndex1);
-        uint16_t value = value1 - value2;
-        setRegValue16(regIndex1, value);
-        return value;
-    }
-
-    uint32_t subRegValue32(uint32_t regIndex1, uint32_t regIndex2) {
-        uint32_t value2 = getRegValue32(regIndex2);
-        uint32_t value1 = getRegValue32(regIndex1);
-        uint32_t value = value1 - value2;
-        setRegValue32(regIndex1, value);
-        return value;
-    }
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    uint64_t subRegValue64(uint32_t regIndex1, uint32_t regIndex2) {
-        uint64_t value2 = getRegValue64(regIndex2);
-        uint64_t value1 = getRegValue64(regIndex1);
-        uint64_t value = value1 - value2;
-        setRegValue64(regIndex1, value);
-        return value;
-    }
-#endif
-
-    basic_type subRegValue(uint32_t regType1, uint32_t regIndex1,
-                           uint32_t regType2, uint32_t regIndex2) {
-        switch (regType1) {
-        case vmRegType::r8:
-            return (basic_type)subRegValue8L(regIndex1, regIndex2);
-
-        case vmRegType::r8_high:
-            return (basic_type)subRegValue8H(regIndex1, regIndex2);
-
-        case vmRegType::r16:
-            return (basic_type)subRegValue16(regIndex1, regIndex2);
-
-        case vmRegType::r32:
-            return (basic_type)subRegValue32(regIndex1, regIndex2);
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)subRegValue64(regIndex1, regIndex2);
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            return (basic_type)0xCCCCCCCCCCCCCCCCULL;
-        }
-    }
-
-    basic_type subRegValue(reg_t reg1, reg_t reg2) {
-        uint32_t regType1  = vmReg::getType(reg1);
-        uint32_t regIndex1 = vmReg::getIndex(reg1);
-        uint32_t regType2  = vmReg::getType(reg2);
-        uint32_t regIndex2 = vmReg::getIndex(reg2);
-        return subRegValue(regType1, regIndex1, regType2, regIndex2);
-    }
-
-    uint8_t subRegValue8L_ri(uint32_t regIndex, uint8_t value) {
-        uint8_t oldValue = getRegValue8L(regIndex);
-        uint8_t newValue = oldValue - value;
-        setRegValue8L(regIndex, newValue);
-        return newValue;
-    }
-
-    uint8_t subRegValue8H_ri(uint32_t regIndex, uint8_t value) {
-        uint8_t oldValue = getRegValue32(regIndex);
-        uint8_t newValue = oldValue - value;
-        setRegValue8H(regIndex, newValue);
-        return newValue;
-    }
-
-    uint16_t subRegValue16_ri(uint32_t regIndex, uint16_t value) {
-        uint16_t oldValue = getRegValue32(regIndex);
-        uint16_t newValue = oldValue - value;
-        setRegValue16(regIndex, newValue);
-        return newValue;
-    }
-
-    uint32_t subRegValue32_ri(uint32_t regIndex, uint32_t value) {
-        uint32_t oldValue = getRegValue32(regIndex);
-        uint32_t newValue = oldValue - value;
-        setRegValue32(regIndex, newValue);
-        return newValue;
-    }
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    uint64_t subRegValue64_ri(uint32_t regIndex, uint64_t value) {
-        uint64_t oldValue = getRegValue64(regIndex);
-        uint64_t newValue = oldValue - value;
-        setRegValue64(regIndex, newValue);
-        return newValue;
-    }
-#endif
-
-    basic_type subRegValue_ri(uint32_t regType, uint32_t regIndex,
-                              basic_type value) {
-        switch (regType) {
-        case vmRegType::r8:
-            return (basic_type)subRegValue8L_ri(regIndex, (uint8_t)value);
-
-        case vmRegType::r8_high:
-            return (basic_type)subRegValue8H_ri(regIndex, (uint8_t)value);
-
-        case vmRegType::r16:
-            return (basic_type)subRegValue16_ri(regIndex, (uint16_t)value);
-
-        case vmRegType::r32:
-            return (basic_type)subRegValue32_ri(regIndex, (uint32_t)value);
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)subRegValue64_ri(regIndex, (uint64_t)value);
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            return (basic_type)0xCCCCCCCCCCCCCCCCULL;
-        }
+        return regOp<vmRegOp_inc>(regType, regIndex, 0);
     }
 
-    basic_type subRegValue_ri(reg_t reg, basic_type value) {
-        uint32_t regType  = vmReg::getType(reg);
-        uint32_t regIndex = vmReg::getIndex(reg);
-        return subRegValue_ri(regType, regIndex, value);
+    basic_type incRegValue(reg_t reg) {
+        return regOp<vmRegOp_inc>(reg, 0);
     }
 
-    uint8_t mulRegValue8L(uint32_t regIndex1, uint32_t regIndex2) {
-        uint8_t value2 = getRegValue8L(regIndex2);
-        uint8_t value1 = getRegValue32(regIndex1);
-        uint8_t value = value1 * value2;
-        setRegValue8L(regIndex1, value);
-        return value;
+    basic_type decRegValue(uint32_t regType, uint32_t regIndex) {
+        return regOp<vmRegOp_dec>(regType, regIndex, 0);
     }
 
-    uint8_t mulRegValue8H(uint32_t regIndex1, uint32_t regIndex2) {
-        uint8_t value2 = getRegValue8H(regIndex2);
-        uint8_t value1 = getRegValue32(regIndex1);
-        uint8_t value = value1 * value2;
-        setRegValue8H(regIndex1, value);
-        return value;
+    basic_type decRegValue(reg_t reg) {
+        return regOp<vmRegOp_dec>(reg, 0);
     }
 
-    uint16_t mulRegValue16(uint32_t regIndex1, uint32_t regIndex2) {
-        uint16_t value2 = getRegValue16(regIndex2);
-        uint16_t value1 = getRegValue32(regIndex1);
-        uint16_t value = value1 * value2;
-        setRegValue16(regIndex1, value);
-        return value;
+    basic_type addRegValue(reg_t reg1, reg_t reg2) {
+        return regOp<vmRegOp_add>(reg1, vmReg::getIndex(reg2));
     }
 
-    uint32_t mulRegValue32(uint32_t regIndex1, uint32_t regIndex2) {
-        uint32_t value2 = getRegValue32(regIndex2);
-        uint32_t value1 = getRegValue32(regIndex1);
-        uint32_t value = value1 * value2;
-        setRegValue32(regIndex1, value);
-        return value;
+    basic_type addRegValue_ri(reg_t reg, basic_type value) {
+        return regOp<vmRegOp_add_ri>(reg, (uintptr_t)value);
     }
 
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    uint64_t mulRegValue64(uint32_t regIndex1, uint32_t regIndex2) {
-        uint64_t value2 = getRegValue64(regIndex2);
-        uint64_t value1 = getRegValue64(regIndex1);
-        uint64_t value = value1 * value2;
-        setRegValue64(regIndex1, value);
-        return value;
+    basic_type subRegValue(reg_t reg1, reg_t reg2) {
+        return regOp<vmRegOp_sub>(reg1, vmReg::getIndex(reg2));
     }
-#endif
 
-    basic_type mulRegValue(uint32_t regType1, uint32_t regIndex1,
-                           uint32_t regType2, uint32_t regIndex2) {
-        switch (regType1) {
-        case vmRegType::r8:
-            return (basic_type)mulRegValue8L(regIndex1, regIndex2);
-
-        case vmRegType::r8_high:
-            return (basic_type)mulRegValue8H(regIndex1, regIndex2);
+    basic_type subRegValue_ri(reg_t reg, basic_type value) {
+        return regOp<vmRegOp_sub_ri>(reg, (uintptr_t)value);
+    }
 
-        case vmRegType::r16:
-            return (basic_type)mulRegValue16(regIndex1, regIndex2);
+    basic_type mulRegValue(reg_t reg1, reg_t reg2) {
+        return regOp<vmRegOp_mul>(reg1, vmReg::getIndex(reg2));
+    }
 
-        case vmRegType::r32:
-            return (basic_type)mulRegValue32(regIndex1, regIndex2);
+    basic_type mulRegValue_ri(reg_t reg, basic_type value) {
+        return regOp<vmRegOp_mul_ri>(reg, (uintptr_t)value);
+    }
 
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmRegType::r64:
-            return (basic_type)mulRegValue64(regIndex1, regIndex2);
-#endif
-        default:
-            // Do nothing !!
-            assert(false);
-            return (basic_type)0xCCCCCCCCCCCCCCCCULL;
-        }
+    const vmSymbolTable * getSymbolTable() const { return symbols_; }
+    void setSymbolTable(const vmSymbolTable * symbols) {
+        symbols_ = symbols;
     }
 
-    basic_type mulRegValue(reg_t reg1, reg_t reg2) {
-        uint32_t regType1  = vmReg::getType(reg1);
-        uint32_t regIndex1 = vmReg::getIndex(reg1);
-        uint32_t regType2  = vmReg::getType(reg2);
-        uint32_t regIndex2 = vmReg::getIndex(reg2);
-        return mulRegValue(regType1, regIndex1, regType2, regIndex2);
+#if !USE_VMSTACK_CALLSTACK
+    const vmCallStack & getCallStack() const { return callStack_; }
+
+    void backtrace(std::string & trace) const {
+        callStack_.backtrace(trace, fp_start_, symbols_);
     }
+#endif
 
-    void pushCallStack(unsigned char * returnFP) {
+    //
+    // Returns false if the call stack is full, the call isn't made then
+    // and the run stops with Stack_Overflow.
+    //
+    bool pushCallStack(unsigned char * callFP, unsigned char * returnFP) {
 #if USE_VMSTACK_CALLSTACK
+        (void)callFP;
         assert(stack_ != nullptr);
         stack_->push_callstack(returnFP);
+        return true;
 #else
-        callStack_.push(nullptr, returnFP);
+        unsigned char * frame = (stack_ != nullptr) ? stack_->current() : nullptr;
+        bool pushed = callStack_.push(callFP, returnFP, frame);
+        if (!pushed) {
+            std::string trace;
+            callStack_.backtrace(trace, fp_start_, symbols_, 16);
+            console.trace("Error: vmCallStack overflow, depth = %u\n%s",
+                          (uint32_t)callStack_.size(), trace.c_str());
+        }
+        return pushed;
 #endif
     }
 
@@ -2186,32 +1833,37 @@ public:
 #endif
     }
 
-    void callShort(unsigned char * callFP, size_t offset,
+    bool callShort(unsigned char * callFP, size_t offset,
                    int16_t callOffset) {
         unsigned char * returnFP = callFP + offset;
-        pushCallStack(returnFP);
+        if (!pushCallStack(callFP, returnFP))
+            return false;
 
         unsigned char * newFP = callFP + callOffset;
         // Call entry address must be align for 16 bytes.
         assert(CHECK_ADDR_ALIGNMENT(newFP));
         setFP(newFP);
+        return true;
     }
 
-    void callLong(unsigned char * callFP, size_t offset,
+    bool callLong(unsigned char * callFP, size_t offset,
                   int32_t callOffset) {
         unsigned char * returnFP = callFP + offset;
-        pushCallStack(returnFP);
+        if (!pushCallStack(callFP, returnFP))
+            return false;
 
         unsigned char * newFP = callFP + callOffset;
         // Call entry address must be align for 16 bytes.
         assert(CHECK_ADDR_ALIGNMENT(newFP));
         setFP(newFP);
+        return true;
     }
 
-    void callPtr32(unsigned char * callFP, size_t offset,
+    bool callPtr32(unsigned char * callFP, size_t offset,
                    uint32_t callEntry) {
         unsigned char * returnFP = callFP + offset;
-        pushCallStack(returnFP);
+        if (!pushCallStack(callFP, returnFP))
+            return false;
 
 #if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
  || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
@@ -2222,19 +1874,22 @@ public:
         // Call entry address must be align for 16 bytes.
         assert(CHECK_ADDR_ALIGNMENT(newFP));
         setFP(newFP);
+        return true;
     }
 
 #if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
  || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-    void callPtr64(unsigned char * callFP, size_t offset,
+    bool callPtr64(unsigned char * callFP, size_t offset,
                    uint64_t callEntry) {
         unsigned char * returnFP = callFP + offset;
-        pushCallStack(returnFP);
+        if (!pushCallStack(callFP, returnFP))
+            return false;
 
         void * newFP = (void *)callEntry;
         // Call entry address must be align for 16 bytes.
         assert(CHECK_ADDR_ALIGNMENT(newFP));
         setFP(newFP);
+        return true;
     }
 #endif
 
@@ -2277,203 +1932,30 @@ public:
     }
 #endif
 
-    template <typename DataType>
-    static bool getCondition(DataType v1, DataType v2, uint8_t condType) {
-        switch (condType) {
-        case OpCode::jz:
-            return (v1 == 0 && v2 == 0);
-
-        case OpCode::jnz:
-            return (v1 != 0 && v2 != 0);
-
-        case OpCode::je:
-            return (v1 == v2);
-
-        case OpCode::jne:
-            return (v1 != v2);
-
-        case OpCode::jl:
-            return (v1 < v2);
-
-        case OpCode::jle:
-            return (v1 <= v2);
-
-        case OpCode::jg:
-            return (v1 > v2);
-
-        case OpCode::jge:
-            return (v1 >= v2);
-
-        default:
-            console.trace("Error: Unknown condition jump code. condType = %u\n",
-                          (uint32_t)condType);
-            return false;
-        }
-    }
-
     bool condCmp_rr(reg_t reg1, reg_t reg2,
                     uint32_t dataType, uint8_t condType) {
-        uint32_t regIndex1 = vmReg::getIndex(reg1);
-        uint32_t regIndex2 = vmReg::getIndex(reg2);
-        switch (dataType) {
-        case vmDataType::Int8:
-            {
-                int8_t v1 = regs_[regIndex1].ax.i8.low;
-                int8_t v2 = regs_[regIndex2].ax.i8.low;
-                return vmFrame::getCondition<int8_t>(v1, v2, condType);
-            }
-
-        case vmDataType::UInt8:
-            {
-                uint8_t v1 = regs_[regIndex1].ax.u8.low;
-                uint8_t v2 = regs_[regIndex2].ax.u8.low;
-                return vmFrame::getCondition<uint8_t>(v1, v2, condType);
-            }
-
-        case vmDataType::Int16:
-            {
-                int16_t v1 = regs_[regIndex1].ax.i16;
-                int16_t v2 = regs_[regIndex2].ax.i16;
-                return vmFrame::getCondition<int16_t>(v1, v2, condType);
-            }
-
-        case vmDataType::UInt16:
-            {
-                uint16_t v1 = regs_[regIndex1].ax.u16;
-                uint16_t v2 = regs_[regIndex2].ax.u16;
-                return vmFrame::getCondition<uint16_t>(v1, v2, condType);
-            }
-
-        case vmDataType::Int32:
-            {
-                int32_t v1 = regs_[regIndex1].eax.i32;
-                int32_t v2 = regs_[regIndex2].eax.i32;
-                return vmFrame::getCondition<int32_t>(v1, v2, condType);
-            }
-
-        case vmDataType::UInt32:
-            {
-                uint32_t v1 = regs_[regIndex1].eax.u32;
-                uint32_t v2 = regs_[regIndex2].eax.u32;
-                return vmFrame::getCondition<uint32_t>(v1, v2, condType);
-            }
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmDataType::Int64:
-            {
-                int64_t v1 = regs_[regIndex1].rax.i64;
-                int64_t v2 = regs_[regIndex2].rax.i64;
-                return vmFrame::getCondition<int64_t>(v1, v2, condType);
-            }
-
-        case vmDataType::UInt64:
-            {
-                uint64_t v1 = regs_[regIndex1].rax.u64;
-                uint64_t v2 = regs_[regIndex2].rax.u64;
-                return vmFrame::getCondition<uint64_t>(v1, v2, condType);
-            }
-#endif
-
-        case vmDataType::Pointer:
-            {
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-                void * v1 = (void *)regs_[regIndex1].rax.u64;
-                void * v2 = (void *)regs_[regIndex2].rax.u64;
-                return vmFrame::getCondition<void *>(v1, v2, condType);
-#else
-                void * v1 = (void *)regs_[regIndex1].eax.u32;
-                void * v2 = (void *)regs_[regIndex2].eax.u32;
-                return vmFrame::getCondition<void *>(v1, v2, condType);
-#endif
-            }
-
-        default:
-            assert(false);
+        uint32_t cond = vmCondOp::fromOpCode(condType);
+        if (cond == vmCondType::last) {
+            console.trace("Error: Unknown condition jump code. condType = %u\n",
+                          (uint32_t)condType);
             return false;
         }
+        uint32_t index = vmCondOp::make(cond, dataType);
+        return vmCondTable<vmRegOperand::Reg>::handlers[index](&regs_[0], vmReg::getIndex(reg1),
+                                                               vmReg::getIndex(reg2));
     }
 
     bool condCmp_ri(reg_t reg, basic_type immValue,
                     uint32_t dataType, uint8_t condType) {
-        uint32_t regIndex = vmReg::getIndex(reg);
-        switch (dataType) {
-        case vmDataType::Int8:
-            {
-                int8_t v1 = regs_[regIndex].ax.i8.low;
-                int8_t v2 = (int8_t)immValue;
-                return vmFrame::getCondition<int8_t>(v1, v2, condType);
-            }
-
-        case vmDataType::UInt8:
-            {
-                uint8_t v1 = regs_[regIndex].ax.u8.low;
-                uint8_t v2 = (uint8_t)immValue;
-                return vmFrame::getCondition<uint8_t>(v1, v2, condType);
-            }
-
-        case vmDataType::Int16:
-            {
-                int16_t v1 = regs_[regIndex].ax.i16;
-                int16_t v2 = (int16_t)immValue;
-                return vmFrame::getCondition<int16_t>(v1, v2, condType);
-            }
-
-        case vmDataType::UInt16:
-            {
-                uint16_t v1 = regs_[regIndex].ax.u16;
-                uint16_t v2 = (uint16_t)immValue;
-                return vmFrame::getCondition<uint16_t>(v1, v2, condType);
-            }
-
-        case vmDataType::Int32:
-            {
-                int32_t v1 = regs_[regIndex].eax.i32;
-                int32_t v2 = (int32_t)immValue;
-                return vmFrame::getCondition<int32_t>(v1, v2, condType);
-            }
-
-        case vmDataType::UInt32:
-            {
-                uint32_t v1 = regs_[regIndex].eax.u32;
-                uint32_t v2 = (uint32_t)immValue;
-                return vmFrame::getCondition<uint32_t>(v1, v2, condType);
-            }
-
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-        case vmDataType::Int64:
-            {
-                int64_t v1 = regs_[regIndex].rax.i64;
-                int64_t v2 = (int64_t)immValue;
-                return vmFrame::getCondition<int64_t>(v1, v2, condType);
-            }
-
-        case vmDataType::UInt64:
-            {
-                uint64_t v1 = regs_[regIndex].rax.u64;
-                uint64_t v2 = (uint64_t)immValue;
-                return vmFrame::getCondition<uint64_t>(v1, v2, condType);
-            }
-#endif
-        case vmDataType::Pointer:
-            {
-#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
- || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
-                void * v1 = (void *)regs_[regIndex].rax.u64;
-                void * v2 = (void *)immValue;
-                return vmFrame::getCondition<void *>(v1, v2, condType);
-#else
-                void * v1 = (void *)regs_[regIndex].eax.u32;
-                void * v2 = (void *)immValue;
-                return vmFrame::getCondition<void *>(v1, v2, condType);
-#endif
-            }
-        default:
-            assert(false);
+        uint32_t cond = vmCondOp::fromOpCode(condType);
+        if (cond == vmCondType::last) {
+            console.trace("Error: Unknown condition jump code. condType = %u\n",
+                          (uint32_t)condType);
             return false;
         }
+        uint32_t index = vmCondOp::make(cond, dataType);
+        return vmCondTable<vmRegOperand::Imm>::handlers[index](&regs_[0], vmReg::getIndex(reg),
+                                                               (uintptr_t)immValue);
     }
 
     bool condCmp_ra(uint32_t regIndex, void * address,
@@ -2495,6 +1977,12 @@ public:
     }
 };
 
+//
+// The stack is mapped, not allocated: the pages are committed when they
+// are first touched, and there is a guard region at the end it grows to,
+// so an overflow faults instead of writing past it (see StackGuard.h).
+// On Windows it's an aligned allocation, without a guard.
+//
 template <typename BasicType, bool IsBackwardPtr = false>
 class vmStack {
 public:
@@ -2502,17 +1990,22 @@ public:
     typedef size_t              size_type;
     typedef vmFrame<basic_type> frame_type;
 
+    // Larger than any frame vmVerifier accepts, so a push can't step over it.
+    static const size_type kGuardSize = 64 * 1024U;
+
 private:
     unsigned char * sp_;
     unsigned char * sp_first_;
     unsigned char * sp_last_;
     frame_type *    frame_;
     size_type       capacity_;
+    unsigned char * map_;
+    size_type       mapSize_;
 
 public:
     vmStack(frame_type * frame = nullptr, size_type capacity = 0)
         : sp_(nullptr), sp_first_(nullptr), sp_last_(nullptr),
-          frame_(frame), capacity_(capacity) {
+          frame_(frame), capacity_(capacity), map_(nullptr), mapSize_(0) {
     }
     ~vmStack() {
         destroy();
@@ -2574,22 +2067,51 @@ public:
     unsigned char * first() const { return sp_first_; }
     unsigned char * last() const { return sp_last_; }
 
-    inline void create(size_type capacity) {
+    // The guard region, an overflow faults in it.
+    bool hasGuard() const { return (map_ != nullptr); }
+    unsigned char * guard() const {
+        if (isBackwardPtr())
+            return map_;
+        else
+            return sp_last_;
+    }
+
+    //
+    // With hugePages the kernel is asked to back the stack with huge
+    // pages (transparent huge pages, where it has them).
+    //
+    inline void create(size_type capacity, bool hugePages = false) {
+        release();
 #if defined(_WIN32)
-        if (sp_first_) {
-            _aligned_free(sp_first_);
-        }
+        (void)hugePages;
         sp_first_ = (unsigned char *)_aligned_malloc(capacity, 64);
-#else
-        if (sp_first_) {
-            free(sp_first_);
-        }
-        int ret = posix_memalign((void **)&sp_first_, 64, capacity);
-#endif // _WIN32
-
+        if (sp_first_ == nullptr)
+            return;
 #ifndef NDEBUG
         memset((void *)sp_first_, 0, sizeof(char) * capacity);
 #endif
+#else
+        size_type pageSize = (size_type)::sysconf(_SC_PAGESIZE);
+        capacity = (capacity + pageSize - 1) & ~(pageSize - 1);
+        // The whole range is reserved, only the stack is accessible.
+        void * map = ::mmap(nullptr, capacity + kGuardSize, PROT_NONE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED)
+            return;
+        map_ = (unsigned char *)map;
+        mapSize_ = capacity + kGuardSize;
+        sp_first_ = isBackwardPtr() ? (map_ + kGuardSize) : map_;
+        if (::mprotect(sp_first_, capacity, PROT_READ | PROT_WRITE) != 0) {
+            release();
+            return;
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugePages)
+            ::madvise(sp_first_, capacity, MADV_HUGEPAGE);
+#else
+        (void)hugePages;
+#endif
+#endif // _WIN32
         sp_last_ = sp_first_ + capacity;
         if (isBackwardPtr())
             sp_ = sp_last_ - sizeof(basic_type);
@@ -2599,20 +2121,39 @@ public:
     }
 
     inline void destroy() {
-        sp_ = nullptr;
+        release();
+        frame_ = nullptr;
+    }
+
+    //
+    // Empty the stack, its pages stay committed for the next run.
+    //
+    void reset() {
+        if (isBackwardPtr())
+            sp_ = sp_last_ - sizeof(basic_type);
+        else
+            sp_ = sp_first_;
+    }
+
+private:
+    void release() {
         if (sp_first_) {
 #if defined(_WIN32)
             _aligned_free(sp_first_);
 #else
-            free(sp_first_);
+            ::munmap(map_, mapSize_);
 #endif
-            sp_first_ = nullptr;
         }
+        sp_ = nullptr;
+        sp_first_ = nullptr;
         sp_last_ = nullptr;
-        frame_ = nullptr;
+        map_ = nullptr;
+        mapSize_ = 0;
         capacity_ = 0;
     }
 
+public:
+
     void back() {
         this->sp_ -= direction() * 1;
     }
@@ -2960,15 +2501,369 @@ public:
     }
 };
 
+struct vmHeapStats {
+    uint64_t    allocs;
+    uint64_t    frees;
+    uint64_t    largeAllocs;
+    uint64_t    failedAllocs;
+    // The frees of a freed or a not allocated reference.
+    uint64_t    badFrees;
+    // The bytes of the live blocks, with their headers.
+    size_t      liveBytes;
+    size_t      peakBytes;
+    size_t      arenaBytes;
+    size_t      largeBytes;
+    size_t      committedBytes;
+    size_t      reservedBytes;
+};
+
+//
+// The guest heap of an execution context.
+//
+// The heap is one reserved range of address space, a guest reference is
+// the offset of an object in it, so it fits in a 32-bit slot; 0 is null.
+// The small objects are cut from 64 KB arenas with a bump pointer, and a
+// freed one goes to the free list of its size class (16 bytes apart).
+// The large objects get a run of pages of their own, the freed runs are
+// reused first fit. The range is only committed as the arenas and the
+// runs reach into it, the range isn't reserved before the first alloc().
+//
+// Each block starts with an 8-byte header: its size class (or large) and
+// its size. It's only used by one thread at a time, as its context.
+//
 template <typename BasicType>
 class vmHeap {
 public:
     typedef BasicType   basic_type;
     typedef size_t      size_type;
 
+    static const size_type kGranule = 16;
+    static const uint32_t  kGranuleShift = 4;
+    static const size_type kHeaderSize = 8;
+    static const uint32_t  kSmallClasses = 64;
+    // The largest small object, its block is 1 KB.
+    static const uint32_t  kMaxSmallSize = kSmallClasses * kGranule - kHeaderSize;
+    static const size_type kArenaSize = 64 * 1024U;
+    static const size_type kPageSize = 4096;
+    // The freed runs of at least this size are given back to the OS.
+    static const size_type kPurgeSize = 64 * 1024U;
+#if defined(_WIN64) || defined(__x86_64__) || defined(__aarch64__) || defined(__LP64__)
+    static const size_type kDefaultReserveSize = 1024 * 1048576U;
+#else
+    static const size_type kDefaultReserveSize = 64 * 1048576U;
+#endif
+
+    static const uint32_t  kLargeClass = 0x7FFFFFFFU;
+    static const uint32_t  kFreeBit = 0x80000000U;
+
+private:
+    struct Header {
+        uint32_t    tag;    // The size class, or kLargeClass; kFreeBit when freed
+        uint32_t    size;   // The size of the block
+    };
+
+    struct Run {
+        size_type   offset;
+        size_type   size;
+    };
+
+    unsigned char *     cur_;
+    unsigned char *     end_;
+    unsigned char *     freeLists_[kSmallClasses + 1];
+    unsigned char *     base_;
+    size_type           top_;
+    size_type           committed_;
+    size_type           reserveSize_;
+    std::vector<Run>    freeRuns_;
+    vmHeapStats         stats_;
+
 public:
-    vmHeap() {}
-    ~vmHeap() {}
+    vmHeap(size_type reserveSize = kDefaultReserveSize)
+        : cur_(nullptr), end_(nullptr), base_(nullptr), top_(0), committed_(0),
+          reserveSize_(reserveSize) {
+        memset((void *)freeLists_, 0, sizeof(freeLists_));
+        memset((void *)&stats_, 0, sizeof(stats_));
+    }
+    ~vmHeap() {
+        destroy();
+    }
+
+    bool isInited() const { return (base_ != nullptr); }
+
+    // The peak is only taken at a free, so the live bytes now count too.
+    vmHeapStats getStats() const {
+        vmHeapStats stats = stats_;
+        if (stats.liveBytes > stats.peakBytes)
+            stats.peakBytes = stats.liveBytes;
+        return stats;
+    }
+
+    // It takes effect the next time the range is reserved.
+    void setReserveSize(size_type reserveSize) {
+        reserveSize_ = reserveSize;
+    }
+
+    //
+    // Allocate an object of the size, return its reference, or 0 if the
+    // heap is full.
+    //
+    JM_FORCEINLINE uint32_t alloc(uint32_t size) {
+        if (likely(size <= kMaxSmallSize)) {
+            uint32_t sizeClass = (uint32_t)((size + kHeaderSize + kGranule - 1) >> kGranuleShift);
+            uint32_t blockSize = sizeClass << kGranuleShift;
+            unsigned char * block = freeLists_[sizeClass];
+            if (block != nullptr) {
+                freeLists_[sizeClass] = *(unsigned char **)(block + kHeaderSize);
+                ((Header *)block)->tag = sizeClass;
+            }
+            else if (likely((size_type)(end_ - cur_) >= blockSize)) {
+                block = cur_;
+                cur_ += blockSize;
+                ((Header *)block)->tag = sizeClass;
+                ((Header *)block)->size = blockSize;
+            }
+            else {
+                return allocSmallSlow(sizeClass);
+            }
+            stats_.allocs++;
+            stats_.liveBytes += blockSize;
+            return (uint32_t)(block + kHeaderSize - base_);
+        }
+        return allocLarge(size);
+    }
+
+    //
+    // Free the object of the reference, a null reference is ignored.
+    // Return false if it isn't an object that's allocated.
+    //
+    JM_FORCEINLINE bool free(uint32_t ref) {
+        Header * header = headerOf(ref);
+        if (likely(header != nullptr)) {
+            uint32_t sizeClass = header->tag;
+            if (likely(sizeClass - 1 < kSmallClasses)) {
+                unsigned char * block = (unsigned char *)header;
+                *(unsigned char **)(block + kHeaderSize) = freeLists_[sizeClass];
+                freeLists_[sizeClass] = block;
+                header->tag = sizeClass | kFreeBit;
+                stats_.frees++;
+                if (stats_.liveBytes > stats_.peakBytes)
+                    stats_.peakBytes = stats_.liveBytes;
+                stats_.liveBytes -= header->size;
+                return true;
+            }
+            return freeLarge(header);
+        }
+        if (ref != 0)
+            stats_.badFrees++;
+        return (ref == 0);
+    }
+
+    //
+    // The host address of the object, nullptr if the reference is out of
+    // the heap.
+    //
+    void * ptr(uint32_t ref) const {
+        return ((headerOf(ref) != nullptr) ? (void *)(base_ + ref) : nullptr);
+    }
+
+    //
+    // The usable size of the object, 0 if it isn't allocated.
+    //
+    size_type sizeOf(uint32_t ref) const {
+        const Header * header = headerOf(ref);
+        if (header == nullptr || (header->tag & kFreeBit) != 0)
+            return 0;
+        return (header->size - kHeaderSize);
+    }
+
+    // The host address of the reference 0, the references are offsets from it.
+    unsigned char * getBase() const { return base_; }
+
+    // The references below it may be in use.
+    size_type getTop() const { return top_; }
+
+    // The bytes that can still be taken from the range, the free lists aside.
+    size_type getHeadroom() const {
+        return ((base_ != nullptr) ? (reserveSize_ - top_) : reserveSize_);
+    }
+
+    //
+    // Free every object at once, the committed pages are kept for the
+    // next run.
+    //
+    void reset() {
+#if defined(_WIN32)
+        // The purged runs were decommitted.
+        if (base_ != nullptr && committed_ != 0)
+            ::VirtualAlloc(base_, committed_, MEM_COMMIT, PAGE_READWRITE);
+#endif
+        cur_ = end_ = nullptr;
+        memset((void *)freeLists_, 0, sizeof(freeLists_));
+        freeRuns_.clear();
+        top_ = 0;
+        size_type committed = stats_.committedBytes;
+        size_type reserved = stats_.reservedBytes;
+        memset((void *)&stats_, 0, sizeof(stats_));
+        stats_.committedBytes = committed;
+        stats_.reservedBytes = reserved;
+    }
+
+    void destroy() {
+        if (base_ != nullptr) {
+#if defined(_WIN32)
+            ::VirtualFree(base_, 0, MEM_RELEASE);
+#else
+            ::munmap(base_, reserveSize_);
+#endif
+            base_ = nullptr;
+        }
+        committed_ = 0;
+        reset();
+        stats_.committedBytes = 0;
+        stats_.reservedBytes = 0;
+    }
+
+private:
+    //
+    // The header of an allocated or freed block, nullptr if the reference
+    // can't be one's.
+    //
+    JM_FORCEINLINE Header * headerOf(uint32_t ref) const {
+        if (likely((ref & (kGranule - 1)) == kHeaderSize && ref < top_))
+            return (Header *)(base_ + ref - kHeaderSize);
+        return nullptr;
+    }
+
+    bool reserve() {
+        if (reserveSize_ > ((size_type)1 << 32))
+            reserveSize_ = ((size_type)1 << 32);
+        reserveSize_ &= ~(kArenaSize - 1);
+#if defined(_WIN32)
+        void * base = ::VirtualAlloc(nullptr, reserveSize_, MEM_RESERVE, PAGE_NOACCESS);
+        if (base == nullptr)
+            return false;
+#else
+        void * base = ::mmap(nullptr, reserveSize_, PROT_NONE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (base == MAP_FAILED)
+            return false;
+#endif
+        base_ = (unsigned char *)base;
+        stats_.reservedBytes = reserveSize_;
+        return true;
+    }
+
+    //
+    // Take the size (pages) from the top of the range, commit them if
+    // they're not yet, return the offset or -1.
+    //
+    intptr_t grow(size_type size) {
+        if (base_ == nullptr && !reserve())
+            return -1;
+        if (size > reserveSize_ - top_)
+            return -1;
+        size_type offset = top_;
+        if (top_ + size > committed_) {
+            size_type commitSize = (top_ + size - committed_ + kArenaSize - 1) & ~(kArenaSize - 1);
+            if (commitSize > reserveSize_ - committed_)
+                commitSize = reserveSize_ - committed_;
+#if defined(_WIN32)
+            if (::VirtualAlloc(base_ + committed_, commitSize, MEM_COMMIT, PAGE_READWRITE) == nullptr)
+                return -1;
+#else
+            if (::mprotect(base_ + committed_, commitSize, PROT_READ | PROT_WRITE) != 0)
+                return -1;
+#endif
+            committed_ += commitSize;
+            stats_.committedBytes = committed_;
+        }
+        top_ += size;
+        return (intptr_t)offset;
+    }
+
+    //
+    // A new arena, the rest of the old one is left unused.
+    //
+    JM_NOINLINE uint32_t allocSmallSlow(uint32_t sizeClass) {
+        intptr_t offset = grow(kArenaSize);
+        if (offset < 0) {
+            stats_.failedAllocs++;
+            return 0;
+        }
+        cur_ = base_ + offset;
+        end_ = cur_ + kArenaSize;
+        stats_.arenaBytes += kArenaSize;
+        return alloc((sizeClass << kGranuleShift) - (uint32_t)kHeaderSize);
+    }
+
+    JM_NOINLINE uint32_t allocLarge(uint32_t size) {
+        size_type runSize = ((size_type)size + kHeaderSize + kPageSize - 1) & ~(kPageSize - 1);
+        intptr_t offset = -1;
+        for (size_t i = 0; i < freeRuns_.size(); i++) {
+            Run & run = freeRuns_[i];
+            if (run.size >= runSize) {
+                offset = (intptr_t)run.offset;
+#if defined(_WIN32)
+                ::VirtualAlloc(base_ + offset, runSize, MEM_COMMIT, PAGE_READWRITE);
+#endif
+                if (run.size == runSize) {
+                    freeRuns_[i] = freeRuns_.back();
+                    freeRuns_.pop_back();
+                }
+                else {
+                    run.offset += runSize;
+                    run.size -= runSize;
+                }
+                break;
+            }
+        }
+        if (offset < 0) {
+            offset = grow(runSize);
+            if (offset < 0) {
+                stats_.failedAllocs++;
+                return 0;
+            }
+        }
+
+        Header * header = (Header *)(base_ + offset);
+        header->tag = kLargeClass;
+        header->size = (uint32_t)runSize;
+        stats_.allocs++;
+        stats_.largeAllocs++;
+        stats_.largeBytes += runSize;
+        stats_.liveBytes += runSize;
+        return (uint32_t)(offset + kHeaderSize);
+    }
+
+    JM_NOINLINE bool freeLarge(Header * header) {
+        size_type offset = (size_type)((unsigned char *)header - base_);
+        size_type runSize = header->size;
+        if (header->tag != kLargeClass || (offset & (kPageSize - 1)) != 0 ||
+            (runSize & (kPageSize - 1)) != 0 || runSize > top_ - offset) {
+            // A freed block, or the middle of an object.
+            stats_.badFrees++;
+            return false;
+        }
+        header->tag = kLargeClass | kFreeBit;
+        if (runSize >= kPurgeSize) {
+            // The header page is kept, it tells a second free.
+#if defined(_WIN32)
+            ::VirtualFree(base_ + offset + kPageSize, runSize - kPageSize, MEM_DECOMMIT);
+#else
+            ::madvise(base_ + offset + kPageSize, runSize - kPageSize, MADV_DONTNEED);
+#endif
+        }
+        Run run;
+        run.offset = offset;
+        run.size = runSize;
+        freeRuns_.push_back(run);
+        stats_.frees++;
+        if (stats_.liveBytes > stats_.peakBytes)
+            stats_.peakBytes = stats_.liveBytes;
+        stats_.largeBytes -= runSize;
+        stats_.liveBytes -= runSize;
+        return true;
+    }
 };
 
 template <typename BasicType = uintptr_t>
@@ -423,6 +423,7 @@ public:
     }
 
     int run(return_type & retValue) {
+        int ec = 0;
         assert(isInited());
         if (frame_.isInited() && stack_.isInited()) {
             // Call program entry.
@@ -807,7 +808,8 @@ JMP_START:
                             {
                                 // Get 16 byte (-32768 -- 32767) address offset.
                                 int16_t callOffset = frame_.getInt16();
-                                frame_.callShort(call_fp, 2 + sizeof(int16_t), callOffset);
+                                if (!frame_.callShort(call_fp, 2 + sizeof(int16_t), callOffset))
+                                    goto Call_Overflow;
                                 console.trace("%08X:  call 0x%08X (short)",
                                               offset, frame_.getFPOffset());
                                 break;
@@ -816,7 +818,8 @@ JMP_START:
                             {
                                 // Get 32 byte (-2147483648 -- 2147483647) address offset.
                                 int32_t callOffset = frame_.getInt32();
-                                frame_.callLong(call_fp, 2 + sizeof(int32_t), callOffset);
+                                if (!frame_.callLong(call_fp, 2 + sizeof(int32_t), callOffset))
+                                    goto Call_Overflow;
                                 console.trace("%08X:  call 0x%08X (long)",
                                               offset, frame_.getFPOffset());
                                 break;
@@ -825,7 +828,8 @@ JMP_START:
                             {
                                 // Get 32 byte absolute address.
                                 uint32_t callEntry = frame_.getUInt32();
-                                frame_.callPtr32(call_fp, 2 + sizeof(uint32_t), callEntry);
+                                if (!frame_.callPtr32(call_fp, 2 + sizeof(uint32_t), callEntry))
+                                    goto Call_Overflow;
                                 console.trace("%08X:  call 0x%08X (Ptr32)",
                                               offset, frame_.getFPOffset());
                                 break;
@@ -836,7 +840,8 @@ JMP_START:
                             {
                                 // Get 64 byte absolute address.
                                 uint64_t callEntry = frame_.getUInt64();
-                                frame_.callPtr64(call_fp, 2 + sizeof(uint64_t), callEntry);
+                                if (!frame_.callPtr64(call_fp, 2 + sizeof(uint64_t), callEntry))
+                                    goto Call_Overflow;
                                 console.trace("%08X:  call 0x%08X (Ptr64)",
                                               offset, frame_.getFPOffset());
                                 break;
@@ -1056,11 +1061,17 @@ JMP_START:
                     break;
                 }
             }
+            goto Execute_Finished;
+
+Call_Overflow:
+            // The call stack is full (see vmFrame::pushCallStack()).
+            ec = Error::Stack_Overflow;
+
 Execute_Finished:
             (void *)(0);
         }
 
-        return 0;
+        return ec;
     }
 };
 
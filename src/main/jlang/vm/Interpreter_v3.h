@@ -26,6 +26,7 @@
 #include "jlang/vm/ArgsDefine.h"
 #include "jlang/vm/Interpreter.h"
 #include "jlang/lang/Error.h"
+#include "jlang/vm/TracePolicy.h"
 #include "jlang/support/Console.h"
 
 #include <stdint.h>
@@ -46,9 +47,9 @@ namespace v3 {
 // 00000001:    push_u32 0x00000014 (int32)
 // 00000006:    call 0x00000010 (short offset 0x0008)
 // 00000009:    pop_u32
-// 0000000A:    ret
+// 0000000A:    ret_n_sm 4  (pop the local of add_sp_4)
 
-// 0000000B:    nop; nop; nop; nop; nop;
+// 0000000C:    nop; nop; nop; nop;
 
 // 00000010:    cmp_imm_u32 arg0, 0x00000003
 // 00000016:    jl_short 0x00000030 (short offset 0x0017)
@@ -79,11 +80,11 @@ static const unsigned char fibonacciBinary32[] = {
     OpCode::call_short, 0x07, 0x00,
     // 00000009:    pop_u32
     OpCode::pop_u32,
-    // 0000000A:    ret
-    OpCode::ret,
+    // 0000000A:    ret_n_sm 4  (pop the local of add_sp_4)
+    OpCode::ret_n_sm, 0x04,
 
-    // 0000000B:    nop; nop;
-    OpCode::nop,  OpCode::nop,
+    // 0000000C:    nop;
+    OpCode::nop,
     // 0000000D:    nop; nop; nop;
     OpCode::nop,  OpCode::nop, OpCode::nop,
 
@@ -138,11 +139,11 @@ static const unsigned char fibonacciBinary32_fast[] = {
     OpCode::call_short, 0x07, 0x00,
     // 00000009:    pop_u32
     OpCode::pop_u32,
-    // 0000000A:    ret
-    OpCode::ret,
+    // 0000000A:    ret_n_sm 4  (pop the local of add_sp_4)
+    OpCode::ret_n_sm, 0x04,
 
-    // 0000000B:    nop; nop;
-    OpCode::nop,  OpCode::nop,
+    // 0000000C:    nop;
+    OpCode::nop,
     // 0000000D:    nop; nop; nop;
     OpCode::nop,  OpCode::nop, OpCode::nop,
 
@@ -928,20 +929,21 @@ struct vmContextRegs {
     }
 };
 
-template <typename BasicType>
+template <typename BasicType, typename TracePolicy>
 class ExecutionEngine;
 
-template <typename BasicType = uintptr_t>
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
 class ExecutionContext : public IExecutionContext<BasicType>,
                          public vmContextRegs {
 public:
-    typedef BasicType                       basic_type;
-    typedef IExecutionContext<basic_type>   base_type;
-    typedef size_t                          size_type;
-    typedef ExecutionEngine<basic_type>     engine_type;
-    typedef vmReturn<basic_type>            return_type;
-    typedef vmContextRegs                   ctx_reg_type;
-    typedef ExecutionContext<basic_type>    this_type;
+    typedef BasicType                                   basic_type;
+    typedef IExecutionContext<basic_type>               base_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionEngine<basic_type, trace_policy>   engine_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef vmContextRegs                               ctx_reg_type;
+    typedef ExecutionContext<basic_type, trace_policy>  this_type;
 
     static const size_type kDefaultStackSize = 8 * 1048576U;
 
@@ -1008,6 +1010,11 @@ public:
         return (uint32_t)(ptrdiff_t)(ip.ptr() - image_.getStart());
     }
 
+    // The offset of ip in a trace line, it's not computed when nothing is traced.
+    JM_FORCEINLINE uint32_t getTraceOffset(vmImagePtr & ip) {
+        return (trace_policy::kEnabled ? getIpOffset(ip) : 0);
+    }
+
     bool sp_isOverflow(vmStackPtr & sp) const {
         if (stack_.isBackwardPtr())
             return (sp.ptr() <= stack_.first());
@@ -1142,7 +1149,7 @@ public:
     // error inst.
     //
     JM_FORCEINLINE void op_error(vmImagePtr & ip) {
-        console.trace("%08X:  error", getIpOffset(ip));
+        VM_TRACE("%08X:  error", getIpOffset(ip));
         ip.next();
     }
 
@@ -1154,8 +1161,8 @@ public:
         int32_t value = fp.getArgValueUInt32(index);
         sp.writeInt32(value);
 
-        console.trace("%08X:  push args[%d]  (0x%08X, int32)",
-                      getIpOffset(ip), getArgIndex(index), value);
+        VM_TRACE("%08X:  push args[%d]  (0x%08X, int32)",
+                 getIpOffset(ip), getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -1165,7 +1172,7 @@ public:
     JM_FORCEINLINE void op_push_i32(vmImagePtr & ip, vmStackPtr & sp) {
         int32_t value = ip.getValue<0, int32_t>();
         sp.writeInt32(value);
-        console.trace("%08X:  push_i32 0x%08X (int32)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  push_i32 0x%08X (int32)", getIpOffset(ip), value);
         ip.next(1 + sizeof(int32_t));
     }
 
@@ -1175,7 +1182,7 @@ public:
     JM_FORCEINLINE void op_push_i64(vmImagePtr & ip, vmStackPtr & sp) {
         int64_t value = ip.getValue<0, int64_t>();
         sp.writeInt64(value);
-        console.trace("%08X:  push_i64 0x%016X (int64)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  push_i64 0x%016X (int64)", getIpOffset(ip), value);
         ip.next(1 + sizeof(int64_t));
     }
 
@@ -1185,7 +1192,7 @@ public:
     JM_FORCEINLINE void op_push_i32_0(vmImagePtr & ip, vmStackPtr & sp) {
         int32_t value = 0;
         sp.writeInt32(value);
-        console.trace("%08X:  push_i32_0 (int32)", getIpOffset(ip));
+        VM_TRACE("%08X:  push_i32_0 (int32)", getIpOffset(ip));
         ip.next();
     }
 
@@ -1195,7 +1202,7 @@ public:
     JM_FORCEINLINE void op_push_i64_0(vmImagePtr & ip, vmStackPtr & sp) {
         int64_t value = 0;
         sp.writeInt64(value);
-        console.trace("%08X:  push_i64_0 (int64)", getIpOffset(ip));
+        VM_TRACE("%08X:  push_i64_0 (int64)", getIpOffset(ip));
         ip.next();
     }
 
@@ -1204,8 +1211,7 @@ public:
     //
     JM_FORCEINLINE void op_pop(vmImagePtr & ip, vmStackPtr & sp) {
         sp.backUInt32();
-        uint32_t value = sp.getUInt32();
-        console.trace("%08X:  pop  (0x%08X)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  pop  (0x%08X)", getIpOffset(ip), sp.getUInt32());
         ip.next();
     }
 
@@ -1214,8 +1220,7 @@ public:
     //
     JM_FORCEINLINE void op_pop_i32(vmImagePtr & ip, vmStackPtr & sp) {
         sp.backInt32();
-        int32_t value = sp.getInt32();
-        console.trace("%08X:  pop_i32  (0x%08X)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  pop_i32  (0x%08X)", getIpOffset(ip), sp.getInt32());
         ip.next();
     }
 
@@ -1224,8 +1229,7 @@ public:
     //
     JM_FORCEINLINE void op_pop_i64(vmImagePtr & ip, vmStackPtr & sp) {
         sp.backInt64();
-        int64_t value = sp.getInt64();
-        console.trace("%08X:  pop_i64  (0x%016X)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  pop_i64  (0x%016X)", getIpOffset(ip), sp.getInt64());
         ip.next();
     }
 
@@ -1236,7 +1240,7 @@ public:
         uint8_t localSize = ip.getValue<0, uint8_t>();
         sp.next(localSize);
 
-        console.trace("%08X:  add_sp %u", getIpOffset(ip), (uint32_t)localSize);
+        VM_TRACE("%08X:  add_sp %u", getIpOffset(ip), (uint32_t)localSize);
         ip.next(1 + sizeof(uint8_t));
     }
 
@@ -1245,7 +1249,7 @@ public:
     //
     JM_FORCEINLINE void op_add_sp_4(vmImagePtr & ip, vmStackPtr & sp) {
         sp.next(sizeof(uint32_t));
-        console.trace("%08X:  add_sp_4", getIpOffset(ip));
+        VM_TRACE("%08X:  add_sp_4", getIpOffset(ip));
         ip.next();
     }
 
@@ -1255,7 +1259,7 @@ public:
     JM_FORCEINLINE void op_load_eax(vmImagePtr & ip, vmStackPtr & sp, Register & regs) {
         uint32_t value = ip.getValue<0, uint32_t>();
         regs.eax.u32 = value;
-        console.trace("%08X:  load eax, 0x%08X", getIpOffset(ip), value);
+        VM_TRACE("%08X:  load eax, 0x%08X", getIpOffset(ip), value);
         ip.next(1 + sizeof(uint32_t));
     }
 
@@ -1266,8 +1270,8 @@ public:
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = ip.getValue<0, uint32_t, uint32_t, 2>();
         fp.putArgValueUInt32(index, value);
-        console.trace("%08X:  load args[%d], 0x%08X",
-                      getIpOffset(ip), getArgIndex(index), value);
+        VM_TRACE("%08X:  load args[%d], 0x%08X",
+                 getIpOffset(ip), getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t) + sizeof(uint32_t));
     }
 
@@ -1275,7 +1279,7 @@ public:
     // move arg0, arg1
     //
     JM_FORCEINLINE void op_move(vmImagePtr & ip, vmStackPtr & sp) {
-        console.trace("%08X:  move args[%d], args[%d]", getIpOffset(ip), 0, 1);
+        VM_TRACE("%08X:  move args[%d], args[%d]", getIpOffset(ip), 0, 1);
         ip.next();
     }
 
@@ -1283,7 +1287,7 @@ public:
     // move eax, arg1
     //
     JM_FORCEINLINE void op_move_to_eax(vmImagePtr & ip, vmStackPtr & sp) {
-        console.trace("%08X:  move eax, args[%d]", getIpOffset(ip), 0);
+        VM_TRACE("%08X:  move eax, args[%d]", getIpOffset(ip), 0);
         ip.next();
     }
 
@@ -1294,13 +1298,13 @@ public:
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = regs.eax.u32;
         fp.putArgValueUInt32(index, value);
-        console.trace("%08X:  copy args[%d], eax = (0x%08X)",
-                      getIpOffset(ip), getArgIndex(index), value);
+        VM_TRACE("%08X:  copy args[%d], eax = (0x%08X)",
+                 getIpOffset(ip), getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t));
     }
 
     JM_FORCEINLINE void op_cmp(vmImagePtr & ip, vmStackPtr & sp) {
-        console.trace("%08X:  cmp", getIpOffset(ip));
+        VM_TRACE("%08X:  cmp", getIpOffset(ip));
         ip.next();
     }
 
@@ -1308,24 +1312,24 @@ public:
     // cmp arg0, arg1 (int32)
     //
     JM_FORCEINLINE bool op_cmp_i32(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index1 = ip.getValue<0, int8_t>();
         int8_t index2 = ip.getValue<0, int8_t>();
         int32_t value1 = fp.getArgValueInt32(index1);
         int32_t value2 = fp.getArgValueInt32(index2);
         ip.next(1 + sizeof(int8_t) * 2);
 
-        console.trace("%08X:  cmp  args[%d], args[%d] - (%d, %d) (int32)",
-                      offset, getArgIndex(index1), getArgIndex(index2),
-                      value1, value2);
+        VM_TRACE("%08X:  cmp  args[%d], args[%d] - (%d, %d) (int32)",
+                 offset, getArgIndex(index1), getArgIndex(index2),
+                 value1, value2);
 
         unsigned char jmpType = ip.getUInt8();
         bool condition = this_type::getCondition(value1, value2, jmpType);
         flags.u32.low = (uint32_t)condition;
         if (likely(!condition))
-            console.trace("%08X:  cmp  condition [false]", offset);
+            VM_TRACE("%08X:  cmp  condition [false]", offset);
         else
-            console.trace("%08X:  cmp  condition [true]", offset);
+            VM_TRACE("%08X:  cmp  condition [true]", offset);
         return condition;
     }
 
@@ -1333,24 +1337,24 @@ public:
     // cmp arg0, arg1 (uint32)
     //
     JM_FORCEINLINE bool op_cmp_u32(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index1 = ip.getValue<0, int8_t>();
         int8_t index2 = ip.getValue<0, int8_t>();
         uint32_t value1 = fp.getArgValueUInt32(index1);
         uint32_t value2 = fp.getArgValueUInt32(index2);
         ip.next(1 + sizeof(int8_t) * 2);
 
-        console.trace("%08X:  cmp  args[%d], args[%d] - (%u, %u) (uint32)",
-                      offset, getArgIndex(index1), getArgIndex(index2),
-                      value1, value2);
+        VM_TRACE("%08X:  cmp  args[%d], args[%d] - (%u, %u) (uint32)",
+                 offset, getArgIndex(index1), getArgIndex(index2),
+                 value1, value2);
 
         unsigned char jmpType = ip.getUInt8();
         bool condition = this_type::getCondition(value1, value2, jmpType);
         flags.u32.low = (uint32_t)condition;
         if (likely(!condition))
-            console.trace("%08X:  cmp  condition [false]", offset);
+            VM_TRACE("%08X:  cmp  condition [false]", offset);
         else
-            console.trace("%08X:  cmp  condition [true]", offset);
+            VM_TRACE("%08X:  cmp  condition [true]", offset);
         return condition;
     }
 
@@ -1358,22 +1362,22 @@ public:
     // cmp arg0, 0x00000008 (int32)
     //
     JM_FORCEINLINE bool op_cmp_imm_i32(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         int32_t value1 = fp.getArgValueInt32(index);
         int32_t value2 = ip.getValue<0, int32_t, int32_t, 2>();
         ip.next(1 + sizeof(int8_t) + sizeof(int32_t));
 
-        console.trace("%08X:  cmp  args[%d], 0x%08X (int32)",
-                      offset, getArgIndex(index), value2);
+        VM_TRACE("%08X:  cmp  args[%d], 0x%08X (int32)",
+                 offset, getArgIndex(index), value2);
 
         unsigned char jmpType = ip.getUInt8();
         bool condition = this_type::getCondition(value1, value2, jmpType);
         flags.u32.low = (uint32_t)condition;
         if (likely(!condition))
-            console.trace("%08X:  cmp  condition [false]", offset);
+            VM_TRACE("%08X:  cmp  condition [false]", offset);
         else
-            console.trace("%08X:  cmp  condition [true]", offset);
+            VM_TRACE("%08X:  cmp  condition [true]", offset);
         return condition;
     }
 
@@ -1381,27 +1385,27 @@ public:
     // cmp arg0, 0x00000008 (uint32)
     //
     JM_FORCEINLINE bool op_cmp_imm_u32(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value1 = fp.getArgValueUInt32(index);
         uint32_t value2 = ip.getValue<0, uint32_t, uint32_t, 2>();
         ip.next(1 + sizeof(int8_t) + sizeof(uint32_t));
 
-        console.trace("%08X:  cmp  args[%d], 0x%08X (uint32)",
-                      offset, getArgIndex(index), value2);
+        VM_TRACE("%08X:  cmp  args[%d], 0x%08X (uint32)",
+                 offset, getArgIndex(index), value2);
 
         unsigned char jmpType = ip.getUInt8();
         bool condition = this_type::getCondition(value1, value2, jmpType);
         flags.u32.low = (uint32_t)condition;
         if (likely(!condition))
-            console.trace("%08X:  cmp  condition [false]", offset);
+            VM_TRACE("%08X:  cmp  condition [false]", offset);
         else
-            console.trace("%08X:  cmp  condition [true]", offset);
+            VM_TRACE("%08X:  cmp  condition [true]", offset);
         return condition;
     }
 
     JM_FORCEINLINE void op_jl(vmImagePtr & ip) {
-        console.trace("%08X:  jl\n", getIpOffset(ip));
+        VM_TRACE("%08X:  jl\n", getIpOffset(ip));
         ip.next();
     }
 
@@ -1409,17 +1413,16 @@ public:
     // jl_near 0x06
     //
     JM_FORCEINLINE bool op_jl_near(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t jmpOffset = ip.getValue<0, int8_t>();
         if (likely(flags.u32.low != (uint32_t)true)) {
             ip.next(1 + sizeof(int8_t));
-            uint32_t jmpEntry = getIpOffset(ip) + jmpOffset;
-            console.trace("%08X:  jl   0x%08X (near)", offset, jmpEntry);
+            VM_TRACE("%08X:  jl   0x%08X (near)", offset, getIpOffset(ip) + jmpOffset);
             return false;
         }
         else {
             ip.next(1L + sizeof(int8_t) + jmpOffset);
-            console.trace("%08X:  jl   0x%08X (near)\n", offset, getIpOffset(ip));
+            VM_TRACE("%08X:  jl   0x%08X (near)\n", offset, getIpOffset(ip));
             return true;
         }
     }
@@ -1428,17 +1431,16 @@ public:
     // jl_short 0x16, 0x00
     //
     JM_FORCEINLINE bool op_jl_short(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t jmpOffset = ip.getValue<0, int16_t>();
         if (likely(flags.u32.low != (uint32_t)true)) {
             ip.next(1 + sizeof(int16_t));
-            uint32_t jmpEntry = getIpOffset(ip) + jmpOffset;
-            console.trace("%08X:  jl   0x%08X (short)", offset, jmpEntry);
+            VM_TRACE("%08X:  jl   0x%08X (short)", offset, getIpOffset(ip) + jmpOffset);
             return false;
         }
         else {
             ip.next(1L + sizeof(int16_t) + jmpOffset);
-            console.trace("%08X:  jl   0x%08X (short)\n", offset, getIpOffset(ip));
+            VM_TRACE("%08X:  jl   0x%08X (short)\n", offset, getIpOffset(ip));
             return true;
         }
     }
@@ -1447,17 +1449,16 @@ public:
     // jl_long 0x29, 0x00, 0x00, 0x00
     //
     JM_FORCEINLINE bool op_jl_long(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int32_t jmpOffset = ip.getValue<0, int32_t>();
         if (likely(flags.u32.low != (uint32_t)true)) {
             ip.next(1 + sizeof(int32_t));
-            uint32_t jmpEntry = getIpOffset(ip) + jmpOffset;
-            console.trace("%08X:  jl   0x%08X (long)", offset, jmpEntry);
+            VM_TRACE("%08X:  jl   0x%08X (long)", offset, getIpOffset(ip) + jmpOffset);
             return false;
         }
         else {
             ip.next(1L + sizeof(int8_t) + jmpOffset);
-            console.trace("%08X:  jl   0x%08X (long)\n", offset, getIpOffset(ip));
+            VM_TRACE("%08X:  jl   0x%08X (long)\n", offset, getIpOffset(ip));
             return true;
         }
     }
@@ -1466,47 +1467,47 @@ public:
     // jmp 0x00102030 (ptr32)
     //
     JM_FORCEINLINE void op_jmp(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t jmpEntry = ip.getValue<0, uint32_t>();
         ip.set(image_.getStart() + jmpEntry);
-        console.trace("%08X:  jmp  0x%08X (ptr32)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  jmp  0x%08X (ptr32)\n", offset, getIpOffset(ip));
     }
 
     //
     // jmp_near 0x08
     //
     JM_FORCEINLINE void op_jmp_near(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t jmpOffset = ip.getValue<0, int8_t>();
         ip.next(1L + sizeof(int8_t) + jmpOffset);
-        console.trace("%08X:  jmp  0x%08X (near)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  jmp  0x%08X (near)\n", offset, getIpOffset(ip));
     }
 
     //
     // jmp_short 0x08, 0x00
     //
     JM_FORCEINLINE void op_jmp_short(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t jmpOffset = ip.getValue<0, int16_t>();
         ip.next(1L + sizeof(int16_t) + jmpOffset);
-        console.trace("%08X:  jmp  0x%08X (short)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  jmp  0x%08X (short)\n", offset, getIpOffset(ip));
     }
 
     //
     // jmp_long 0x18, 0x00, 0x00, 0x00
     //
     JM_FORCEINLINE void op_jmp_long(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int32_t jmpOffset = ip.getValue<0, int32_t>();
         ip.next(1L + sizeof(int32_t) + jmpOffset);
-        console.trace("%08X:  jmp  0x%08X (long)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  jmp  0x%08X (long)\n", offset, getIpOffset(ip));
     }
 
     //
     // call 0x00102030 (ptr32)
     //
     JM_FORCEINLINE void op_call(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t callEntry = ip.getValue<0, uint32_t>();
         ip.next(1 + sizeof(uint32_t));
 
@@ -1517,14 +1518,14 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X (ptr32)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X (ptr32)\n", offset, getIpOffset(ip));
     }
 
     //
     // call_near 0x08
     //
     JM_FORCEINLINE void op_call_near(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t callOffset = ip.getValue<0, int8_t>();
         ip.next(1 + sizeof(int8_t));
 
@@ -1535,14 +1536,14 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X (near)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X (near)\n", offset, getIpOffset(ip));
     }
 
     //
     // call_short 0x08, 0x00
     //
     JM_FORCEINLINE void op_call_short(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t callOffset = ip.getValue<0, int16_t>();
         ip.next(1 + sizeof(int16_t));
 
@@ -1553,14 +1554,14 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X (short)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X (short)\n", offset, getIpOffset(ip));
     }
 
     //
     // call_long 0x18, 0x00, 0x00, 0x00
     //
     JM_FORCEINLINE void op_call_long(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int32_t callOffset = ip.getValue<0, int32_t>();
         ip.next(1 + sizeof(int32_t));
 
@@ -1571,24 +1572,24 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X (long)\n",
-                      offset, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X (long)\n",
+                 offset, getIpOffset(ip));
     }
 
     //
     // ret
     //
     JM_FORCEINLINE bool op_ret(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         void * returnIP = pop_callstack(sp, fp);
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret  0x%08X\n", offset, getIpOffset(ip));
+            VM_TRACE("%08X:  ret  0x%08X\n", offset, getIpOffset(ip));
             return false;
         }
         else {
-            console.trace("%08X:  ret  (done)\n", offset);
+            VM_TRACE("%08X:  ret  (done)\n", offset);
             return true;
         }
     }
@@ -1597,18 +1598,18 @@ public:
     // ret_n_sm 0x08
     //
     JM_FORCEINLINE bool op_ret_n_sm(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint8_t localSize = ip.getValue<0, uint8_t>();
         void * returnIP = pop_callstack(sp, fp, localSize);
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret_n_sm [%u] 0x%08X\n",
-                          offset, (uint32_t)localSize, getIpOffset(ip));
+            VM_TRACE("%08X:  ret_n_sm [%u] 0x%08X\n",
+                     offset, (uint32_t)localSize, getIpOffset(ip));
             return false;
         }
         else {
-            console.trace("%08X:  ret_n_sm [%u] (done)\n", offset, (uint32_t)localSize);
+            VM_TRACE("%08X:  ret_n_sm [%u] (done)\n", offset, (uint32_t)localSize);
             return true;
         }
     }
@@ -1617,18 +1618,18 @@ public:
     // ret_n 0x08, 0x00
     //
     JM_FORCEINLINE bool op_ret_n(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint16_t localSize = ip.getValue<0, uint16_t>();
         void * returnIP = pop_callstack(sp, fp, localSize);
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret_n [%u] 0x%08X\n",
-                          offset, (uint32_t)localSize, getIpOffset(ip));
+            VM_TRACE("%08X:  ret_n [%u] 0x%08X\n",
+                     offset, (uint32_t)localSize, getIpOffset(ip));
             return false;
         }
         else {
-            console.trace("%08X:  ret_n [%u] (done)\n", offset, (uint32_t)localSize);
+            VM_TRACE("%08X:  ret_n [%u] (done)\n", offset, (uint32_t)localSize);
             return true;
         }
     }
@@ -1638,7 +1639,7 @@ public:
     //
     JM_FORCEINLINE bool op_ret_eax(vmImagePtr & ip, vmStackPtr & sp,
                                    vmFramePtr & fp, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t value = ip.getValue<0, uint32_t>();
         regs.eax.u32 = value;
 
@@ -1646,12 +1647,12 @@ public:
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret_eax 0x%08X (eax = 0x%08X)\n",
-                          offset, getIpOffset(ip), value);
+            VM_TRACE("%08X:  ret_eax 0x%08X (eax = 0x%08X)\n",
+                     offset, getIpOffset(ip), value);
             return false;
         }
         else {
-            console.trace("%08X:  ret_eax (done) (eax = 0x%08X)\n", offset, value);
+            VM_TRACE("%08X:  ret_eax (done) (eax = 0x%08X)\n", offset, value);
             return true;
         }
     }
@@ -1661,7 +1662,7 @@ public:
     //
     JM_FORCEINLINE bool op_ret_eax_n(vmImagePtr & ip, vmStackPtr & sp,
                                      vmFramePtr & fp, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint16_t localSize = ip.getValue<0, uint16_t>();
         uint32_t value = ip.getValue<0, uint32_t, uint32_t, 3>();
         regs.eax.u32 = value;
@@ -1670,13 +1671,13 @@ public:
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret_eax_n [%u] 0x%08X (eax = 0x%08X)\n",
-                          offset, (uint32_t)localSize, getIpOffset(ip), value);
+            VM_TRACE("%08X:  ret_eax_n [%u] 0x%08X (eax = 0x%08X)\n",
+                     offset, (uint32_t)localSize, getIpOffset(ip), value);
             return false;
         }
         else {
-            console.trace("%08X:  ret_eax_n [%u] (eax = 0x%08X) (done)\n",
-                          offset, (uint32_t)localSize, value);
+            VM_TRACE("%08X:  ret_eax_n [%u] (eax = 0x%08X) (done)\n",
+                     offset, (uint32_t)localSize, value);
             return true;
         }
     }
@@ -1686,7 +1687,7 @@ public:
     //
     JM_FORCEINLINE void op_inline_call_near(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp,
                                             vmStackPtr & cp, int retType) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t callOffset = ip.getValue<0, int8_t>();
         ip.next(1 + sizeof(int8_t));
 
@@ -1697,7 +1698,7 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X (near)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X (near)\n", offset, getIpOffset(ip));
     }
 
     //
@@ -1705,7 +1706,7 @@ public:
     //
     JM_FORCEINLINE void op_inline_call_short(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp,
                                              vmStackPtr & cp, int retType) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t callOffset = ip.getValue<0, int16_t>();
         ip.next(1 + sizeof(int16_t));
 
@@ -1716,7 +1717,7 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X (short)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X (short)\n", offset, getIpOffset(ip));
     }
 
     //
@@ -1724,7 +1725,7 @@ public:
     //
     JM_FORCEINLINE void op_inline_call_long(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp,
                                             vmStackPtr & cp, int retType) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int32_t callOffset = ip.getValue<0, int32_t>();
         ip.next(1 + sizeof(int32_t));
 
@@ -1735,7 +1736,7 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X (long)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X (long)\n", offset, getIpOffset(ip));
     }
 
     //
@@ -1743,18 +1744,18 @@ public:
     //
     JM_FORCEINLINE int op_inline_ret(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp,
                                      vmStackPtr & cp, bool & done) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
 
         int retType;
         void * returnIP = inline_pop_callstack(sp, fp, cp, retType);
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret  0x%08X\n", offset, getIpOffset(ip));
+            VM_TRACE("%08X:  ret  0x%08X\n", offset, getIpOffset(ip));
             done = false;
         }
         else {
-            console.trace("%08X:  ret  (done)\n", offset);
+            VM_TRACE("%08X:  ret  (done)\n", offset);
             done = true;
         }
 
@@ -1766,7 +1767,7 @@ public:
     //
     JM_FORCEINLINE int op_inline_ret_n(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp,
                                        vmStackPtr & cp, bool & done) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint16_t localSize = ip.getValue<0, uint16_t>();
 
         int retType;
@@ -1774,12 +1775,12 @@ public:
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret_n [%u] 0x%08X\n",
-                          offset, (uint32_t)localSize, getIpOffset(ip));
+            VM_TRACE("%08X:  ret_n [%u] 0x%08X\n",
+                     offset, (uint32_t)localSize, getIpOffset(ip));
             done = false;
         }
         else {
-            console.trace("%08X:  ret_n [%u] (done)\n", offset, (uint32_t)localSize);
+            VM_TRACE("%08X:  ret_n [%u] (done)\n", offset, (uint32_t)localSize);
             done = true;
         }
 
@@ -1791,7 +1792,7 @@ public:
     //
     JM_FORCEINLINE int op_inline_ret_eax(vmImagePtr & ip, vmStackPtr & sp, vmFramePtr & fp,
                                          vmStackPtr & cp, Register & regs, bool & done) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t value = ip.getValue<0, uint32_t>();
         regs.eax.u32 = value;
 
@@ -1800,12 +1801,12 @@ public:
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret_eax 0x%08X (eax = 0x%08X)\n",
-                          offset, getIpOffset(ip), value);
+            VM_TRACE("%08X:  ret_eax 0x%08X (eax = 0x%08X)\n",
+                     offset, getIpOffset(ip), value);
             done = false;
         }
         else {
-            console.trace("%08X:  ret_eax (done) (eax = 0x%08X)\n", offset, value);
+            VM_TRACE("%08X:  ret_eax (done) (eax = 0x%08X)\n", offset, value);
             done = true;
         }
 
@@ -1816,7 +1817,7 @@ public:
     // nop
     //
     JM_FORCEINLINE void op_nop(vmImagePtr & ip) {
-        console.trace("%08X:  nop", getIpOffset(ip));
+        VM_TRACE("%08X:  nop", getIpOffset(ip));
         ip.next();
     }
 
@@ -1825,7 +1826,7 @@ public:
     //
     JM_FORCEINLINE void op_nop_n(vmImagePtr & ip) {
         uint8_t skip_n = ip.getValue<0, uint8_t>();
-        console.trace("%08X:  nop_n %u", getIpOffset(ip), (uint32_t)skip_n);
+        VM_TRACE("%08X:  nop_n %u", getIpOffset(ip), (uint32_t)skip_n);
         ip.next(1 + sizeof(uint8_t) + skip_n);
     }
 
@@ -1833,14 +1834,14 @@ public:
     // inc arg0
     //
     JM_FORCEINLINE void op_inc(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = fp.getArgValueUInt32(index);
         value++;
         fp.putArgValueUInt32(index, value);
 
-        console.trace("%08X:  inc  arg[%d]  (0x%08X)",
-                      offset, getArgIndex(index), value);
+        VM_TRACE("%08X:  inc  arg[%d]  (0x%08X)",
+                 offset, getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -1848,14 +1849,14 @@ public:
     // dec arg0
     //
     JM_FORCEINLINE void op_dec(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = fp.getArgValueUInt32(index);
         value--;
         fp.putArgValueUInt32(index, value);
 
-        console.trace("%08X:  dec  args[%d]  (0x%08X)",
-                      offset, getArgIndex(index), value);
+        VM_TRACE("%08X:  dec  args[%d]  (0x%08X)",
+                 offset, getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -1863,7 +1864,7 @@ public:
     // add arg0, arg1
     //
     JM_FORCEINLINE void op_add(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index1 = ip.getValue<0, int8_t>();
         int8_t index2 = ip.getValue<0, int8_t, int8_t, 2>();
         uint32_t value1 = fp.getArgValueUInt32(index1);
@@ -1872,9 +1873,9 @@ public:
         uint32_t newValue = value1 + value2;
         fp.putArgValueUInt32(index1, newValue);
 
-        console.trace("%08X:  add  args[%d], args[%d] = (0x%08X)",
-                      offset, getArgIndex(index1), getArgIndex(index2),
-                      newValue);
+        VM_TRACE("%08X:  add  args[%d], args[%d] = (0x%08X)",
+                 offset, getArgIndex(index1), getArgIndex(index2),
+                 newValue);
         ip.next(1 + sizeof(int8_t) * 2);
     }
 
@@ -1882,7 +1883,7 @@ public:
     // add arg0, 0x00000006
     //
     JM_FORCEINLINE void op_add_imm(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value2 = ip.getValue<0, uint32_t, uint32_t, 2>();
         uint32_t value1 = fp.getArgValueUInt32(index);
@@ -1890,8 +1891,8 @@ public:
         uint32_t newValue = value1 + value2;
         fp.putArgValueUInt32(index, newValue);
 
-        console.trace("%08X:  add  args[%d], 0x%08X = (0x%08X)",
-                      offset, getArgIndex(index), value2, newValue);
+        VM_TRACE("%08X:  add  args[%d], 0x%08X = (0x%08X)",
+                 offset, getArgIndex(index), value2, newValue);
         ip.next(1 + sizeof(int8_t) + sizeof(uint32_t));
     }
 
@@ -1899,15 +1900,15 @@ public:
     // add eax, arg0
     //
     JM_FORCEINLINE void op_add_eax(vmImagePtr & ip, vmFramePtr & fp, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = fp.getArgValueUInt32(index);
 
         uint32_t newValue = regs.eax.u32 + value;
         regs.eax.u32 = newValue;
 
-        console.trace("%08X:  add  eax, args[%d] = (0x%08X)",
-                      offset, getArgIndex(index), newValue);
+        VM_TRACE("%08X:  add  eax, args[%d] = (0x%08X)",
+                 offset, getArgIndex(index), newValue);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -1915,14 +1916,14 @@ public:
     // add eax, 0x00000006
     //
     JM_FORCEINLINE void op_add_eax_imm(vmImagePtr & ip, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t value = ip.getValue<0, uint32_t, uint32_t>();
 
         uint32_t newValue = regs.eax.u32 + value;
         regs.eax.u32 = newValue;
 
-        console.trace("%08X:  add  eax, 0x%08X = (0x%08X)",
-                      offset, value, newValue);
+        VM_TRACE("%08X:  add  eax, 0x%08X = (0x%08X)",
+                 offset, value, newValue);
         ip.next(1 + sizeof(uint32_t));
     }
 
@@ -1930,7 +1931,7 @@ public:
     // sub arg0, arg1
     //
     JM_FORCEINLINE void op_sub(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index1 = ip.getValue<0, int8_t>();
         int8_t index2 = ip.getValue<0, int8_t, int8_t, 2>();
         uint32_t value1 = fp.getArgValueUInt32(index1);
@@ -1938,9 +1939,9 @@ public:
         uint32_t newValue = value1 - value2;
         fp.putArgValueUInt32(index1, newValue);
 
-        console.trace("%08X:  sub  args[%d], args[%d] = (0x%08X)",
-                      offset, getArgIndex(index1), getArgIndex(index2),
-                      newValue);
+        VM_TRACE("%08X:  sub  args[%d], args[%d] = (0x%08X)",
+                 offset, getArgIndex(index1), getArgIndex(index2),
+                 newValue);
         ip.next(1 + sizeof(int8_t) * 2);
     }
 
@@ -1948,7 +1949,7 @@ public:
     // sub arg0, 0x00000006
     //
     JM_FORCEINLINE void op_sub_imm(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value2 = ip.getValue<0, uint32_t, uint32_t, 2>();
         uint32_t value1 = fp.getArgValueUInt32(index);
@@ -1956,8 +1957,8 @@ public:
         uint32_t newValue = value1 - value2;
         fp.putArgValueUInt32(index, newValue);
 
-        console.trace("%08X:  sub  args[%d], 0x%08X = (0x%08X)",
-                      offset, getArgIndex(index), value2, newValue);
+        VM_TRACE("%08X:  sub  args[%d], 0x%08X = (0x%08X)",
+                 offset, getArgIndex(index), value2, newValue);
         ip.next(1 + sizeof(int8_t) + sizeof(uint32_t));
     }
 
@@ -1965,14 +1966,14 @@ public:
     // sub eax, arg0
     //
     JM_FORCEINLINE void op_sub_eax(vmImagePtr & ip, vmFramePtr & fp, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = fp.getArgValueUInt32(index);
         uint32_t newValue = regs.eax.u32 - value;
         regs.eax.u32 = newValue;
 
-        console.trace("%08X:  sub  eax, args[%d] = (0x%08X)",
-                      offset, getArgIndex(index), newValue);
+        VM_TRACE("%08X:  sub  eax, args[%d] = (0x%08X)",
+                 offset, getArgIndex(index), newValue);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -1980,14 +1981,14 @@ public:
     // add eax, 0x00000006
     //
     JM_FORCEINLINE void op_sub_eax_imm(vmImagePtr & ip, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t value = ip.getValue<0, uint32_t>();
 
         uint32_t newValue = regs.eax.u32 - value;
         regs.eax.u32 = newValue;
 
-        console.trace("%08X:  sub  eax, 0x%08X = (0x%08X)",
-                      offset, value, newValue);
+        VM_TRACE("%08X:  sub  eax, 0x%08X = (0x%08X)",
+                 offset, value, newValue);
         ip.next(1 + sizeof(uint32_t));
     }
 
@@ -1995,7 +1996,7 @@ public:
     // Exit the program
     //
     JM_FORCEINLINE void op_exit(vmImagePtr & ip, return_type & retValue) {
-        console.trace("%08X:  end\n", getIpOffset(ip));
+        VM_TRACE("%08X:  end\n", getIpOffset(ip));
         ip.next();
     }
 
@@ -2003,7 +2004,7 @@ public:
     // Unknown opcode.
     //
     JM_FORCEINLINE void op_unknown(vmImagePtr & ip, unsigned char opcode) {
-        console.trace("%08X:  Error: Unknown opcode: %u", getIpOffset(ip), (uint32_t)opcode);
+        VM_TRACE("%08X:  Error: Unknown opcode: %u", getIpOffset(ip), (uint32_t)opcode);
         ip.next();
     }
 
@@ -2316,7 +2317,7 @@ fibonacci_ret_00:
                         break;
                     }
                     else {
-                        console.trace("Error: Unknown error.");
+                        VM_TRACE("Error: Unknown error.");
                     }
                     goto Execute_Finished;
                 }
@@ -2375,14 +2376,15 @@ Execute_Finished:
     }
 };
 
-template <typename BasicType = uintptr_t>
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
 class ExecutionEngine {
 public:
-    typedef BasicType                       basic_type;
-    typedef size_t                          size_type;
-    typedef ExecutionContext<basic_type>    context_type;
-    typedef vmReturn<basic_type>            return_type;
-    typedef ExecutionEngine<basic_type>     this_type;
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionContext<basic_type, trace_policy>  context_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef ExecutionEngine<basic_type, trace_policy>   this_type;
 
 private:
     vmBinaryFile binary_;
@@ -2444,13 +2446,14 @@ public:
     }
 };
 
-template <typename BasicType = uintptr_t>
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
 class Interpreter {
 public:
-    typedef BasicType                   basic_type;
-    typedef ExecutionEngine<basic_type> engine_type;
-    typedef vmReturn<basic_type>        return_type;
-    typedef Interpreter<basic_type>     this_type;
+    typedef BasicType                                  basic_type;
+    typedef TracePolicy                                trace_policy;
+    typedef ExecutionEngine<basic_type, trace_policy>  engine_type;
+    typedef vmReturn<basic_type>                       return_type;
+    typedef Interpreter<basic_type, trace_policy>      this_type;
 
 private:
     engine_type engine_;
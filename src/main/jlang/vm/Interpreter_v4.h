@@ -24,7 +24,22 @@
 
 #include "jlang/vm/Interpreter.h"
 #include "jlang/vm/Interpreter_v3.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/vm/SuperInstruction.h"
+#include "jlang/vm/ImageSpecializer.h"
+#include "jlang/vm/JitCompiler.h"
+#include "jlang/vm/Tiering.h"
+#include "jlang/vm/Memoizer.h"
+#include "jlang/vm/Profiler.h"
+#include "jlang/vm/Sampler.h"
+#include "jlang/vm/SymbolTable.h"
+#include "jlang/vm/StackGuard.h"
+#include "jlang/vm/GcHeap.h"
+#include "jlang/vm/StackMap.h"
+#include "jlang/vm/Verifier.h"
+#include "jlang/vm/ImageFile.h"
 #include "jlang/lang/Error.h"
+#include "jlang/vm/TracePolicy.h"
 #include "jlang/support/Console.h"
 
 #include <stdint.h>
@@ -32,6 +47,7 @@
 #include <assert.h>
 
 #include <list>
+#include <vector>
 #include <memory>
 #include <atomic>
 
@@ -112,6 +128,205 @@ static const unsigned char fibonacciBinary32[] = {
     OpCode::exit
 };
 
+//
+// heap_loop(n): n times, allocate a small, a medium and a large object
+// and free them again, out of order.
+//
+// 00000000:    store var0, 0x00000400 (int32)
+// 00000006:    fast_call 0x00000010, 8 (short offset 0x0005, local_size = 8)
+// 0000000B:    ret_n 8
+//
+// 0000000E:    nop; nop;
+//
+// 00000010:    alloc var0, 0x00000018
+// 00000016:    alloc var1, 0x00000064
+// 0000001C:    alloc var2, 0x000005DC
+// 00000022:    free var0
+// 00000024:    free var2
+// 00000026:    free var1
+// 00000028:    dec arg1
+// 0000002A:    cmp_imm_u32 arg1, 0x00000001
+// 00000030:    jl_near 0x00000034 (near offset 0x02)
+// 00000032:    jmp_near 0x00000010 (near offset 0xDC)
+//
+// 00000034:    ret_eax_n, 8, 0x00000000 (uint32)
+//
+
+static const unsigned char heapLoopBinary32[] = {
+    // 00000000:    store var0, 0x00000400 (int32)
+    OpCode::store, __var0, 0x00, 0x04, 0x00, 0x00,
+    // 00000006:    call (0x00000010, 8) (short offset 0x0005, local_size = 8)
+    OpCode::fast_call_short, 0x05, 0x00, 0x08, 0x00,
+    // 0000000B:    ret_n 8
+    OpCode::ret_n, 0x08, 0x00,
+
+    // 0000000E:    nop; nop;
+    OpCode::nop,  OpCode::nop,
+
+    // 00000010:    alloc var0, 0x00000018
+    OpCode::alloc, __var0, 0x18, 0x00, 0x00, 0x00,
+    // 00000016:    alloc var1, 0x00000064
+    OpCode::alloc, __var1, 0x64, 0x00, 0x00, 0x00,
+    // 0000001C:    alloc var2, 0x000005DC
+    OpCode::alloc, __var2, 0xDC, 0x05, 0x00, 0x00,
+    // 00000022:    free var0
+    OpCode::free, __var0,
+    // 00000024:    free var2
+    OpCode::free, __var2,
+    // 00000026:    free var1
+    OpCode::free, __var1,
+    // 00000028:    dec arg1
+    OpCode::dec,  __arg1,
+    // 0000002A:    cmp_imm_u32 arg1, 0x00000001
+    OpCode::cmp_imm_u32, __arg1, 0x01, 0x00, 0x00, 0x00,
+    // 00000030:    jl_near 0x00000034 (near offset 0x02)
+    OpCode::jl_near, 0x02,
+    // 00000032:    jmp_near 0x00000010 (near offset 0xDC)
+    OpCode::jmp_near, 0xDC,
+
+    // 00000034:    ret eax, 0x00000000 (uint32)
+    OpCode::ret_eax_n, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00,
+
+    // 0000003B:    exit
+    OpCode::exit
+};
+
+//
+// gc_churn(n): n times, push_node() a node of the list in var2 and make
+// a short-lived object that points to it, every 0x4000 nodes the list is
+// dropped. Then it returns the sum of the values in the nodes left, the
+// stack maps and the collector have to keep them all.
+//
+// push_node(list, value) puts the new node in the caller's slot of list.
+//
+// 00000000:    store var0, 0x00002000 (int32)
+// 00000006:    fast_call 0x00000010, 8 (short offset 0x0005, local_size = 8)
+// 0000000B:    ret_n 8
+//
+// 0000000E:    nop; nop;
+//
+// 00000010:    store var2, 0x00000000 (null)
+// 00000016:    store var0, 0x00000000 (int32)
+// 0000001C:    move var3, arg1
+// 0000001F:    fast_call 0x0000006B, 16 (short offset 0x0047, local_size = 16)
+// 00000024:    new_obj var1, 3, 1
+// 00000028:    st_ref var1.0, var2
+// 0000002C:    inc var0
+// 0000002E:    cmp_imm_u32 var0, 0x00004000
+// 00000034:    jl_near 0x00000042 (near offset 0x0C)
+// 00000036:    store var2, 0x00000000 (null)
+// 0000003C:    store var0, 0x00000000 (int32)
+// 00000042:    dec arg1
+// 00000044:    cmp_imm_u32 arg1, 0x00000001
+// 0000004A:    jl_near 0x0000004E (near offset 0x02)
+// 0000004C:    jmp_near 0x0000001C (near offset 0xCE)
+//
+// 0000004E:    load_eax 0x00000000
+// 00000053:    cmp_imm_u32 var2, 0x00000001
+// 00000059:    jl_near 0x00000067 (near offset 0x0C)
+// 0000005B:    ld_field var1, var2.2
+// 0000005F:    add eax, var1
+// 00000061:    ld_ref var2, var2.0
+// 00000065:    jmp_near 0x00000053 (near offset 0xEC)
+// 00000067:    ret_n 8
+//
+// 0000006A:    nop;
+//
+// 0000006B:    new_obj var0, 4, 2
+// 0000006F:    st_ref var0.0, arg1
+// 00000073:    new_obj var1, 2, 0
+// 00000077:    st_field var1.0, arg0
+// 0000007B:    st_ref var0.1, var1
+// 0000007F:    st_field var0.2, arg0
+// 00000083:    move arg1, var0
+// 00000086:    ret_n 16
+//
+// 00000089:    exit
+//
+
+static const unsigned char gcChurnBinary32[] = {
+    // 00000000:    store var0, 0x00002000 (int32)
+    OpCode::store, __var0, 0x00, 0x20, 0x00, 0x00,
+    // 00000006:    fast_call 0x00000010, 8 (short offset 0x0005, local_size = 8)
+    OpCode::fast_call_short, 0x05, 0x00, 0x08, 0x00,
+    // 0000000B:    ret_n 8
+    OpCode::ret_n, 0x08, 0x00,
+
+    // 0000000E:    nop; nop;
+    OpCode::nop, OpCode::nop,
+
+    // 00000010:    store var2, 0x00000000 (null)
+    OpCode::store, __var2, 0x00, 0x00, 0x00, 0x00,
+    // 00000016:    store var0, 0x00000000 (int32)
+    OpCode::store, __var0, 0x00, 0x00, 0x00, 0x00,
+    // 0000001C:    move var3, arg1
+    OpCode::move, __var3, __arg1,
+    // 0000001F:    fast_call 0x0000006B, 16 (short offset 0x0047, local_size = 16)
+    OpCode::fast_call_short, 0x47, 0x00, 0x10, 0x00,
+    // 00000024:    new_obj var1, 3, 1
+    OpCode::new_obj, __var1, 0x03, 0x01,
+    // 00000028:    st_ref var1.0, var2
+    OpCode::st_ref, __var1, 0x00, __var2,
+    // 0000002C:    inc var0
+    OpCode::inc, __var0,
+    // 0000002E:    cmp_imm_u32 var0, 0x00004000
+    OpCode::cmp_imm_u32, __var0, 0x00, 0x40, 0x00, 0x00,
+    // 00000034:    jl_near 0x00000042 (near offset 0x0C)
+    OpCode::jl_near, 0x0C,
+    // 00000036:    store var2, 0x00000000 (null)
+    OpCode::store, __var2, 0x00, 0x00, 0x00, 0x00,
+    // 0000003C:    store var0, 0x00000000 (int32)
+    OpCode::store, __var0, 0x00, 0x00, 0x00, 0x00,
+    // 00000042:    dec arg1
+    OpCode::dec, __arg1,
+    // 00000044:    cmp_imm_u32 arg1, 0x00000001
+    OpCode::cmp_imm_u32, __arg1, 0x01, 0x00, 0x00, 0x00,
+    // 0000004A:    jl_near 0x0000004E (near offset 0x02)
+    OpCode::jl_near, 0x02,
+    // 0000004C:    jmp_near 0x0000001C (near offset 0xCE)
+    OpCode::jmp_near, 0xCE,
+
+    // 0000004E:    load_eax 0x00000000
+    OpCode::load_eax, 0x00, 0x00, 0x00, 0x00,
+    // 00000053:    cmp_imm_u32 var2, 0x00000001
+    OpCode::cmp_imm_u32, __var2, 0x01, 0x00, 0x00, 0x00,
+    // 00000059:    jl_near 0x00000067 (near offset 0x0C)
+    OpCode::jl_near, 0x0C,
+    // 0000005B:    ld_field var1, var2.2
+    OpCode::ld_field, __var1, __var2, 0x02,
+    // 0000005F:    add eax, var1
+    OpCode::add_eax, __var1,
+    // 00000061:    ld_ref var2, var2.0
+    OpCode::ld_ref, __var2, __var2, 0x00,
+    // 00000065:    jmp_near 0x00000053 (near offset 0xEC)
+    OpCode::jmp_near, 0xEC,
+    // 00000067:    ret_n 8
+    OpCode::ret_n, 0x08, 0x00,
+
+    // 0000006A:    nop;
+    OpCode::nop,
+
+    // 0000006B:    new_obj var0, 4, 2
+    OpCode::new_obj, __var0, 0x04, 0x02,
+    // 0000006F:    st_ref var0.0, arg1
+    OpCode::st_ref, __var0, 0x00, __arg1,
+    // 00000073:    new_obj var1, 2, 0
+    OpCode::new_obj, __var1, 0x02, 0x00,
+    // 00000077:    st_field var1.0, arg0
+    OpCode::st_field, __var1, 0x00, __arg0,
+    // 0000007B:    st_ref var0.1, var1
+    OpCode::st_ref, __var0, 0x01, __var1,
+    // 0000007F:    st_field var0.2, arg0
+    OpCode::st_field, __var0, 0x02, __arg0,
+    // 00000083:    move arg1, var0
+    OpCode::move, __arg1, __var0,
+    // 00000086:    ret_n 16
+    OpCode::ret_n, 0x10, 0x00,
+
+    // 00000089:    exit
+    OpCode::exit
+};
+
 typedef v3::ForwardPtr  vmImagePtr;
 
 #if USE_FORWARD_STACK_PTR
@@ -142,35 +357,204 @@ struct vmContextRegs {
     }
 };
 
+//
+// How a slice of execute_slice() is cut: after a count of instructions,
+// or of back edges and calls, every loop and recursion passes one.
+//
+struct vmSliceMode {
+    enum Type {
+        None,
+        Instructions,
+        BackEdges
+    };
+};
+
+//
+// The executors of ExecutionContext, each is run by execute_guarded().
+//
+struct vmExecutor {
+    enum Type {
+        Bytecode,
+        Checked,
+        Threaded,
+        Decoded,
+        Specialized,
+        Native,
+        Inline
+    };
+};
+
 class vmBinaryFile {
 private:
-    vmBinImage image_;
+    vmImageFile         file_;
+    vmBinImage          image_;
+    vmDecodedImage      decoded_;
+    vmSuperInstProfiler superInst_;
+    vmExecPlan          plan_;
+    vmJitCode           jit_;
+    bool                jitFailed_;
+    vmTierManager       tiers_;
+    vmMemoizer          memo_;
+    bool                memoFailed_;
+    vmExecProfiler      profiler_;
+    vmSymbolTable       symbols_;
+    vmSampler           sampler_;
+    vmStackMaps         stackMaps_;
 
 public:
-    vmBinaryFile() {}
+    vmBinaryFile() : jitFailed_(false), memoFailed_(false) {}
     ~vmBinaryFile() {}
 
+    //
+    // Load an image file, see vmImageFile. The code is run where it's
+    // mapped, the pages are shared by all who load the same file.
+    //
     int loadFromFile(const char * filename) {
-        static const size_t kImageSize = sizeof(fibonacciBinary32);
-        image_.allocate(kImageSize);
+        int ec = file_.open(filename);
+        if (ec != Error::Ok) {
+            // The old mapping is gone.
+            if (image_.isAttached()) {
+                image_.deallocate();
+            }
+            return ec;
+        }
+        image_.attach((void *)file_.code(), file_.codeSize());
+        image_.setEntryOffset(file_.entryOffset());
+        symbols_.clear();
+        for (uint32_t i = 0; i < file_.symbolCount(); i++) {
+            const vmImageSymbol & symbol = file_.symbol(i);
+            if ((symbol.flags & vmImageSymbol::kFunction) != 0)
+                symbols_.addFunction(symbol.offset, file_.nameOf(symbol));
+            else
+                symbols_.addLabel(symbol.offset, file_.nameOf(symbol));
+        }
+        return prepare(file_.entryOffset());
+    }
+
+    //
+    // Load the built-in image of fibonacci.jasm.
+    //
+    int loadBuiltin() {
+        int ec = loadFromMemory(&fibonacciBinary32[0], sizeof(fibonacciBinary32), 0);
+        if (ec <= 0) {
+            return ec;
+        }
+
+        // The names of fibonacci.jasm, the assembler doesn't emit them yet.
+        symbols_.addFunction(0x00000000, "main");
+        symbols_.addFunction(0x00000010, "fibonacci32");
+        symbols_.addLabel(0x00000010, "fib_start");
+        symbols_.addLabel(0x00000030, "recur_exit");
+        return ec;
+    }
+
+    //
+    // Load an image that's assembled already, it's copied.
+    //
+    int loadFromMemory(const void * data, size_t size, size_t entryOffset) {
+        image_.allocate(size);
         void * imageData = image_.data();
-        if (imageData) {
-            memcpy(imageData, (const void *)&fibonacciBinary32[0], kImageSize);
+        if (imageData == nullptr) {
+            return Error::BinaryFile_Read_Failed;
         }
-        image_.setEntryOffset(0);
-        return 1;
+        memcpy(imageData, data, size);
+        image_.setEntryOffset(entryOffset);
+        file_.close();
+        symbols_.clear();
+        return prepare(entryOffset);
     }
 
+    //
+    // Write the image, its entry and its symbols as an image file.
+    //
     int saveToFile(const char * filename) {
+        if (image_.data() == nullptr) {
+            return Error::BinaryFile_Read_Failed;
+        }
+        uint32_t entryOffset = (uint32_t)((char *)image_.entry() - (char *)image_.data());
+        int ec = vmImageFile::write(filename, image_.data(), (uint32_t)image_.size(),
+                                    entryOffset, symbols_);
+        return ((ec == Error::Ok) ? 1 : ec);
+    }
+
+    // The image is read in place from a mapped file.
+    bool isMapped() const {
+        return file_.isOpen();
+    }
+
+    // The read-only data of the image file.
+    const char * getStrings() const {
+        return file_.strings();
+    }
+
+    uint32_t getStringsSize() const {
+        return file_.stringsSize();
+    }
+
+private:
+    int prepare(size_t entryOffset) {
+        // Predecode the image once, at load time.
+        int ec = decoded_.decode(image_.data(), image_.size(), entryOffset);
+        if (ec != Error::Ok) {
+            return ec;
+        }
+
+        // An image the verifier refuses isn't run.
+        ec = vmVerifier::verify(decoded_);
+        if (ec != Error::Ok) {
+            decoded_.destroy();
+            return ec;
+        }
+        decoded_.setVerified(true);
+
+        // The stack maps of the collector, if it has objects.
+        ec = stackMaps_.build(decoded_);
+        if (ec != Error::Ok) {
+            return ec;
+        }
+        if (stackMaps_.usesGc()) {
+            decoded_.setStackMaps(&stackMaps_);
+        }
+
+        // And build its direct-jump execution plan.
+        ec = vmImageSpecializer::specialize(image_.data(), image_.size(), entryOffset, plan_);
+        if (ec != Error::Ok) {
+            return ec;
+        }
         return 1;
     }
 
-    void setInput(uintptr_t initValue) {
+public:
+    //
+    // Patch the input of the image, return BinaryFile_Not_Writable if the
+    // page of a mapped image can't get a copy of its own.
+    //
+    int setInput(uintptr_t initValue) {
         char * imageData = (char *)image_.data();
         uint32_t * pInitValue = (uint32_t *)&(imageData[2]);
+        // A mapped image is read-only, this page gets a copy of its own.
+        if (file_.isOpen() && !file_.getMappedFile().makeWritable(pInitValue, sizeof(uint32_t))) {
+            return Error::BinaryFile_Not_Writable;
+        }
         if (pInitValue) {
             *pInitValue = (uint32_t)initValue;
         }
+        // The input is the immediate of the first instruction.
+        if (decoded_.isInited()) {
+            decoded_.refresh(0);
+        }
+        if (plan_.isInited()) {
+            plan_.refresh(0);
+        }
+        if (jit_.isCompiled()) {
+            int ec = jit_.refresh(0);
+            if (ec != Error::Ok) {
+                jit_.destroy();
+                // The promoted functions pointed into it.
+                tiers_.reset();
+            }
+        }
+        return Error::Ok;
     }
 
     void * getImagePtr() const {
@@ -184,6 +568,74 @@ public:
     void * getImageEntry() const {
         return image_.entry();
     }
+
+    vmDecodedImage * getDecodedImage() {
+        return &decoded_;
+    }
+
+    vmSuperInstProfiler * getSuperInstProfiler() {
+        return &superInst_;
+    }
+
+    vmExecPlan * getExecPlan() {
+        return &plan_;
+    }
+
+    //
+    // The image is compiled the first time it's asked for, return nullptr
+    // if it can't be compiled.
+    //
+    vmJitCode * getJitCode() {
+        if (!jit_.isCompiled() && !jitFailed_) {
+            int ec = vmJitCompiler::compile(image_.data(), image_.size(), 0, jit_);
+            if (ec != Error::Ok) {
+                jitFailed_ = true;
+            }
+        }
+        return (jit_.isCompiled() ? &jit_ : nullptr);
+    }
+
+    //
+    // The tier manager shares the native code with getJitCode().
+    //
+    vmTierManager * getTierManager() {
+        if (!tiers_.isAttached()) {
+            tiers_.attach(&decoded_, &jit_);
+        }
+        return &tiers_;
+    }
+
+    //
+    // The pure functions are found the first time it's asked for, return
+    // nullptr if the predecoded stream was fused before.
+    //
+    vmMemoizer * getMemoizer() {
+        if (!memo_.isAttached() && !memoFailed_) {
+            int ec = memo_.attach(&decoded_);
+            if (ec != Error::Ok) {
+                memoFailed_ = true;
+            }
+        }
+        return (memo_.isAttached() ? &memo_ : nullptr);
+    }
+
+    vmExecProfiler * getExecProfiler() {
+        if (!profiler_.isAttached()) {
+            profiler_.attach(&decoded_);
+        }
+        return &profiler_;
+    }
+
+    const vmSymbolTable * getSymbolTable() const {
+        return &symbols_;
+    }
+
+    vmSampler * getSampler() {
+        if (!sampler_.isAttached()) {
+            sampler_.attach(&decoded_, &symbols_);
+        }
+        return &sampler_;
+    }
 };
 
 template <typename BasicType>
@@ -241,20 +693,21 @@ public:
     }
 };
 
-template <typename BasicType>
+template <typename BasicType, typename TracePolicy>
 class ExecutionEngine;
 
-template <typename BasicType = uintptr_t>
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
 class ExecutionContext : public IExecutionContext<BasicType>,
                          public vmContextRegs {
 public:
-    typedef BasicType                       basic_type;
-    typedef IExecutionContext<basic_type>   base_type;
-    typedef size_t                          size_type;
-    typedef ExecutionEngine<basic_type>     engine_type;
-    typedef vmReturn<basic_type>            return_type;
-    typedef vmContextRegs                   ctx_reg_type;
-    typedef ExecutionContext<basic_type>    this_type;
+    typedef BasicType                                   basic_type;
+    typedef IExecutionContext<basic_type>               base_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionEngine<basic_type, trace_policy>   engine_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef vmContextRegs                               ctx_reg_type;
+    typedef ExecutionContext<basic_type, trace_policy>  this_type;
 
     static const size_type kDefaultStackSize = 8 * 1048576U;
 
@@ -268,16 +721,58 @@ private:
 #endif
     vmImageInfo<basic_type> image_;
     vmHeap<basic_type>      heap_;
+    vmGcHeap<basic_type>    gc_;
+    vmDecodedImage *        decoded_;
+    vmSuperInstProfiler *   superInst_;
+    vmExecPlan *            plan_;
+    vmTierManager *         tierManager_;
+    vmMemoizer *            memoizer_;
+    vmExecProfiler *        profiler_;
+    vmSampler *             sampler_;
     engine_type *           engine_;
+    vmThreadId              id_;
+    uint32_t                entryArgSize_;
+    bool                    entryFastFrame_;
+    bool                    bindOnly_;
+    const vmDecodedInst *   invokeEntry_;
+    bool                    invokeFastFrame_;
+    int64_t                 sliceBudget_;
+    const unsigned char *   sliceLimit_;
+
+    // The frames of a collection, and the slots of each that are references.
+    struct GcFrame {
+        unsigned char *             fp;
+        const vmStackMaps::Map *    map;
+    };
+    std::vector<GcFrame>    gcFrames_;
+    std::vector<uint8_t>    gcRefs_;
+
+    // The innermost guest frames of the last Stack_Overflow.
+    vmCallStack             overflowStack_;
+    size_t                  overflowDepth_;
 
 public:
-    ExecutionContext(engine_type * engine = nullptr) : engine_(engine) {}
+    // execute_slice() ran out of its budget, the registers are saved.
+    static const int kSlicePreempted = 1;
+
+    // The innermost frames kept of a Stack_Overflow, see getOverflowStack().
+    enum { kOverflowFrames = 16 };
+
+    ExecutionContext(engine_type * engine = nullptr)
+        : gc_(heap_), decoded_(nullptr), superInst_(nullptr), plan_(nullptr),
+          tierManager_(nullptr), memoizer_(nullptr), profiler_(nullptr),
+          sampler_(nullptr), engine_(engine), id_(1), entryArgSize_(0),
+          entryFastFrame_(false), bindOnly_(false), invokeEntry_(nullptr),
+          invokeFastFrame_(false), sliceBudget_(0), sliceLimit_(nullptr),
+          overflowDepth_(0) {}
     virtual ~ExecutionContext() {
         destroy();
     }
 
-    vmThreadId getId() { return 1; }
+    // The main context is 1, the threads of a vmProcess count from 2.
+    vmThreadId getId() const { return id_; }
     void setId(vmThreadId id) {
+        id_ = id;
     }
 
     bool isInited() const {
@@ -294,17 +789,101 @@ public:
         image_.setting(imageStart, imageSize, imageEntry);
     }
 
-    void create(size_type stackSize = kDefaultStackSize) {
-        stack_.create(stackSize);
-        callstack_.create(stackSize);
+    vmDecodedImage * getDecodedImage() const { return decoded_; }
+    void setDecodedImage(vmDecodedImage * decoded) {
+        decoded_ = decoded;
+        invokeEntry_ = nullptr;
+    }
+
+    vmSuperInstProfiler * getSuperInstProfiler() const { return superInst_; }
+    void setSuperInstProfiler(vmSuperInstProfiler * superInst) {
+        superInst_ = superInst;
+    }
+
+    vmExecPlan * getExecPlan() const { return plan_; }
+    void setExecPlan(vmExecPlan * plan) {
+        plan_ = plan;
+    }
+
+    vmTierManager * getTierManager() const { return tierManager_; }
+    void setTierManager(vmTierManager * tierManager) {
+        tierManager_ = tierManager;
+    }
+
+    vmMemoizer * getMemoizer() const { return memoizer_; }
+    void setMemoizer(vmMemoizer * memoizer) {
+        memoizer_ = memoizer;
+    }
+
+    vmExecProfiler * getExecProfiler() const { return profiler_; }
+    void setExecProfiler(vmExecProfiler * profiler) {
+        profiler_ = profiler;
+    }
+
+    vmSampler * getSampler() const { return sampler_; }
+    void setSampler(vmSampler * sampler) {
+        sampler_ = sampler;
+    }
+
+    //
+    // The stacks are mapped, the pages are only committed when they are
+    // used, see vmStack.
+    //
+    void create(size_type stackSize = kDefaultStackSize, bool hugePages = false) {
+        stack_.create(stackSize, hugePages);
+        callstack_.create(stackSize, hugePages);
     }
 
     void destroy() {
         callstack_.destroy();
         stack_.destroy();
+        gc_.reset();
+        heap_.destroy();
         image_.clear();
     }
 
+    //
+    // Make a used context as good as a new one for the same image: the
+    // registers and the stacks are emptied, nothing is freed.
+    //
+    void reset() {
+        ctx_reg_type::clear();
+        stack_.reset();
+        callstack_.reset();
+        gc_.reset();
+        heap_.reset();
+        entryArgSize_ = 0;
+        entryFastFrame_ = false;
+        sliceBudget_ = 0;
+        sliceLimit_ = nullptr;
+    }
+
+    // The guest heap of the alloc and free instructions, it's emptied by reset().
+    vmHeap<basic_type> & getHeap() { return heap_; }
+    vmHeapStats getHeapStats() const { return heap_.getStats(); }
+
+    // The collected objects of new_obj, they live in the same heap.
+    vmGcHeap<basic_type> & getGc() { return gc_; }
+    vmGcStats getGcStats() const { return gc_.getStats(); }
+
+    //
+    // The guest frames of the last run that returned Stack_Overflow, the
+    // innermost kOverflowFrames of them, and how many there were. Empty
+    // if they couldn't be found, see find_overflow_frames().
+    //
+    const vmCallStack & getOverflowStack() const { return overflowStack_; }
+    size_t getOverflowDepth() const { return overflowDepth_; }
+
+    void backtrace(std::string & trace, const vmSymbolTable * symbols) const {
+        overflowStack_.backtrace(trace, image_.getStart(), symbols);
+        if (overflowDepth_ > overflowStack_.size()) {
+            char buf[64];
+            snprintf(buf, sizeof(buf), "  ... %u frames\n",
+                     (uint32_t)(overflowDepth_ - overflowStack_.size()));
+            trace += buf;
+        }
+    }
+
     unsigned char * getIP() const {
         return ip_.ptr();
     }
@@ -317,7 +896,19 @@ public:
         return (uint32_t)(ptrdiff_t)(ip.ptr() - image_.getStart());
     }
 
+    uint32_t getIpOffset(const void * ip) {
+        return (uint32_t)(ptrdiff_t)((const unsigned char *)ip - image_.getStart());
+    }
+
+    // The offset of ip in a trace line, it's not computed when nothing is traced.
+    JM_FORCEINLINE uint32_t getTraceOffset(vmImagePtr & ip) {
+        return (trace_policy::kEnabled ? getIpOffset(ip) : 0);
+    }
+
     bool fp_isOverflow(vmStackPtr & fp) const {
+        // A slice runs on the stack of its fiber, see execute_slice().
+        if (sliceLimit_ != nullptr)
+            return (fp.ptr() >= sliceLimit_);
         if (stack_.isBackwardPtr())
             return (fp.ptr() <= stack_.first());
         else
@@ -360,6 +951,24 @@ public:
         return returnIP;
     }
 
+    //
+    // fast_call + ret_n of the same local size: move the outgoing arguments
+    // (the top argSize bytes of the locals) down over the incoming ones, the
+    // frame and the return IP are reused. The other locals of the caller's
+    // caller are left as they are.
+    //
+    JM_FORCEINLINE void tail_callstack_fast(vmFramePtr & fp, int32_t localSize, int32_t argSize) {
+        assert(argSize >= 0 && argSize <= localSize);
+#if USE_FORWARD_STACK_PTR
+        unsigned char * frame = fp.ptr();
+        memmove((void *)(frame - sizeof(void *) - argSize),
+                (const void *)(frame + localSize - argSize), argSize);
+#else
+        unsigned char * frame = fp.ptr();
+        memmove((void *)(frame + sizeof(void *)), (const void *)(frame - argSize), argSize);
+#endif
+    }
+
     JM_FORCEINLINE void inline_push_callstack(vmFramePtr & fp, vmStackPtr & cp,
                                               void * returnIP, intptr_t localSize, int retType) {
         void * framePoint = fp.get<void *>();
@@ -470,7 +1079,7 @@ public:
     // error inst.
     //
     JM_FORCEINLINE void op_error(vmImagePtr & ip) {
-        console.trace("%08X:  error", getIpOffset(ip));
+        VM_TRACE("%08X:  error", getIpOffset(ip));
         ip.next();
     }
 
@@ -482,8 +1091,8 @@ public:
         int32_t value = fp.getArgValueUInt32(index);
         sp.writeInt32(value);
 
-        console.trace("%08X:  push args[%d]  (0x%08X, int32)",
-                      getIpOffset(ip), getArgIndex(index), value);
+        VM_TRACE("%08X:  push args[%d]  (0x%08X, int32)",
+                 getIpOffset(ip), getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -493,7 +1102,7 @@ public:
     JM_FORCEINLINE void op_push_i32(vmImagePtr & ip, vmStackPtr & sp) {
         int32_t value = ip.getValue<0, int32_t>();
         sp.writeInt32(value);
-        console.trace("%08X:  push_i32 0x%08X (int32)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  push_i32 0x%08X (int32)", getIpOffset(ip), value);
         ip.next(1 + sizeof(int32_t));
     }
 
@@ -503,7 +1112,7 @@ public:
     JM_FORCEINLINE void op_push_i64(vmImagePtr & ip, vmStackPtr & sp) {
         int64_t value = ip.getValue<0, int64_t>();
         sp.writeInt64(value);
-        console.trace("%08X:  push_i64 0x%016X (int64)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  push_i64 0x%016X (int64)", getIpOffset(ip), value);
         ip.next(1 + sizeof(int64_t));
     }
 
@@ -513,7 +1122,7 @@ public:
     JM_FORCEINLINE void op_push_i32_0(vmImagePtr & ip, vmStackPtr & sp) {
         int32_t value = 0;
         sp.writeInt32(value);
-        console.trace("%08X:  push_i32_0 (int32)", getIpOffset(ip));
+        VM_TRACE("%08X:  push_i32_0 (int32)", getIpOffset(ip));
         ip.next();
     }
 
@@ -523,7 +1132,7 @@ public:
     JM_FORCEINLINE void op_push_i64_0(vmImagePtr & ip, vmStackPtr & sp) {
         int64_t value = 0;
         sp.writeInt64(value);
-        console.trace("%08X:  push_i64_0 (int64)", getIpOffset(ip));
+        VM_TRACE("%08X:  push_i64_0 (int64)", getIpOffset(ip));
         ip.next();
     }
 
@@ -532,8 +1141,7 @@ public:
     //
     JM_FORCEINLINE void op_pop(vmImagePtr & ip, vmStackPtr & sp) {
         sp.backUInt32();
-        uint32_t value = sp.getUInt32();
-        console.trace("%08X:  pop  (0x%08X)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  pop  (0x%08X)", getIpOffset(ip), sp.getUInt32());
         ip.next();
     }
 
@@ -542,8 +1150,7 @@ public:
     //
     JM_FORCEINLINE void op_pop_i32(vmImagePtr & ip, vmStackPtr & sp) {
         sp.backInt32();
-        int32_t value = sp.getInt32();
-        console.trace("%08X:  pop_i32  (0x%08X)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  pop_i32  (0x%08X)", getIpOffset(ip), sp.getInt32());
         ip.next();
     }
 
@@ -552,8 +1159,7 @@ public:
     //
     JM_FORCEINLINE void op_pop_i64(vmImagePtr & ip, vmStackPtr & sp) {
         sp.backInt64();
-        int64_t value = sp.getInt64();
-        console.trace("%08X:  pop_i64  (0x%016X)", getIpOffset(ip), value);
+        VM_TRACE("%08X:  pop_i64  (0x%016X)", getIpOffset(ip), sp.getInt64());
         ip.next();
     }
 
@@ -564,7 +1170,7 @@ public:
         uint8_t localSize = ip.getValue<0, uint8_t>();
         sp.next(localSize);
 
-        console.trace("%08X:  add_sp %u", getIpOffset(ip), (uint32_t)localSize);
+        VM_TRACE("%08X:  add_sp %u", getIpOffset(ip), (uint32_t)localSize);
         ip.next(1 + sizeof(uint8_t));
     }
 
@@ -573,7 +1179,7 @@ public:
     //
     JM_FORCEINLINE void op_add_sp_4(vmImagePtr & ip, vmStackPtr & sp) {
         sp.next(sizeof(uint32_t));
-        console.trace("%08X:  add_sp_4", getIpOffset(ip));
+        VM_TRACE("%08X:  add_sp_4", getIpOffset(ip));
         ip.next();
     }
 
@@ -583,7 +1189,7 @@ public:
     JM_FORCEINLINE void op_load_eax(vmImagePtr & ip, vmFramePtr & fp, Register & regs) {
         uint32_t value = ip.getValue<0, uint32_t>();
         regs.eax.u32 = value;
-        console.trace("%08X:  load eax, 0x%08X", getIpOffset(ip), value);
+        VM_TRACE("%08X:  load eax, 0x%08X", getIpOffset(ip), value);
         ip.next(1 + sizeof(uint32_t));
     }
 
@@ -594,8 +1200,8 @@ public:
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = ip.getValue<0, uint32_t, uint32_t, 2>();
         fp.putArgValueUInt32(index, value);
-        console.trace("%08X:  store args[%d], 0x%08X",
-                      getIpOffset(ip), getArgIndex(index), value);
+        VM_TRACE("%08X:  store args[%d], 0x%08X",
+                 getIpOffset(ip), getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t) + sizeof(uint32_t));
     }
 
@@ -607,8 +1213,8 @@ public:
         int8_t index2 = ip.getValue<0, int8_t, int8_t, 2>();
         uint32_t value = fp.getArgValueUInt32(index2);
         fp.putArgValueUInt32(index1, value);
-        console.trace("%08X:  move args[%d], args[%d] - 0x%08X",
-                      getIpOffset(ip), getArgIndex(index1), getArgIndex(index2), value);
+        VM_TRACE("%08X:  move args[%d], args[%d] - 0x%08X",
+                 getIpOffset(ip), getArgIndex(index1), getArgIndex(index2), value);
         ip.next(1 + sizeof(int8_t) + sizeof(int8_t));
     }
 
@@ -616,7 +1222,7 @@ public:
     // move eax, arg1
     //
     JM_FORCEINLINE void op_move_to_eax(vmImagePtr & ip, vmFramePtr & fp) {
-        console.trace("%08X:  move eax, args[%d]", getIpOffset(ip), 0);
+        VM_TRACE("%08X:  move eax, args[%d]", getIpOffset(ip), 0);
         ip.next();
     }
 
@@ -627,13 +1233,13 @@ public:
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = regs.eax.u32;
         fp.putArgValueUInt32(index, value);
-        console.trace("%08X:  copy args[%d], eax = (0x%08X)",
-                      getIpOffset(ip), getArgIndex(index), value);
+        VM_TRACE("%08X:  copy args[%d], eax = (0x%08X)",
+                 getIpOffset(ip), getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t));
     }
 
     JM_FORCEINLINE void op_cmp(vmImagePtr & ip, vmFramePtr & fp) {
-        console.trace("%08X:  cmp", getIpOffset(ip));
+        VM_TRACE("%08X:  cmp", getIpOffset(ip));
         ip.next();
     }
 
@@ -641,24 +1247,24 @@ public:
     // cmp arg0, arg1 (int32)
     //
     JM_FORCEINLINE bool op_cmp_i32(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index1 = ip.getValue<0, int8_t>();
         int8_t index2 = ip.getValue<0, int8_t, int8_t, 2>();
         int32_t value1 = fp.getArgValueInt32(index1);
         int32_t value2 = fp.getArgValueInt32(index2);
         ip.next(1 + sizeof(int8_t) * 2);
 
-        console.trace("%08X:  cmp  args[%d], args[%d] - (%d, %d) (int32)",
-                      offset, getArgIndex(index1), getArgIndex(index2),
-                      value1, value2);
+        VM_TRACE("%08X:  cmp  args[%d], args[%d] - (%d, %d) (int32)",
+                 offset, getArgIndex(index1), getArgIndex(index2),
+                 value1, value2);
 
         unsigned char jmpType = ip.getUInt8();
         bool condition = this_type::getCondition(value1, value2, jmpType);
         flags.u32.low = (uint32_t)condition;
         if (likely(!condition))
-            console.trace("%08X:  cmp  condition [false]", offset);
+            VM_TRACE("%08X:  cmp  condition [false]", offset);
         else
-            console.trace("%08X:  cmp  condition [true]", offset);
+            VM_TRACE("%08X:  cmp  condition [true]", offset);
         return condition;
     }
 
@@ -666,24 +1272,24 @@ public:
     // cmp arg0, arg1 (uint32)
     //
     JM_FORCEINLINE bool op_cmp_u32(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index1 = ip.getValue<0, int8_t>();
         int8_t index2 = ip.getValue<0, int8_t, int8_t, 2>();
         uint32_t value1 = fp.getArgValueUInt32(index1);
         uint32_t value2 = fp.getArgValueUInt32(index2);
         ip.next(1 + sizeof(int8_t) * 2);
 
-        console.trace("%08X:  cmp  args[%d], args[%d] - (%u, %u) (uint32)",
-                      offset, getArgIndex(index1), getArgIndex(index2),
-                      value1, value2);
+        VM_TRACE("%08X:  cmp  args[%d], args[%d] - (%u, %u) (uint32)",
+                 offset, getArgIndex(index1), getArgIndex(index2),
+                 value1, value2);
 
         unsigned char jmpType = ip.getUInt8();
         bool condition = this_type::getCondition(value1, value2, jmpType);
         flags.u32.low = (uint32_t)condition;
         if (likely(!condition))
-            console.trace("%08X:  cmp  condition [false]", offset);
+            VM_TRACE("%08X:  cmp  condition [false]", offset);
         else
-            console.trace("%08X:  cmp  condition [true]", offset);
+            VM_TRACE("%08X:  cmp  condition [true]", offset);
         return condition;
     }
 
@@ -691,22 +1297,22 @@ public:
     // cmp arg0, 0x00000008 (int32)
     //
     JM_FORCEINLINE bool op_cmp_imm_i32(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         int32_t value1 = fp.getArgValueInt32(index);
         int32_t value2 = ip.getValue<0, int32_t, int32_t, 2>();
         ip.next(1 + sizeof(int8_t) + sizeof(int32_t));
 
-        console.trace("%08X:  cmp  args[%d], 0x%08X (int32)",
-                      offset, getArgIndex(index), value2);
+        VM_TRACE("%08X:  cmp  args[%d], 0x%08X (int32)",
+                 offset, getArgIndex(index), value2);
 
         unsigned char jmpType = ip.getUInt8();
         bool condition = this_type::getCondition(value1, value2, jmpType);
         flags.u32.low = (uint32_t)condition;
         if (likely(!condition))
-            console.trace("%08X:  cmp  condition [false]", offset);
+            VM_TRACE("%08X:  cmp  condition [false]", offset);
         else
-            console.trace("%08X:  cmp  condition [true]", offset);
+            VM_TRACE("%08X:  cmp  condition [true]", offset);
         return condition;
     }
 
@@ -714,27 +1320,27 @@ public:
     // cmp arg0, 0x00000008 (uint32)
     //
     JM_FORCEINLINE bool op_cmp_imm_u32(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value1 = fp.getArgValueUInt32(index);
         uint32_t value2 = ip.getValue<0, uint32_t, uint32_t, 2>();
         ip.next(1 + sizeof(int8_t) + sizeof(uint32_t));
 
-        console.trace("%08X:  cmp  args[%d], 0x%08X (uint32)",
-                      offset, getArgIndex(index), value2);
+        VM_TRACE("%08X:  cmp  args[%d], 0x%08X (uint32)",
+                 offset, getArgIndex(index), value2);
 
         unsigned char jmpType = ip.getUInt8();
         bool condition = this_type::getCondition(value1, value2, jmpType);
         flags.u32.low = (uint32_t)condition;
         if (likely(!condition))
-            console.trace("%08X:  cmp  condition [false]", offset);
+            VM_TRACE("%08X:  cmp  condition [false]", offset);
         else
-            console.trace("%08X:  cmp  condition [true]", offset);
+            VM_TRACE("%08X:  cmp  condition [true]", offset);
         return condition;
     }
 
     JM_FORCEINLINE void op_jl(vmImagePtr & ip) {
-        console.trace("%08X:  jl", getIpOffset(ip));
+        VM_TRACE("%08X:  jl", getIpOffset(ip));
         ip.next();
     }
 
@@ -742,17 +1348,16 @@ public:
     // jl_near 0x06
     //
     JM_FORCEINLINE bool op_jl_near(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t jmpOffset = ip.getValue<0, int8_t>();
         if (likely(flags.u32.low != (uint32_t)true)) {
             ip.next(1 + sizeof(int8_t));
-            uint32_t jmpEntry = getIpOffset(ip) + jmpOffset;
-            console.trace("%08X:  jl   0x%08X (near)", offset, jmpEntry);
+            VM_TRACE("%08X:  jl   0x%08X (near)", offset, getIpOffset(ip) + jmpOffset);
             return false;
         }
         else {
             ip.next(1L + sizeof(int8_t) + jmpOffset);
-            console.trace("%08X:  jl   0x%08X (near)\n", offset, getIpOffset(ip));
+            VM_TRACE("%08X:  jl   0x%08X (near)\n", offset, getIpOffset(ip));
             return true;
         }
     }
@@ -761,17 +1366,16 @@ public:
     // jl_short 0x16, 0x00
     //
     JM_FORCEINLINE bool op_jl_short(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t jmpOffset = ip.getValue<0, int16_t>();
         if (likely(flags.u32.low != (uint32_t)true)) {
             ip.next(1 + sizeof(int16_t));
-            uint32_t jmpEntry = getIpOffset(ip) + jmpOffset;
-            console.trace("%08X:  jl   0x%08X (short)", offset, jmpEntry);
+            VM_TRACE("%08X:  jl   0x%08X (short)", offset, getIpOffset(ip) + jmpOffset);
             return false;
         }
         else {
             ip.next(1L + sizeof(int16_t) + jmpOffset);
-            console.trace("%08X:  jl   0x%08X (short)\n", offset, getIpOffset(ip));
+            VM_TRACE("%08X:  jl   0x%08X (short)\n", offset, getIpOffset(ip));
             return true;
         }
     }
@@ -780,17 +1384,16 @@ public:
     // jl_long 0x29, 0x00, 0x00, 0x00
     //
     JM_FORCEINLINE bool op_jl_long(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int32_t jmpOffset = ip.getValue<0, int32_t>();
         if (likely(flags.u32.low != (uint32_t)true)) {
             ip.next(1 + sizeof(int32_t));
-            uint32_t jmpEntry = getIpOffset(ip) + jmpOffset;
-            console.trace("%08X:  jl   0x%08X (long)", offset, jmpEntry);
+            VM_TRACE("%08X:  jl   0x%08X (long)", offset, getIpOffset(ip) + jmpOffset);
             return false;
         }
         else {
-            ip.next(1L + sizeof(int8_t) + jmpOffset);
-            console.trace("%08X:  jl   0x%08X (long)\n", offset, getIpOffset(ip));
+            ip.next(1L + sizeof(int32_t) + jmpOffset);
+            VM_TRACE("%08X:  jl   0x%08X (long)\n", offset, getIpOffset(ip));
             return true;
         }
     }
@@ -799,47 +1402,47 @@ public:
     // jmp 0x00102030 (ptr32)
     //
     JM_FORCEINLINE void op_jmp(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t jmpEntry = ip.getValue<0, uint32_t>();
         ip.set(image_.getStart() + jmpEntry);
-        console.trace("%08X:  jmp  0x%08X (ptr32)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  jmp  0x%08X (ptr32)\n", offset, getIpOffset(ip));
     }
 
     //
     // jmp_near 0x08
     //
     JM_FORCEINLINE void op_jmp_near(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t jmpOffset = ip.getValue<0, int8_t>();
         ip.next(1L + sizeof(int8_t) + jmpOffset);
-        console.trace("%08X:  jmp  0x%08X (near)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  jmp  0x%08X (near)\n", offset, getIpOffset(ip));
     }
 
     //
     // jmp_short 0x08, 0x00
     //
     JM_FORCEINLINE void op_jmp_short(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t jmpOffset = ip.getValue<0, int16_t>();
         ip.next(1L + sizeof(int16_t) + jmpOffset);
-        console.trace("%08X:  jmp  0x%08X (short)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  jmp  0x%08X (short)\n", offset, getIpOffset(ip));
     }
 
     //
     // jmp_long 0x18, 0x00, 0x00, 0x00
     //
     JM_FORCEINLINE void op_jmp_long(vmImagePtr & ip) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int32_t jmpOffset = ip.getValue<0, int32_t>();
         ip.next(1L + sizeof(int32_t) + jmpOffset);
-        console.trace("%08X:  jmp  0x%08X (long)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  jmp  0x%08X (long)\n", offset, getIpOffset(ip));
     }
 
     //
     // call 0x00102030 (ptr32)
     //
     JM_FORCEINLINE void op_call(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t callEntry = ip.getValue<0, uint32_t>();
         uint16_t localSize = ip.getValue<0, uint16_t, uint16_t, 5>();
         ip.next(1 + sizeof(uint32_t) + sizeof(uint16_t));
@@ -851,15 +1454,15 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X, %u (ptr32)\n",
-                      offset, (uint32_t)localSize, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X, %u (ptr32)\n",
+                 offset, (uint32_t)localSize, getIpOffset(ip));
     }
 
     //
     // call_short 0x08, 0x00, 0x08, 0x00
     //
     JM_FORCEINLINE void op_call_short(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t callOffset = ip.getValue<0, int16_t>();
         uint16_t localSize = ip.getValue<0, uint16_t, uint16_t, 3>();
         ip.next(1 + sizeof(int16_t) + sizeof(uint16_t));
@@ -871,15 +1474,15 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X, %u (short)\n",
-                      offset, (uint32_t)localSize, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X, %u (short)\n",
+                 offset, (uint32_t)localSize, getIpOffset(ip));
     }
 
     //
     // call_long 0x18, 0x00, 0x00, 0x00, 0x08, 0x00
     //
     JM_FORCEINLINE void op_call_long(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int32_t callOffset = ip.getValue<0, int32_t>();
         uint16_t localSize = ip.getValue<0, uint16_t, uint16_t, 5>();
         ip.next(1 + sizeof(int32_t) + sizeof(uint16_t));
@@ -891,15 +1494,15 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X, %u (long)\n",
-                      offset, (uint32_t)localSize, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X, %u (long)\n",
+                 offset, (uint32_t)localSize, getIpOffset(ip));
     }
 
     //
     // fast_call_short 0x05, 0x00, 0x08, 0x00
     //
     JM_FORCEINLINE void op_fast_call_short(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t callOffset = ip.getValue<0, int16_t>();
         uint16_t localSize = ip.getValue<0, uint16_t, uint16_t, 3>();
         ip.next(1 + sizeof(int16_t) + sizeof(uint16_t));
@@ -911,24 +1514,43 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  fast_call 0x%08X, %u (short)\n",
-                      offset, (uint32_t)localSize, getIpOffset(ip));
+        VM_TRACE("%08X:  fast_call 0x%08X, %u (short)\n",
+                 offset, (uint32_t)localSize, getIpOffset(ip));
+    }
+
+    //
+    // fast_tail_call_short 0x05, 0x00, 0x08, 0x00
+    //
+    JM_FORCEINLINE void op_fast_tail_call_short(vmImagePtr & ip, vmFramePtr & fp) {
+        uint32_t offset = getTraceOffset(ip);
+        int16_t callOffset = ip.getValue<0, int16_t>();
+        uint16_t localSize = ip.getValue<0, uint16_t, uint16_t, 3>();
+        ip.next(1 + sizeof(int16_t) + sizeof(uint16_t));
+
+        tail_callstack_fast(fp, localSize, localSize);
+
+        void * newIP = PointerAdd(ip.get<void *>(), callOffset);
+        assert(CHECK_ADDR_ALIGNMENT(newIP));
+        ip.set(newIP);
+
+        VM_TRACE("%08X:  fast_tail_call 0x%08X, %u (short)\n",
+                 offset, (uint32_t)localSize, getIpOffset(ip));
     }
 
     //
     // ret
     //
     JM_FORCEINLINE bool op_ret(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         void * returnIP = pop_callstack(fp);
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret  0x%08X\n", offset, getIpOffset(ip));
+            VM_TRACE("%08X:  ret  0x%08X\n", offset, getIpOffset(ip));
             return false;
         }
         else {
-            console.trace("%08X:  ret  (done)\n", offset);
+            VM_TRACE("%08X:  ret  (done)\n", offset);
             return true;
         }
     }
@@ -937,17 +1559,17 @@ public:
     // ret_n_sm 0x08
     //
     JM_FORCEINLINE bool op_ret_n_sm(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint8_t localSize = ip.getValue<0, uint8_t>();
         void * returnIP = pop_callstack_fast(fp, localSize);
         ip.set(returnIP);
 
         if (returnIP == nullptr) {
-            console.trace("%08X:  ret_n_sm [%u] (done)\n\n", offset, (uint32_t)localSize);
+            VM_TRACE("%08X:  ret_n_sm [%u] (done)\n\n", offset, (uint32_t)localSize);
         }
         else {
-            console.trace("%08X:  ret_n_sm [%u] 0x%08X\n",
-                          offset, (uint32_t)localSize, getIpOffset(ip));
+            VM_TRACE("%08X:  ret_n_sm [%u] 0x%08X\n",
+                     offset, (uint32_t)localSize, getIpOffset(ip));
         }
 
         return (returnIP == nullptr);
@@ -957,17 +1579,17 @@ public:
     // ret_n 0x08, 0x00
     //
     JM_FORCEINLINE bool op_ret_n(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint16_t localSize = ip.getValue<0, uint16_t>();
         void * returnIP = pop_callstack_fast(fp, localSize);
         ip.set(returnIP);
 
         if (returnIP == nullptr) {
-            console.trace("%08X:  ret_n [%u] (done)\n\n", offset, (uint32_t)localSize);
+            VM_TRACE("%08X:  ret_n [%u] (done)\n\n", offset, (uint32_t)localSize);
         }
         else {
-            console.trace("%08X:  ret_n [%u] 0x%08X\n",
-                          offset, (uint32_t)localSize, getIpOffset(ip));
+            VM_TRACE("%08X:  ret_n [%u] 0x%08X\n",
+                     offset, (uint32_t)localSize, getIpOffset(ip));
         }
 
         return (returnIP == nullptr);
@@ -977,7 +1599,7 @@ public:
     // ret_eax 0x00000001
     //
     JM_FORCEINLINE bool op_ret_eax(vmImagePtr & ip, vmFramePtr & fp, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t value = ip.getValue<0, uint32_t>();
         regs.eax.u32 = value;
 
@@ -985,12 +1607,12 @@ public:
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret_eax 0x%08X (eax = 0x%08X)",
-                          offset, getIpOffset(ip), value);
+            VM_TRACE("%08X:  ret_eax 0x%08X (eax = 0x%08X)",
+                     offset, getIpOffset(ip), value);
             return false;
         }
         else {
-            console.trace("%08X:  ret_eax (done) (eax = 0x%08X)\n", offset, value);
+            VM_TRACE("%08X:  ret_eax (done) (eax = 0x%08X)\n", offset, value);
             return true;
         }
     }
@@ -999,7 +1621,7 @@ public:
     // ret_eax_n 0x08, 0x00, 0x00000001
     //
     JM_FORCEINLINE bool op_ret_eax_n(vmImagePtr & ip, vmFramePtr & fp, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint16_t localSize = ip.getValue<0, uint16_t>();
         uint32_t value = ip.getValue<0, uint32_t, uint32_t, 3>();
         regs.eax.u32 = value;
@@ -1008,13 +1630,13 @@ public:
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret_eax_n [%u] 0x%08X (eax = 0x%08X)\n",
-                          offset, (uint32_t)localSize, getIpOffset(ip), value);
+            VM_TRACE("%08X:  ret_eax_n [%u] 0x%08X (eax = 0x%08X)\n",
+                     offset, (uint32_t)localSize, getIpOffset(ip), value);
             return false;
         }
         else {
-            console.trace("%08X:  ret_eax_n [%u] (eax = 0x%08X) (done)\n",
-                          offset, (uint32_t)localSize, value);
+            VM_TRACE("%08X:  ret_eax_n [%u] (eax = 0x%08X) (done)\n",
+                     offset, (uint32_t)localSize, value);
             return true;
         }
     }
@@ -1024,7 +1646,7 @@ public:
     //
     JM_FORCEINLINE void op_inline_call_near(vmImagePtr & ip, vmFramePtr & fp,
                                             vmStackPtr & cp, int retType) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t callOffset = ip.getValue<0, int8_t>();
         ip.next(1 + sizeof(int8_t));
 
@@ -1035,7 +1657,7 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X (near)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X (near)\n", offset, getIpOffset(ip));
     }
 
     //
@@ -1043,7 +1665,7 @@ public:
     //
     JM_FORCEINLINE void op_inline_call_short(vmImagePtr & ip, vmFramePtr & fp,
                                              vmStackPtr & cp, int retType) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t callOffset = ip.getValue<0, int16_t>();
         uint16_t localSize = ip.getValue<0, uint16_t, uint16_t, 3>();
         ip.next(1 + sizeof(int16_t) + sizeof(uint16_t));
@@ -1055,8 +1677,8 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  fast_call 0x%08X, %u (short)\n",
-                      offset, (uint32_t)localSize, getIpOffset(ip));
+        VM_TRACE("%08X:  fast_call 0x%08X, %u (short)\n",
+                 offset, (uint32_t)localSize, getIpOffset(ip));
     }
 
     //
@@ -1064,7 +1686,7 @@ public:
     //
     JM_FORCEINLINE void op_inline_fast_call_short(vmImagePtr & ip, vmFramePtr & fp,
                                                   vmStackPtr & cp, int retType) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int16_t callOffset = ip.getValue<0, int16_t>();
         uint16_t localSize = ip.getValue<0, uint16_t, uint16_t, 3>();
         ip.next(1 + sizeof(int16_t) + sizeof(uint16_t));
@@ -1076,8 +1698,8 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  fast_call 0x%08X, %u (short)\n",
-                      offset, (uint32_t)localSize, getIpOffset(ip));
+        VM_TRACE("%08X:  fast_call 0x%08X, %u (short)\n",
+                 offset, (uint32_t)localSize, getIpOffset(ip));
     }
 
     //
@@ -1085,7 +1707,7 @@ public:
     //
     JM_FORCEINLINE void op_inline_call_long(vmImagePtr & ip, vmFramePtr & fp,
                                             vmStackPtr & cp, int retType) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int32_t callOffset = ip.getValue<0, int32_t>();
         ip.next(1 + sizeof(int32_t));
 
@@ -1096,7 +1718,7 @@ public:
         assert(CHECK_ADDR_ALIGNMENT(newIP));
         ip.set(newIP);
 
-        console.trace("%08X:  call 0x%08X (long)\n", offset, getIpOffset(ip));
+        VM_TRACE("%08X:  call 0x%08X (long)\n", offset, getIpOffset(ip));
     }
 
     //
@@ -1104,18 +1726,18 @@ public:
     //
     JM_FORCEINLINE int op_inline_ret(vmImagePtr & ip, vmFramePtr & fp,
                                      vmStackPtr & cp, bool & done) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
 
         int retType;
         void * returnIP = inline_pop_callstack(fp, cp, retType);
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret  0x%08X\n", offset, getIpOffset(ip));
+            VM_TRACE("%08X:  ret  0x%08X\n", offset, getIpOffset(ip));
             done = false;
         }
         else {
-            console.trace("%08X:  ret  (done)\n", offset);
+            VM_TRACE("%08X:  ret  (done)\n", offset);
             done = true;
         }
 
@@ -1127,7 +1749,7 @@ public:
     //
     JM_FORCEINLINE int op_inline_ret_n(vmImagePtr & ip, vmFramePtr & fp,
                                        vmStackPtr & cp, bool & done) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint16_t localSize = ip.getValue<0, uint16_t>();
 
         int retType;
@@ -1135,12 +1757,12 @@ public:
         ip.set(returnIP);
 
         if (returnIP != nullptr) {
-            console.trace("%08X:  ret_n [%u] 0x%08X\n",
-                          offset, (uint32_t)localSize, getIpOffset(ip));
+            VM_TRACE("%08X:  ret_n [%u] 0x%08X\n",
+                     offset, (uint32_t)localSize, getIpOffset(ip));
             done = false;
         }
         else {
-            console.trace("%08X:  ret_n [%u] (done)\n\n", offset, (uint32_t)localSize);
+            VM_TRACE("%08X:  ret_n [%u] (done)\n\n", offset, (uint32_t)localSize);
             done = true;
         }
 
@@ -1152,7 +1774,7 @@ public:
     //
     JM_FORCEINLINE int op_inline_ret_eax_n(vmImagePtr & ip, vmFramePtr & fp, vmStackPtr & cp,
                                            Register & regs, bool & done) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint16_t localSize = ip.getValue<0, uint16_t>();
         uint32_t value = ip.getValue<0, uint32_t, uint32_t, 3>();
         regs.eax.u32 = value;
@@ -1162,12 +1784,12 @@ public:
         ip.set(returnIP);
 
         if (returnIP == nullptr) {
-            console.trace("%08X:  ret_eax_n %u (done) (eax = 0x%08X)",
-                          offset, (uint32_t)localSize, value);
+            VM_TRACE("%08X:  ret_eax_n %u (done) (eax = 0x%08X)",
+                     offset, (uint32_t)localSize, value);
         }
         else {
-            console.trace("%08X:  ret_eax_n %u, 0x%08X (eax = 0x%08X)",
-                          offset, getIpOffset(ip), (uint32_t)localSize, value);
+            VM_TRACE("%08X:  ret_eax_n %u, 0x%08X (eax = 0x%08X)",
+                     offset, getIpOffset(ip), (uint32_t)localSize, value);
         }
 
         done = (returnIP == nullptr);
@@ -1178,7 +1800,7 @@ public:
     // nop
     //
     JM_FORCEINLINE void op_nop(vmImagePtr & ip) {
-        console.trace("%08X:  nop", getIpOffset(ip));
+        VM_TRACE("%08X:  nop", getIpOffset(ip));
         ip.next();
     }
 
@@ -1187,7 +1809,7 @@ public:
     //
     JM_FORCEINLINE void op_nop_n(vmImagePtr & ip) {
         uint8_t skip_n = ip.getValue<0, uint8_t>();
-        console.trace("%08X:  nop_n %u", getIpOffset(ip), (uint32_t)skip_n);
+        VM_TRACE("%08X:  nop_n %u", getIpOffset(ip), (uint32_t)skip_n);
         ip.next(1 + sizeof(uint8_t) + skip_n);
     }
 
@@ -1195,14 +1817,14 @@ public:
     // inc arg0
     //
     JM_FORCEINLINE void op_inc(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = fp.getArgValueUInt32(index);
         value++;
         fp.putArgValueUInt32(index, value);
 
-        console.trace("%08X:  inc  arg[%d]  (0x%08X)",
-                      offset, getArgIndex(index), value);
+        VM_TRACE("%08X:  inc  arg[%d]  (0x%08X)",
+                 offset, getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -1210,14 +1832,14 @@ public:
     // dec arg0
     //
     JM_FORCEINLINE void op_dec(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = fp.getArgValueUInt32(index);
         value--;
         fp.putArgValueUInt32(index, value);
 
-        console.trace("%08X:  dec  args[%d]  (0x%08X)",
-                      offset, getArgIndex(index), value);
+        VM_TRACE("%08X:  dec  args[%d]  (0x%08X)",
+                 offset, getArgIndex(index), value);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -1225,7 +1847,7 @@ public:
     // add arg0, arg1
     //
     JM_FORCEINLINE void op_add(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index1 = ip.getValue<0, int8_t>();
         int8_t index2 = ip.getValue<0, int8_t, int8_t, 2>();
         uint32_t value1 = fp.getArgValueUInt32(index1);
@@ -1234,9 +1856,9 @@ public:
         uint32_t newValue = value1 + value2;
         fp.putArgValueUInt32(index1, newValue);
 
-        console.trace("%08X:  add  args[%d], args[%d] = (0x%08X)",
-                      offset, getArgIndex(index1), getArgIndex(index2),
-                      newValue);
+        VM_TRACE("%08X:  add  args[%d], args[%d] = (0x%08X)",
+                 offset, getArgIndex(index1), getArgIndex(index2),
+                 newValue);
         ip.next(1 + sizeof(int8_t) * 2);
     }
 
@@ -1244,7 +1866,7 @@ public:
     // add arg0, 0x00000006
     //
     JM_FORCEINLINE void op_add_imm(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value2 = ip.getValue<0, uint32_t, uint32_t, 2>();
         uint32_t value1 = fp.getArgValueUInt32(index);
@@ -1252,8 +1874,8 @@ public:
         uint32_t newValue = value1 + value2;
         fp.putArgValueUInt32(index, newValue);
 
-        console.trace("%08X:  add  args[%d], 0x%08X = (0x%08X)",
-                      offset, getArgIndex(index), value2, newValue);
+        VM_TRACE("%08X:  add  args[%d], 0x%08X = (0x%08X)",
+                 offset, getArgIndex(index), value2, newValue);
         ip.next(1 + sizeof(int8_t) + sizeof(uint32_t));
     }
 
@@ -1261,15 +1883,15 @@ public:
     // add eax, arg0
     //
     JM_FORCEINLINE void op_add_eax(vmImagePtr & ip, vmFramePtr & fp, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = fp.getArgValueUInt32(index);
 
         uint32_t newValue = regs.eax.u32 + value;
         regs.eax.u32 = newValue;
 
-        console.trace("%08X:  add  eax, args[%d] = (0x%08X)",
-                      offset, getArgIndex(index), newValue);
+        VM_TRACE("%08X:  add  eax, args[%d] = (0x%08X)",
+                 offset, getArgIndex(index), newValue);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -1277,14 +1899,14 @@ public:
     // add eax, 0x00000006
     //
     JM_FORCEINLINE void op_add_eax_imm(vmImagePtr & ip, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t value = ip.getValue<0, uint32_t, uint32_t>();
 
         uint32_t newValue = regs.eax.u32 + value;
         regs.eax.u32 = newValue;
 
-        console.trace("%08X:  add  eax, 0x%08X = (0x%08X)",
-                      offset, value, newValue);
+        VM_TRACE("%08X:  add  eax, 0x%08X = (0x%08X)",
+                 offset, value, newValue);
         ip.next(1 + sizeof(uint32_t));
     }
 
@@ -1292,7 +1914,7 @@ public:
     // sub arg0, arg1
     //
     JM_FORCEINLINE void op_sub(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index1 = ip.getValue<0, int8_t>();
         int8_t index2 = ip.getValue<0, int8_t, int8_t, 2>();
         uint32_t value1 = fp.getArgValueUInt32(index1);
@@ -1300,9 +1922,9 @@ public:
         uint32_t newValue = value1 - value2;
         fp.putArgValueUInt32(index1, newValue);
 
-        console.trace("%08X:  sub  args[%d], args[%d] = (0x%08X)",
-                      offset, getArgIndex(index1), getArgIndex(index2),
-                      newValue);
+        VM_TRACE("%08X:  sub  args[%d], args[%d] = (0x%08X)",
+                 offset, getArgIndex(index1), getArgIndex(index2),
+                 newValue);
         ip.next(1 + sizeof(int8_t) * 2);
     }
 
@@ -1310,7 +1932,7 @@ public:
     // sub arg0, 0x00000006
     //
     JM_FORCEINLINE void op_sub_imm(vmImagePtr & ip, vmFramePtr & fp) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value2 = ip.getValue<0, uint32_t, uint32_t, 2>();
         uint32_t value1 = fp.getArgValueUInt32(index);
@@ -1318,8 +1940,8 @@ public:
         uint32_t newValue = value1 - value2;
         fp.putArgValueUInt32(index, newValue);
 
-        console.trace("%08X:  sub  args[%d], 0x%08X = (0x%08X)",
-                      offset, getArgIndex(index), value2, newValue);
+        VM_TRACE("%08X:  sub  args[%d], 0x%08X = (0x%08X)",
+                 offset, getArgIndex(index), value2, newValue);
         ip.next(1 + sizeof(int8_t) + sizeof(uint32_t));
     }
 
@@ -1327,14 +1949,14 @@ public:
     // sub eax, arg0
     //
     JM_FORCEINLINE void op_sub_eax(vmImagePtr & ip, vmFramePtr & fp, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         int8_t index = ip.getValue<0, int8_t>();
         uint32_t value = fp.getArgValueUInt32(index);
         uint32_t newValue = regs.eax.u32 - value;
         regs.eax.u32 = newValue;
 
-        console.trace("%08X:  sub  eax, args[%d] = (0x%08X)",
-                      offset, getArgIndex(index), newValue);
+        VM_TRACE("%08X:  sub  eax, args[%d] = (0x%08X)",
+                 offset, getArgIndex(index), newValue);
         ip.next(1 + sizeof(int8_t));
     }
 
@@ -1342,74 +1964,290 @@ public:
     // add eax, 0x00000006
     //
     JM_FORCEINLINE void op_sub_eax_imm(vmImagePtr & ip, Register & regs) {
-        uint32_t offset = getIpOffset(ip);
+        uint32_t offset = getTraceOffset(ip);
         uint32_t value = ip.getValue<0, uint32_t>();
 
         uint32_t newValue = regs.eax.u32 - value;
         regs.eax.u32 = newValue;
 
-        console.trace("%08X:  sub  eax, 0x%08X = (0x%08X)",
-                      offset, value, newValue);
+        VM_TRACE("%08X:  sub  eax, 0x%08X = (0x%08X)",
+                 offset, value, newValue);
         ip.next(1 + sizeof(uint32_t));
     }
 
     //
-    // Exit the program
+    // alloc arg0, 0x00000018
     //
-    JM_FORCEINLINE void op_exit(vmImagePtr & ip, return_type & retValue) {
-        console.trace("%08X:  end\n", getIpOffset(ip));
-        ip.next();
+    JM_FORCEINLINE void op_alloc(vmImagePtr & ip, vmFramePtr & fp) {
+        uint32_t offset = getTraceOffset(ip);
+        int8_t index = ip.getValue<0, int8_t>();
+        uint32_t size = ip.getValue<0, uint32_t, uint32_t, 2>();
+        uint32_t ref = heap_.alloc(size);
+        fp.putArgValueUInt32(index, ref);
+
+        VM_TRACE("%08X:  alloc  args[%d], 0x%08X  (0x%08X)",
+                 offset, getArgIndex(index), size, ref);
+        ip.next(1 + sizeof(int8_t) + sizeof(uint32_t));
     }
 
     //
-    // Unknown opcode.
+    // free arg0
     //
-    JM_FORCEINLINE void op_unknown(vmImagePtr & ip, unsigned char opcode) {
-        console.trace("%08X:  Error: Unknown opcode: %u", getIpOffset(ip), (uint32_t)opcode);
-        ip.next();
+    JM_FORCEINLINE void op_free(vmImagePtr & ip, vmFramePtr & fp) {
+        uint32_t offset = getTraceOffset(ip);
+        int8_t index = ip.getValue<0, int8_t>();
+        uint32_t ref = fp.getArgValueUInt32(index);
+        heap_.free(ref);
+
+        VM_TRACE("%08X:  free  args[%d]  (0x%08X)",
+                 offset, getArgIndex(index), ref);
+        ip.next(1 + sizeof(int8_t));
     }
 
     //
-    // Execute the vm bytecode.
+    // The frames from the safepoint at offset up to the entry, and the
+    // slots of each that hold references. False if one has no map, it
+    // can't be collected then.
     //
-    int execute(return_type & retVal) {
-        int ec = 0;
-        if (isInited()) {
-            register vmImagePtr ip;
-            register vmFramePtr fp;
-            register Register   regs;
+    bool gc_find_roots(uint32_t offset, unsigned char * fp) {
+#if USE_FORWARD_STACK_PTR
+        const vmStackMaps * maps = (decoded_ != nullptr) ? decoded_->getStackMaps() : nullptr;
+        // The suspended fibers' stacks aren't walked, see execute_slice().
+        if (maps == nullptr || sliceLimit_ != nullptr)
+            return false;
 
-            // Init environment
-            ip.set(image_.getPtr());
-            fp.set(stack_.current());
-            regs.uval = 0;
+        gcFrames_.clear();
+        const vmStackMaps::Map * map = maps->atSafepoint(offset);
+        while (true) {
+            if (map == nullptr)
+                return false;
+            GcFrame frame = { fp, map };
+            gcFrames_.push_back(frame);
+            void * returnIP = *(void **)(fp - sizeof(void *));
+            if (returnIP == nullptr)
+                break;
+            map = maps->atReturn(getIpOffset(returnIP));
+            if (map == nullptr)
+                return false;
+            if (map->isFastCall)
+                fp = fp - sizeof(void *) - map->callAux;
+            else
+                fp = *(unsigned char **)(fp - sizeof(void *) * 2);
+        }
 
-            // Push call program entry.
-            push_callstack(fp, nullptr, 0);
+        // The arguments of a frame are what its caller's map says, so the
+        // outermost frame goes first.
+        size_t count = gcFrames_.size();
+        gcRefs_.assign(count * 256, 0);
+        for (size_t i = count; i-- > 0; ) {
+            uint8_t * refs = &gcRefs_[i * 256];
+            const vmStackMaps::Slot * slots = maps->getSlots(gcFrames_[i].map);
+            for (uint32_t n = 0; n < gcFrames_[i].map->count; n++) {
+                if (slots[n].kind == vmStackMaps::kRef) {
+                    refs[slots[n].index + 128] = 1;
+                }
+                else if (i + 1 < count) {
+                    const uint8_t * callerRefs = &gcRefs_[(i + 1) * 256];
+                    ptrdiff_t from = slots[n].argIndex
+                        + (gcFrames_[i].fp - gcFrames_[i + 1].fp) / (ptrdiff_t)sizeof(uint32_t);
+                    if (from >= -128 && from < 128)
+                        refs[slots[n].index + 128] = callerRefs[from + 128];
+                }
+            }
+        }
+        return true;
+#else
+        return false;
+#endif
+    }
 
-            // Main loop
-            while (ip.ptr() < image_.getLimit()) {
-                unsigned char opcode = ip.getUInt8();
-                switch (opcode) {
-                case OpCode::error:
-                    op_error(ip);
-                    break;
+    //
+    // Visit the roots found by gc_find_roots(). The frames overlap, the
+    // inner frame's view of a slot is the newer one.
+    //
+    template <typename Visitor>
+    void gc_visit_roots(Visitor & visitor) {
+        for (size_t i = 0; i < gcFrames_.size(); i++) {
+            uint32_t * frame = (uint32_t *)gcFrames_[i].fp;
+            const uint8_t * refs = &gcRefs_[i * 256];
+            const uint32_t * limit = (i > 0) ? ((const uint32_t *)gcFrames_[i - 1].fp - 128) : nullptr;
+            for (int k = 0; k < 256; k++) {
+                uint32_t * slot = frame + (k - 128);
+                if (refs[k] != 0 && (limit == nullptr || slot < limit))
+                    visitor(slot);
+            }
+        }
+    }
 
-                case OpCode::load_eax:
-                    op_load_eax(ip, fp, regs);
-                    break;
+    struct GcRoots {
+        this_type * context;
 
-                case OpCode::store:
-                    op_store(ip, fp);
-                    break;
+        template <typename Visitor>
+        void visit(Visitor & visitor) {
+            context->gc_visit_roots(visitor);
+        }
+    };
 
-                case OpCode::move:
-                    op_move(ip, fp);
-                    break;
+    //
+    // The nursery is full: collect it if the frames can be walked, or
+    // else put the object in the old generation.
+    //
+    JM_NOINLINE uint32_t gc_new_slow(uint32_t offset, unsigned char * fp,
+                                     uint32_t fields, uint32_t refs) {
+        bool canCollect = gc_find_roots(offset, fp);
+        GcRoots roots = { this };
+        return gc_.allocSlow(fields, refs, roots, canCollect);
+    }
 
-                case OpCode::move_to_eax:
-                    op_move_to_eax(ip, fp);
-                    break;
+    //
+    // new_obj arg0, 4, 2  (fields, the first 2 are references)
+    //
+    JM_FORCEINLINE void op_new_obj(vmImagePtr & ip, vmFramePtr & fp) {
+        int8_t index = ip.getValue<0, int8_t>();
+        uint32_t fields = ip.getValue<0, uint8_t, uint8_t, 2>();
+        uint32_t refs = ip.getValue<0, uint8_t, uint8_t, 3>();
+        if (refs > fields)
+            refs = fields;
+        uint32_t ref = gc_.alloc(fields, refs);
+        if (unlikely(ref == 0))
+            ref = gc_new_slow(getIpOffset(ip), fp.ptr(), fields, refs);
+        fp.putArgValueUInt32(index, ref);
+
+        VM_TRACE("%08X:  new_obj  args[%d], %u, %u  (0x%08X)",
+                 getTraceOffset(ip), getArgIndex(index), fields, refs, ref);
+        ip.next(1 + sizeof(int8_t) * 3);
+    }
+
+    //
+    // ld_ref arg0, arg1, 1
+    //
+    JM_FORCEINLINE void op_ld_ref(vmImagePtr & ip, vmFramePtr & fp) {
+        uint32_t offset = getTraceOffset(ip);
+        int8_t index1 = ip.getValue<0, int8_t>();
+        int8_t index2 = ip.getValue<0, int8_t, int8_t, 2>();
+        uint32_t field = ip.getValue<0, uint8_t, uint8_t, 3>();
+        uint32_t value = gc_.loadRef(fp.getArgValueUInt32(index2), field);
+        fp.putArgValueUInt32(index1, value);
+
+        VM_TRACE("%08X:  ld_ref  args[%d], args[%d].%u  (0x%08X)",
+                 offset, getArgIndex(index1), getArgIndex(index2), field, value);
+        ip.next(1 + sizeof(int8_t) * 3);
+    }
+
+    //
+    // st_ref arg0, 1, arg1
+    //
+    JM_FORCEINLINE void op_st_ref(vmImagePtr & ip, vmFramePtr & fp) {
+        uint32_t offset = getTraceOffset(ip);
+        int8_t index1 = ip.getValue<0, int8_t>();
+        uint32_t field = ip.getValue<0, uint8_t, uint8_t, 2>();
+        int8_t index2 = ip.getValue<0, int8_t, int8_t, 3>();
+        uint32_t value = fp.getArgValueUInt32(index2);
+        gc_.storeRef(fp.getArgValueUInt32(index1), field, value);
+
+        VM_TRACE("%08X:  st_ref  args[%d].%u, args[%d]  (0x%08X)",
+                 offset, getArgIndex(index1), field, getArgIndex(index2), value);
+        ip.next(1 + sizeof(int8_t) * 3);
+    }
+
+    //
+    // ld_field arg0, arg1, 2
+    //
+    JM_FORCEINLINE void op_ld_field(vmImagePtr & ip, vmFramePtr & fp) {
+        uint32_t offset = getTraceOffset(ip);
+        int8_t index1 = ip.getValue<0, int8_t>();
+        int8_t index2 = ip.getValue<0, int8_t, int8_t, 2>();
+        uint32_t field = ip.getValue<0, uint8_t, uint8_t, 3>();
+        uint32_t value = gc_.loadValue(fp.getArgValueUInt32(index2), field);
+        fp.putArgValueUInt32(index1, value);
+
+        VM_TRACE("%08X:  ld_field  args[%d], args[%d].%u  (0x%08X)",
+                 offset, getArgIndex(index1), getArgIndex(index2), field, value);
+        ip.next(1 + sizeof(int8_t) * 3);
+    }
+
+    //
+    // st_field arg0, 2, arg1
+    //
+    JM_FORCEINLINE void op_st_field(vmImagePtr & ip, vmFramePtr & fp) {
+        uint32_t offset = getTraceOffset(ip);
+        int8_t index1 = ip.getValue<0, int8_t>();
+        uint32_t field = ip.getValue<0, uint8_t, uint8_t, 2>();
+        int8_t index2 = ip.getValue<0, int8_t, int8_t, 3>();
+        uint32_t value = fp.getArgValueUInt32(index2);
+        gc_.storeValue(fp.getArgValueUInt32(index1), field, value);
+
+        VM_TRACE("%08X:  st_field  args[%d].%u, args[%d]  (0x%08X)",
+                 offset, getArgIndex(index1), field, getArgIndex(index2), value);
+        ip.next(1 + sizeof(int8_t) * 3);
+    }
+
+    //
+    // Exit the program
+    //
+    JM_FORCEINLINE void op_exit(vmImagePtr & ip, return_type & retValue) {
+        VM_TRACE("%08X:  end\n", getIpOffset(ip));
+        ip.next();
+    }
+
+    //
+    // Unknown opcode.
+    //
+    JM_FORCEINLINE void op_unknown(vmImagePtr & ip, unsigned char opcode) {
+        VM_TRACE("%08X:  Error: Unknown opcode: %u", getIpOffset(ip), (uint32_t)opcode);
+        ip.next();
+    }
+
+    //
+    // Execute the vm bytecode, an image that's verified at load time can't
+    // run off its end, it's run without the image limit check.
+    //
+    int execute(return_type & retVal) {
+        if (decoded_ != nullptr && decoded_->isVerified())
+            return execute_guarded<vmExecutor::Bytecode>(retVal);
+        else
+            return execute_guarded<vmExecutor::Checked>(retVal);
+    }
+
+    template <bool Checked>
+    int execute_bytecode(return_type & retVal) {
+        int ec = 0;
+        if (isInited()) {
+            register vmImagePtr ip;
+            register vmFramePtr fp;
+            register Register   regs;
+
+            // Init environment
+            ip.set(image_.getPtr());
+            fp.set(stack_.current());
+            regs.uval = 0;
+
+            // Push call program entry.
+            push_callstack(fp, nullptr, 0);
+
+            // Main loop
+            while (!Checked || ip.ptr() < image_.getLimit()) {
+                unsigned char opcode = ip.getUInt8();
+                switch (opcode) {
+                case OpCode::error:
+                    op_error(ip);
+                    break;
+
+                case OpCode::load_eax:
+                    op_load_eax(ip, fp, regs);
+                    break;
+
+                case OpCode::store:
+                    op_store(ip, fp);
+                    break;
+
+                case OpCode::move:
+                    op_move(ip, fp);
+                    break;
+
+                case OpCode::move_to_eax:
+                    op_move_to_eax(ip, fp);
+                    break;
 
                 case OpCode::copy_from_eax:
                     op_copy_from_eax(ip, fp, regs);
@@ -1483,6 +2321,10 @@ public:
                     op_fast_call_short(ip, fp);
                     break;
 
+                case OpCode::fast_tail_call_short:
+                    op_fast_tail_call_short(ip, fp);
+                    break;
+
                 case OpCode::ret:
                     {
                         bool isDone = op_ret(ip, fp);
@@ -1576,6 +2418,34 @@ public:
                     op_sub_eax_imm(ip, regs);
                     break;
 
+                case OpCode::alloc:
+                    op_alloc(ip, fp);
+                    break;
+
+                case OpCode::free:
+                    op_free(ip, fp);
+                    break;
+
+                case OpCode::new_obj:
+                    op_new_obj(ip, fp);
+                    break;
+
+                case OpCode::ld_ref:
+                    op_ld_ref(ip, fp);
+                    break;
+
+                case OpCode::st_ref:
+                    op_st_ref(ip, fp);
+                    break;
+
+                case OpCode::ld_field:
+                    op_ld_field(ip, fp);
+                    break;
+
+                case OpCode::st_field:
+                    op_st_field(ip, fp);
+                    break;
+
                 case OpCode::exit:
                     op_exit(ip, retVal);
                     goto Execute_Finished;
@@ -1592,198 +2462,2844 @@ Execute_Finished:
         return ec;
     }
 
-    enum {
-        ret_first,
-        ret_00,
-        ret_01,
-        ret_02,
-        ret_last
-    };
+    //
+    // Execute the vm bytecode with threaded dispatch (computed goto).
+    //
+    // Every handler ends with its own indirect jump to the next handler,
+    // so the branch predictor gets one history per opcode instead of the
+    // single shared jump of the switch loop. There is no image limit check
+    // per instruction, so only an image vmVerifier accepted at load time is
+    // run this way, the others go to the checked switch loop.
+    //
+    int execute_threaded(return_type & retVal) {
+        if (decoded_ != nullptr && decoded_->isVerified())
+            return execute_guarded<vmExecutor::Threaded>(retVal);
+        else
+            return execute_guarded<vmExecutor::Checked>(retVal);
+    }
 
-    int execute_inline(return_type & retVal) {
+    int execute_threaded_bytecode(return_type & retVal) {
+#if USE_THREADED_DISPATCH
         int ec = 0;
         if (isInited()) {
             register vmImagePtr ip;
-            register vmStackPtr sp;
             register vmFramePtr fp;
-            register vmStackPtr cp;
             register Register   regs;
 
+            void * dispatchTable[256];
+            for (size_t i = 0; i < 256; i++) {
+                dispatchTable[i] = &&Dispatch_unknown;
+            }
+
+            dispatchTable[OpCode::error]            = &&Dispatch_error;
+            dispatchTable[OpCode::load_eax]         = &&Dispatch_load_eax;
+            dispatchTable[OpCode::store]            = &&Dispatch_store;
+            dispatchTable[OpCode::move]             = &&Dispatch_move;
+            dispatchTable[OpCode::move_to_eax]      = &&Dispatch_move_to_eax;
+            dispatchTable[OpCode::copy_from_eax]    = &&Dispatch_copy_from_eax;
+            dispatchTable[OpCode::cmp]              = &&Dispatch_cmp;
+            dispatchTable[OpCode::cmp_i32]          = &&Dispatch_cmp_i32;
+            dispatchTable[OpCode::cmp_u32]          = &&Dispatch_cmp_u32;
+            dispatchTable[OpCode::cmp_imm_i32]      = &&Dispatch_cmp_imm_i32;
+            dispatchTable[OpCode::cmp_imm_u32]      = &&Dispatch_cmp_imm_u32;
+            dispatchTable[OpCode::jl]               = &&Dispatch_jl;
+            dispatchTable[OpCode::jl_near]          = &&Dispatch_jl_near;
+            dispatchTable[OpCode::jl_short]         = &&Dispatch_jl_short;
+            dispatchTable[OpCode::jl_long]          = &&Dispatch_jl_long;
+            dispatchTable[OpCode::jmp]              = &&Dispatch_jmp;
+            dispatchTable[OpCode::jmp_near]         = &&Dispatch_jmp_near;
+            dispatchTable[OpCode::jmp_short]        = &&Dispatch_jmp_short;
+            dispatchTable[OpCode::jmp_long]         = &&Dispatch_jmp_long;
+            dispatchTable[OpCode::call]             = &&Dispatch_call;
+            dispatchTable[OpCode::call_short]       = &&Dispatch_call_short;
+            dispatchTable[OpCode::call_long]        = &&Dispatch_call_long;
+            dispatchTable[OpCode::fast_call_short]  = &&Dispatch_fast_call_short;
+            dispatchTable[OpCode::fast_tail_call_short] = &&Dispatch_fast_tail_call_short;
+            dispatchTable[OpCode::ret]              = &&Dispatch_ret;
+            dispatchTable[OpCode::ret_n_sm]         = &&Dispatch_ret_n_sm;
+            dispatchTable[OpCode::ret_n]            = &&Dispatch_ret_n;
+            dispatchTable[OpCode::ret_eax]          = &&Dispatch_ret_eax;
+            dispatchTable[OpCode::ret_eax_n]        = &&Dispatch_ret_eax_n;
+            dispatchTable[OpCode::nop]              = &&Dispatch_nop;
+            dispatchTable[OpCode::nop_n]            = &&Dispatch_nop_n;
+            dispatchTable[OpCode::inc]              = &&Dispatch_inc;
+            dispatchTable[OpCode::dec]              = &&Dispatch_dec;
+            dispatchTable[OpCode::add]              = &&Dispatch_add;
+            dispatchTable[OpCode::add_imm]          = &&Dispatch_add_imm;
+            dispatchTable[OpCode::add_eax]          = &&Dispatch_add_eax;
+            dispatchTable[OpCode::add_eax_imm]      = &&Dispatch_add_eax_imm;
+            dispatchTable[OpCode::sub]              = &&Dispatch_sub;
+            dispatchTable[OpCode::sub_imm]          = &&Dispatch_sub_imm;
+            dispatchTable[OpCode::sub_eax]          = &&Dispatch_sub_eax;
+            dispatchTable[OpCode::sub_eax_imm]      = &&Dispatch_sub_eax_imm;
+            dispatchTable[OpCode::alloc]            = &&Dispatch_alloc;
+            dispatchTable[OpCode::free]             = &&Dispatch_free;
+            dispatchTable[OpCode::new_obj]          = &&Dispatch_new_obj;
+            dispatchTable[OpCode::ld_ref]           = &&Dispatch_ld_ref;
+            dispatchTable[OpCode::st_ref]           = &&Dispatch_st_ref;
+            dispatchTable[OpCode::ld_field]         = &&Dispatch_ld_field;
+            dispatchTable[OpCode::st_field]         = &&Dispatch_st_field;
+            dispatchTable[OpCode::exit]             = &&Dispatch_exit;
+
+#define VM_DISPATCH_NEXT()  goto *dispatchTable[ip.getUInt8()]
+
             // Init environment
             ip.set(image_.getPtr());
-            sp.set(stack_.current());
             fp.set(stack_.current());
-            cp.set(callstack_.current());
             regs.uval = 0;
 
             // Push call program entry.
-            inline_push_callstack(cp, fp, nullptr, 0, ret_first);
+            push_callstack(fp, nullptr, 0);
 
             // Main loop
-            bool done;
-            do {
-                op_push_i32(ip, sp);
-                op_inline_call_short(ip, fp, cp, ret_00);
-                goto fibonacci_n;
-fibonacci_ret_00:
-                {
-                    op_pop_i32(ip, sp);
-                    int retType = op_inline_ret(ip, fp, cp, done);
-                    if (likely(done)) {
-                        retVal.setDataType(return_type::Basic);
-                        retVal.setValue(regs.eax.u32);
-                        break;
-                    }
-                    else {
-                        console.trace("Error: Unknown error.\n");
-                    }
-                    goto Execute_Finished;
-                }
-fibonacci_n:
-                op_cmp_imm_i32(ip, fp);
-                bool is_large = op_jl_near(ip);
-                if (likely(!is_large)) {
-                    op_add_sp_4(ip, sp);
-                    op_push(ip, sp, fp);
-                    op_dec(ip, fp);
-                    op_inline_fast_call_short(ip, fp, cp, ret_01);
-                    goto fibonacci_n;
-fibonacci_ret_01:
-                    op_copy_from_eax(ip, fp, regs);
-                    op_dec(ip, fp);
-                    op_inline_fast_call_short(ip, fp, cp, ret_02);
-                    goto fibonacci_n;
-fibonacci_ret_02:
-                    op_add_eax(ip, fp, regs);
-                    int retType = op_inline_ret_n(ip, fp, cp, done);
-                    if (retType == ret_01)
-                        goto fibonacci_ret_01;
-                    else if (retType == ret_02)
-                        goto fibonacci_ret_02;
-                    else
-                        goto fibonacci_ret_00;
-                }
-                else {
-                    int retType = op_inline_ret_eax_n(ip, fp, cp, regs, done);
-                    if (retType == ret_01)
-                        goto fibonacci_ret_01;
-                    else if (retType == ret_02)
-                        goto fibonacci_ret_02;
-                    else
-                        goto fibonacci_ret_00;
-                }
-            } while (1);
-        }
+            VM_DISPATCH_NEXT();
 
-Execute_Finished:
-        return ec;
-    }
+Dispatch_error:
+            op_error(ip);
+            VM_DISPATCH_NEXT();
 
-    int run(return_type & retVal) {
-        ip_.set(image_.getPtr());
-        fp_.set(stack_.current());
-        return execute(retVal);
-    }
+Dispatch_load_eax:
+            op_load_eax(ip, fp, regs);
+            VM_DISPATCH_NEXT();
 
-    int run_inline(return_type & retVal) {
-        ip_.set(image_.getPtr());
-        fp_.set(stack_.current());
-        return execute_inline(retVal);
-    }
-};
+Dispatch_store:
+            op_store(ip, fp);
+            VM_DISPATCH_NEXT();
 
-template <typename BasicType = uintptr_t>
-class ExecutionEngine {
-public:
-    typedef BasicType                       basic_type;
-    typedef size_t                          size_type;
-    typedef ExecutionContext<basic_type>    context_type;
-    typedef vmReturn<basic_type>            return_type;
-    typedef ExecutionEngine<basic_type>     this_type;
+Dispatch_move:
+            op_move(ip, fp);
+            VM_DISPATCH_NEXT();
 
-private:
-    vmBinaryFile binary_;
-    context_type context_;
+Dispatch_move_to_eax:
+            op_move_to_eax(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_copy_from_eax:
+            op_copy_from_eax(ip, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp:
+            op_cmp(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_i32:
+            op_cmp_i32(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_u32:
+            op_cmp_u32(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_i32:
+            op_cmp_imm_i32(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_u32:
+            op_cmp_imm_u32(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jl:
+            op_jl(ip);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jl_near:
+            op_jl_near(ip);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jl_short:
+            op_jl_short(ip);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jl_long:
+            op_jl_long(ip);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jmp:
+            op_jmp(ip);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jmp_near:
+            op_jmp_near(ip);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jmp_short:
+            op_jmp_short(ip);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jmp_long:
+            op_jmp_long(ip);
+            VM_DISPATCH_NEXT();
+
+Dispatch_call:
+            op_call(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_call_short:
+            op_call_short(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_call_long:
+            op_call_long(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_fast_call_short:
+            op_fast_call_short(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_fast_tail_call_short:
+            op_fast_tail_call_short(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret:
+            if (op_ret(ip, fp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret_n_sm:
+            if (op_ret_n_sm(ip, fp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret_n:
+            if (op_ret_n(ip, fp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
 
-public:
-    ExecutionEngine() {}
-    virtual ~ExecutionEngine() {
-        destroy();
-    }
+Dispatch_ret_eax:
+            if (op_ret_eax(ip, fp, regs))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
 
-    bool isInited() const { return (context_.getId() != 0); }
+Dispatch_ret_eax_n:
+            if (op_ret_eax_n(ip, fp, regs))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
 
-    int create() {
-        int ec = binary_.loadFromFile("test.bin");
-        if (ec <= 0) {
-            return Error::BinaryFile_Read_Failed;
-        }
+Dispatch_nop:
+            op_nop(ip);
+            VM_DISPATCH_NEXT();
 
-        context_.setImageInfo(binary_.getImagePtr(), binary_.getImageSize(),
-                              binary_.getImageEntry());
+Dispatch_nop_n:
+            op_nop_n(ip);
+            VM_DISPATCH_NEXT();
 
-        bool success = createContext();
-        if (!success) {
-            return Error::MainProcess_Create_Failed;
-        }
+Dispatch_inc:
+            op_inc(ip, fp);
+            VM_DISPATCH_NEXT();
 
-        return (int)success;
-    }
+Dispatch_dec:
+            op_dec(ip, fp);
+            VM_DISPATCH_NEXT();
 
-    void destroy() {
-        destroyContext();
-    }
+Dispatch_add:
+            op_add(ip, fp);
+            VM_DISPATCH_NEXT();
 
-    bool createContext() {
-        if (!context_.isInited()) {
-            context_.create();
-        }
+Dispatch_add_imm:
+            op_add_imm(ip, fp);
+            VM_DISPATCH_NEXT();
 
-        return context_.isInited();
-    }
+Dispatch_add_eax:
+            op_add_eax(ip, fp, regs);
+            VM_DISPATCH_NEXT();
 
-    void destroyContext() {
-        if (context_.isInited()) {
-            context_.destroy();
-        }
-    }
+Dispatch_add_eax_imm:
+            op_add_eax_imm(ip, regs);
+            VM_DISPATCH_NEXT();
 
-    int run(return_type & ret) {
-        binary_.setInput(ret.getValue());
-        int ec = context_.run(ret);
-        return ec;
-    }
+Dispatch_sub:
+            op_sub(ip, fp);
+            VM_DISPATCH_NEXT();
 
-    int run_inline(return_type & ret) {
-        binary_.setInput(ret.getValue());
-        int ec = context_.run_inline(ret);
-        return ec;
-    }
-};
+Dispatch_sub_imm:
+            op_sub_imm(ip, fp);
+            VM_DISPATCH_NEXT();
 
-template <typename BasicType = uintptr_t>
-class Interpreter {
-public:
-    typedef BasicType                   basic_type;
-    typedef ExecutionEngine<basic_type> engine_type;
-    typedef vmReturn<basic_type>        return_type;
-    typedef Interpreter<basic_type>     this_type;
+Dispatch_sub_eax:
+            op_sub_eax(ip, fp, regs);
+            VM_DISPATCH_NEXT();
 
-private:
-    engine_type engine_;
+Dispatch_sub_eax_imm:
+            op_sub_eax_imm(ip, regs);
+            VM_DISPATCH_NEXT();
 
-public:
-    Interpreter() {}
-    ~Interpreter() {}
+Dispatch_alloc:
+            op_alloc(ip, fp);
+            VM_DISPATCH_NEXT();
 
-    int create() {
-        int ec = engine_.create();
-        return ec;
-    }
+Dispatch_free:
+            op_free(ip, fp);
+            VM_DISPATCH_NEXT();
 
-    int run(return_type & ret) {
-        int ec = engine_.run(ret);
-        return ec;
+Dispatch_new_obj:
+            op_new_obj(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_ld_ref:
+            op_ld_ref(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_st_ref:
+            op_st_ref(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_ld_field:
+            op_ld_field(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_st_field:
+            op_st_field(ip, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_unknown:
+            op_unknown(ip, ip.getUInt8());
+            VM_DISPATCH_NEXT();
+
+Dispatch_exit:
+            op_exit(ip, retVal);
+            goto Execute_Finished;
+
+#undef VM_DISPATCH_NEXT
+
+Execute_Finished:
+            retVal.setDataType(return_type::Basic);
+            retVal.setValue(regs.eax.u32);
+        }
+        return ec;
+#else
+        return execute_bytecode<true>(retVal);
+#endif // USE_THREADED_DISPATCH
+    }
+
+    //
+    // The handlers of the predecoded instructions (see Predecoder.h),
+    // all operands and branch targets are already decoded.
+    //
+
+    //
+    // load eax, 0x00000006 (predecoded)
+    //
+    JM_FORCEINLINE void op_load_eax(vmDecodedInst *& pc, Register & regs) {
+        regs.eax.u32 = pc->operand2;
+        VM_TRACE("%08X:  load eax, 0x%08X", pc->offset, pc->operand2);
+        pc++;
+    }
+
+    //
+    // store arg0, 0x00000006 (predecoded)
+    //
+    JM_FORCEINLINE void op_store(vmDecodedInst *& pc, vmFramePtr & fp) {
+        fp.putArgValueUInt32(pc->operand1, pc->operand2);
+        VM_TRACE("%08X:  store args[%d], 0x%08X",
+                 pc->offset, getArgIndex(pc->operand1), pc->operand2);
+        pc++;
+    }
+
+    //
+    // move arg0, arg1 (predecoded)
+    //
+    JM_FORCEINLINE void op_move(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32((int32_t)pc->operand2);
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  move args[%d], args[%d] - 0x%08X", pc->offset,
+                 getArgIndex(pc->operand1), getArgIndex(pc->operand2), value);
+        pc++;
+    }
+
+    //
+    // copy arg0, eax (predecoded)
+    //
+    JM_FORCEINLINE void op_copy_from_eax(vmDecodedInst *& pc, vmFramePtr & fp, Register & regs) {
+        fp.putArgValueUInt32(pc->operand1, regs.eax.u32);
+        VM_TRACE("%08X:  copy args[%d], eax = (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), regs.eax.u32);
+        pc++;
+    }
+
+    //
+    // cmp arg0, arg1 (int32) (predecoded)
+    //
+    JM_FORCEINLINE void op_cmp_i32(vmDecodedInst *& pc, vmFramePtr & fp) {
+        int32_t value1 = fp.getArgValueInt32(pc->operand1);
+        int32_t value2 = fp.getArgValueInt32((int32_t)pc->operand2);
+        bool condition = this_type::getCondition(value1, value2, (uint8_t)pc->aux);
+        flags.u32.low = (uint32_t)condition;
+        VM_TRACE("%08X:  cmp  args[%d], args[%d] - (%d, %d) (int32) [%d]",
+                 pc->offset, getArgIndex(pc->operand1), getArgIndex(pc->operand2),
+                 value1, value2, (int)condition);
+        pc++;
+    }
+
+    //
+    // cmp arg0, arg1 (uint32) (predecoded)
+    //
+    JM_FORCEINLINE void op_cmp_u32(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value1 = fp.getArgValueUInt32(pc->operand1);
+        uint32_t value2 = fp.getArgValueUInt32((int32_t)pc->operand2);
+        bool condition = this_type::getCondition(value1, value2, (uint8_t)pc->aux);
+        flags.u32.low = (uint32_t)condition;
+        VM_TRACE("%08X:  cmp  args[%d], args[%d] - (%u, %u) (uint32) [%d]",
+                 pc->offset, getArgIndex(pc->operand1), getArgIndex(pc->operand2),
+                 value1, value2, (int)condition);
+        pc++;
+    }
+
+    //
+    // cmp arg0, 0x00000008 (int32) (predecoded)
+    //
+    JM_FORCEINLINE void op_cmp_imm_i32(vmDecodedInst *& pc, vmFramePtr & fp) {
+        int32_t value1 = fp.getArgValueInt32(pc->operand1);
+        int32_t value2 = (int32_t)pc->operand2;
+        bool condition = this_type::getCondition(value1, value2, (uint8_t)pc->aux);
+        flags.u32.low = (uint32_t)condition;
+        VM_TRACE("%08X:  cmp  args[%d], 0x%08X (int32) [%d]",
+                 pc->offset, getArgIndex(pc->operand1), value2, (int)condition);
+        pc++;
+    }
+
+    //
+    // cmp arg0, 0x00000008 (uint32) (predecoded)
+    //
+    JM_FORCEINLINE void op_cmp_imm_u32(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value1 = fp.getArgValueUInt32(pc->operand1);
+        uint32_t value2 = pc->operand2;
+        bool condition = this_type::getCondition(value1, value2, (uint8_t)pc->aux);
+        flags.u32.low = (uint32_t)condition;
+        VM_TRACE("%08X:  cmp  args[%d], 0x%08X (uint32) [%d]",
+                 pc->offset, getArgIndex(pc->operand1), value2, (int)condition);
+        pc++;
+    }
+
+    //
+    // The sample point of the calls and the jumps (see Sampler.h), it's
+    // only reached when the sampler's timer has fired.
+    //
+    JM_NOINLINE void take_sample(const vmDecodedInst * pc, vmFramePtr & fp) {
+        if (sampler_ != nullptr)
+            sampler_->sample(pc, fp.ptr());
+        else
+            vmSampler::pendingFlag() = 0;
+    }
+
+    //
+    // jl_near, jl_short, jl_long (predecoded)
+    //
+    JM_FORCEINLINE void op_jl_to(vmDecodedInst *& pc) {
+        if (likely(flags.u32.low != (uint32_t)true)) {
+            VM_TRACE("%08X:  jl   0x%08X", pc->offset, pc->target->offset);
+            pc++;
+        }
+        else {
+            VM_TRACE("%08X:  jl   0x%08X\n", pc->offset, pc->target->offset);
+            pc = pc->target;
+        }
+    }
+
+    //
+    // jmp, jmp_near, jmp_short, jmp_long (predecoded)
+    //
+    JM_FORCEINLINE void op_jmp_to(vmDecodedInst *& pc) {
+        VM_TRACE("%08X:  jmp  0x%08X\n", pc->offset, pc->target->offset);
+        pc = pc->target;
+    }
+
+    //
+    // call, call_short, call_long (predecoded)
+    //
+    JM_FORCEINLINE void op_call(vmDecodedInst *& pc, vmFramePtr & fp) {
+        void * returnIP = image_.getStart() + pc->operand2;
+        push_callstack(fp, returnIP, pc->aux);
+        VM_TRACE("%08X:  call 0x%08X, %u\n",
+                 pc->offset, pc->target->offset, (uint32_t)pc->aux);
+        pc = pc->target;
+    }
+
+    //
+    // fast_call_short (predecoded)
+    //
+    JM_FORCEINLINE void op_fast_call(vmDecodedInst *& pc, vmFramePtr & fp) {
+        void * returnIP = image_.getStart() + pc->operand2;
+        push_callstack_fast(fp, returnIP, pc->aux);
+        VM_TRACE("%08X:  fast_call 0x%08X, %u\n",
+                 pc->offset, pc->target->offset, (uint32_t)pc->aux);
+        pc = pc->target;
+    }
+
+    //
+    // fast_tail_call_short (predecoded)
+    //
+    JM_FORCEINLINE void op_fast_tail_call(vmDecodedInst *& pc, vmFramePtr & fp) {
+        tail_callstack_fast(fp, pc->aux, pc->operand1);
+        VM_TRACE("%08X:  fast_tail_call 0x%08X, %u\n",
+                 pc->offset, pc->target->offset, (uint32_t)pc->aux);
+        pc = pc->target;
+    }
+
+    //
+    // call of a pure function (predecoded), on a hit the frame is popped
+    // again and it goes on from the return site.
+    //
+    JM_FORCEINLINE void op_memo_call(vmDecodedInst *& pc, vmFramePtr & fp, Register & regs) {
+        void * returnIP = image_.getStart() + pc->operand2;
+        push_callstack(fp, returnIP, pc->aux);
+        if (memoizer_->lookup((uint32_t)pc->operand1, fp.ptr(), regs.eax.u32)) {
+            pop_callstack(fp);
+            VM_TRACE("%08X:  call 0x%08X, %u (memo: 0x%08X)\n",
+                     pc->offset, pc->target->offset, (uint32_t)pc->aux, regs.eax.u32);
+            pc++;
+        }
+        else {
+            VM_TRACE("%08X:  call 0x%08X, %u (memo: miss)\n",
+                     pc->offset, pc->target->offset, (uint32_t)pc->aux);
+            pc = pc->target;
+        }
+    }
+
+    //
+    // fast_call_short of a pure function (predecoded)
+    //
+    JM_FORCEINLINE void op_memo_fast_call(vmDecodedInst *& pc, vmFramePtr & fp, Register & regs) {
+        void * returnIP = image_.getStart() + pc->operand2;
+        push_callstack_fast(fp, returnIP, pc->aux);
+        if (memoizer_->lookup((uint32_t)pc->operand1, fp.ptr(), regs.eax.u32)) {
+            pop_callstack_fast(fp, pc->aux);
+            VM_TRACE("%08X:  fast_call 0x%08X, %u (memo: 0x%08X)\n",
+                     pc->offset, pc->target->offset, (uint32_t)pc->aux, regs.eax.u32);
+            pc++;
+        }
+        else {
+            VM_TRACE("%08X:  fast_call 0x%08X, %u (memo: miss)\n",
+                     pc->offset, pc->target->offset, (uint32_t)pc->aux);
+            pc = pc->target;
+        }
+    }
+
+    //
+    // ret (predecoded)
+    //
+    JM_FORCEINLINE bool op_ret(vmDecodedInst *& pc, vmFramePtr & fp) {
+        void * returnIP = pop_callstack(fp);
+        if (returnIP != nullptr) {
+            VM_TRACE("%08X:  ret  0x%08X\n", pc->offset, getIpOffset(returnIP));
+            pc = decoded_->at(returnIP);
+            return false;
+        }
+        else {
+            VM_TRACE("%08X:  ret  (done)\n", pc->offset);
+            return true;
+        }
+    }
+
+    //
+    // ret_n_sm, ret_n (predecoded)
+    //
+    JM_FORCEINLINE bool op_ret_n(vmDecodedInst *& pc, vmFramePtr & fp) {
+        void * returnIP = pop_callstack_fast(fp, pc->aux);
+        if (returnIP != nullptr) {
+            VM_TRACE("%08X:  ret_n [%u] 0x%08X\n",
+                     pc->offset, (uint32_t)pc->aux, getIpOffset(returnIP));
+            pc = decoded_->at(returnIP);
+            return false;
+        }
+        else {
+            VM_TRACE("%08X:  ret_n [%u] (done)\n\n", pc->offset, (uint32_t)pc->aux);
+            return true;
+        }
+    }
+
+    //
+    // ret_eax 0x00000001 (predecoded)
+    //
+    JM_FORCEINLINE bool op_ret_eax(vmDecodedInst *& pc, vmFramePtr & fp, Register & regs) {
+        regs.eax.u32 = pc->operand2;
+        return op_ret(pc, fp);
+    }
+
+    //
+    // ret_eax_n 0x08, 0x00000001 (predecoded)
+    //
+    JM_FORCEINLINE bool op_ret_eax_n(vmDecodedInst *& pc, vmFramePtr & fp, Register & regs) {
+        regs.eax.u32 = pc->operand2;
+        return op_ret_n(pc, fp);
+    }
+
+    //
+    // inc arg0 (predecoded)
+    //
+    JM_FORCEINLINE void op_inc(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32(pc->operand1) + 1;
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  inc  arg[%d]  (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), value);
+        pc++;
+    }
+
+    //
+    // dec arg0 (predecoded)
+    //
+    JM_FORCEINLINE void op_dec(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32(pc->operand1) - 1;
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  dec  args[%d]  (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), value);
+        pc++;
+    }
+
+    //
+    // add arg0, arg1 (predecoded)
+    //
+    JM_FORCEINLINE void op_add(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32(pc->operand1)
+                       + fp.getArgValueUInt32((int32_t)pc->operand2);
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  add  args[%d], args[%d] = (0x%08X)", pc->offset,
+                 getArgIndex(pc->operand1), getArgIndex(pc->operand2), value);
+        pc++;
+    }
+
+    //
+    // add arg0, 0x00000006 (predecoded)
+    //
+    JM_FORCEINLINE void op_add_imm(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32(pc->operand1) + pc->operand2;
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  add  args[%d], 0x%08X = (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), pc->operand2, value);
+        pc++;
+    }
+
+    //
+    // add eax, arg0 (predecoded)
+    //
+    JM_FORCEINLINE void op_add_eax(vmDecodedInst *& pc, vmFramePtr & fp, Register & regs) {
+        regs.eax.u32 += fp.getArgValueUInt32(pc->operand1);
+        VM_TRACE("%08X:  add  eax, args[%d] = (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), regs.eax.u32);
+        pc++;
+    }
+
+    //
+    // add eax, 0x00000006 (predecoded)
+    //
+    JM_FORCEINLINE void op_add_eax_imm(vmDecodedInst *& pc, Register & regs) {
+        regs.eax.u32 += pc->operand2;
+        VM_TRACE("%08X:  add  eax, 0x%08X = (0x%08X)",
+                 pc->offset, pc->operand2, regs.eax.u32);
+        pc++;
+    }
+
+    //
+    // sub arg0, arg1 (predecoded)
+    //
+    JM_FORCEINLINE void op_sub(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32(pc->operand1)
+                       - fp.getArgValueUInt32((int32_t)pc->operand2);
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  sub  args[%d], args[%d] = (0x%08X)", pc->offset,
+                 getArgIndex(pc->operand1), getArgIndex(pc->operand2), value);
+        pc++;
+    }
+
+    //
+    // sub arg0, 0x00000006 (predecoded)
+    //
+    JM_FORCEINLINE void op_sub_imm(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32(pc->operand1) - pc->operand2;
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  sub  args[%d], 0x%08X = (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), pc->operand2, value);
+        pc++;
+    }
+
+    //
+    // sub eax, arg0 (predecoded)
+    //
+    JM_FORCEINLINE void op_sub_eax(vmDecodedInst *& pc, vmFramePtr & fp, Register & regs) {
+        regs.eax.u32 -= fp.getArgValueUInt32(pc->operand1);
+        VM_TRACE("%08X:  sub  eax, args[%d] = (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), regs.eax.u32);
+        pc++;
+    }
+
+    //
+    // sub eax, 0x00000006 (predecoded)
+    //
+    JM_FORCEINLINE void op_sub_eax_imm(vmDecodedInst *& pc, Register & regs) {
+        regs.eax.u32 -= pc->operand2;
+        VM_TRACE("%08X:  sub  eax, 0x%08X = (0x%08X)",
+                 pc->offset, pc->operand2, regs.eax.u32);
+        pc++;
+    }
+
+    //
+    // alloc arg0, 0x00000018 (predecoded)
+    //
+    JM_FORCEINLINE void op_alloc(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t ref = heap_.alloc(pc->operand2);
+        fp.putArgValueUInt32(pc->operand1, ref);
+        VM_TRACE("%08X:  alloc  args[%d], 0x%08X  (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), pc->operand2, ref);
+        pc++;
+    }
+
+    //
+    // free arg0 (predecoded)
+    //
+    JM_FORCEINLINE void op_free(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t ref = fp.getArgValueUInt32(pc->operand1);
+        heap_.free(ref);
+        VM_TRACE("%08X:  free  args[%d]  (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), ref);
+        pc++;
+    }
+
+    //
+    // new_obj arg0, 4, 2 (predecoded)
+    //
+    JM_FORCEINLINE void op_new_obj(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t fields = pc->operand2 & 0xFF;
+        uint32_t refs = pc->operand2 >> 8;
+        uint32_t ref = gc_.alloc(fields, refs);
+        if (unlikely(ref == 0))
+            ref = gc_new_slow(pc->offset, fp.ptr(), fields, refs);
+        fp.putArgValueUInt32(pc->operand1, ref);
+        VM_TRACE("%08X:  new_obj  args[%d], %u, %u  (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), fields, refs, ref);
+        pc++;
+    }
+
+    //
+    // ld_ref arg0, arg1, 1 (predecoded)
+    //
+    JM_FORCEINLINE void op_ld_ref(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = gc_.loadRef(fp.getArgValueUInt32((int32_t)pc->operand2), pc->aux);
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  ld_ref  args[%d], args[%d].%u  (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), getArgIndex((int8_t)pc->operand2),
+                 (uint32_t)pc->aux, value);
+        pc++;
+    }
+
+    //
+    // st_ref arg0, 1, arg1 (predecoded)
+    //
+    JM_FORCEINLINE void op_st_ref(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32((int32_t)pc->operand2);
+        gc_.storeRef(fp.getArgValueUInt32(pc->operand1), pc->aux, value);
+        VM_TRACE("%08X:  st_ref  args[%d].%u, args[%d]  (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), (uint32_t)pc->aux,
+                 getArgIndex((int8_t)pc->operand2), value);
+        pc++;
+    }
+
+    //
+    // ld_field arg0, arg1, 2 (predecoded)
+    //
+    JM_FORCEINLINE void op_ld_field(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = gc_.loadValue(fp.getArgValueUInt32((int32_t)pc->operand2), pc->aux);
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  ld_field  args[%d], args[%d].%u  (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), getArgIndex((int8_t)pc->operand2),
+                 (uint32_t)pc->aux, value);
+        pc++;
+    }
+
+    //
+    // st_field arg0, 2, arg1 (predecoded)
+    //
+    JM_FORCEINLINE void op_st_field(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32((int32_t)pc->operand2);
+        gc_.storeValue(fp.getArgValueUInt32(pc->operand1), pc->aux, value);
+        VM_TRACE("%08X:  st_field  args[%d].%u, args[%d]  (0x%08X)",
+                 pc->offset, getArgIndex(pc->operand1), (uint32_t)pc->aux,
+                 getArgIndex((int8_t)pc->operand2), value);
+        pc++;
+    }
+
+    //
+    // nop, nop_n and the other no-operation instructions (predecoded)
+    //
+    JM_FORCEINLINE void op_nop(vmDecodedInst *& pc) {
+        VM_TRACE("%08X:  nop", pc->offset);
+        pc++;
+    }
+
+    //
+    // Unknown opcode (predecoded)
+    //
+    JM_FORCEINLINE void op_unknown(vmDecodedInst *& pc) {
+        VM_TRACE("%08X:  Error: Unknown opcode: %u", pc->offset, (uint32_t)pc->opcode);
+        pc++;
+    }
+
+    //
+    // The handlers of the fused instructions (see SuperInstruction.h),
+    // the slots after a fused instruction still hold the original ones.
+    //
+
+    //
+    // jl_to, the taken and not taken paths of a fused compare and branch.
+    //
+    JM_FORCEINLINE void op_fused_jl_to(vmDecodedInst *& pc, bool condition) {
+        flags.u32.low = (uint32_t)condition;
+        if (likely(!condition)) {
+            VM_TRACE("%08X:  jl   0x%08X (fused)", pc->offset, pc->target->offset);
+            pc += 2;
+        }
+        else {
+            VM_TRACE("%08X:  jl   0x%08X (fused)\n", pc->offset, pc->target->offset);
+            pc = pc->target;
+        }
+    }
+
+    //
+    // cmp arg0, arg1 (int32); jl (fused)
+    //
+    JM_FORCEINLINE void op_cmp_i32_jl(vmDecodedInst *& pc, vmFramePtr & fp) {
+        int32_t value1 = fp.getArgValueInt32(pc->operand1);
+        int32_t value2 = fp.getArgValueInt32((int32_t)pc->operand2);
+        op_fused_jl_to(pc, this_type::getCondition(value1, value2, (uint8_t)pc->aux));
+    }
+
+    //
+    // cmp arg0, arg1 (uint32); jl (fused)
+    //
+    JM_FORCEINLINE void op_cmp_u32_jl(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value1 = fp.getArgValueUInt32(pc->operand1);
+        uint32_t value2 = fp.getArgValueUInt32((int32_t)pc->operand2);
+        op_fused_jl_to(pc, this_type::getCondition(value1, value2, (uint8_t)pc->aux));
+    }
+
+    //
+    // cmp arg0, 0x00000008 (int32); jl (fused)
+    //
+    JM_FORCEINLINE void op_cmp_imm_i32_jl(vmDecodedInst *& pc, vmFramePtr & fp) {
+        int32_t value1 = fp.getArgValueInt32(pc->operand1);
+        int32_t value2 = (int32_t)pc->operand2;
+        op_fused_jl_to(pc, this_type::getCondition(value1, value2, (uint8_t)pc->aux));
+    }
+
+    //
+    // cmp arg0, 0x00000008 (uint32); jl (fused)
+    //
+    JM_FORCEINLINE void op_cmp_imm_u32_jl(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value1 = fp.getArgValueUInt32(pc->operand1);
+        uint32_t value2 = pc->operand2;
+        op_fused_jl_to(pc, this_type::getCondition(value1, value2, (uint8_t)pc->aux));
+    }
+
+    //
+    // fast_call_short, the return site is after the last fused slot.
+    //
+    JM_FORCEINLINE void op_fused_fast_call(vmDecodedInst *& pc, vmFramePtr & fp,
+                                           const vmDecodedInst * call) {
+        void * returnIP = image_.getStart() + call->operand2;
+        push_callstack_fast(fp, returnIP, pc->aux);
+        VM_TRACE("%08X:  fast_call 0x%08X, %u (fused)\n",
+                 call->offset, pc->target->offset, (uint32_t)pc->aux);
+        pc = pc->target;
+    }
+
+    //
+    // dec var0; fast_call_short (fused)
+    //
+    JM_FORCEINLINE void op_dec_fast_call(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32(pc->operand1) - 1;
+        fp.putArgValueUInt32(pc->operand1, value);
+        op_fused_fast_call(pc, fp, pc + 1);
+    }
+
+    //
+    // move var0, arg1; dec var0 (fused)
+    //
+    JM_FORCEINLINE void op_move_dec(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32((int32_t)pc->operand2) - 1;
+        fp.putArgValueUInt32(pc->operand1, value);
+        VM_TRACE("%08X:  move args[%d], args[%d]; dec - 0x%08X (fused)", pc->offset,
+                 getArgIndex(pc->operand1), getArgIndex(pc->operand2), value);
+        pc += 2;
+    }
+
+    //
+    // move var0, arg1; dec var0; fast_call_short (fused)
+    //
+    JM_FORCEINLINE void op_move_dec_fast_call(vmDecodedInst *& pc, vmFramePtr & fp) {
+        uint32_t value = fp.getArgValueUInt32((int32_t)pc->operand2) - 1;
+        fp.putArgValueUInt32(pc->operand1, value);
+        op_fused_fast_call(pc, fp, pc + 2);
+    }
+
+    //
+    // copy var1, eax; dec var0 (fused)
+    //
+    JM_FORCEINLINE void op_copy_from_eax_dec(vmDecodedInst *& pc, vmFramePtr & fp, Register & regs) {
+        fp.putArgValueUInt32(pc->operand1, regs.eax.u32);
+        uint32_t value = fp.getArgValueUInt32((int32_t)pc->operand2) - 1;
+        fp.putArgValueUInt32((int32_t)pc->operand2, value);
+        VM_TRACE("%08X:  copy args[%d], eax; dec args[%d] (fused)", pc->offset,
+                 getArgIndex(pc->operand1), getArgIndex(pc->operand2));
+        pc += 2;
+    }
+
+    //
+    // copy var1, eax; dec var0; fast_call_short (fused)
+    //
+    JM_FORCEINLINE void op_copy_from_eax_dec_fast_call(vmDecodedInst *& pc, vmFramePtr & fp,
+                                                       Register & regs) {
+        fp.putArgValueUInt32(pc->operand1, regs.eax.u32);
+        uint32_t value = fp.getArgValueUInt32((int32_t)pc->operand2) - 1;
+        fp.putArgValueUInt32((int32_t)pc->operand2, value);
+        op_fused_fast_call(pc, fp, pc + 2);
+    }
+
+    //
+    // add eax, var1; ret_n 8 (fused)
+    //
+    JM_FORCEINLINE bool op_add_eax_ret_n(vmDecodedInst *& pc, vmFramePtr & fp, Register & regs) {
+        regs.eax.u32 += fp.getArgValueUInt32(pc->operand1);
+        return op_ret_n(pc, fp);
+    }
+
+    //
+    // Execute the predecoded instruction stream of the image.
+    //
+    // With threaded dispatch every instruction carries the address of its
+    // handler, otherwise it's a switch over the decoded opcode.
+    //
+    int execute_predecoded(return_type & retVal) {
+        return execute_guarded<vmExecutor::Decoded>(retVal);
+    }
+
+    //
+    // Execute the predecoded instruction stream as the baseline tier,
+    // the calls and the loops are counted by the tier manager, and run
+    // natively once they are hot (see Tiering.h).
+    //
+    int execute_tiered(return_type & retVal) {
+        if (tierManager_ == nullptr)
+            return execute_guarded<vmExecutor::Decoded>(retVal);
+        return execute_guarded<vmExecutor::Decoded, true>(retVal);
+    }
+
+    //
+    // Run the executor inside a guard scope of the stacks, an overflow
+    // of the guest stack returns Stack_Overflow (see StackGuard.h). All
+    // executors go through it, the guest frames are dropped and the
+    // context can run again.
+    //
+    template <uint32_t Executor, bool Tiered = false, uint32_t Slice = vmSliceMode::None>
+    int execute_guarded(return_type & retVal,
+                        const vmStack<basic_type, false> * sliceStack = nullptr,
+                        vmJitCode * jit = nullptr) {
+        vmStackGuard::Scope scope;
+        scope.add(stack_);
+        scope.add(callstack_);
+        if (sliceStack != nullptr)
+            scope.add(*sliceStack);
+#if !defined(_WIN32)
+        if (sigsetjmp(scope.env, 0) != 0) {
+            find_overflow_frames(scope.fault);
+            return Error::Stack_Overflow;
+        }
+#endif
+        switch (Executor) {
+        case vmExecutor::Bytecode:      return execute_bytecode<false>(retVal);
+        case vmExecutor::Checked:       return execute_bytecode<true>(retVal);
+        case vmExecutor::Threaded:      return execute_threaded_bytecode(retVal);
+        case vmExecutor::Specialized:   return execute_plan(retVal);
+        case vmExecutor::Native:        return execute_native(jit, retVal);
+        case vmExecutor::Inline:        return execute_inline_bytecode(retVal);
+        default:                        return execute_decoded<Tiered, Slice>(retVal);
+        }
+    }
+
+    //
+    // The guest frames under a fault in the guard of the stack. The frame
+    // pointer was lost with the jump, so the innermost frame is the first
+    // return IP below the fault whose frames lead down to the entry: the
+    // call before a return IP gives its local size, or the saved frame
+    // pointer, as gc_find_roots() walks them.
+    //
+    void find_overflow_frames(const unsigned char * fault) {
+        overflowStack_.clear();
+        overflowDepth_ = 0;
+#if USE_FORWARD_STACK_PTR
+        // The suspended fibers' stacks aren't walked, see execute_slice().
+        if (decoded_ == nullptr || !decoded_->isInited() || sliceLimit_ != nullptr)
+            return;
+        if (!stack_.hasGuard() || fault < stack_.guard()
+            || fault >= stack_.guard() + stack_.kGuardSize)
+            return;
+        if (!overflowStack_.isInited())
+            overflowStack_.create(kOverflowFrames + 1);
+
+        // A frame is no larger than the guard, see vmVerifier.
+        unsigned char * first = stack_.first();
+        unsigned char * fp = stack_.guard();
+        unsigned char * bottom = (fp - first > (ptrdiff_t)stack_.kGuardSize)
+                               ? (fp - stack_.kGuardSize) : first;
+        for (; fp > bottom; fp -= sizeof(uint32_t)) {
+            if (walk_overflow_frames(fp))
+                return;
+        }
+#else
+        (void)fault;
+#endif
+    }
+
+    //
+    // Walk the frames from fp down to the entry, keep the innermost ones.
+    // False if a return IP isn't one of a call of the image.
+    //
+    bool walk_overflow_frames(unsigned char * fp) {
+        vmCallRecord records[kOverflowFrames];
+        size_t depth = 0;
+        unsigned char * first = stack_.first();
+        while (fp >= first + sizeof(void *)) {
+            void * returnIP = *(void **)(fp - sizeof(void *));
+            if (returnIP == nullptr) {
+                // The entry, the outermost record first.
+                overflowDepth_ = depth;
+                if (depth <= kOverflowFrames)
+                    overflowStack_.push(nullptr, nullptr, fp);
+                for (size_t i = ((depth < kOverflowFrames) ? depth : kOverflowFrames); i-- > 0; ) {
+                    overflowStack_.push(records[i].callIP, records[i].returnIP, records[i].frame);
+                }
+                return true;
+            }
+            const unsigned char * ip = (const unsigned char *)returnIP;
+            if (ip <= image_.getStart() || ip > image_.getStart() + decoded_->getImageSize())
+                return false;
+            uint32_t offset = getIpOffset(ip);
+            const vmDecodedInst * inst = decoded_->atOffset(offset);
+            if (inst == nullptr || inst == decoded_->begin())
+                return false;
+            const vmDecodedInst * call = inst - 1;
+            if (!vmDecodedImage::isCallOp(call->opcode) || call->operand2 != offset)
+                return false;
+
+            if (depth < kOverflowFrames) {
+                records[depth].callIP = image_.getStart() + call->offset;
+                records[depth].returnIP = (unsigned char *)returnIP;
+                records[depth].frame = fp;
+            }
+            depth++;
+
+            unsigned char * callerFP;
+            if (call->opcode == OpCode::fast_call_short || call->opcode == OpCode::fast_tail_call_short)
+                callerFP = fp - sizeof(void *) - call->aux;
+            else
+                callerFP = *(unsigned char **)(fp - sizeof(void *) * 2);
+            if (callerFP >= fp || callerFP < first)
+                return false;
+            fp = callerFP;
+        }
+        return false;
+    }
+
+    template <bool Tiered, uint32_t Slice = vmSliceMode::None>
+    int execute_decoded(return_type & retVal) {
+        int ec = 0;
+        if (isInited() && decoded_ != nullptr && decoded_->isInited()) {
+            register vmDecodedInst * pc;
+            register vmFramePtr fp;
+            register Register   regs;
+
+            // The tier switches.
+            const void * nativeEntry = nullptr;
+            void * fpOut = nullptr;
+            void * returnIP = nullptr;
+
+            // What is left of the slice, see execute_slice().
+            int64_t budget = sliceBudget_;
+
+#if USE_THREADED_DISPATCH
+            void * dispatchTable[256];
+            for (size_t i = 0; i < 256; i++) {
+                dispatchTable[i] = &&Dispatch_unknown;
+            }
+
+            dispatchTable[OpCode::error]            = &&Dispatch_nop;
+            dispatchTable[OpCode::load_eax]         = &&Dispatch_load_eax;
+            dispatchTable[OpCode::store]            = &&Dispatch_store;
+            dispatchTable[OpCode::move]             = &&Dispatch_move;
+            dispatchTable[OpCode::move_to_eax]      = &&Dispatch_nop;
+            dispatchTable[OpCode::copy_from_eax]    = &&Dispatch_copy_from_eax;
+            dispatchTable[OpCode::cmp]              = &&Dispatch_nop;
+            dispatchTable[OpCode::cmp_i32]          = &&Dispatch_cmp_i32;
+            dispatchTable[OpCode::cmp_u32]          = &&Dispatch_cmp_u32;
+            dispatchTable[OpCode::cmp_imm_i32]      = &&Dispatch_cmp_imm_i32;
+            dispatchTable[OpCode::cmp_imm_u32]      = &&Dispatch_cmp_imm_u32;
+            dispatchTable[OpCode::jl]               = &&Dispatch_nop;
+            dispatchTable[OpCode::jl_near]          = &&Dispatch_jl;
+            dispatchTable[OpCode::jl_short]         = &&Dispatch_jl;
+            dispatchTable[OpCode::jl_long]          = &&Dispatch_jl;
+            dispatchTable[OpCode::jmp]              = &&Dispatch_jmp;
+            dispatchTable[OpCode::jmp_near]         = &&Dispatch_jmp;
+            dispatchTable[OpCode::jmp_short]        = &&Dispatch_jmp;
+            dispatchTable[OpCode::jmp_long]         = &&Dispatch_jmp;
+            dispatchTable[OpCode::call]             = &&Dispatch_call;
+            dispatchTable[OpCode::call_short]       = &&Dispatch_call;
+            dispatchTable[OpCode::call_long]        = &&Dispatch_call;
+            dispatchTable[OpCode::fast_call_short]  = &&Dispatch_fast_call;
+            dispatchTable[OpCode::fast_tail_call_short] = &&Dispatch_fast_tail_call;
+            dispatchTable[OpCode::ret]              = &&Dispatch_ret;
+            dispatchTable[OpCode::ret_n_sm]         = &&Dispatch_ret_n;
+            dispatchTable[OpCode::ret_n]            = &&Dispatch_ret_n;
+            dispatchTable[OpCode::ret_eax]          = &&Dispatch_ret_eax;
+            dispatchTable[OpCode::ret_eax_n]        = &&Dispatch_ret_eax_n;
+            dispatchTable[OpCode::nop]              = &&Dispatch_nop;
+            dispatchTable[OpCode::nop_n]            = &&Dispatch_nop;
+            dispatchTable[OpCode::inc]              = &&Dispatch_inc;
+            dispatchTable[OpCode::dec]              = &&Dispatch_dec;
+            dispatchTable[OpCode::add]              = &&Dispatch_add;
+            dispatchTable[OpCode::add_imm]          = &&Dispatch_add_imm;
+            dispatchTable[OpCode::add_eax]          = &&Dispatch_add_eax;
+            dispatchTable[OpCode::add_eax_imm]      = &&Dispatch_add_eax_imm;
+            dispatchTable[OpCode::sub]              = &&Dispatch_sub;
+            dispatchTable[OpCode::sub_imm]          = &&Dispatch_sub_imm;
+            dispatchTable[OpCode::sub_eax]          = &&Dispatch_sub_eax;
+            dispatchTable[OpCode::sub_eax_imm]      = &&Dispatch_sub_eax_imm;
+            dispatchTable[OpCode::alloc]            = &&Dispatch_alloc;
+            dispatchTable[OpCode::free]             = &&Dispatch_free;
+            dispatchTable[OpCode::new_obj]          = &&Dispatch_new_obj;
+            dispatchTable[OpCode::ld_ref]           = &&Dispatch_ld_ref;
+            dispatchTable[OpCode::st_ref]           = &&Dispatch_st_ref;
+            dispatchTable[OpCode::ld_field]         = &&Dispatch_ld_field;
+            dispatchTable[OpCode::st_field]         = &&Dispatch_st_field;
+            dispatchTable[OpCode::exit]             = &&Dispatch_exit;
+
+#if USE_SUPER_INSTRUCTIONS
+            dispatchTable[vmFusedOp::cmp_i32_jl]        = &&Dispatch_cmp_i32_jl;
+            dispatchTable[vmFusedOp::cmp_u32_jl]        = &&Dispatch_cmp_u32_jl;
+            dispatchTable[vmFusedOp::cmp_imm_i32_jl]    = &&Dispatch_cmp_imm_i32_jl;
+            dispatchTable[vmFusedOp::cmp_imm_u32_jl]    = &&Dispatch_cmp_imm_u32_jl;
+            dispatchTable[vmFusedOp::dec_fast_call]     = &&Dispatch_dec_fast_call;
+            dispatchTable[vmFusedOp::move_dec]          = &&Dispatch_move_dec;
+            dispatchTable[vmFusedOp::move_dec_fast_call]    = &&Dispatch_move_dec_fast_call;
+            dispatchTable[vmFusedOp::copy_from_eax_dec]     = &&Dispatch_copy_from_eax_dec;
+            dispatchTable[vmFusedOp::copy_from_eax_dec_fast_call]
+                                                        = &&Dispatch_copy_from_eax_dec_fast_call;
+            dispatchTable[vmFusedOp::add_eax_ret_n]     = &&Dispatch_add_eax_ret_n;
+#endif // USE_SUPER_INSTRUCTIONS
+
+            dispatchTable[vmMemoOp::memo_call]          = &&Dispatch_memo_call;
+            dispatchTable[vmMemoOp::memo_fast_call]     = &&Dispatch_memo_fast_call;
+            dispatchTable[vmMemoOp::memo_ret]           = &&Dispatch_memo_ret;
+            dispatchTable[vmMemoOp::memo_ret_n]         = &&Dispatch_memo_ret_n;
+            dispatchTable[vmMemoOp::memo_ret_eax]       = &&Dispatch_memo_ret_eax;
+            dispatchTable[vmMemoOp::memo_ret_eax_n]     = &&Dispatch_memo_ret_eax_n;
+
+            // The handler addresses are bound to this executor only.
+            const void * bindKey = &&Dispatch_unknown;
+            const void * countKey = &&Dispatch_count;
+#if USE_SUPER_INSTRUCTIONS
+            const void * profileKey = &&Dispatch_profile;
+#endif
+            // While counting, every instruction goes through the count stub.
+            if (!Tiered && profiler_ != nullptr) {
+                if (!decoded_->isBoundTo(countKey)) {
+                    void * countTable[256];
+                    for (size_t i = 0; i < 256; i++) {
+                        countTable[i] = &&Dispatch_count;
+                    }
+                    decoded_->bind(countTable, countKey);
+                }
+            }
+            else
+#if USE_SUPER_INSTRUCTIONS
+            // While profiling, every instruction goes through the profile stub.
+            if (!Tiered && superInst_ != nullptr && superInst_->isProfiling()) {
+                if (!decoded_->isBoundTo(profileKey)) {
+                    void * profileTable[256];
+                    for (size_t i = 0; i < 256; i++) {
+                        profileTable[i] = &&Dispatch_profile;
+                    }
+                    decoded_->bind(profileTable, profileKey);
+                }
+            }
+            else
+#endif // USE_SUPER_INSTRUCTIONS
+            if (!decoded_->isBoundTo(bindKey)) {
+                decoded_->bind(dispatchTable, bindKey);
+            }
+
+#define VM_DISPATCH_JUMP()  goto *pc->handler
+#else
+#define VM_DISPATCH_JUMP()  goto Dispatch_Switch
+#endif // USE_THREADED_DISPATCH
+
+#define VM_DISPATCH_NEXT() \
+            do { \
+                if (Slice == vmSliceMode::Instructions && unlikely(--budget < 0)) \
+                    goto Slice_Preempt; \
+                VM_DISPATCH_JUMP(); \
+            } while (0)
+
+#if USE_FORWARD_STACK_PTR
+#define VM_SAMPLE_POINT() \
+            do { \
+                if (!Tiered && unlikely(vmSampler::isPending())) \
+                    take_sample(pc, fp); \
+            } while (0)
+#else
+#define VM_SAMPLE_POINT()   do { } while (0)
+#endif // USE_FORWARD_STACK_PTR
+
+            // The back edges and the calls, where the samples are taken
+            // and the slices of the back edge budget are cut.
+#define VM_SAFE_POINT(isBackEdge) \
+            do { \
+                if (Slice == vmSliceMode::BackEdges && (isBackEdge) \
+                    && unlikely(--budget < 0)) \
+                    goto Slice_Preempt; \
+                VM_SAMPLE_POINT(); \
+            } while (0)
+
+            // The fused instructions count their runs for vmSuperInstProfiler.
+#define VM_FUSED_COUNT() \
+            do { \
+                if (!Tiered && superInst_ != nullptr) \
+                    superInst_->countFused(pc->opcode); \
+            } while (0)
+
+            // The stream is only bound, see prepare_predecoded().
+            if (unlikely(bindOnly_))
+                return ec;
+
+            // Go on from the registers that execute_slice() swapped in.
+            if (Slice != vmSliceMode::None) {
+                pc = decoded_->at(ip_.ptr());
+                fp.set(fp_.ptr());
+                regs = regs_;
+                VM_DISPATCH_NEXT();
+            }
+
+            // Init environment
+            pc = decoded_->at(ip_.ptr());
+            fp.set(stack_.current());
+            regs.uval = 0;
+
+            if (!Tiered && memoizer_ != nullptr)
+                memoizer_->start();
+            if (!Tiered && profiler_ != nullptr)
+                profiler_->start(pc);
+
+            // Push call program entry, the arguments of invoke() are below it.
+            if (likely(!entryFastFrame_))
+                push_callstack(fp, nullptr, entryArgSize_);
+            else
+                push_callstack_fast(fp, nullptr, entryArgSize_);
+
+            // Main loop
+            VM_DISPATCH_NEXT();
+
+#if USE_THREADED_DISPATCH
+Dispatch_count:
+            profiler_->count(pc);
+            goto *dispatchTable[pc->opcode];
+#endif // USE_THREADED_DISPATCH
+
+#if USE_SUPER_INSTRUCTIONS
+#if USE_THREADED_DISPATCH
+Dispatch_profile:
+            if (unlikely(superInst_->sample(pc))) {
+                superInst_->fuse();
+                decoded_->bind(dispatchTable, bindKey);
+            }
+            goto *dispatchTable[pc->opcode];
+#endif // USE_THREADED_DISPATCH
+#endif // USE_SUPER_INSTRUCTIONS
+
+#if !USE_THREADED_DISPATCH
+Dispatch_Switch:
+            if (unlikely(!Tiered && profiler_ != nullptr)) {
+                profiler_->count(pc);
+            }
+#if USE_SUPER_INSTRUCTIONS
+            else if (unlikely(!Tiered && superInst_ != nullptr && superInst_->isProfiling())) {
+                if (unlikely(superInst_->sample(pc))) {
+                    superInst_->fuse();
+                }
+            }
+#endif // USE_SUPER_INSTRUCTIONS
+            switch (pc->opcode) {
+            case OpCode::load_eax:          goto Dispatch_load_eax;
+            case OpCode::store:             goto Dispatch_store;
+            case OpCode::move:              goto Dispatch_move;
+            case OpCode::copy_from_eax:     goto Dispatch_copy_from_eax;
+            case OpCode::cmp_i32:           goto Dispatch_cmp_i32;
+            case OpCode::cmp_u32:           goto Dispatch_cmp_u32;
+            case OpCode::cmp_imm_i32:       goto Dispatch_cmp_imm_i32;
+            case OpCode::cmp_imm_u32:       goto Dispatch_cmp_imm_u32;
+            case OpCode::jl_near:
+            case OpCode::jl_short:
+            case OpCode::jl_long:           goto Dispatch_jl;
+            case OpCode::jmp:
+            case OpCode::jmp_near:
+            case OpCode::jmp_short:
+            case OpCode::jmp_long:          goto Dispatch_jmp;
+            case OpCode::call:
+            case OpCode::call_short:
+            case OpCode::call_long:         goto Dispatch_call;
+            case OpCode::fast_call_short:   goto Dispatch_fast_call;
+            case OpCode::fast_tail_call_short:
+                                            goto Dispatch_fast_tail_call;
+            case OpCode::ret:               goto Dispatch_ret;
+            case OpCode::ret_n_sm:
+            case OpCode::ret_n:             goto Dispatch_ret_n;
+            case OpCode::ret_eax:           goto Dispatch_ret_eax;
+            case OpCode::ret_eax_n:         goto Dispatch_ret_eax_n;
+            case OpCode::error:
+            case OpCode::move_to_eax:
+            case OpCode::cmp:
+            case OpCode::jl:
+            case OpCode::nop:
+            case OpCode::nop_n:             goto Dispatch_nop;
+            case OpCode::inc:               goto Dispatch_inc;
+            case OpCode::dec:               goto Dispatch_dec;
+            case OpCode::add:               goto Dispatch_add;
+            case OpCode::add_imm:           goto Dispatch_add_imm;
+            case OpCode::add_eax:           goto Dispatch_add_eax;
+            case OpCode::add_eax_imm:       goto Dispatch_add_eax_imm;
+            case OpCode::sub:               goto Dispatch_sub;
+            case OpCode::sub_imm:           goto Dispatch_sub_imm;
+            case OpCode::sub_eax:           goto Dispatch_sub_eax;
+            case OpCode::sub_eax_imm:       goto Dispatch_sub_eax_imm;
+            case OpCode::alloc:             goto Dispatch_alloc;
+            case OpCode::free:              goto Dispatch_free;
+            case OpCode::new_obj:           goto Dispatch_new_obj;
+            case OpCode::ld_ref:            goto Dispatch_ld_ref;
+            case OpCode::st_ref:            goto Dispatch_st_ref;
+            case OpCode::ld_field:          goto Dispatch_ld_field;
+            case OpCode::st_field:          goto Dispatch_st_field;
+            case OpCode::exit:              goto Dispatch_exit;
+#if USE_SUPER_INSTRUCTIONS
+            case vmFusedOp::cmp_i32_jl:     goto Dispatch_cmp_i32_jl;
+            case vmFusedOp::cmp_u32_jl:     goto Dispatch_cmp_u32_jl;
+            case vmFusedOp::cmp_imm_i32_jl: goto Dispatch_cmp_imm_i32_jl;
+            case vmFusedOp::cmp_imm_u32_jl: goto Dispatch_cmp_imm_u32_jl;
+            case vmFusedOp::dec_fast_call:  goto Dispatch_dec_fast_call;
+            case vmFusedOp::move_dec:       goto Dispatch_move_dec;
+            case vmFusedOp::move_dec_fast_call:
+                                            goto Dispatch_move_dec_fast_call;
+            case vmFusedOp::copy_from_eax_dec:
+                                            goto Dispatch_copy_from_eax_dec;
+            case vmFusedOp::copy_from_eax_dec_fast_call:
+                                            goto Dispatch_copy_from_eax_dec_fast_call;
+            case vmFusedOp::add_eax_ret_n:  goto Dispatch_add_eax_ret_n;
+#endif // USE_SUPER_INSTRUCTIONS
+            case vmMemoOp::memo_call:       goto Dispatch_memo_call;
+            case vmMemoOp::memo_fast_call:  goto Dispatch_memo_fast_call;
+            case vmMemoOp::memo_ret:        goto Dispatch_memo_ret;
+            case vmMemoOp::memo_ret_n:      goto Dispatch_memo_ret_n;
+            case vmMemoOp::memo_ret_eax:    goto Dispatch_memo_ret_eax;
+            case vmMemoOp::memo_ret_eax_n:  goto Dispatch_memo_ret_eax_n;
+            default:                        goto Dispatch_unknown;
+            }
+#endif // !USE_THREADED_DISPATCH
+
+Dispatch_load_eax:
+            op_load_eax(pc, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_store:
+            op_store(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_move:
+            op_move(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_copy_from_eax:
+            op_copy_from_eax(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_i32:
+            op_cmp_i32(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_u32:
+            op_cmp_u32(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_i32:
+            op_cmp_imm_i32(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_u32:
+            op_cmp_imm_u32(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jl:
+            VM_SAFE_POINT(pc->target <= pc);
+            if (Tiered && flags.u32.low == (uint32_t)true && pc->target <= pc) {
+                nativeEntry = tierManager_->onBackEdge(pc);
+                if (unlikely(nativeEntry != nullptr))
+                    goto Tiered_osr;
+            }
+            op_jl_to(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jmp:
+            VM_SAFE_POINT(pc->target <= pc);
+            if (Tiered && pc->target <= pc) {
+                nativeEntry = tierManager_->onBackEdge(pc);
+                if (unlikely(nativeEntry != nullptr))
+                    goto Tiered_osr;
+            }
+            op_jmp_to(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_call:
+            VM_SAFE_POINT(true);
+            if (Tiered) {
+                nativeEntry = tierManager_->onCall(pc->target);
+                if (nativeEntry != nullptr) {
+                    push_callstack(fp, image_.getStart() + pc->operand2, pc->aux);
+                    goto Tiered_call;
+                }
+            }
+            op_call(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_fast_call:
+            VM_SAFE_POINT(true);
+            if (Tiered) {
+                nativeEntry = tierManager_->onCall(pc->target);
+                if (nativeEntry != nullptr) {
+                    push_callstack_fast(fp, image_.getStart() + pc->operand2, pc->aux);
+                    goto Tiered_call;
+                }
+            }
+            op_fast_call(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_fast_tail_call:
+            VM_SAFE_POINT(true);
+            if (Tiered) {
+                nativeEntry = tierManager_->onCall(pc->target);
+                if (nativeEntry != nullptr) {
+                    // The callee returns to the caller's return IP.
+                    tail_callstack_fast(fp, pc->aux, pc->operand1);
+                    goto Tiered_osr;
+                }
+            }
+            op_fast_tail_call(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret:
+            if (op_ret(pc, fp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret_n:
+            if (op_ret_n(pc, fp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret_eax:
+            if (op_ret_eax(pc, fp, regs))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret_eax_n:
+            if (op_ret_eax_n(pc, fp, regs))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_nop:
+            op_nop(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_inc:
+            op_inc(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_dec:
+            op_dec(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add:
+            op_add(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add_imm:
+            op_add_imm(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add_eax:
+            op_add_eax(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add_eax_imm:
+            op_add_eax_imm(pc, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_sub:
+            op_sub(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_sub_imm:
+            op_sub_imm(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_sub_eax:
+            op_sub_eax(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_sub_eax_imm:
+            op_sub_eax_imm(pc, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_alloc:
+            op_alloc(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_free:
+            op_free(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_new_obj:
+            op_new_obj(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_ld_ref:
+            op_ld_ref(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_st_ref:
+            op_st_ref(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_ld_field:
+            op_ld_field(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_st_field:
+            op_st_field(pc, fp);
+            VM_DISPATCH_NEXT();
+
+#if USE_SUPER_INSTRUCTIONS
+Dispatch_cmp_i32_jl:
+            VM_SAFE_POINT(pc->target <= pc);
+            VM_FUSED_COUNT();
+            op_cmp_i32_jl(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_u32_jl:
+            VM_SAFE_POINT(pc->target <= pc);
+            VM_FUSED_COUNT();
+            op_cmp_u32_jl(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_i32_jl:
+            VM_SAFE_POINT(pc->target <= pc);
+            VM_FUSED_COUNT();
+            op_cmp_imm_i32_jl(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_u32_jl:
+            VM_SAFE_POINT(pc->target <= pc);
+            VM_FUSED_COUNT();
+            op_cmp_imm_u32_jl(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_dec_fast_call:
+            VM_SAFE_POINT(true);
+            VM_FUSED_COUNT();
+            op_dec_fast_call(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_move_dec:
+            VM_FUSED_COUNT();
+            op_move_dec(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_move_dec_fast_call:
+            VM_SAFE_POINT(true);
+            VM_FUSED_COUNT();
+            op_move_dec_fast_call(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_copy_from_eax_dec:
+            VM_FUSED_COUNT();
+            op_copy_from_eax_dec(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_copy_from_eax_dec_fast_call:
+            VM_SAFE_POINT(true);
+            VM_FUSED_COUNT();
+            op_copy_from_eax_dec_fast_call(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add_eax_ret_n:
+            VM_FUSED_COUNT();
+            if (op_add_eax_ret_n(pc, fp, regs))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+#endif // USE_SUPER_INSTRUCTIONS
+
+            //
+            // The calls and returns of the pure functions, they are plain
+            // calls and returns without a memoizer, or in the tiered mode.
+            //
+Dispatch_memo_call:
+            if (Tiered || memoizer_ == nullptr)
+                goto Dispatch_call;
+            VM_SAFE_POINT(true);
+            op_memo_call(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_memo_fast_call:
+            if (Tiered || memoizer_ == nullptr)
+                goto Dispatch_fast_call;
+            VM_SAFE_POINT(true);
+            op_memo_fast_call(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_memo_ret:
+            if (!Tiered && memoizer_ != nullptr)
+                memoizer_->store(regs.eax.u32);
+            goto Dispatch_ret;
+
+Dispatch_memo_ret_n:
+            if (!Tiered && memoizer_ != nullptr)
+                memoizer_->store(regs.eax.u32);
+            goto Dispatch_ret_n;
+
+Dispatch_memo_ret_eax:
+            if (!Tiered && memoizer_ != nullptr)
+                memoizer_->store(pc->operand2);
+            goto Dispatch_ret_eax;
+
+Dispatch_memo_ret_eax_n:
+            if (!Tiered && memoizer_ != nullptr)
+                memoizer_->store(pc->operand2);
+            goto Dispatch_ret_eax_n;
+
+Dispatch_unknown:
+            op_unknown(pc);
+            VM_DISPATCH_NEXT();
+
+            //
+            // The frame of the callee is pushed, run it natively until it
+            // returns, then go on from the return site.
+            //
+Tiered_call:
+            VM_TRACE("%08X:  call 0x%08X, %u (native)\n",
+                     pc->offset, pc->target->offset, (uint32_t)pc->aux);
+            regs.eax.u32 = tierManager_->getJitCode()->enter(fp.ptr(), nativeEntry,
+                                                             regs.eax.u32, fpOut);
+            if (unlikely(vmJitCode::isStackOverflow(fpOut)))
+                goto Native_Overflow;
+            if (fpOut == nullptr)
+                goto Execute_Finished;
+            fp.set(fpOut);
+            pc++;
+            VM_DISPATCH_NEXT();
+
+            //
+            // On-stack replacement: the running frame goes on natively from
+            // the loop head, until it returns to its caller.
+            //
+Tiered_osr:
+            VM_TRACE("%08X:  jmp  0x%08X (native)\n", pc->offset, pc->target->offset);
+            returnIP = *(void **)(fp.ptr() - sizeof(void *));
+            regs.eax.u32 = tierManager_->getJitCode()->enter(fp.ptr(), nativeEntry,
+                                                             regs.eax.u32, fpOut);
+            if (unlikely(vmJitCode::isStackOverflow(fpOut)))
+                goto Native_Overflow;
+            if (fpOut == nullptr || returnIP == nullptr)
+                goto Execute_Finished;
+            fp.set(fpOut);
+            pc = decoded_->at(returnIP);
+            VM_DISPATCH_NEXT();
+
+            //
+            // The native code ran out of host stack, the guest frames are dropped.
+            //
+Native_Overflow:
+            ec = Error::Stack_Overflow;
+            goto Execute_Finished;
+
+Dispatch_exit:
+            VM_TRACE("%08X:  end\n", pc->offset);
+            goto Execute_Finished;
+
+#undef VM_FUSED_COUNT
+#undef VM_SAFE_POINT
+#undef VM_SAMPLE_POINT
+#undef VM_DISPATCH_NEXT
+#undef VM_DISPATCH_JUMP
+
+            //
+            // The budget is spent, pc is not run yet: save the registers
+            // for the next slice.
+            //
+Slice_Preempt:
+            ip_.set(image_.getStart() + pc->offset);
+            fp_.set(fp.ptr());
+            regs_ = regs;
+            return kSlicePreempted;
+
+Execute_Finished:
+            if (!Tiered && profiler_ != nullptr)
+                profiler_->finish();
+            retVal.setDataType(return_type::Basic);
+            retVal.setValue(regs.eax.u32);
+        }
+        return ec;
+    }
+
+    //
+    // The call and return handlers of the execution plan (see ImageSpecializer.h),
+    // the other instructions use the predecoded handlers.
+    //
+
+    //
+    // call, call_short, call_long (tagged)
+    //
+    JM_FORCEINLINE void op_call_tagged(vmDecodedInst *& pc, vmFramePtr & fp, vmStackPtr & cp) {
+        void * returnIP = image_.getStart() + pc->operand2;
+        push_callstack(fp, returnIP, pc->aux);
+        cp.push_Int32(pc->operand1);
+        VM_TRACE("%08X:  call 0x%08X, %u (ret_%02d)\n",
+                 pc->offset, pc->target->offset, (uint32_t)pc->aux, pc->operand1);
+        pc = pc->target;
+    }
+
+    //
+    // fast_call_short (tagged)
+    //
+    JM_FORCEINLINE void op_fast_call_tagged(vmDecodedInst *& pc, vmFramePtr & fp, vmStackPtr & cp) {
+        void * returnIP = image_.getStart() + pc->operand2;
+        push_callstack_fast(fp, returnIP, pc->aux);
+        cp.push_Int32(pc->operand1);
+        VM_TRACE("%08X:  fast_call 0x%08X, %u (ret_%02d)\n",
+                 pc->offset, pc->target->offset, (uint32_t)pc->aux, pc->operand1);
+        pc = pc->target;
+    }
+
+    //
+    // ret (tagged)
+    //
+    JM_FORCEINLINE bool op_ret_tagged(vmDecodedInst *& pc, vmFramePtr & fp, vmStackPtr & cp) {
+        pop_callstack(fp);
+        int32_t returnTag = cp.pop_Int32();
+        if (likely(returnTag != 0)) {
+            VM_TRACE("%08X:  ret  (ret_%02d)\n", pc->offset, returnTag);
+            pc = plan_->returnSite(returnTag);
+            return false;
+        }
+        else {
+            VM_TRACE("%08X:  ret  (done)\n", pc->offset);
+            return true;
+        }
+    }
+
+    //
+    // ret_n_sm, ret_n (tagged)
+    //
+    JM_FORCEINLINE bool op_ret_n_tagged(vmDecodedInst *& pc, vmFramePtr & fp, vmStackPtr & cp) {
+        pop_callstack_fast(fp, pc->aux);
+        int32_t returnTag = cp.pop_Int32();
+        if (likely(returnTag != 0)) {
+            VM_TRACE("%08X:  ret_n [%u] (ret_%02d)\n",
+                     pc->offset, (uint32_t)pc->aux, returnTag);
+            pc = plan_->returnSite(returnTag);
+            return false;
+        }
+        else {
+            VM_TRACE("%08X:  ret_n [%u] (done)\n\n", pc->offset, (uint32_t)pc->aux);
+            return true;
+        }
+    }
+
+    //
+    // Execute the direct-jump execution plan of the image.
+    //
+    // It's the generic form of execute_inline(): the returns go through
+    // the return tags on the call stack, and the fused instructions are
+    // formed when the plan is built.
+    //
+    int execute_specialized(return_type & retVal) {
+        return execute_guarded<vmExecutor::Specialized>(retVal);
+    }
+
+    int execute_plan(return_type & retVal) {
+        int ec = 0;
+        if (isInited() && plan_ != nullptr && plan_->isInited()) {
+            register vmDecodedInst * pc;
+            register vmFramePtr fp;
+            register vmStackPtr cp;
+            register Register   regs;
+
+#if USE_THREADED_DISPATCH
+            void * dispatchTable[256];
+            for (size_t i = 0; i < 256; i++) {
+                dispatchTable[i] = &&Dispatch_unknown;
+            }
+
+            dispatchTable[OpCode::error]            = &&Dispatch_nop;
+            dispatchTable[OpCode::load_eax]         = &&Dispatch_load_eax;
+            dispatchTable[OpCode::store]            = &&Dispatch_store;
+            dispatchTable[OpCode::move]             = &&Dispatch_move;
+            dispatchTable[OpCode::move_to_eax]      = &&Dispatch_nop;
+            dispatchTable[OpCode::copy_from_eax]    = &&Dispatch_copy_from_eax;
+            dispatchTable[OpCode::cmp]              = &&Dispatch_nop;
+            dispatchTable[OpCode::cmp_i32]          = &&Dispatch_cmp_i32;
+            dispatchTable[OpCode::cmp_u32]          = &&Dispatch_cmp_u32;
+            dispatchTable[OpCode::cmp_imm_i32]      = &&Dispatch_cmp_imm_i32;
+            dispatchTable[OpCode::cmp_imm_u32]      = &&Dispatch_cmp_imm_u32;
+            dispatchTable[OpCode::jl]               = &&Dispatch_nop;
+            dispatchTable[OpCode::jl_near]          = &&Dispatch_jl;
+            dispatchTable[OpCode::jl_short]         = &&Dispatch_jl;
+            dispatchTable[OpCode::jl_long]          = &&Dispatch_jl;
+            dispatchTable[OpCode::jmp]              = &&Dispatch_jmp;
+            dispatchTable[OpCode::jmp_near]         = &&Dispatch_jmp;
+            dispatchTable[OpCode::jmp_short]        = &&Dispatch_jmp;
+            dispatchTable[OpCode::jmp_long]         = &&Dispatch_jmp;
+            dispatchTable[OpCode::call]             = &&Dispatch_call;
+            dispatchTable[OpCode::call_short]       = &&Dispatch_call;
+            dispatchTable[OpCode::call_long]        = &&Dispatch_call;
+            dispatchTable[OpCode::fast_call_short]  = &&Dispatch_fast_call;
+            dispatchTable[OpCode::fast_tail_call_short] = &&Dispatch_fast_tail_call;
+            dispatchTable[OpCode::ret]              = &&Dispatch_ret;
+            dispatchTable[OpCode::ret_n_sm]         = &&Dispatch_ret_n;
+            dispatchTable[OpCode::ret_n]            = &&Dispatch_ret_n;
+            dispatchTable[OpCode::ret_eax]          = &&Dispatch_ret_eax;
+            dispatchTable[OpCode::ret_eax_n]        = &&Dispatch_ret_eax_n;
+            dispatchTable[OpCode::nop]              = &&Dispatch_nop;
+            dispatchTable[OpCode::nop_n]            = &&Dispatch_nop;
+            dispatchTable[OpCode::inc]              = &&Dispatch_inc;
+            dispatchTable[OpCode::dec]              = &&Dispatch_dec;
+            dispatchTable[OpCode::add]              = &&Dispatch_add;
+            dispatchTable[OpCode::add_imm]          = &&Dispatch_add_imm;
+            dispatchTable[OpCode::add_eax]          = &&Dispatch_add_eax;
+            dispatchTable[OpCode::add_eax_imm]      = &&Dispatch_add_eax_imm;
+            dispatchTable[OpCode::sub]              = &&Dispatch_sub;
+            dispatchTable[OpCode::sub_imm]          = &&Dispatch_sub_imm;
+            dispatchTable[OpCode::sub_eax]          = &&Dispatch_sub_eax;
+            dispatchTable[OpCode::sub_eax_imm]      = &&Dispatch_sub_eax_imm;
+            dispatchTable[OpCode::alloc]            = &&Dispatch_alloc;
+            dispatchTable[OpCode::free]             = &&Dispatch_free;
+            dispatchTable[OpCode::new_obj]          = &&Dispatch_new_obj;
+            dispatchTable[OpCode::ld_ref]           = &&Dispatch_ld_ref;
+            dispatchTable[OpCode::st_ref]           = &&Dispatch_st_ref;
+            dispatchTable[OpCode::ld_field]         = &&Dispatch_ld_field;
+            dispatchTable[OpCode::st_field]         = &&Dispatch_st_field;
+            dispatchTable[OpCode::exit]             = &&Dispatch_exit;
+
+            dispatchTable[vmFusedOp::cmp_i32_jl]        = &&Dispatch_cmp_i32_jl;
+            dispatchTable[vmFusedOp::cmp_u32_jl]        = &&Dispatch_cmp_u32_jl;
+            dispatchTable[vmFusedOp::cmp_imm_i32_jl]    = &&Dispatch_cmp_imm_i32_jl;
+            dispatchTable[vmFusedOp::cmp_imm_u32_jl]    = &&Dispatch_cmp_imm_u32_jl;
+            dispatchTable[vmFusedOp::dec_fast_call]     = &&Dispatch_dec_fast_call;
+            dispatchTable[vmFusedOp::move_dec]          = &&Dispatch_move_dec;
+            dispatchTable[vmFusedOp::move_dec_fast_call]    = &&Dispatch_move_dec_fast_call;
+            dispatchTable[vmFusedOp::copy_from_eax_dec]     = &&Dispatch_copy_from_eax_dec;
+            dispatchTable[vmFusedOp::copy_from_eax_dec_fast_call]
+                                                        = &&Dispatch_copy_from_eax_dec_fast_call;
+            dispatchTable[vmFusedOp::add_eax_ret_n]     = &&Dispatch_add_eax_ret_n;
+
+            // The handler addresses are bound to this executor only.
+            const void * bindKey = &&Dispatch_unknown;
+            vmDecodedImage * code = plan_->getCode();
+            if (!code->isBoundTo(bindKey)) {
+                code->bind(dispatchTable, bindKey);
+            }
+
+#define VM_DISPATCH_NEXT()  goto *pc->handler
+#else
+#define VM_DISPATCH_NEXT()  goto Dispatch_Switch
+#endif // USE_THREADED_DISPATCH
+
+            // Init environment
+            pc = plan_->entry();
+            fp.set(stack_.current());
+            cp.set(callstack_.current());
+            regs.uval = 0;
+
+            // Push call program entry, the return tag 0 is the exit.
+            push_callstack(fp, nullptr, 0);
+            cp.push_Int32(0);
+
+            // Main loop
+            VM_DISPATCH_NEXT();
+
+#if !USE_THREADED_DISPATCH
+Dispatch_Switch:
+            switch (pc->opcode) {
+            case OpCode::load_eax:          goto Dispatch_load_eax;
+            case OpCode::store:             goto Dispatch_store;
+            case OpCode::move:              goto Dispatch_move;
+            case OpCode::copy_from_eax:     goto Dispatch_copy_from_eax;
+            case OpCode::cmp_i32:           goto Dispatch_cmp_i32;
+            case OpCode::cmp_u32:           goto Dispatch_cmp_u32;
+            case OpCode::cmp_imm_i32:       goto Dispatch_cmp_imm_i32;
+            case OpCode::cmp_imm_u32:       goto Dispatch_cmp_imm_u32;
+            case OpCode::jl_near:
+            case OpCode::jl_short:
+            case OpCode::jl_long:           goto Dispatch_jl;
+            case OpCode::jmp:
+            case OpCode::jmp_near:
+            case OpCode::jmp_short:
+            case OpCode::jmp_long:          goto Dispatch_jmp;
+            case OpCode::call:
+            case OpCode::call_short:
+            case OpCode::call_long:         goto Dispatch_call;
+            case OpCode::fast_call_short:   goto Dispatch_fast_call;
+            case OpCode::fast_tail_call_short:
+                                            goto Dispatch_fast_tail_call;
+            case OpCode::ret:               goto Dispatch_ret;
+            case OpCode::ret_n_sm:
+            case OpCode::ret_n:             goto Dispatch_ret_n;
+            case OpCode::ret_eax:           goto Dispatch_ret_eax;
+            case OpCode::ret_eax_n:         goto Dispatch_ret_eax_n;
+            case OpCode::error:
+            case OpCode::move_to_eax:
+            case OpCode::cmp:
+            case OpCode::jl:
+            case OpCode::nop:
+            case OpCode::nop_n:             goto Dispatch_nop;
+            case OpCode::inc:               goto Dispatch_inc;
+            case OpCode::dec:               goto Dispatch_dec;
+            case OpCode::add:               goto Dispatch_add;
+            case OpCode::add_imm:           goto Dispatch_add_imm;
+            case OpCode::add_eax:           goto Dispatch_add_eax;
+            case OpCode::add_eax_imm:       goto Dispatch_add_eax_imm;
+            case OpCode::sub:               goto Dispatch_sub;
+            case OpCode::sub_imm:           goto Dispatch_sub_imm;
+            case OpCode::sub_eax:           goto Dispatch_sub_eax;
+            case OpCode::sub_eax_imm:       goto Dispatch_sub_eax_imm;
+            case OpCode::alloc:             goto Dispatch_alloc;
+            case OpCode::free:              goto Dispatch_free;
+            case OpCode::new_obj:           goto Dispatch_new_obj;
+            case OpCode::ld_ref:            goto Dispatch_ld_ref;
+            case OpCode::st_ref:            goto Dispatch_st_ref;
+            case OpCode::ld_field:          goto Dispatch_ld_field;
+            case OpCode::st_field:          goto Dispatch_st_field;
+            case OpCode::exit:              goto Dispatch_exit;
+            case vmFusedOp::cmp_i32_jl:     goto Dispatch_cmp_i32_jl;
+            case vmFusedOp::cmp_u32_jl:     goto Dispatch_cmp_u32_jl;
+            case vmFusedOp::cmp_imm_i32_jl: goto Dispatch_cmp_imm_i32_jl;
+            case vmFusedOp::cmp_imm_u32_jl: goto Dispatch_cmp_imm_u32_jl;
+            case vmFusedOp::dec_fast_call:  goto Dispatch_dec_fast_call;
+            case vmFusedOp::move_dec:       goto Dispatch_move_dec;
+            case vmFusedOp::move_dec_fast_call:
+                                            goto Dispatch_move_dec_fast_call;
+            case vmFusedOp::copy_from_eax_dec:
+                                            goto Dispatch_copy_from_eax_dec;
+            case vmFusedOp::copy_from_eax_dec_fast_call:
+                                            goto Dispatch_copy_from_eax_dec_fast_call;
+            case vmFusedOp::add_eax_ret_n:  goto Dispatch_add_eax_ret_n;
+            default:                        goto Dispatch_unknown;
+            }
+#endif // !USE_THREADED_DISPATCH
+
+Dispatch_load_eax:
+            op_load_eax(pc, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_store:
+            op_store(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_move:
+            op_move(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_copy_from_eax:
+            op_copy_from_eax(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_i32:
+            op_cmp_i32(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_u32:
+            op_cmp_u32(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_i32:
+            op_cmp_imm_i32(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_u32:
+            op_cmp_imm_u32(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jl:
+            op_jl_to(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jmp:
+            op_jmp_to(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_call:
+            op_call_tagged(pc, fp, cp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_fast_call:
+            op_fast_call_tagged(pc, fp, cp);
+            VM_DISPATCH_NEXT();
+
+            // The return tag of the caller is reused as well.
+Dispatch_fast_tail_call:
+            op_fast_tail_call(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret:
+            if (op_ret_tagged(pc, fp, cp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret_n:
+            if (op_ret_n_tagged(pc, fp, cp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret_eax:
+            regs.eax.u32 = pc->operand2;
+            if (op_ret_tagged(pc, fp, cp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_ret_eax_n:
+            regs.eax.u32 = pc->operand2;
+            if (op_ret_n_tagged(pc, fp, cp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_nop:
+            op_nop(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_inc:
+            op_inc(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_dec:
+            op_dec(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add:
+            op_add(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add_imm:
+            op_add_imm(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add_eax:
+            op_add_eax(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add_eax_imm:
+            op_add_eax_imm(pc, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_sub:
+            op_sub(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_sub_imm:
+            op_sub_imm(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_sub_eax:
+            op_sub_eax(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_sub_eax_imm:
+            op_sub_eax_imm(pc, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_alloc:
+            op_alloc(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_free:
+            op_free(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_new_obj:
+            op_new_obj(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_ld_ref:
+            op_ld_ref(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_st_ref:
+            op_st_ref(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_ld_field:
+            op_ld_field(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_st_field:
+            op_st_field(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_i32_jl:
+            op_cmp_i32_jl(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_u32_jl:
+            op_cmp_u32_jl(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_i32_jl:
+            op_cmp_imm_i32_jl(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_imm_u32_jl:
+            op_cmp_imm_u32_jl(pc, fp);
+            VM_DISPATCH_NEXT();
+
+            // The fused calls run the leading instructions, then the call
+            // instruction, which holds the return tag.
+Dispatch_dec_fast_call:
+            op_dec(pc, fp);
+            op_fast_call_tagged(pc, fp, cp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_move_dec:
+            op_move_dec(pc, fp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_move_dec_fast_call:
+            op_move_dec(pc, fp);
+            op_fast_call_tagged(pc, fp, cp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_copy_from_eax_dec:
+            op_copy_from_eax_dec(pc, fp, regs);
+            VM_DISPATCH_NEXT();
+
+Dispatch_copy_from_eax_dec_fast_call:
+            op_copy_from_eax_dec(pc, fp, regs);
+            op_fast_call_tagged(pc, fp, cp);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add_eax_ret_n:
+            op_add_eax(pc, fp, regs);
+            if (op_ret_n_tagged(pc, fp, cp))
+                goto Execute_Finished;
+            VM_DISPATCH_NEXT();
+
+Dispatch_unknown:
+            op_unknown(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_exit:
+            VM_TRACE("%08X:  end\n", pc->offset);
+            goto Execute_Finished;
+
+#undef VM_DISPATCH_NEXT
+
+Execute_Finished:
+            retVal.setDataType(return_type::Basic);
+            retVal.setValue(regs.eax.u32);
+        }
+        return ec;
+    }
+
+    enum {
+        ret_first,
+        ret_00,
+        ret_01,
+        ret_02,
+        ret_last
+    };
+
+    int execute_inline(return_type & retVal) {
+        return execute_guarded<vmExecutor::Inline>(retVal);
+    }
+
+    int execute_inline_bytecode(return_type & retVal) {
+        int ec = 0;
+        if (isInited()) {
+            register vmImagePtr ip;
+            register vmStackPtr sp;
+            register vmFramePtr fp;
+            register vmStackPtr cp;
+            register Register   regs;
+
+            // Init environment
+            ip.set(image_.getPtr());
+            sp.set(stack_.current());
+            fp.set(stack_.current());
+            cp.set(callstack_.current());
+            regs.uval = 0;
+
+            // Push call program entry.
+            inline_push_callstack(cp, fp, nullptr, 0, ret_first);
+
+            // Main loop
+            bool done;
+            do {
+                op_push_i32(ip, sp);
+                op_inline_call_short(ip, fp, cp, ret_00);
+                goto fibonacci_n;
+fibonacci_ret_00:
+                {
+                    op_pop_i32(ip, sp);
+                    int retType = op_inline_ret(ip, fp, cp, done);
+                    if (likely(done)) {
+                        retVal.setDataType(return_type::Basic);
+                        retVal.setValue(regs.eax.u32);
+                        break;
+                    }
+                    else {
+                        VM_TRACE("Error: Unknown error.\n");
+                    }
+                    goto Execute_Finished;
+                }
+fibonacci_n:
+                op_cmp_imm_i32(ip, fp);
+                bool is_large = op_jl_near(ip);
+                if (likely(!is_large)) {
+                    op_add_sp_4(ip, sp);
+                    op_push(ip, sp, fp);
+                    op_dec(ip, fp);
+                    op_inline_fast_call_short(ip, fp, cp, ret_01);
+                    goto fibonacci_n;
+fibonacci_ret_01:
+                    op_copy_from_eax(ip, fp, regs);
+                    op_dec(ip, fp);
+                    op_inline_fast_call_short(ip, fp, cp, ret_02);
+                    goto fibonacci_n;
+fibonacci_ret_02:
+                    op_add_eax(ip, fp, regs);
+                    int retType = op_inline_ret_n(ip, fp, cp, done);
+                    if (retType == ret_01)
+                        goto fibonacci_ret_01;
+                    else if (retType == ret_02)
+                        goto fibonacci_ret_02;
+                    else
+                        goto fibonacci_ret_00;
+                }
+                else {
+                    int retType = op_inline_ret_eax_n(ip, fp, cp, regs, done);
+                    if (retType == ret_01)
+                        goto fibonacci_ret_01;
+                    else if (retType == ret_02)
+                        goto fibonacci_ret_02;
+                    else
+                        goto fibonacci_ret_00;
+                }
+            } while (1);
+        }
+
+Execute_Finished:
+        return ec;
+    }
+
+    int run(return_type & retVal) {
+        ip_.set(image_.getPtr());
+        fp_.set(stack_.current());
+        return execute(retVal);
+    }
+
+    int run_threaded(return_type & retVal) {
+        ip_.set(image_.getPtr());
+        fp_.set(stack_.current());
+        return execute_threaded(retVal);
+    }
+
+    int run_predecoded(return_type & retVal) {
+        ip_.set(image_.getPtr());
+        fp_.set(stack_.current());
+        return execute_predecoded(retVal);
+    }
+
+    //
+    // Bind the predecoded stream to this executor without running it, the
+    // contexts that share the stream can run it at the same time then.
+    //
+    int prepare_predecoded() {
+        return_type retVal;
+        bindOnly_ = true;
+        int ec = execute_decoded<false>(retVal);
+        bindOnly_ = false;
+        return ec;
+    }
+
+    //
+    // Call the guest function at the offset with the predecoded stream,
+    // args[i] is the callee's argi. The image isn't written to, so the
+    // contexts of a process can invoke the same image at the same time.
+    //
+    int invoke(uint32_t entryOffset, const uint32_t * args, uint32_t argc,
+               return_type & retVal) {
+        if (!isInited() || decoded_ == nullptr || !decoded_->isInited())
+            return Error::Invoke_Bad_Entry;
+        vmDecodedInst * entry = decoded_->atOffset(entryOffset);
+        if (entry == nullptr || entry == decoded_->end())
+            return Error::Invoke_Bad_Entry;
+#if USE_FORWARD_STACK_PTR
+        // The arguments as a call site leaves them, argi is the (i + 1)th
+        // slot below the callee's frame header.
+        unsigned char * frame = stack_.current();
+        uint32_t argSize = argc * sizeof(uint32_t);
+        for (uint32_t i = 0; i < argc; i++) {
+            *(uint32_t *)(frame + argSize - (i + 1) * sizeof(uint32_t)) = args[i];
+        }
+        ip_.set(image_.getStart() + entryOffset);
+        fp_.set(frame);
+        entryArgSize_ = argSize;
+        entryFastFrame_ = isFastEntry(entry);
+        int ec = execute_guarded<vmExecutor::Decoded>(retVal);
+        entryArgSize_ = 0;
+        entryFastFrame_ = false;
+        return ec;
+#else
+        (void)args;
+        (void)argc;
+        (void)retVal;
+        return Error::Invoke_Bad_Entry;
+#endif
+    }
+
+    //
+    // Lay the entry's frame on the stack of a fiber, as invoke() does, and
+    // set the registers to start it with execute_slice().
+    //
+    int prepare_slice(vmContextRegs & regs, unsigned char * stack, uint32_t entryOffset,
+                      const uint32_t * args, uint32_t argc) {
+        if (!isInited() || decoded_ == nullptr || !decoded_->isInited())
+            return Error::Invoke_Bad_Entry;
+        vmDecodedInst * entry = decoded_->atOffset(entryOffset);
+        if (entry == nullptr || entry == decoded_->end())
+            return Error::Invoke_Bad_Entry;
+#if USE_FORWARD_STACK_PTR
+        uint32_t argSize = argc * sizeof(uint32_t);
+        for (uint32_t i = 0; i < argc; i++) {
+            *(uint32_t *)(stack + argSize - (i + 1) * sizeof(uint32_t)) = args[i];
+        }
+        // The frame of push_callstack() or push_callstack_fast(), the
+        // null return IP is the exit.
+        unsigned char * fp = stack + argSize;
+        if (!isFastEntry(entry)) {
+            *(void **)fp = (void *)stack;
+            fp += sizeof(void *);
+        }
+        *(void **)fp = nullptr;
+        fp += sizeof(void *);
+
+        regs.ip_.set(image_.getStart() + entryOffset);
+        regs.fp_.set(fp);
+        regs.regs_.uval = 0;
+        regs.flags.uval = 0;
+        return Error::Ok;
+#else
+        (void)regs;
+        (void)stack;
+        (void)args;
+        (void)argc;
+        return Error::Invoke_Bad_Entry;
+#endif
+    }
+
+    //
+    // Run a fiber for a slice: its registers are swapped in, run until
+    // its entry returns or the budget is spent, and swapped out again.
+    // Return kSlicePreempted if it's not done, the registers resume it.
+    //
+    int execute_slice(vmContextRegs & regs, const vmStack<basic_type, false> & stack,
+                      uint32_t mode, int64_t budget, return_type & retVal) {
+        ctx_reg_type & self = *this;
+        self = regs;
+        sliceBudget_ = budget;
+        sliceLimit_ = stack.last();
+        int ec;
+        if (mode == vmSliceMode::BackEdges)
+            ec = execute_guarded<vmExecutor::Decoded, false, vmSliceMode::BackEdges>(retVal, &stack);
+        else
+            ec = execute_guarded<vmExecutor::Decoded, false, vmSliceMode::Instructions>(retVal, &stack);
+        sliceLimit_ = nullptr;
+        regs = self;
+        return ec;
+    }
+
+    //
+    // The frame kind of the last entry is kept, a context that's reused
+    // for the same entry doesn't look for its call sites again.
+    //
+    bool isFastEntry(const vmDecodedInst * entry) {
+        if (entry != invokeEntry_) {
+            invokeFastFrame_ = isFastCallee(entry);
+            invokeEntry_ = entry;
+        }
+        return invokeFastFrame_;
+    }
+
+    //
+    // The entry's frame is the one its call sites push, a fast frame has
+    // no saved frame pointer.
+    //
+    bool isFastCallee(const vmDecodedInst * entry) const {
+        for (const vmDecodedInst * inst = decoded_->begin(); inst != decoded_->end(); ++inst) {
+            if (inst->target != entry)
+                continue;
+            switch (inst->opcode) {
+            case OpCode::fast_call_short:
+            case OpCode::fast_tail_call_short:
+            case vmFusedOp::dec_fast_call:
+            case vmFusedOp::move_dec_fast_call:
+            case vmFusedOp::copy_from_eax_dec_fast_call:
+            case vmMemoOp::memo_fast_call:
+                return true;
+            case OpCode::call:
+            case OpCode::call_short:
+            case OpCode::call_long:
+            case vmMemoOp::memo_call:
+                return false;
+            default:
+                break;
+            }
+        }
+        return false;
+    }
+
+    int run_tiered(return_type & retVal) {
+        ip_.set(image_.getPtr());
+        fp_.set(stack_.current());
+        return execute_tiered(retVal);
+    }
+
+    //
+    // Run the native code of the image, the guest frames are on the same stack.
+    //
+    int execute_jit(vmJitCode * jit, return_type & retVal) {
+        return execute_guarded<vmExecutor::Native>(retVal, nullptr, jit);
+    }
+
+    int execute_native(vmJitCode * jit, return_type & retVal) {
+        int ec = 0;
+        if (isInited() && jit != nullptr && jit->isCompiled()) {
+            uint32_t eax = 0;
+            ec = jit->invoke(stack_.current(), eax);
+            retVal.setDataType(return_type::Basic);
+            retVal.setValue(eax);
+        }
+        return ec;
+    }
+
+    int run_jit(vmJitCode * jit, return_type & retVal) {
+        ip_.set(image_.getPtr());
+        fp_.set(stack_.current());
+        return execute_jit(jit, retVal);
+    }
+
+    int run_specialized(return_type & retVal) {
+        ip_.set(image_.getPtr());
+        fp_.set(stack_.current());
+        return execute_specialized(retVal);
+    }
+
+    int run_inline(return_type & retVal) {
+        ip_.set(image_.getPtr());
+        fp_.set(stack_.current());
+        return execute_inline(retVal);
+    }
+};
+
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class ExecutionEngine {
+public:
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionContext<basic_type, trace_policy>  context_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef ExecutionEngine<basic_type, trace_policy>   this_type;
+
+private:
+    vmBinaryFile binary_;
+    context_type context_;
+
+public:
+    ExecutionEngine() {}
+    virtual ~ExecutionEngine() {
+        destroy();
+    }
+
+    bool isInited() const { return (context_.getId() != 0); }
+
+    //
+    // Load the image file, or the built-in image when there's no filename.
+    //
+    int create(const char * filename = nullptr) {
+        int ec = (filename != nullptr) ? binary_.loadFromFile(filename)
+                                       : binary_.loadBuiltin();
+        if (ec <= 0) {
+            return Error::BinaryFile_Read_Failed;
+        }
+
+        context_.setImageInfo(binary_.getImagePtr(), binary_.getImageSize(),
+                              binary_.getImageEntry());
+        context_.setDecodedImage(binary_.getDecodedImage());
+        context_.setExecPlan(binary_.getExecPlan());
+
+        bool success = createContext();
+        if (!success) {
+            return Error::MainProcess_Create_Failed;
+        }
+
+        return (int)success;
+    }
+
+    void destroy() {
+        destroyContext();
+    }
+
+    bool createContext() {
+        if (!context_.isInited()) {
+            context_.create();
+        }
+
+        return context_.isInited();
+    }
+
+    void destroyContext() {
+        if (context_.isInited()) {
+            context_.destroy();
+        }
+    }
+
+    int run(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+        ec = context_.run(ret);
+        return ec;
+    }
+
+    int run_threaded(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+        ec = context_.run_threaded(ret);
+        return ec;
+    }
+
+    int run_predecoded(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+        ec = context_.run_predecoded(ret);
+        return ec;
+    }
+
+    //
+    // Run the predecoded stream, the first run profiles it and fuses
+    // the hot instruction sequences into superinstructions.
+    //
+    int run_fused(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+        vmSuperInstProfiler * superInst = binary_.getSuperInstProfiler();
+        if (context_.getSuperInstProfiler() == nullptr) {
+            superInst->attach(binary_.getDecodedImage());
+            context_.setSuperInstProfiler(superInst);
+        }
+        ec = context_.run_predecoded(ret);
+        return ec;
+    }
+
+    void dumpSuperInstructions() const {
+        const vmSuperInstProfiler * superInst = context_.getSuperInstProfiler();
+        if (superInst != nullptr) {
+            superInst->dump();
+        }
+    }
+
+    int run_specialized(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+        ec = context_.run_specialized(ret);
+        return ec;
+    }
+
+    void dumpExecPlan() const {
+        const vmExecPlan * plan = context_.getExecPlan();
+        if (plan != nullptr) {
+            plan->dump();
+        }
+    }
+
+    //
+    // Run the image as native code, fall back to the interpreter when
+    // the image can't be compiled.
+    //
+    int run_jit(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+#if USE_FORWARD_STACK_PTR
+        vmJitCode * jit = binary_.getJitCode();
+        if (jit != nullptr) {
+            ec = context_.run_jit(jit, ret);
+            return ec;
+        }
+#endif
+        ec = context_.run_predecoded(ret);
+        return ec;
+    }
+
+    void dumpJitCode() {
+        vmJitCode * jit = binary_.getJitCode();
+        if (jit != nullptr) {
+            jit->dump();
+        }
+        else {
+            console.printf("  jit code: not compiled, the interpreter was used\n");
+        }
+    }
+
+    //
+    // Run the predecoded stream with the hot functions and loops promoted
+    // to native code as it runs.
+    //
+    int run_tiered(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+#if USE_FORWARD_STACK_PTR
+        if (context_.getTierManager() == nullptr) {
+            context_.setTierManager(binary_.getTierManager());
+        }
+#endif
+        ec = context_.run_tiered(ret);
+        return ec;
+    }
+
+    void dumpTiers() const {
+        const vmTierManager * tierManager = context_.getTierManager();
+        if (tierManager != nullptr) {
+            tierManager->dump();
+        }
+        else {
+            console.printf("  tiers: not supported, the interpreter was used\n");
+        }
+    }
+
+    //
+    // Run the predecoded stream with the results of the pure functions
+    // cached, the calls with the arguments seen before are skipped.
+    //
+    int run_memoized(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+        if (context_.getMemoizer() == nullptr) {
+            context_.setMemoizer(binary_.getMemoizer());
+        }
+        ec = context_.run_predecoded(ret);
+        return ec;
+    }
+
+    void dumpMemoizer() const {
+        const vmMemoizer * memoizer = context_.getMemoizer();
+        if (memoizer != nullptr) {
+            memoizer->dump();
+        }
+        else {
+            console.printf("  memo: the stream was fused, the interpreter was used\n");
+        }
+    }
+
+    //
+    // Run the predecoded stream with every instruction, call and return
+    // counted, the counters add up over the runs.
+    //
+    int run_profiled(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+        if (context_.getExecProfiler() == nullptr) {
+            context_.setExecProfiler(binary_.getExecProfiler());
+        }
+        ec = context_.run_predecoded(ret);
+        return ec;
+    }
+
+    void dumpProfile() const {
+        const vmExecProfiler * profiler = context_.getExecProfiler();
+        if (profiler != nullptr) {
+            profiler->dump();
+        }
+    }
+
+    int writeProfile(const char * filename) const {
+        const vmExecProfiler * profiler = context_.getExecProfiler();
+        if (profiler == nullptr)
+            return Error::Profile_Write_Failed;
+        return profiler->writeReport(filename);
+    }
+
+    //
+    // Run the predecoded stream with the guest call stacks sampled by the
+    // CPU time timer, the samples add up over the runs.
+    //
+    int run_sampled(return_type & ret, uint32_t intervalUsec = vmSampler::kDefaultIntervalUsec) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+        vmSampler * sampler = binary_.getSampler();
+        if (context_.getSampler() == nullptr) {
+            context_.setSampler(sampler);
+        }
+        ec = sampler->start(intervalUsec);
+        if (ec != Error::Ok) {
+            return ec;
+        }
+        ec = context_.run_predecoded(ret);
+        sampler->stop();
+        return ec;
+    }
+
+    void dumpSampler() const {
+        const vmSampler * sampler = context_.getSampler();
+        if (sampler != nullptr) {
+            sampler->dump();
+        }
+    }
+
+    int writeSamples(const char * filename) const {
+        const vmSampler * sampler = context_.getSampler();
+        if (sampler == nullptr)
+            return Error::Profile_Write_Failed;
+        return sampler->writeFolded(filename);
+    }
+
+    int run_inline(return_type & ret) {
+        int ec = binary_.setInput(ret.getValue());
+        if (ec != Error::Ok)
+            return ec;
+        ec = context_.run_inline(ret);
+        return ec;
+    }
+};
+
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class Interpreter {
+public:
+    typedef BasicType                                  basic_type;
+    typedef TracePolicy                                trace_policy;
+    typedef ExecutionEngine<basic_type, trace_policy>  engine_type;
+    typedef vmReturn<basic_type>                       return_type;
+    typedef Interpreter<basic_type, trace_policy>      this_type;
+
+private:
+    engine_type engine_;
+
+public:
+    Interpreter() {}
+    ~Interpreter() {}
+
+    int create() {
+        int ec = engine_.create();
+        return ec;
+    }
+
+    int run(return_type & ret) {
+        int ec = engine_.run(ret);
+        return ec;
+    }
+
+    int run_threaded(return_type & ret) {
+        int ec = engine_.run_threaded(ret);
+        return ec;
+    }
+
+    int run_predecoded(return_type & ret) {
+        int ec = engine_.run_predecoded(ret);
+        return ec;
+    }
+
+    int run_fused(return_type & ret) {
+        int ec = engine_.run_fused(ret);
+        return ec;
+    }
+
+    void dumpSuperInstructions() const {
+        engine_.dumpSuperInstructions();
+    }
+
+    int run_specialized(return_type & ret) {
+        int ec = engine_.run_specialized(ret);
+        return ec;
+    }
+
+    void dumpExecPlan() const {
+        engine_.dumpExecPlan();
+    }
+
+    int run_jit(return_type & ret) {
+        int ec = engine_.run_jit(ret);
+        return ec;
+    }
+
+    void dumpJitCode() {
+        engine_.dumpJitCode();
+    }
+
+    int run_tiered(return_type & ret) {
+        int ec = engine_.run_tiered(ret);
+        return ec;
+    }
+
+    void dumpTiers() const {
+        engine_.dumpTiers();
+    }
+
+    int run_memoized(return_type & ret) {
+        int ec = engine_.run_memoized(ret);
+        return ec;
+    }
+
+    void dumpMemoizer() const {
+        engine_.dumpMemoizer();
+    }
+
+    int run_profiled(return_type & ret) {
+        int ec = engine_.run_profiled(ret);
+        return ec;
+    }
+
+    void dumpProfile() const {
+        engine_.dumpProfile();
+    }
+
+    int writeProfile(const char * filename) const {
+        return engine_.writeProfile(filename);
+    }
+
+    int run_sampled(return_type & ret) {
+        int ec = engine_.run_sampled(ret);
+        return ec;
+    }
+
+    int run_sampled(return_type & ret, uint32_t intervalUsec) {
+        int ec = engine_.run_sampled(ret, intervalUsec);
+        return ec;
+    }
+
+    void dumpSampler() const {
+        engine_.dumpSampler();
+    }
+
+    int writeSamples(const char * filename) const {
+        return engine_.writeSamples(filename);
     }
 
     int run_inline(return_type & ret) {
@@ -0,0 +1,786 @@
+
+#ifndef JLANG_VM_INTERPRETER_V5_H
+#define JLANG_VM_INTERPRETER_V5_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/RegOpCode.h"
+#include "jlang/vm/VectorReg.h"
+#include "jlang/asm/RegAssembler.h"
+#include "jlang/lang/Error.h"
+#include "jlang/vm/TracePolicy.h"
+#include "jlang/support/Console.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <vector>
+
+namespace jlang {
+namespace v5 {
+
+//
+// The register machine: every function runs in a window of the register
+// file, its locals are the registers of the window. A call slides the
+// window up to the register of the call, so the arguments are passed in
+// place, and the result comes back in the same register.
+//
+//   fibonacci:  7 instructions per call (v4: 10), 1 for a leaf (v4: 2).
+//
+static const char * fibonacciSource =
+    "main:\n"
+    "    mov         r0, 20          ; n, the input\n"
+    "    call        r0, fib         ; r0 = fib(n)\n"
+    "    exit\n"
+    "\n"
+    "fib:\n"
+    "    cmp_br_lt   r0, 3, leaf     ; if (n < 3) goto leaf\n"
+    "    sub         r1, r0, 1\n"
+    "    call        r1, fib         ; r1 = fib(n - 1)\n"
+    "    sub         r2, r0, 2\n"
+    "    call        r2, fib         ; r2 = fib(n - 2)\n"
+    "    add         r0, r1, r2\n"
+    "    ret         r0\n"
+    "\n"
+    "leaf:\n"
+    "    ret         1\n";
+
+class vmBinaryFile {
+private:
+    std::vector<uint32_t>   code_;
+    uint32_t                entry_;
+
+public:
+    vmBinaryFile() : entry_(0) {}
+    ~vmBinaryFile() {}
+
+    int loadFromFile(const char * filename) {
+        RegAssembler assembler(fibonacciSource);
+        int ec = assembler.parse();
+        if (ec != Error::Ok) {
+            console.trace("v5::vmBinaryFile: line %u: error %d\n", assembler.getErrorLine(), ec);
+            return ec;
+        }
+        int32_t entry = assembler.getLabel("main");
+        if (entry < 0) {
+            return Error::IllegalIdentifer;
+        }
+        code_ = assembler.getCode();
+        entry_ = (uint32_t)entry;
+        return 1;
+    }
+
+    int saveToFile(const char * filename) {
+        return 1;
+    }
+
+    void setInput(uintptr_t initValue) {
+        // The input is the immediate of the first instruction.
+        if (code_.size() > entry_ + 1 && RegOp::getOp(code_[entry_]) == RegOp::movi) {
+            code_[entry_ + 1] = (uint32_t)initValue;
+        }
+    }
+
+    const uint32_t * getCode() const {
+        return code_.data();
+    }
+
+    size_t getCodeSize() const {
+        return code_.size();
+    }
+
+    uint32_t getEntry() const {
+        return entry_;
+    }
+};
+
+//
+// A frame of the call stack, where to go back and the caller's window.
+//
+struct vmRegFrame {
+    const uint32_t *    returnPC;
+    uint32_t *          window;
+};
+
+template <typename BasicType, typename TracePolicy>
+class ExecutionEngine;
+
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class ExecutionContext {
+public:
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionEngine<basic_type, trace_policy>   engine_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef ExecutionContext<basic_type, trace_policy>  this_type;
+
+    static const size_type kDefaultRegisterCount = 1048576U;
+    static const size_type kDefaultCallDepth = 65536U;
+
+private:
+    const uint32_t *            code_;
+    size_t                      codeSize_;
+    uint32_t                    entry_;
+    std::vector<uint32_t>       regs_;
+    std::vector<vmRegFrame>     callstack_;
+    std::vector<uint32_t>       data_;
+    vmVectorFile                vregs_;
+    engine_type *               engine_;
+
+public:
+    ExecutionContext(engine_type * engine = nullptr)
+        : code_(nullptr), codeSize_(0), entry_(0), engine_(engine) {}
+    virtual ~ExecutionContext() {
+        destroy();
+    }
+
+    bool isInited() const {
+        return (code_ != nullptr && !regs_.empty());
+    }
+
+    engine_type * getEngine() { return engine_; }
+    void setEngine(engine_type * engine) {
+        engine_ = engine;
+    }
+
+    void setCode(const uint32_t * code, size_t codeSize, uint32_t entry) {
+        code_ = code;
+        codeSize_ = codeSize;
+        entry_ = entry;
+    }
+
+    void create(size_type registerCount = kDefaultRegisterCount,
+                size_type callDepth = kDefaultCallDepth) {
+        regs_.assign(registerCount, 0);
+        callstack_.resize(callDepth);
+    }
+
+    void destroy() {
+        callstack_.clear();
+        regs_.clear();
+        data_.clear();
+        code_ = nullptr;
+        codeSize_ = 0;
+    }
+
+    //
+    // The data memory of ld, st, vld and vst, a copy of the words.
+    //
+    void setData(const uint32_t * data, size_t size) {
+        data_.assign(data, data + size);
+    }
+
+    const uint32_t * getData() const { return data_.data(); }
+    size_t getDataSize() const { return data_.size(); }
+
+    const vmVectorFile & getVectorRegs() const { return vregs_; }
+
+    //
+    // mov rA, rB
+    //
+    JM_FORCEINLINE void op_mov(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        r[RegOp::getA(inst)] = r[RegOp::getB(inst)];
+        VM_TRACE("%08X:  mov  r%u, r%u\n", getOffset(pc), RegOp::getA(inst), RegOp::getB(inst));
+        pc += 1;
+    }
+
+    //
+    // movi rA, imm
+    //
+    JM_FORCEINLINE void op_movi(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        r[RegOp::getA(inst)] = pc[1];
+        VM_TRACE("%08X:  mov  r%u, %d\n", getOffset(pc), RegOp::getA(inst), (int32_t)pc[1]);
+        pc += 2;
+    }
+
+    //
+    // add rA, rB, rC
+    //
+    JM_FORCEINLINE void op_add(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        r[RegOp::getA(inst)] = r[RegOp::getB(inst)] + r[RegOp::getC(inst)];
+        VM_TRACE("%08X:  add  r%u, r%u, r%u\n", getOffset(pc),
+                 RegOp::getA(inst), RegOp::getB(inst), RegOp::getC(inst));
+        pc += 1;
+    }
+
+    //
+    // addi rA, rB, imm
+    //
+    JM_FORCEINLINE void op_addi(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        r[RegOp::getA(inst)] = r[RegOp::getB(inst)] + pc[1];
+        VM_TRACE("%08X:  add  r%u, r%u, %d\n", getOffset(pc),
+                 RegOp::getA(inst), RegOp::getB(inst), (int32_t)pc[1]);
+        pc += 2;
+    }
+
+    //
+    // sub rA, rB, rC
+    //
+    JM_FORCEINLINE void op_sub(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        r[RegOp::getA(inst)] = r[RegOp::getB(inst)] - r[RegOp::getC(inst)];
+        VM_TRACE("%08X:  sub  r%u, r%u, r%u\n", getOffset(pc),
+                 RegOp::getA(inst), RegOp::getB(inst), RegOp::getC(inst));
+        pc += 1;
+    }
+
+    //
+    // subi rA, rB, imm
+    //
+    JM_FORCEINLINE void op_subi(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        r[RegOp::getA(inst)] = r[RegOp::getB(inst)] - pc[1];
+        VM_TRACE("%08X:  sub  r%u, r%u, %d\n", getOffset(pc),
+                 RegOp::getA(inst), RegOp::getB(inst), (int32_t)pc[1]);
+        pc += 2;
+    }
+
+    //
+    // cmp_br_lt rA, rB, target
+    //
+    JM_FORCEINLINE void op_cmp_br_lt(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        VM_TRACE("%08X:  cmp_br_lt r%u, r%u, 0x%08X\n", getOffset(pc),
+                 RegOp::getA(inst), RegOp::getB(inst), pc[1]);
+        if ((int32_t)r[RegOp::getA(inst)] < (int32_t)r[RegOp::getB(inst)])
+            pc = code_ + pc[1];
+        else
+            pc += 2;
+    }
+
+    //
+    // cmp_br_ge rA, rB, target
+    //
+    JM_FORCEINLINE void op_cmp_br_ge(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        VM_TRACE("%08X:  cmp_br_ge r%u, r%u, 0x%08X\n", getOffset(pc),
+                 RegOp::getA(inst), RegOp::getB(inst), pc[1]);
+        if ((int32_t)r[RegOp::getA(inst)] >= (int32_t)r[RegOp::getB(inst)])
+            pc = code_ + pc[1];
+        else
+            pc += 2;
+    }
+
+    //
+    // cmp_br_lti rA, imm, target
+    //
+    JM_FORCEINLINE void op_cmp_br_lti(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        VM_TRACE("%08X:  cmp_br_lt r%u, %d, 0x%08X\n", getOffset(pc),
+                 RegOp::getA(inst), (int32_t)pc[1], pc[2]);
+        if ((int32_t)r[RegOp::getA(inst)] < (int32_t)pc[1])
+            pc = code_ + pc[2];
+        else
+            pc += 3;
+    }
+
+    //
+    // cmp_br_gei rA, imm, target
+    //
+    JM_FORCEINLINE void op_cmp_br_gei(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        VM_TRACE("%08X:  cmp_br_ge r%u, %d, 0x%08X\n", getOffset(pc),
+                 RegOp::getA(inst), (int32_t)pc[1], pc[2]);
+        if ((int32_t)r[RegOp::getA(inst)] >= (int32_t)pc[1])
+            pc = code_ + pc[2];
+        else
+            pc += 3;
+    }
+
+    //
+    // jmp target
+    //
+    JM_FORCEINLINE void op_jmp(const uint32_t *& pc) {
+        VM_TRACE("%08X:  jmp  0x%08X\n", getOffset(pc), pc[1]);
+        pc = code_ + pc[1];
+    }
+
+    //
+    // ld rA, rB
+    //
+    JM_FORCEINLINE bool op_ld(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        uint32_t index = r[RegOp::getB(inst)];
+        VM_TRACE("%08X:  ld   r%u, r%u\n", getOffset(pc), RegOp::getA(inst), RegOp::getB(inst));
+        if (unlikely(index >= data_.size()))
+            return false;
+        r[RegOp::getA(inst)] = data_[index];
+        pc += 1;
+        return true;
+    }
+
+    //
+    // st rA, rB
+    //
+    JM_FORCEINLINE bool op_st(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        uint32_t index = r[RegOp::getB(inst)];
+        VM_TRACE("%08X:  st   r%u, r%u\n", getOffset(pc), RegOp::getA(inst), RegOp::getB(inst));
+        if (unlikely(index >= data_.size()))
+            return false;
+        data_[index] = r[RegOp::getA(inst)];
+        pc += 1;
+        return true;
+    }
+
+    //
+    // vld vA, rB
+    //
+    JM_FORCEINLINE bool op_vld(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        size_t index = r[RegOp::getB(inst)];
+        VM_TRACE("%08X:  vld  v%u, r%u\n", getOffset(pc), RegOp::getA(inst), RegOp::getB(inst));
+        if (unlikely(index + vmVector::kLanes > data_.size()))
+            return false;
+        vmVectorOps::load(vregs_[RegOp::getA(inst)], &data_[index]);
+        pc += 1;
+        return true;
+    }
+
+    //
+    // vst vA, rB
+    //
+    JM_FORCEINLINE bool op_vst(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        size_t index = r[RegOp::getB(inst)];
+        VM_TRACE("%08X:  vst  v%u, r%u\n", getOffset(pc), RegOp::getA(inst), RegOp::getB(inst));
+        if (unlikely(index + vmVector::kLanes > data_.size()))
+            return false;
+        vmVectorOps::store(&data_[index], vregs_[RegOp::getA(inst)]);
+        pc += 1;
+        return true;
+    }
+
+    //
+    // vsplat vA, rB
+    //
+    JM_FORCEINLINE void op_vsplat(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        vmVectorOps::splat(vregs_[RegOp::getA(inst)], r[RegOp::getB(inst)]);
+        VM_TRACE("%08X:  vsplat v%u, r%u\n", getOffset(pc), RegOp::getA(inst), RegOp::getB(inst));
+        pc += 1;
+    }
+
+    //
+    // vadd, vmul, vand, vcmp_eq, vcmp_lt vA, vB, vC
+    //
+#define VM_VECTOR_OP_VVV(name, func)                                                    \
+    JM_FORCEINLINE void op_##name(const uint32_t *& pc) {                               \
+        uint32_t inst = pc[0];                                                          \
+        vmVectorOps::func(vregs_[RegOp::getA(inst)], vregs_[RegOp::getB(inst)],         \
+                          vregs_[RegOp::getC(inst)]);                                   \
+        VM_TRACE("%08X:  " #name " v%u, v%u, v%u\n", getOffset(pc),                    \
+                 RegOp::getA(inst), RegOp::getB(inst), RegOp::getC(inst));              \
+        pc += 1;                                                                        \
+    }
+
+    VM_VECTOR_OP_VVV(vadd,      add)
+    VM_VECTOR_OP_VVV(vmul,      mul)
+    VM_VECTOR_OP_VVV(vand,      and_)
+    VM_VECTOR_OP_VVV(vcmp_eq,   cmp_eq)
+    VM_VECTOR_OP_VVV(vcmp_lt,   cmp_lt)
+#undef VM_VECTOR_OP_VVV
+
+    //
+    // vshuf vA, vB, imm
+    //
+    JM_FORCEINLINE void op_vshuf(const uint32_t *& pc) {
+        uint32_t inst = pc[0];
+        vmVectorOps::shuffle(vregs_[RegOp::getA(inst)], vregs_[RegOp::getB(inst)], pc[1]);
+        VM_TRACE("%08X:  vshuf v%u, v%u, 0x%06X\n", getOffset(pc),
+                 RegOp::getA(inst), RegOp::getB(inst), pc[1]);
+        pc += 2;
+    }
+
+    //
+    // vsum rA, vB
+    //
+    JM_FORCEINLINE void op_vsum(const uint32_t *& pc, uint32_t * r) {
+        uint32_t inst = pc[0];
+        r[RegOp::getA(inst)] = vmVectorOps::sum(vregs_[RegOp::getB(inst)]);
+        VM_TRACE("%08X:  vsum r%u, v%u\n", getOffset(pc), RegOp::getA(inst), RegOp::getB(inst));
+        pc += 1;
+    }
+
+    JM_FORCEINLINE void op_nop(const uint32_t *& pc) {
+        VM_TRACE("%08X:  nop\n", getOffset(pc));
+        pc += 1;
+    }
+
+    void op_unknown(const uint32_t *& pc) {
+        VM_TRACE("%08X:  unknown opcode %u\n", getOffset(pc), RegOp::getOp(pc[0]));
+        pc += 1;
+    }
+
+    //
+    // Execute the image from its entry, the result is r0.
+    //
+    int execute(return_type & retVal) {
+        int ec = 0;
+        if (isInited()) {
+            register const uint32_t * pc;
+            register uint32_t *       r;
+            vmRegFrame *              cs;
+            vmRegFrame * const        csFirst = callstack_.data();
+            vmRegFrame * const        csLimit = callstack_.data() + callstack_.size();
+            // A window must fit in the register file.
+            uint32_t * const          rLimit = regs_.data() + regs_.size() - RegOp::kMaxRegs;
+
+#if USE_THREADED_DISPATCH
+            void * dispatchTable[256];
+            for (size_t i = 0; i < 256; i++) {
+                dispatchTable[i] = &&Dispatch_unknown;
+            }
+
+            dispatchTable[RegOp::nop]           = &&Dispatch_nop;
+            dispatchTable[RegOp::mov]           = &&Dispatch_mov;
+            dispatchTable[RegOp::movi]          = &&Dispatch_movi;
+            dispatchTable[RegOp::add]           = &&Dispatch_add;
+            dispatchTable[RegOp::addi]          = &&Dispatch_addi;
+            dispatchTable[RegOp::sub]           = &&Dispatch_sub;
+            dispatchTable[RegOp::subi]          = &&Dispatch_subi;
+            dispatchTable[RegOp::cmp_br_lt]     = &&Dispatch_cmp_br_lt;
+            dispatchTable[RegOp::cmp_br_ge]     = &&Dispatch_cmp_br_ge;
+            dispatchTable[RegOp::cmp_br_lti]    = &&Dispatch_cmp_br_lti;
+            dispatchTable[RegOp::cmp_br_gei]    = &&Dispatch_cmp_br_gei;
+            dispatchTable[RegOp::jmp]           = &&Dispatch_jmp;
+            dispatchTable[RegOp::call]          = &&Dispatch_call;
+            dispatchTable[RegOp::ret]           = &&Dispatch_ret;
+            dispatchTable[RegOp::reti]          = &&Dispatch_reti;
+            dispatchTable[RegOp::exit]          = &&Dispatch_exit;
+            dispatchTable[RegOp::ld]            = &&Dispatch_ld;
+            dispatchTable[RegOp::st]            = &&Dispatch_st;
+            dispatchTable[RegOp::vld]           = &&Dispatch_vld;
+            dispatchTable[RegOp::vst]           = &&Dispatch_vst;
+            dispatchTable[RegOp::vsplat]        = &&Dispatch_vsplat;
+            dispatchTable[RegOp::vadd]          = &&Dispatch_vadd;
+            dispatchTable[RegOp::vmul]          = &&Dispatch_vmul;
+            dispatchTable[RegOp::vand]          = &&Dispatch_vand;
+            dispatchTable[RegOp::vcmp_eq]       = &&Dispatch_vcmp_eq;
+            dispatchTable[RegOp::vcmp_lt]       = &&Dispatch_vcmp_lt;
+            dispatchTable[RegOp::vshuf]         = &&Dispatch_vshuf;
+            dispatchTable[RegOp::vsum]          = &&Dispatch_vsum;
+
+#define VM_DISPATCH_NEXT()  goto *dispatchTable[RegOp::getOp(*pc)]
+#else
+#define VM_DISPATCH_NEXT()  goto Dispatch_Switch
+#endif // USE_THREADED_DISPATCH
+
+            // Init environment
+            pc = code_ + entry_;
+            r = regs_.data();
+            cs = csFirst;
+
+            // Main loop
+            VM_DISPATCH_NEXT();
+
+#if !USE_THREADED_DISPATCH
+Dispatch_Switch:
+            switch (RegOp::getOp(*pc)) {
+            case RegOp::nop:                goto Dispatch_nop;
+            case RegOp::mov:                goto Dispatch_mov;
+            case RegOp::movi:               goto Dispatch_movi;
+            case RegOp::add:                goto Dispatch_add;
+            case RegOp::addi:               goto Dispatch_addi;
+            case RegOp::sub:                goto Dispatch_sub;
+            case RegOp::subi:               goto Dispatch_subi;
+            case RegOp::cmp_br_lt:          goto Dispatch_cmp_br_lt;
+            case RegOp::cmp_br_ge:          goto Dispatch_cmp_br_ge;
+            case RegOp::cmp_br_lti:         goto Dispatch_cmp_br_lti;
+            case RegOp::cmp_br_gei:         goto Dispatch_cmp_br_gei;
+            case RegOp::jmp:                goto Dispatch_jmp;
+            case RegOp::call:               goto Dispatch_call;
+            case RegOp::ret:                goto Dispatch_ret;
+            case RegOp::reti:               goto Dispatch_reti;
+            case RegOp::exit:               goto Dispatch_exit;
+            case RegOp::ld:                 goto Dispatch_ld;
+            case RegOp::st:                 goto Dispatch_st;
+            case RegOp::vld:                goto Dispatch_vld;
+            case RegOp::vst:                goto Dispatch_vst;
+            case RegOp::vsplat:             goto Dispatch_vsplat;
+            case RegOp::vadd:               goto Dispatch_vadd;
+            case RegOp::vmul:               goto Dispatch_vmul;
+            case RegOp::vand:               goto Dispatch_vand;
+            case RegOp::vcmp_eq:            goto Dispatch_vcmp_eq;
+            case RegOp::vcmp_lt:            goto Dispatch_vcmp_lt;
+            case RegOp::vshuf:              goto Dispatch_vshuf;
+            case RegOp::vsum:               goto Dispatch_vsum;
+            default:                        goto Dispatch_unknown;
+            }
+#endif // !USE_THREADED_DISPATCH
+
+Dispatch_nop:
+            op_nop(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_mov:
+            op_mov(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_movi:
+            op_movi(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_add:
+            op_add(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_addi:
+            op_addi(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_sub:
+            op_sub(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_subi:
+            op_subi(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_br_lt:
+            op_cmp_br_lt(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_br_ge:
+            op_cmp_br_ge(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_br_lti:
+            op_cmp_br_lti(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_cmp_br_gei:
+            op_cmp_br_gei(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_jmp:
+            op_jmp(pc);
+            VM_DISPATCH_NEXT();
+
+            //
+            // ld, st, vld, vst: an index out of the data memory stops the run.
+            //
+Dispatch_ld:
+            if (unlikely(!op_ld(pc, r)))
+                goto Data_Out_Of_Range;
+            VM_DISPATCH_NEXT();
+
+Dispatch_st:
+            if (unlikely(!op_st(pc, r)))
+                goto Data_Out_Of_Range;
+            VM_DISPATCH_NEXT();
+
+Dispatch_vld:
+            if (unlikely(!op_vld(pc, r)))
+                goto Data_Out_Of_Range;
+            VM_DISPATCH_NEXT();
+
+Dispatch_vst:
+            if (unlikely(!op_vst(pc, r)))
+                goto Data_Out_Of_Range;
+            VM_DISPATCH_NEXT();
+
+Dispatch_vsplat:
+            op_vsplat(pc, r);
+            VM_DISPATCH_NEXT();
+
+Dispatch_vadd:
+            op_vadd(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_vmul:
+            op_vmul(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_vand:
+            op_vand(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_vcmp_eq:
+            op_vcmp_eq(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_vcmp_lt:
+            op_vcmp_lt(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_vshuf:
+            op_vshuf(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_vsum:
+            op_vsum(pc, r);
+            VM_DISPATCH_NEXT();
+
+            //
+            // call rA, target
+            //
+Dispatch_call:
+            {
+                uint32_t a = RegOp::getA(pc[0]);
+                VM_TRACE("%08X:  call r%u, 0x%08X\n", getOffset(pc), a, pc[1]);
+                if (unlikely(cs == csLimit || r + a > rLimit)) {
+                    ec = Error::Stack_Overflow;
+                    goto Execute_Finished;
+                }
+                cs->returnPC = pc + 2;
+                cs->window = r;
+                cs++;
+                r += a;
+                pc = code_ + pc[1];
+            }
+            VM_DISPATCH_NEXT();
+
+            //
+            // ret rA, reti imm: the result is r0 of the callee, the rA of the call.
+            //
+Dispatch_ret:
+            VM_TRACE("%08X:  ret  r%u\n", getOffset(pc), RegOp::getA(pc[0]));
+            r[0] = r[RegOp::getA(pc[0])];
+            goto Dispatch_return;
+
+Dispatch_reti:
+            VM_TRACE("%08X:  ret  %d\n", getOffset(pc), (int32_t)pc[1]);
+            r[0] = pc[1];
+
+Dispatch_return:
+            if (unlikely(cs == csFirst))
+                goto Execute_Finished;
+            cs--;
+            pc = cs->returnPC;
+            r = cs->window;
+            VM_DISPATCH_NEXT();
+
+Dispatch_unknown:
+            op_unknown(pc);
+            VM_DISPATCH_NEXT();
+
+Dispatch_exit:
+            VM_TRACE("%08X:  end\n", getOffset(pc));
+            goto Execute_Finished;
+
+#undef VM_DISPATCH_NEXT
+
+Data_Out_Of_Range:
+            ec = Error::Data_Out_Of_Range;
+
+Execute_Finished:
+            retVal.setDataType(return_type::Basic);
+            retVal.setValue(r[0]);
+        }
+        return ec;
+    }
+
+    int run(return_type & retVal) {
+        return execute(retVal);
+    }
+
+private:
+    uint32_t getOffset(const uint32_t * pc) const {
+        return (uint32_t)(pc - code_);
+    }
+};
+
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class ExecutionEngine {
+public:
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionContext<basic_type, trace_policy>  context_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef ExecutionEngine<basic_type, trace_policy>   this_type;
+
+private:
+    vmBinaryFile binary_;
+    context_type context_;
+
+public:
+    ExecutionEngine() {}
+    virtual ~ExecutionEngine() {
+        destroy();
+    }
+
+    bool isInited() const { return context_.isInited(); }
+
+    int create() {
+        int ec = binary_.loadFromFile("test.bin");
+        if (ec <= 0) {
+            return Error::BinaryFile_Read_Failed;
+        }
+
+        context_.setCode(binary_.getCode(), binary_.getCodeSize(), binary_.getEntry());
+
+        bool success = createContext();
+        if (!success) {
+            return Error::MainProcess_Create_Failed;
+        }
+
+        return (int)success;
+    }
+
+    void destroy() {
+        destroyContext();
+    }
+
+    bool createContext() {
+        if (!context_.isInited()) {
+            context_.create();
+        }
+
+        return context_.isInited();
+    }
+
+    void destroyContext() {
+        if (context_.isInited()) {
+            context_.destroy();
+        }
+    }
+
+    int run(return_type & ret) {
+        binary_.setInput(ret.getValue());
+        int ec = context_.run(ret);
+        return ec;
+    }
+};
+
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class Interpreter {
+public:
+    typedef BasicType                                  basic_type;
+    typedef TracePolicy                                trace_policy;
+    typedef ExecutionEngine<basic_type, trace_policy>  engine_type;
+    typedef vmReturn<basic_type>                       return_type;
+    typedef Interpreter<basic_type, trace_policy>      this_type;
+
+private:
+    engine_type engine_;
+
+public:
+    Interpreter() {}
+    ~Interpreter() {}
+
+    int create() {
+        int ec = engine_.create();
+        return ec;
+    }
+
+    int run(return_type & ret) {
+        int ec = engine_.run(ret);
+        return ec;
+    }
+};
+
+} // namespace v5
+} // namespace jlang
+
+#endif // JLANG_VM_INTERPRETER_V5_H
@@ -0,0 +1,926 @@
+
+#ifndef JLANG_VM_JITCOMPILER_H
+#define JLANG_VM_JITCOMPILER_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/lang/Error.h"
+#include "jlang/support/Console.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <vector>
+
+#if USE_JIT_COMPILER
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#include <pthread.h>
+#endif // _WIN32
+#endif // USE_JIT_COMPILER
+
+namespace jlang {
+
+//
+// The executable memory of the JIT code, it's writable or executable,
+// never both at the same time.
+//
+class vmJitBuffer {
+private:
+    unsigned char * data_;
+    size_t          size_;
+
+public:
+    vmJitBuffer() : data_(nullptr), size_(0) {}
+    ~vmJitBuffer() {
+        release();
+    }
+
+    bool isInited() const { return (data_ != nullptr); }
+
+    unsigned char * data() const { return data_; }
+    size_t size() const { return size_; }
+
+    bool allocate(size_t size) {
+        release();
+#if USE_JIT_COMPILER
+        size_t pageSize = getPageSize();
+        size = (size + pageSize - 1) & ~(pageSize - 1);
+#if defined(_WIN32)
+        void * data = ::VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+        void * data = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED)
+            data = nullptr;
+#endif // _WIN32
+        if (data != nullptr) {
+            data_ = (unsigned char *)data;
+            size_ = size;
+        }
+#endif // USE_JIT_COMPILER
+        return isInited();
+    }
+
+    void release() {
+#if USE_JIT_COMPILER
+        if (data_ != nullptr) {
+#if defined(_WIN32)
+            ::VirtualFree(data_, 0, MEM_RELEASE);
+#else
+            ::munmap(data_, size_);
+#endif // _WIN32
+        }
+#endif // USE_JIT_COMPILER
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    bool makeWritable() {
+        return protect(false);
+    }
+
+    bool makeExecutable() {
+        return protect(true);
+    }
+
+private:
+    bool protect(bool executable) {
+#if USE_JIT_COMPILER
+        if (data_ != nullptr) {
+#if defined(_WIN32)
+            DWORD oldProtect;
+            BOOL success = ::VirtualProtect(data_, size_,
+                executable ? PAGE_EXECUTE_READ : PAGE_READWRITE, &oldProtect);
+            if (success && executable)
+                ::FlushInstructionCache(::GetCurrentProcess(), data_, size_);
+            return (success != FALSE);
+#else
+            int ret = ::mprotect(data_, size_, executable ? (PROT_READ | PROT_EXEC)
+                                                          : (PROT_READ | PROT_WRITE));
+            return (ret == 0);
+#endif // _WIN32
+        }
+#endif // USE_JIT_COMPILER
+        return false;
+    }
+
+    static size_t getPageSize() {
+#if defined(_WIN32)
+        SYSTEM_INFO si;
+        ::GetSystemInfo(&si);
+        return (size_t)si.dwPageSize;
+#else
+        return (size_t)::sysconf(_SC_PAGESIZE);
+#endif // _WIN32
+    }
+};
+
+//
+// A stencil is the precompiled x86-64 machine code of one (or two)
+// bytecode instructions, with holes for the values only known when
+// the image is compiled.
+//
+// Register usage of the JIT code:
+//
+//   rbx  the guest frame pointer (vmFramePtr)
+//   eax  the guest eax (Register)
+//   ecx  scratch
+//   edx  scratch (fast_tail_call)
+//   r12  the native stack pointer of the entry trampoline
+//   r13  where the trampoline stores the final guest fp
+//   r14  the lowest native stack pointer a guest call may push to
+//
+// A guest call is a native call, the frame layout is the same as the
+// interpreter's, the bytecode return IPs are still stored in the frames.
+// Each guest call also takes 8 bytes of the host stack, a call below the
+// limit in r14 leaves through the overflow path of the trampoline.
+//
+class vmStencil {
+public:
+    enum HoleKind {
+        Slot1,          // disp32, the first slot index * 4
+        Slot2,          // disp32, the second slot index * 4
+        Imm32,          // the immediate value
+        Imm64,          // the bytecode return IP
+        Rel32,          // the jump or call target
+        Rel32Exit,      // the exit path of the entry trampoline
+        Rel32Overflow,  // the stack overflow path of the entry trampoline
+        Local32,        // the local size
+        LocalPlus8,     // the local size + 8
+        LocalPlus16,    // the local size + 16
+        LocalNeg8,      // -(the local size + 8)
+        LocalArgs,      // the local size - the bytes a tail call moves
+        HoleKindLast
+    };
+
+    struct Hole {
+        uint8_t offset;
+        uint8_t kind;
+    };
+
+    enum { kMaxHoles = 6 };
+
+    const unsigned char *   code;
+    uint8_t                 size;
+    uint8_t                 holeCount;
+    Hole                    holes[kMaxHoles];
+};
+
+class vmJitStencils {
+public:
+    enum Type {
+        nop,
+        load_eax,
+        store,
+        move,
+        copy_from_eax,
+        cmp_u32_jl,
+        cmp_i32_jl,
+        cmp_imm_u32_jl,
+        cmp_imm_i32_jl,
+        jmp,
+        call,
+        fast_call,
+        fast_tail_call,
+        ret,
+        ret_n,
+        ret_eax,
+        ret_eax_n,
+        inc,
+        dec,
+        add,
+        add_imm,
+        add_eax,
+        add_eax_imm,
+        sub,
+        sub_imm,
+        sub_eax,
+        sub_eax_imm,
+        exit,
+        last
+    };
+
+    static const vmStencil & get(uint32_t type) {
+        // mov eax, imm32
+        static const unsigned char s_load_eax[] = {
+            0xB8, 0x00, 0x00, 0x00, 0x00
+        };
+        // mov dword [rbx + slot1], imm32
+        static const unsigned char s_store[] = {
+            0xC7, 0x83, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+        };
+        // mov ecx, dword [rbx + slot2]; mov dword [rbx + slot1], ecx
+        static const unsigned char s_move[] = {
+            0x8B, 0x8B, 0x00, 0x00, 0x00, 0x00,
+            0x89, 0x8B, 0x00, 0x00, 0x00, 0x00
+        };
+        // mov dword [rbx + slot1], eax
+        static const unsigned char s_copy_from_eax[] = {
+            0x89, 0x83, 0x00, 0x00, 0x00, 0x00
+        };
+        // mov ecx, dword [rbx + slot1]; cmp ecx, dword [rbx + slot2]; jb rel32
+        static const unsigned char s_cmp_u32_jl[] = {
+            0x8B, 0x8B, 0x00, 0x00, 0x00, 0x00,
+            0x3B, 0x8B, 0x00, 0x00, 0x00, 0x00,
+            0x0F, 0x82, 0x00, 0x00, 0x00, 0x00
+        };
+        // mov ecx, dword [rbx + slot1]; cmp ecx, dword [rbx + slot2]; jl rel32
+        static const unsigned char s_cmp_i32_jl[] = {
+            0x8B, 0x8B, 0x00, 0x00, 0x00, 0x00,
+            0x3B, 0x8B, 0x00, 0x00, 0x00, 0x00,
+            0x0F, 0x8C, 0x00, 0x00, 0x00, 0x00
+        };
+        // cmp dword [rbx + slot1], imm32; jb rel32
+        static const unsigned char s_cmp_imm_u32_jl[] = {
+            0x81, 0xBB, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x0F, 0x82, 0x00, 0x00, 0x00, 0x00
+        };
+        // cmp dword [rbx + slot1], imm32; jl rel32
+        static const unsigned char s_cmp_imm_i32_jl[] = {
+            0x81, 0xBB, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x0F, 0x8C, 0x00, 0x00, 0x00, 0x00
+        };
+        // jmp rel32
+        static const unsigned char s_jmp[] = {
+            0xE9, 0x00, 0x00, 0x00, 0x00
+        };
+        // push_callstack():
+        //   mov qword [rbx + local], rbx; mov rcx, imm64;
+        //   mov qword [rbx + local + 8], rcx; add rbx, local + 16;
+        //   cmp rsp, r14; jb overflow; call rel32
+        static const unsigned char s_call[] = {
+            0x48, 0x89, 0x9B, 0x00, 0x00, 0x00, 0x00,
+            0x48, 0xB9, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x48, 0x89, 0x8B, 0x00, 0x00, 0x00, 0x00,
+            0x48, 0x81, 0xC3, 0x00, 0x00, 0x00, 0x00,
+            0x4C, 0x39, 0xF4,
+            0x0F, 0x82, 0x00, 0x00, 0x00, 0x00,
+            0xE8, 0x00, 0x00, 0x00, 0x00
+        };
+        // push_callstack_fast():
+        //   mov rcx, imm64; mov qword [rbx + local], rcx;
+        //   add rbx, local + 8; cmp rsp, r14; jb overflow; call rel32
+        static const unsigned char s_fast_call[] = {
+            0x48, 0xB9, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0x48, 0x89, 0x8B, 0x00, 0x00, 0x00, 0x00,
+            0x48, 0x81, 0xC3, 0x00, 0x00, 0x00, 0x00,
+            0x4C, 0x39, 0xF4,
+            0x0F, 0x82, 0x00, 0x00, 0x00, 0x00,
+            0xE8, 0x00, 0x00, 0x00, 0x00
+        };
+        // Move the outgoing arguments (the top words of the locals) over the
+        // incoming ones, then jump:
+        //   mov ecx, local;
+        // loop:
+        //   sub ecx, 4; cmp ecx, local - args; jl done;
+        //   mov edx, dword [rbx + rcx]; mov dword [rbx + rcx - (local + 8)], edx;
+        //   jmp loop;
+        // done:
+        //   jmp rel32
+        static const unsigned char s_fast_tail_call[] = {
+            0xB9, 0x00, 0x00, 0x00, 0x00,
+            0x83, 0xE9, 0x04,
+            0x81, 0xF9, 0x00, 0x00, 0x00, 0x00,
+            0x7C, 0x0C,
+            0x8B, 0x14, 0x0B,
+            0x89, 0x94, 0x0B, 0x00, 0x00, 0x00, 0x00,
+            0xEB, 0xE9,
+            0xE9, 0x00, 0x00, 0x00, 0x00
+        };
+        // pop_callstack(): mov rbx, qword [rbx - 16]; ret
+        static const unsigned char s_ret[] = {
+            0x48, 0x8B, 0x5B, 0xF0,
+            0xC3
+        };
+        // pop_callstack_fast(): sub rbx, local + 8; ret
+        static const unsigned char s_ret_n[] = {
+            0x48, 0x81, 0xEB, 0x00, 0x00, 0x00, 0x00,
+            0xC3
+        };
+        // mov eax, imm32; mov rbx, qword [rbx - 16]; ret
+        static const unsigned char s_ret_eax[] = {
+            0xB8, 0x00, 0x00, 0x00, 0x00,
+            0x48, 0x8B, 0x5B, 0xF0,
+            0xC3
+        };
+        // mov eax, imm32; sub rbx, local + 8; ret
+        static const unsigned char s_ret_eax_n[] = {
+            0xB8, 0x00, 0x00, 0x00, 0x00,
+            0x48, 0x81, 0xEB, 0x00, 0x00, 0x00, 0x00,
+            0xC3
+        };
+        // inc dword [rbx + slot1]
+        static const unsigned char s_inc[] = {
+            0xFF, 0x83, 0x00, 0x00, 0x00, 0x00
+        };
+        // dec dword [rbx + slot1]
+        static const unsigned char s_dec[] = {
+            0xFF, 0x8B, 0x00, 0x00, 0x00, 0x00
+        };
+        // mov ecx, dword [rbx + slot2]; add dword [rbx + slot1], ecx
+        static const unsigned char s_add[] = {
+            0x8B, 0x8B, 0x00, 0x00, 0x00, 0x00,
+            0x01, 0x8B, 0x00, 0x00, 0x00, 0x00
+        };
+        // add dword [rbx + slot1], imm32
+        static const unsigned char s_add_imm[] = {
+            0x81, 0x83, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+        };
+        // add eax, dword [rbx + slot1]
+        static const unsigned char s_add_eax[] = {
+            0x03, 0x83, 0x00, 0x00, 0x00, 0x00
+        };
+        // add eax, imm32
+        static const unsigned char s_add_eax_imm[] = {
+            0x05, 0x00, 0x00, 0x00, 0x00
+        };
+        // mov ecx, dword [rbx + slot2]; sub dword [rbx + slot1], ecx
+        static const unsigned char s_sub[] = {
+            0x8B, 0x8B, 0x00, 0x00, 0x00, 0x00,
+            0x29, 0x8B, 0x00, 0x00, 0x00, 0x00
+        };
+        // sub dword [rbx + slot1], imm32
+        static const unsigned char s_sub_imm[] = {
+            0x81, 0xAB, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+        };
+        // sub eax, dword [rbx + slot1]
+        static const unsigned char s_sub_eax[] = {
+            0x2B, 0x83, 0x00, 0x00, 0x00, 0x00
+        };
+        // sub eax, imm32
+        static const unsigned char s_sub_eax_imm[] = {
+            0x2D, 0x00, 0x00, 0x00, 0x00
+        };
+        // mov rsp, r12; jmp rel32 (the exit path of the trampoline)
+        static const unsigned char s_exit[] = {
+            0x4C, 0x89, 0xE4,
+            0xE9, 0x00, 0x00, 0x00, 0x00
+        };
+
+#define STENCIL(code)   code, (uint8_t)sizeof(code)
+
+        static const vmStencil s_stencils[last] = {
+            { nullptr, 0, 0, { } },
+            { STENCIL(s_load_eax),          1, { { 1, vmStencil::Imm32 } } },
+            { STENCIL(s_store),             2, { { 2, vmStencil::Slot1 }, { 6, vmStencil::Imm32 } } },
+            { STENCIL(s_move),              2, { { 2, vmStencil::Slot2 }, { 8, vmStencil::Slot1 } } },
+            { STENCIL(s_copy_from_eax),     1, { { 2, vmStencil::Slot1 } } },
+            { STENCIL(s_cmp_u32_jl),        3, { { 2, vmStencil::Slot1 }, { 8, vmStencil::Slot2 },
+                                                 { 14, vmStencil::Rel32 } } },
+            { STENCIL(s_cmp_i32_jl),        3, { { 2, vmStencil::Slot1 }, { 8, vmStencil::Slot2 },
+                                                 { 14, vmStencil::Rel32 } } },
+            { STENCIL(s_cmp_imm_u32_jl),    3, { { 2, vmStencil::Slot1 }, { 6, vmStencil::Imm32 },
+                                                 { 12, vmStencil::Rel32 } } },
+            { STENCIL(s_cmp_imm_i32_jl),    3, { { 2, vmStencil::Slot1 }, { 6, vmStencil::Imm32 },
+                                                 { 12, vmStencil::Rel32 } } },
+            { STENCIL(s_jmp),               1, { { 1, vmStencil::Rel32 } } },
+            { STENCIL(s_call),              6, { { 3, vmStencil::Local32 }, { 9, vmStencil::Imm64 },
+                                                 { 20, vmStencil::LocalPlus8 },
+                                                 { 27, vmStencil::LocalPlus16 },
+                                                 { 36, vmStencil::Rel32Overflow },
+                                                 { 41, vmStencil::Rel32 } } },
+            { STENCIL(s_fast_call),         5, { { 2, vmStencil::Imm64 }, { 13, vmStencil::Local32 },
+                                                 { 20, vmStencil::LocalPlus8 },
+                                                 { 29, vmStencil::Rel32Overflow },
+                                                 { 34, vmStencil::Rel32 } } },
+            { STENCIL(s_fast_tail_call),    4, { { 1, vmStencil::Local32 }, { 10, vmStencil::LocalArgs },
+                                                 { 22, vmStencil::LocalNeg8 },
+                                                 { 29, vmStencil::Rel32 } } },
+            { STENCIL(s_ret),               0, { } },
+            { STENCIL(s_ret_n),             1, { { 3, vmStencil::LocalPlus8 } } },
+            { STENCIL(s_ret_eax),           1, { { 1, vmStencil::Imm32 } } },
+            { STENCIL(s_ret_eax_n),         2, { { 1, vmStencil::Imm32 }, { 8, vmStencil::LocalPlus8 } } },
+            { STENCIL(s_inc),               1, { { 2, vmStencil::Slot1 } } },
+            { STENCIL(s_dec),               1, { { 2, vmStencil::Slot1 } } },
+            { STENCIL(s_add),               2, { { 2, vmStencil::Slot2 }, { 8, vmStencil::Slot1 } } },
+            { STENCIL(s_add_imm),           2, { { 2, vmStencil::Slot1 }, { 6, vmStencil::Imm32 } } },
+            { STENCIL(s_add_eax),           1, { { 2, vmStencil::Slot1 } } },
+            { STENCIL(s_add_eax_imm),       1, { { 1, vmStencil::Imm32 } } },
+            { STENCIL(s_sub),               2, { { 2, vmStencil::Slot2 }, { 8, vmStencil::Slot1 } } },
+            { STENCIL(s_sub_imm),           2, { { 2, vmStencil::Slot1 }, { 6, vmStencil::Imm32 } } },
+            { STENCIL(s_sub_eax),           1, { { 2, vmStencil::Slot1 } } },
+            { STENCIL(s_sub_eax_imm),       1, { { 1, vmStencil::Imm32 } } },
+            { STENCIL(s_exit),              1, { { 4, vmStencil::Rel32Exit } } }
+        };
+
+#undef STENCIL
+
+        assert(type < last);
+        return s_stencils[type];
+    }
+};
+
+//
+// The compiled native code of an image.
+//
+class vmJitCode {
+public:
+    //
+    // uint32_t enter(void * fp, const void * target, uint32_t eax, void ** fpOut,
+    //                const void * stackLimit)
+    //
+    // Run the native code at target with the guest fp and eax, until the
+    // guest function it belongs to returns. Returns the guest eax, and the
+    // guest fp after the return in fpOut (nullptr if exit was executed,
+    // kStackOverflow if a guest call would have pushed below stackLimit).
+    //
+    typedef uint32_t (*enter_func)(void * fp, const void * target, uint32_t eax,
+                                   void ** fpOut, const void * stackLimit);
+
+    // fpOut of a run that stopped at the host stack limit.
+    enum { kStackOverflow = 1 };
+
+    // The host stack left below the limit, for the trampoline, the
+    // interpreter and the signal handlers.
+    enum { kHostStackReserve = 64 * 1024 };
+
+private:
+    vmJitBuffer                 buffer_;
+    vmDecodedImage              decoded_;
+    std::vector<uint32_t>       stencils_;
+    std::vector<uint32_t>       nativeOffsets_;
+    uint32_t                    exitOffset_;
+    uint32_t                    codeSize_;
+    enter_func                  enter_;
+    const void *                entryPoint_;
+
+    friend class vmJitCompiler;
+
+public:
+    vmJitCode() : exitOffset_(0), codeSize_(0), enter_(nullptr), entryPoint_(nullptr) {}
+    ~vmJitCode() {
+        destroy();
+    }
+
+    bool isCompiled() const { return (enter_ != nullptr); }
+
+    size_t getCodeSize() const { return codeSize_; }
+
+    //
+    // The native address of the instruction at the bytecode offset, return
+    // nullptr if it can't be entered there (the jl of a cmp + jl pair).
+    //
+    const void * getEntryPoint(uint32_t offset) const {
+        const vmDecodedInst * inst = decoded_.atOffset(offset);
+        if (!isCompiled() || inst == nullptr)
+            return nullptr;
+        uint32_t nativeOffset = nativeOffsets_[inst - decoded_.begin()];
+        if (nativeOffset == kNoEntryPoint)
+            return nullptr;
+        return (const void *)(buffer_.data() + nativeOffset);
+    }
+
+    JM_FORCEINLINE uint32_t enter(void * fp, const void * target, uint32_t eax,
+                                  void *& fpOut) const {
+        assert(enter_ != nullptr);
+        return enter_(fp, target, eax, &fpOut, getHostStackLimit());
+    }
+
+    static bool isStackOverflow(const void * fpOut) {
+        return ((uintptr_t)fpOut == (uintptr_t)kStackOverflow);
+    }
+
+    //
+    // Run the image from its entry, return Stack_Overflow if the guest
+    // calls went deeper than the host stack allows.
+    //
+    int invoke(void * fp, uint32_t & eax) const {
+        assert(enter_ != nullptr);
+        // push_callstack(fp, nullptr, 0)
+        void ** frame = (void **)fp;
+        frame[0] = fp;
+        frame[1] = nullptr;
+        void * fpOut;
+        eax = enter_((void *)(frame + 2), entryPoint_, 0, &fpOut, getHostStackLimit());
+        return (isStackOverflow(fpOut) ? (int)Error::Stack_Overflow : (int)Error::Ok);
+    }
+
+    //
+    // The lowest address of the host stack the native code may push to,
+    // found once per thread.
+    //
+    static const void * getHostStackLimit() {
+        static thread_local const void * s_limit = nullptr;
+        if (unlikely(s_limit == nullptr))
+            s_limit = findHostStackLimit();
+        return s_limit;
+    }
+
+    static const uint32_t kNoEntryPoint = (uint32_t)-1;
+
+    void destroy() {
+        enter_ = nullptr;
+        entryPoint_ = nullptr;
+        buffer_.release();
+        decoded_.destroy();
+        stencils_.clear();
+        nativeOffsets_.clear();
+        exitOffset_ = 0;
+        codeSize_ = 0;
+    }
+
+private:
+    static const void * findHostStackLimit() {
+        const unsigned char * low = nullptr;
+#if USE_JIT_COMPILER
+#if defined(_WIN32)
+        ULONG_PTR lowLimit = 0, highLimit = 0;
+        ::GetCurrentThreadStackLimits(&lowLimit, &highLimit);
+        low = (const unsigned char *)lowLimit;
+#elif defined(__APPLE__)
+        pthread_t self = ::pthread_self();
+        low = (const unsigned char *)::pthread_get_stackaddr_np(self)
+              - ::pthread_get_stacksize_np(self);
+#elif defined(__linux__)
+        pthread_attr_t attr;
+        if (::pthread_getattr_np(::pthread_self(), &attr) == 0) {
+            void * addr = nullptr;
+            size_t size = 0;
+            if (::pthread_attr_getstack(&attr, &addr, &size) == 0)
+                low = (const unsigned char *)addr;
+            ::pthread_attr_destroy(&attr);
+        }
+#endif // _WIN32
+#endif // USE_JIT_COMPILER
+        if (low == nullptr) {
+            // Unknown, assume the smallest stack of a thread (512 KB).
+            unsigned char here;
+            low = &here - 512 * 1024;
+        }
+        return (const void *)(low + kHostStackReserve);
+    }
+
+public:
+
+    //
+    // Patch the holes of the instruction at the bytecode offset again,
+    // after its immediate was patched (see vmBinaryFile::setInput()).
+    //
+    int refresh(uint32_t offset);
+
+    void dump() const {
+        console.printf("  jit code: %u instructions, %u bytes of native code\n",
+                       (uint32_t)decoded_.size(), codeSize_);
+    }
+};
+
+class vmJitCompiler {
+public:
+    //
+    // Compile the whole image into native code, the functions that can't be
+    // compiled make the compilation fail, the caller uses the interpreter then.
+    //
+    static int compile(const void * image, size_t imageSize, size_t entryOffset,
+                       vmJitCode & jit) {
+        jit.destroy();
+#if USE_JIT_COMPILER
+        int ec = jit.decoded_.decode(image, imageSize, entryOffset);
+        if (ec != Error::Ok)
+            return ec;
+
+        const vmDecodedImage & decoded = jit.decoded_;
+        vmDecodedInst * first = decoded.begin();
+        size_t count = decoded.size();
+
+        // The instructions a jump can land on, a cmp and its jl must stay
+        // together, the flags only live inside one stencil.
+        std::vector<uint8_t> isLabel(count + 1, 0);
+        isLabel[decoded.entry() - first] = 1;
+        for (size_t i = 0; i < count; i++) {
+            if (first[i].target != nullptr)
+                isLabel[first[i].target - first] = 1;
+        }
+
+        // Select the stencils.
+        std::vector<uint32_t> & stencils = jit.stencils_;
+        stencils.resize(count + 1);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t type = selectStencil(first, i, count, isLabel);
+            if (type == vmJitStencils::last) {
+                console.trace("vmJitCompiler: %08X: unsupported opcode %u\n",
+                              first[i].offset, (uint32_t)first[i].opcode);
+                jit.destroy();
+                return Error::Jit_Unsupported_Opcode;
+            }
+            stencils[i] = type;
+            // The jl is a part of the cmp stencil.
+            if (type >= vmJitStencils::cmp_u32_jl && type <= vmJitStencils::cmp_imm_i32_jl) {
+                stencils[++i] = vmJitStencils::nop;
+            }
+        }
+        // Falling off the end of image.
+        stencils[count] = vmJitStencils::exit;
+
+        // Lay out the native code: the trampoline first, then all stencils.
+        std::vector<uint32_t> & nativeOffsets = jit.nativeOffsets_;
+        nativeOffsets.resize(count + 1);
+        uint32_t codeSize = kTrampolineSize;
+        for (size_t i = 0; i <= count; i++) {
+            nativeOffsets[i] = codeSize;
+            codeSize += vmJitStencils::get(stencils[i]).size;
+        }
+        jit.exitOffset_ = kTrampolineExit;
+        jit.codeSize_ = codeSize;
+
+        if (!jit.buffer_.allocate(codeSize)) {
+            jit.destroy();
+            return Error::Jit_Alloc_Failed;
+        }
+
+        unsigned char * code = jit.buffer_.data();
+        emitTrampoline(code);
+        for (size_t i = 0; i <= count; i++) {
+            emitStencil(jit, i);
+        }
+
+        // The jl of a cmp + jl pair has no code of its own.
+        for (size_t i = 0; i < count; i++) {
+            uint32_t type = stencils[i];
+            if (type >= vmJitStencils::cmp_u32_jl && type <= vmJitStencils::cmp_imm_i32_jl) {
+                nativeOffsets[++i] = vmJitCode::kNoEntryPoint;
+            }
+        }
+
+        if (!jit.buffer_.makeExecutable()) {
+            jit.destroy();
+            return Error::Jit_Alloc_Failed;
+        }
+        jit.enter_ = (vmJitCode::enter_func)(void *)code;
+        jit.entryPoint_ = (const void *)(code + nativeOffsets[decoded.entry() - first]);
+        return Error::Ok;
+#else
+        (void)image;
+        (void)imageSize;
+        (void)entryOffset;
+        return Error::Jit_Not_Supported;
+#endif // USE_JIT_COMPILER
+    }
+
+private:
+    //
+    // The entry trampoline, the arguments are in rdi, rsi, edx, rcx, r8 (SysV)
+    // or rcx, rdx, r8d, r9, [rsp + 40] (Win64):
+    //
+    //   push rbx; push r12; push r13; push r14; mov r12, rsp;
+    //   mov rbx, fp; mov r13, fpOut; mov r14, stackLimit; mov eax, eax_in;
+    //   call target;
+    //   mov qword [r13], rbx; jmp done;
+    // exit:
+    //   mov qword [r13], 0; jmp done;
+    // overflow:
+    //   mov rsp, r12; mov qword [r13], kStackOverflow;
+    // done:
+    //   pop r14; pop r13; pop r12; pop rbx; ret
+    //
+    enum {
+        kTrampolineExit = 32,
+        kTrampolineOverflow = 42,
+        kTrampolineSize = 61
+    };
+
+    static void emitTrampoline(unsigned char * code) {
+        static const unsigned char s_trampoline[kTrampolineSize] = {
+            0x53,
+            0x41, 0x54,
+            0x41, 0x55,
+            0x41, 0x56,
+            0x49, 0x89, 0xE4,
+#if defined(_WIN32)
+            0x48, 0x89, 0xCB,
+            0x4D, 0x89, 0xCD,
+            0x4C, 0x8B, 0x74, 0x24, 0x48,
+            0x44, 0x89, 0xC0,
+            0xFF, 0xD2,
+#else
+            0x48, 0x89, 0xFB,
+            0x49, 0x89, 0xCD,
+            0x4D, 0x89, 0xC6,
+            0x89, 0xD0, 0x90, 0x90, 0x90,
+            0xFF, 0xD6,
+#endif
+            0x49, 0x89, 0x5D, 0x00,
+            0xEB, 0x15,
+            // exit:
+            0x49, 0xC7, 0x45, 0x00, 0x00, 0x00, 0x00, 0x00,
+            0xEB, 0x0B,
+            // overflow:
+            0x4C, 0x89, 0xE4,
+            0x49, 0xC7, 0x45, 0x00, 0x01, 0x00, 0x00, 0x00,
+            // done:
+            0x41, 0x5E,
+            0x41, 0x5D,
+            0x41, 0x5C,
+            0x5B,
+            0xC3
+        };
+        memcpy(code, s_trampoline, kTrampolineSize);
+    }
+
+    static void putRel32(unsigned char * code, uint32_t holeOffset, uint32_t targetOffset) {
+        int32_t rel32 = (int32_t)targetOffset - (int32_t)(holeOffset + sizeof(int32_t));
+        memcpy(code + holeOffset, &rel32, sizeof(rel32));
+    }
+
+    static void putValue32(unsigned char * code, uint32_t holeOffset, uint32_t value) {
+        memcpy(code + holeOffset, &value, sizeof(value));
+    }
+
+    static uint32_t selectStencil(const vmDecodedInst * first, size_t i, size_t count,
+                                  const std::vector<uint8_t> & isLabel) {
+        const vmDecodedInst * inst = &first[i];
+        switch (inst->opcode) {
+        case OpCode::nop:
+        case OpCode::nop_n:
+            return vmJitStencils::nop;
+        case OpCode::load_eax:
+            return vmJitStencils::load_eax;
+        case OpCode::store:
+            return vmJitStencils::store;
+        case OpCode::move:
+            return vmJitStencils::move;
+        case OpCode::copy_from_eax:
+            return vmJitStencils::copy_from_eax;
+        case OpCode::cmp_i32:
+        case OpCode::cmp_u32:
+        case OpCode::cmp_imm_i32:
+        case OpCode::cmp_imm_u32:
+            {
+                // Only a cmp followed by a jl is supported.
+                if (i + 1 >= count || isLabel[i + 1])
+                    break;
+                uint32_t jmpType = first[i + 1].opcode;
+                if (jmpType != OpCode::jl_near && jmpType != OpCode::jl_short
+                    && jmpType != OpCode::jl_long)
+                    break;
+                if (inst->opcode == OpCode::cmp_i32)
+                    return vmJitStencils::cmp_i32_jl;
+                else if (inst->opcode == OpCode::cmp_u32)
+                    return vmJitStencils::cmp_u32_jl;
+                else if (inst->opcode == OpCode::cmp_imm_i32)
+                    return vmJitStencils::cmp_imm_i32_jl;
+                else
+                    return vmJitStencils::cmp_imm_u32_jl;
+            }
+        case OpCode::jmp:
+        case OpCode::jmp_near:
+        case OpCode::jmp_short:
+        case OpCode::jmp_long:
+            return vmJitStencils::jmp;
+        case OpCode::call:
+        case OpCode::call_short:
+        case OpCode::call_long:
+            return vmJitStencils::call;
+        case OpCode::fast_call_short:
+            return vmJitStencils::fast_call;
+        case OpCode::fast_tail_call_short:
+            return vmJitStencils::fast_tail_call;
+        case OpCode::ret:
+            return vmJitStencils::ret;
+        case OpCode::ret_n_sm:
+        case OpCode::ret_n:
+            return vmJitStencils::ret_n;
+        case OpCode::ret_eax:
+            return vmJitStencils::ret_eax;
+        case OpCode::ret_eax_n:
+            return vmJitStencils::ret_eax_n;
+        case OpCode::inc:
+            return vmJitStencils::inc;
+        case OpCode::dec:
+            return vmJitStencils::dec;
+        case OpCode::add:
+            return vmJitStencils::add;
+        case OpCode::add_imm:
+            return vmJitStencils::add_imm;
+        case OpCode::add_eax:
+            return vmJitStencils::add_eax;
+        case OpCode::add_eax_imm:
+            return vmJitStencils::add_eax_imm;
+        case OpCode::sub:
+            return vmJitStencils::sub;
+        case OpCode::sub_imm:
+            return vmJitStencils::sub_imm;
+        case OpCode::sub_eax:
+            return vmJitStencils::sub_eax;
+        case OpCode::sub_eax_imm:
+            return vmJitStencils::sub_eax_imm;
+        case OpCode::exit:
+            return vmJitStencils::exit;
+        default:
+            break;
+        }
+        // error, move_to_eax, a single cmp or jl, and the unknown opcodes.
+        return vmJitStencils::last;
+    }
+
+public:
+    //
+    // Copy the stencil of the instruction and patch its holes.
+    //
+    static void emitStencil(vmJitCode & jit, size_t index) {
+        const vmStencil & stencil = vmJitStencils::get(jit.stencils_[index]);
+        if (stencil.size == 0)
+            return;
+
+        unsigned char * code = jit.buffer_.data();
+        uint32_t nativeOffset = jit.nativeOffsets_[index];
+        memcpy(code + nativeOffset, stencil.code, stencil.size);
+
+        const vmDecodedInst * first = jit.decoded_.begin();
+        const vmDecodedInst * inst = &first[index];
+        const unsigned char * image = jit.decoded_.getImage();
+        for (uint32_t i = 0; i < stencil.holeCount; i++) {
+            uint32_t holeOffset = nativeOffset + stencil.holes[i].offset;
+            switch (stencil.holes[i].kind) {
+            case vmStencil::Slot1:
+                putValue32(code, holeOffset, (uint32_t)(inst->operand1 * (int32_t)sizeof(uint32_t)));
+                break;
+            case vmStencil::Slot2:
+                putValue32(code, holeOffset, (uint32_t)((int32_t)inst->operand2 * (int32_t)sizeof(uint32_t)));
+                break;
+            case vmStencil::Imm32:
+                putValue32(code, holeOffset, inst->operand2);
+                break;
+            case vmStencil::Imm64:
+                {
+                    const void * returnIP = image + inst->operand2;
+                    memcpy(code + holeOffset, &returnIP, sizeof(returnIP));
+                }
+                break;
+            case vmStencil::Rel32:
+                {
+                    // The jl of a cmp + jl pair holds the target.
+                    const vmDecodedInst * target = inst->target;
+                    if (target == nullptr)
+                        target = inst[1].target;
+                    assert(target != nullptr);
+                    putRel32(code, holeOffset, jit.nativeOffsets_[target - first]);
+                }
+                break;
+            case vmStencil::Rel32Exit:
+                putRel32(code, holeOffset, jit.exitOffset_);
+                break;
+            case vmStencil::Rel32Overflow:
+                putRel32(code, holeOffset, kTrampolineOverflow);
+                break;
+            case vmStencil::Local32:
+                putValue32(code, holeOffset, (uint32_t)inst->aux);
+                break;
+            case vmStencil::LocalPlus8:
+                putValue32(code, holeOffset, (uint32_t)inst->aux + 8);
+                break;
+            case vmStencil::LocalPlus16:
+                putValue32(code, holeOffset, (uint32_t)inst->aux + 16);
+                break;
+            case vmStencil::LocalNeg8:
+                putValue32(code, holeOffset, (uint32_t)(-((int32_t)inst->aux + 8)));
+                break;
+            case vmStencil::LocalArgs:
+                putValue32(code, holeOffset, (uint32_t)((int32_t)inst->aux - inst->operand1));
+                break;
+            default:
+                assert(false);
+                break;
+            }
+        }
+    }
+};
+
+inline int vmJitCode::refresh(uint32_t offset) {
+    vmDecodedInst * inst = decoded_.atOffset(offset);
+    if (!isCompiled() || inst == nullptr || inst == decoded_.end())
+        return Error::Predecode_Illegal_Branch_Target;
+
+    uint16_t opcode = inst->opcode;
+    int ec = decoded_.refresh(offset);
+    if (ec != Error::Ok)
+        return ec;
+    // The stencil would change, the image must be compiled again.
+    if (inst->opcode != opcode)
+        return Error::Jit_Unsupported_Opcode;
+
+    if (!buffer_.makeWritable())
+        return Error::Jit_Alloc_Failed;
+    vmJitCompiler::emitStencil(*this, (size_t)(inst - decoded_.begin()));
+    if (!buffer_.makeExecutable())
+        return Error::Jit_Alloc_Failed;
+    return Error::Ok;
+}
+
+} // namespace jlang
+
+#endif // JLANG_VM_JITCOMPILER_H
@@ -0,0 +1,806 @@
+
+#ifndef JLANG_VM_MEMOIZER_H
+#define JLANG_VM_MEMOIZER_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/vm/SuperInstruction.h"
+#include "jlang/lang/Error.h"
+#include "jlang/support/Console.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <vector>
+
+namespace jlang {
+
+//
+// The memoized calls and returns only exist in the predecoded instruction
+// stream, they follow the fused opcodes (see SuperInstruction.h).
+//
+class vmMemoOp {
+public:
+    enum Type {
+        first = 0xD0,
+
+        // call, call_short, call_long of a pure function
+        memo_call = first,
+        // fast_call_short of a pure function
+        memo_fast_call,
+
+        // The returns of a pure function, they store the result.
+        memo_ret,
+        memo_ret_n,
+        memo_ret_eax,
+        memo_ret_eax_n,
+
+        last
+    };
+
+    static const char * getName(uint32_t memoOp) {
+        static const char * s_names[] = {
+            "memo_call",
+            "memo_fast_call",
+            "memo_ret",
+            "memo_ret_n",
+            "memo_ret_eax",
+            "memo_ret_eax_n"
+        };
+        if (memoOp >= first && memoOp < last)
+            return s_names[memoOp - first];
+        else
+            return "unknown";
+    }
+};
+
+static_assert((uint32_t)vmFusedOp::last <= (uint32_t)vmMemoOp::first,
+              "The memoized opcodes overlap with the fused opcodes.");
+
+//
+// Caches the results of the pure guest functions, keyed on the argument
+// words they read.
+//
+// A function is pure when it only reads its arguments and its own locals,
+// only writes its locals and eax, and only calls pure functions. Every
+// local, eax and the flags must be written before they are read, so the
+// result can't depend on what an earlier call left on the stack. It's
+// proven on the predecoded stream when the memoizer is attached, then:
+//
+//   - The calls to a pure function become memo_call / memo_fast_call,
+//     they look up the table first and skip the call on a hit.
+//   - The returns of a pure function become memo_ret*, they store eax
+//     for the key of the innermost memoized call that missed.
+//
+// The table is direct-mapped, an entry is 16 bytes (4 per cache line),
+// a new result replaces whatever was in its entry. The results are kept
+// between the runs, clear() them if the image is patched.
+//
+class vmMemoizer {
+public:
+    // The argument words of a key.
+    static const uint32_t kMaxKeyWords = 2;
+    // 4096 entries, 64 KB.
+    static const uint32_t kDefaultTableBits = 12;
+
+    struct Function {
+        uint32_t    offset;
+        uint16_t    localSize;
+        uint8_t     isFastCall;
+        uint8_t     numKeys;
+        int32_t     keySlots[kMaxKeyWords];
+        uint64_t    hits;
+        uint64_t    misses;
+    };
+
+private:
+    struct Entry {
+        uint32_t    tag;        // function id + 1, 0 is empty
+        uint32_t    key0;
+        uint32_t    key1;
+        uint32_t    value;
+    };
+
+    struct Pending {
+        uint32_t    tag;
+        uint32_t    key0;
+        uint32_t    key1;
+    };
+
+    // The analysis of one call target.
+    struct Candidate {
+        size_t                  index;
+        bool                    isPure;
+        bool                    isFastCall;
+        uint16_t                localSize;
+        uint32_t                numKeys;
+        int32_t                 keySlots[kMaxKeyWords];
+        // The instructions of the function body, the calls are not followed.
+        std::vector<uint32_t>   body;
+        // The body plus the code it tail-calls.
+        std::vector<uint32_t>   extent;
+    };
+
+    // The data-flow state: the locals 0-31 are written, eax, the flags.
+    static const uint64_t kStateEax = 1ULL << 32;
+    static const uint64_t kStateFlags = 1ULL << 33;
+    static const uint64_t kStateAll = (1ULL << 34) - 1;
+    static const int32_t  kMaxLocals = 32;
+
+    vmDecodedImage *        decoded_;
+    std::vector<Function>   functions_;
+    std::vector<Entry>      table_;
+    uint32_t                tableMask_;
+    std::vector<Pending>    pending_;
+    uint64_t                evictions_;
+
+public:
+    vmMemoizer(uint32_t tableBits = kDefaultTableBits)
+        : decoded_(nullptr), tableMask_(0), evictions_(0) {
+        table_.resize((size_t)1 << tableBits);
+        tableMask_ = (uint32_t)(table_.size() - 1);
+        clear();
+    }
+    ~vmMemoizer() {}
+
+    bool isAttached() const { return (decoded_ != nullptr); }
+
+    size_t getFunctionCount() const { return functions_.size(); }
+    const Function & getFunction(size_t id) const { return functions_[id]; }
+
+    //
+    // Find the pure functions of the stream and rewrite their calls and
+    // returns, it must be done before the superinstructions are fused.
+    //
+    int attach(vmDecodedImage * decoded) {
+        if (decoded == nullptr || !decoded->isInited())
+            return Error::Error_NullPtr;
+
+        vmDecodedInst * code = decoded->begin();
+        size_t count = decoded->size();
+        for (size_t i = 0; i < count; i++) {
+            if (code[i].opcode >= vmFusedOp::first)
+                return Error::Memo_Image_Fused;
+        }
+
+        std::vector<Candidate> candidates;
+        findCandidates(decoded, candidates);
+        provePurity(decoded, candidates);
+        rewrite(decoded, candidates);
+
+        decoded_ = decoded;
+        clear();
+        return Error::Ok;
+    }
+
+    //
+    // Forget the results and the counters.
+    //
+    void clear() {
+        Entry empty = { 0, 0, 0, 0 };
+        for (size_t i = 0; i < table_.size(); i++) {
+            table_[i] = empty;
+        }
+        for (size_t i = 0; i < functions_.size(); i++) {
+            functions_[i].hits = 0;
+            functions_[i].misses = 0;
+        }
+        pending_.clear();
+        evictions_ = 0;
+    }
+
+    //
+    // A run starts, the calls left open by the last one are dropped.
+    //
+    void start() {
+        pending_.clear();
+    }
+
+    //
+    // The frame of the pure function is pushed, return true and its result
+    // if the arguments were seen before, otherwise the call is remembered
+    // until its return stores the result.
+    //
+    JM_FORCEINLINE bool lookup(uint32_t id, const unsigned char * fp, uint32_t & result) {
+        Function & func = functions_[id];
+        const uint32_t * slots = (const uint32_t *)fp;
+        uint32_t key0 = (func.numKeys > 0) ? slots[func.keySlots[0]] : 0;
+        uint32_t key1 = (func.numKeys > 1) ? slots[func.keySlots[1]] : 0;
+        uint32_t tag = id + 1;
+
+        const Entry & entry = table_[hash(tag, key0, key1)];
+        if (likely(entry.tag == tag && entry.key0 == key0 && entry.key1 == key1)) {
+            func.hits++;
+            result = entry.value;
+            return true;
+        }
+
+        func.misses++;
+        Pending pending = { tag, key0, key1 };
+        pending_.push_back(pending);
+        return false;
+    }
+
+    //
+    // A pure function returns the result of the innermost call that missed.
+    //
+    JM_FORCEINLINE void store(uint32_t result) {
+        if (unlikely(pending_.empty()))
+            return;
+        const Pending & pending = pending_.back();
+        Entry & entry = table_[hash(pending.tag, pending.key0, pending.key1)];
+        if (entry.tag != 0 && (entry.tag != pending.tag || entry.key0 != pending.key0
+            || entry.key1 != pending.key1)) {
+            evictions_++;
+        }
+        entry.tag = pending.tag;
+        entry.key0 = pending.key0;
+        entry.key1 = pending.key1;
+        entry.value = result;
+        pending_.pop_back();
+    }
+
+    uint64_t getHitCount() const {
+        uint64_t hits = 0;
+        for (size_t i = 0; i < functions_.size(); i++) {
+            hits += functions_[i].hits;
+        }
+        return hits;
+    }
+
+    uint64_t getMissCount() const {
+        uint64_t misses = 0;
+        for (size_t i = 0; i < functions_.size(); i++) {
+            misses += functions_[i].misses;
+        }
+        return misses;
+    }
+
+    uint64_t getEvictionCount() const { return evictions_; }
+
+    void dump() const {
+        uint64_t hits = getHitCount();
+        uint64_t misses = getMissCount();
+        uint64_t total = hits + misses;
+        console.printf("  memo: %u pure function(s), %u entries (%u KB)\n",
+                       (uint32_t)functions_.size(), (uint32_t)table_.size(),
+                       (uint32_t)(table_.size() * sizeof(Entry) / 1024));
+        console.printf("    %llu hit(s), %llu miss(es), %llu eviction(s), hit rate = %0.2f %%\n",
+                       (unsigned long long)hits, (unsigned long long)misses,
+                       (unsigned long long)evictions_,
+                       (total != 0) ? (100.0 * hits / total) : 0.0);
+        for (size_t i = 0; i < functions_.size(); i++) {
+            const Function & func = functions_[i];
+            console.printf("    %08X:  %s, local_size = %u, key =", func.offset,
+                           func.isFastCall ? "fast_call" : "call", (uint32_t)func.localSize);
+            for (uint32_t k = 0; k < func.numKeys; k++) {
+                console.printf(" slot[%d]", func.keySlots[k]);
+            }
+            console.printf("%s, %llu hit(s), %llu miss(es)\n", (func.numKeys == 0) ? " none" : "",
+                           (unsigned long long)func.hits, (unsigned long long)func.misses);
+        }
+    }
+
+private:
+    JM_FORCEINLINE size_t hash(uint32_t tag, uint32_t key0, uint32_t key1) const {
+        uint32_t h = tag * 0x9E3779B1U ^ key0 * 0x85EBCA77U ^ key1 * 0xC2B2AE3DU;
+        return (size_t)((h ^ (h >> 15)) & tableMask_);
+    }
+
+    static bool isCall(uint32_t opcode) {
+        return (opcode == OpCode::call || opcode == OpCode::call_short
+                || opcode == OpCode::call_long);
+    }
+
+    static bool isFastCall(uint32_t opcode) {
+        return (opcode == OpCode::fast_call_short || opcode == OpCode::fast_tail_call_short);
+    }
+
+    static bool isReturn(uint32_t opcode) {
+        return (opcode == OpCode::ret || opcode == OpCode::ret_n_sm || opcode == OpCode::ret_n
+                || opcode == OpCode::ret_eax || opcode == OpCode::ret_eax_n);
+    }
+
+    static bool isJump(uint32_t opcode) {
+        return (opcode == OpCode::jmp || opcode == OpCode::jmp_near
+                || opcode == OpCode::jmp_short || opcode == OpCode::jmp_long);
+    }
+
+    static bool isCondJump(uint32_t opcode) {
+        return (opcode == OpCode::jl_near || opcode == OpCode::jl_short
+                || opcode == OpCode::jl_long);
+    }
+
+    //
+    // The frame header between the caller's locals and the callee's fp:
+    // the return IP, and the saved fp of a full call.
+    //
+    static int32_t getHeaderSlots(bool isFastCall) {
+        return (int32_t)((isFastCall ? 1 : 2) * sizeof(void *) / sizeof(uint32_t));
+    }
+
+    //
+    // The caller's local that holds the argument slot of the callee.
+    //
+    static int32_t getCallerSlot(int32_t calleeSlot, bool isFastCall, uint32_t localSize) {
+        return (int32_t)(localSize / sizeof(uint32_t)) + getHeaderSlots(isFastCall) + calleeSlot;
+    }
+
+    //
+    // The instructions reachable from the start, the calls return to the
+    // next instruction, the tail calls are followed only for the extent.
+    //
+    static void collect(const vmDecodedImage * decoded, size_t start, bool followTailCalls,
+                        std::vector<uint8_t> & visited, std::vector<uint32_t> & out) {
+        const vmDecodedInst * code = decoded->begin();
+        size_t count = decoded->size();
+        out.clear();
+        visited.assign(count + 1, 0);
+
+        std::vector<uint32_t> worklist;
+        worklist.push_back((uint32_t)start);
+        visited[start] = 1;
+        while (!worklist.empty()) {
+            uint32_t index = worklist.back();
+            worklist.pop_back();
+            out.push_back(index);
+
+            const vmDecodedInst * inst = &code[index];
+            uint32_t succs[2];
+            uint32_t numSuccs = 0;
+            if (isJump(inst->opcode)) {
+                succs[numSuccs++] = (uint32_t)(inst->target - code);
+            }
+            else if (isCondJump(inst->opcode)) {
+                succs[numSuccs++] = (uint32_t)(inst->target - code);
+                succs[numSuccs++] = index + 1;
+            }
+            else if (inst->opcode == OpCode::fast_tail_call_short) {
+                if (followTailCalls)
+                    succs[numSuccs++] = (uint32_t)(inst->target - code);
+            }
+            else if (!isReturn(inst->opcode) && inst->opcode != OpCode::exit && index < count) {
+                succs[numSuccs++] = index + 1;
+            }
+
+            for (uint32_t i = 0; i < numSuccs; i++) {
+                if (succs[i] <= count && !visited[succs[i]]) {
+                    visited[succs[i]] = 1;
+                    worklist.push_back(succs[i]);
+                }
+            }
+        }
+    }
+
+    //
+    // The call targets, except the entry function. All calls of a target
+    // must push the same kind of frame with the same local size.
+    //
+    void findCandidates(const vmDecodedImage * decoded, std::vector<Candidate> & candidates) {
+        const vmDecodedInst * code = decoded->begin();
+        size_t count = decoded->size();
+        std::vector<int32_t> candidateOf(count + 1, -1);
+        std::vector<uint8_t> visited;
+
+        for (size_t i = 0; i < count; i++) {
+            const vmDecodedInst * inst = &code[i];
+            if (inst->target == nullptr || !(isCall(inst->opcode) || isFastCall(inst->opcode)))
+                continue;
+            size_t index = (size_t)(inst->target - code);
+            if (inst->target == decoded->entry() || index >= count)
+                continue;
+
+            bool fast = isFastCall(inst->opcode);
+            if (candidateOf[index] < 0) {
+                Candidate candidate = Candidate();
+                candidate.index = index;
+                candidate.isPure = true;
+                candidate.isFastCall = fast;
+                candidate.localSize = inst->aux;
+                candidate.numKeys = 0;
+                candidateOf[index] = (int32_t)candidates.size();
+                candidates.push_back(candidate);
+            }
+            else {
+                Candidate & candidate = candidates[candidateOf[index]];
+                if (candidate.isFastCall != fast || candidate.localSize != inst->aux)
+                    candidate.isPure = false;
+            }
+        }
+
+        for (size_t i = 0; i < candidates.size(); i++) {
+            Candidate & candidate = candidates[i];
+            if ((candidate.localSize % sizeof(uint32_t)) != 0)
+                candidate.isPure = false;
+            collect(decoded, candidate.index, false, visited, candidate.body);
+            collect(decoded, candidate.index, true, visited, candidate.extent);
+            if (!findKeys(decoded, candidate))
+                candidate.isPure = false;
+        }
+    }
+
+    //
+    // The argument slots the function reads are its key, they must be in
+    // the locals of its callers.
+    //
+    static bool findKeys(const vmDecodedImage * decoded, Candidate & candidate) {
+        const vmDecodedInst * code = decoded->begin();
+        int32_t lowest = -getHeaderSlots(candidate.isFastCall)
+                       - (int32_t)(candidate.localSize / sizeof(uint32_t));
+        int32_t highest = -getHeaderSlots(candidate.isFastCall) - 1;
+
+        for (size_t i = 0; i < candidate.body.size(); i++) {
+            const vmDecodedInst * inst = &code[candidate.body[i]];
+            Access access;
+            if (!getAccess(inst, access))
+                continue;
+            for (uint32_t r = 0; r < access.numReads; r++) {
+                int32_t slot = access.reads[r];
+                if (slot >= 0)
+                    continue;
+                if (slot < lowest || slot > highest)
+                    return false;
+                bool found = false;
+                for (uint32_t k = 0; k < candidate.numKeys; k++) {
+                    if (candidate.keySlots[k] == slot)
+                        found = true;
+                }
+                if (!found) {
+                    if (candidate.numKeys >= kMaxKeyWords)
+                        return false;
+                    candidate.keySlots[candidate.numKeys++] = slot;
+                }
+            }
+        }
+        return true;
+    }
+
+    // The slots, eax and flags an instruction reads and writes.
+    struct Access {
+        int32_t     reads[2];
+        uint32_t    numReads;
+        int32_t     write;
+        bool        hasWrite;
+        bool        readsEax;
+        bool        writesEax;
+        bool        readsFlags;
+        bool        writesFlags;
+    };
+
+    //
+    // Return false for the calls and the instructions that are never pure.
+    //
+    static bool getAccess(const vmDecodedInst * inst, Access & access) {
+        access.numReads = 0;
+        access.write = 0;
+        access.hasWrite = false;
+        access.readsEax = access.writesEax = false;
+        access.readsFlags = access.writesFlags = false;
+
+        int32_t operand2 = (int32_t)inst->operand2;
+        switch (inst->opcode) {
+        case OpCode::store:
+            access.write = inst->operand1;
+            access.hasWrite = true;
+            break;
+        case OpCode::move:
+            access.reads[access.numReads++] = operand2;
+            access.write = inst->operand1;
+            access.hasWrite = true;
+            break;
+        case OpCode::copy_from_eax:
+            access.readsEax = true;
+            access.write = inst->operand1;
+            access.hasWrite = true;
+            break;
+        case OpCode::cmp_i32:
+        case OpCode::cmp_u32:
+            access.reads[access.numReads++] = inst->operand1;
+            access.reads[access.numReads++] = operand2;
+            access.writesFlags = true;
+            break;
+        case OpCode::cmp_imm_i32:
+        case OpCode::cmp_imm_u32:
+            access.reads[access.numReads++] = inst->operand1;
+            access.writesFlags = true;
+            break;
+        case OpCode::jl_near:
+        case OpCode::jl_short:
+        case OpCode::jl_long:
+            access.readsFlags = true;
+            break;
+        case OpCode::inc:
+        case OpCode::dec:
+        case OpCode::add_imm:
+        case OpCode::sub_imm:
+            access.reads[access.numReads++] = inst->operand1;
+            access.write = inst->operand1;
+            access.hasWrite = true;
+            break;
+        case OpCode::add:
+        case OpCode::sub:
+            access.reads[access.numReads++] = inst->operand1;
+            access.reads[access.numReads++] = operand2;
+            access.write = inst->operand1;
+            access.hasWrite = true;
+            break;
+        case OpCode::add_eax:
+        case OpCode::sub_eax:
+            access.reads[access.numReads++] = inst->operand1;
+            access.readsEax = access.writesEax = true;
+            break;
+        case OpCode::add_eax_imm:
+        case OpCode::sub_eax_imm:
+            access.readsEax = access.writesEax = true;
+            break;
+        case OpCode::load_eax:
+        case OpCode::ret_eax:
+        case OpCode::ret_eax_n:
+            access.writesEax = true;
+            break;
+        case OpCode::ret:
+        case OpCode::ret_n_sm:
+        case OpCode::ret_n:
+            access.readsEax = true;
+            break;
+        case OpCode::jmp:
+        case OpCode::jmp_near:
+        case OpCode::jmp_short:
+        case OpCode::jmp_long:
+        case OpCode::nop:
+        case OpCode::nop_n:
+            break;
+        default:
+            // The calls, exit, error, and the opcodes the predecoded
+            // stream runs as nop (move_to_eax, cmp, jl).
+            return false;
+        }
+        return true;
+    }
+
+    //
+    // Assume all candidates are pure, drop the ones that break the rules
+    // until nothing changes.
+    //
+    void provePurity(const vmDecodedImage * decoded, std::vector<Candidate> & candidates) {
+        const vmDecodedInst * code = decoded->begin();
+        size_t count = decoded->size();
+        std::vector<int32_t> candidateOf(count + 1, -1);
+        for (size_t i = 0; i < candidates.size(); i++) {
+            candidateOf[candidates[i].index] = (int32_t)i;
+        }
+
+        std::vector<uint8_t> visited;
+        std::vector<uint32_t> entryExtent;
+        collect(decoded, (size_t)(decoded->entry() - code), true, visited, entryExtent);
+
+        bool changed;
+        do {
+            changed = false;
+            for (size_t i = 0; i < candidates.size(); i++) {
+                if (candidates[i].isPure && !isPure(decoded, candidates, candidateOf, candidates[i])) {
+                    candidates[i].isPure = false;
+                    changed = true;
+                }
+            }
+
+            // The returns of a pure function are only run by its memoized
+            // calls, no other code may reach them.
+            std::vector<uint8_t> impure(count + 1, 0);
+            for (size_t i = 0; i < entryExtent.size(); i++) {
+                impure[entryExtent[i]] = 1;
+            }
+            for (size_t i = 0; i < candidates.size(); i++) {
+                if (!candidates[i].isPure) {
+                    for (size_t j = 0; j < candidates[i].extent.size(); j++) {
+                        impure[candidates[i].extent[j]] = 1;
+                    }
+                }
+            }
+            for (size_t i = 0; i < candidates.size(); i++) {
+                if (!candidates[i].isPure)
+                    continue;
+                for (size_t j = 0; j < candidates[i].extent.size(); j++) {
+                    if (impure[candidates[i].extent[j]]) {
+                        candidates[i].isPure = false;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        } while (changed);
+    }
+
+    //
+    // The must-be-written data-flow over the function body: a state bit is
+    // set when the local (eax, the flags) is written on all paths.
+    //
+    static bool isPure(const vmDecodedImage * decoded, const std::vector<Candidate> & candidates,
+                       const std::vector<int32_t> & candidateOf, const Candidate & func) {
+        const vmDecodedInst * code = decoded->begin();
+        size_t count = decoded->size();
+        std::vector<uint64_t> states(count + 1, kStateAll);
+        std::vector<uint8_t> queued(count + 1, 0);
+        std::vector<uint32_t> worklist;
+
+        states[func.index] = 0;
+        worklist.push_back((uint32_t)func.index);
+        queued[func.index] = 1;
+
+        while (!worklist.empty()) {
+            uint32_t index = worklist.back();
+            worklist.pop_back();
+            queued[index] = 0;
+
+            const vmDecodedInst * inst = &code[index];
+            uint64_t state = states[index];
+            bool isExit = false;
+
+            Access access;
+            if (getAccess(inst, access)) {
+                for (uint32_t r = 0; r < access.numReads; r++) {
+                    int32_t slot = access.reads[r];
+                    if (slot >= kMaxLocals)
+                        return false;
+                    if (slot >= 0 && (state & (1ULL << slot)) == 0)
+                        return false;
+                }
+                if ((access.readsEax && (state & kStateEax) == 0)
+                    || (access.readsFlags && (state & kStateFlags) == 0))
+                    return false;
+                if (access.hasWrite) {
+                    if (access.write < 0 || access.write >= kMaxLocals)
+                        return false;
+                    state |= (1ULL << access.write);
+                }
+                if (access.writesEax)
+                    state |= kStateEax;
+                if (access.writesFlags)
+                    state |= kStateFlags;
+
+                if (isReturn(inst->opcode)) {
+                    bool fastReturn = (inst->opcode == OpCode::ret_n_sm
+                                       || inst->opcode == OpCode::ret_n
+                                       || inst->opcode == OpCode::ret_eax_n);
+                    if (fastReturn != func.isFastCall
+                        || (fastReturn && inst->aux != func.localSize))
+                        return false;
+                    isExit = true;
+                }
+            }
+            else if (isCall(inst->opcode) || isFastCall(inst->opcode)) {
+                size_t target = (size_t)(inst->target - code);
+                int32_t calleeId = candidateOf[target];
+                if (calleeId < 0 || !candidates[calleeId].isPure)
+                    return false;
+                const Candidate & callee = candidates[calleeId];
+
+                // The callee's key must be written by the caller.
+                for (uint32_t k = 0; k < callee.numKeys; k++) {
+                    int32_t slot = getCallerSlot(callee.keySlots[k], callee.isFastCall,
+                                                 callee.localSize);
+                    if (slot < 0 || slot >= kMaxLocals || (state & (1ULL << slot)) == 0)
+                        return false;
+                }
+
+                if (inst->opcode == OpCode::fast_tail_call_short) {
+                    // It reuses the caller's frame.
+                    if (!func.isFastCall || inst->aux != func.localSize)
+                        return false;
+                    isExit = true;
+                }
+                else {
+                    // The callee's frame is over the locals after the arguments.
+                    int32_t firstClobbered = (int32_t)(inst->aux / sizeof(uint32_t));
+                    if (firstClobbered < kMaxLocals)
+                        state &= ~(((1ULL << kMaxLocals) - 1) & ~((1ULL << firstClobbered) - 1));
+                    state |= kStateEax;
+                    state &= ~kStateFlags;
+                }
+            }
+            else {
+                return false;
+            }
+
+            if (isExit)
+                continue;
+
+            uint32_t succs[2];
+            uint32_t numSuccs = 0;
+            if (isJump(inst->opcode)) {
+                succs[numSuccs++] = (uint32_t)(inst->target - code);
+            }
+            else if (isCondJump(inst->opcode)) {
+                succs[numSuccs++] = (uint32_t)(inst->target - code);
+                succs[numSuccs++] = index + 1;
+            }
+            else {
+                succs[numSuccs++] = index + 1;
+            }
+
+            for (uint32_t i = 0; i < numSuccs; i++) {
+                uint32_t succ = succs[i];
+                // Falls off the end of the image.
+                if (succ >= count)
+                    return false;
+                uint64_t merged = states[succ] & state;
+                if (merged != states[succ]) {
+                    states[succ] = merged;
+                    if (!queued[succ]) {
+                        queued[succ] = 1;
+                        worklist.push_back(succ);
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    void rewrite(vmDecodedImage * decoded, const std::vector<Candidate> & candidates) {
+        vmDecodedInst * code = decoded->begin();
+        size_t count = decoded->size();
+        std::vector<int32_t> idOf(count + 1, -1);
+
+        functions_.clear();
+        for (size_t i = 0; i < candidates.size(); i++) {
+            const Candidate & candidate = candidates[i];
+            if (!candidate.isPure)
+                continue;
+            Function func;
+            func.offset = code[candidate.index].offset;
+            func.localSize = candidate.localSize;
+            func.isFastCall = candidate.isFastCall ? 1 : 0;
+            func.numKeys = (uint8_t)candidate.numKeys;
+            for (uint32_t k = 0; k < kMaxKeyWords; k++) {
+                func.keySlots[k] = (k < candidate.numKeys) ? candidate.keySlots[k] : 0;
+            }
+            func.hits = 0;
+            func.misses = 0;
+            idOf[candidate.index] = (int32_t)functions_.size();
+            functions_.push_back(func);
+
+            for (size_t j = 0; j < candidate.body.size(); j++) {
+                vmDecodedInst * inst = &code[candidate.body[j]];
+                switch (inst->opcode) {
+                case OpCode::ret:       inst->opcode = vmMemoOp::memo_ret;          break;
+                case OpCode::ret_n_sm:
+                case OpCode::ret_n:     inst->opcode = vmMemoOp::memo_ret_n;        break;
+                case OpCode::ret_eax:   inst->opcode = vmMemoOp::memo_ret_eax;      break;
+                case OpCode::ret_eax_n: inst->opcode = vmMemoOp::memo_ret_eax_n;    break;
+                default:                                                            break;
+                }
+            }
+        }
+
+        // The calls from anywhere, the tail calls keep the caller's key.
+        for (size_t i = 0; i < count; i++) {
+            vmDecodedInst * inst = &code[i];
+            if (inst->target == nullptr || idOf[inst->target - code] < 0)
+                continue;
+            if (isCall(inst->opcode)) {
+                inst->opcode = vmMemoOp::memo_call;
+                inst->operand1 = idOf[inst->target - code];
+            }
+            else if (inst->opcode == OpCode::fast_call_short) {
+                inst->opcode = vmMemoOp::memo_fast_call;
+                inst->operand1 = idOf[inst->target - code];
+            }
+        }
+        decoded->unbind();
+
+        for (size_t i = 0; i < functions_.size(); i++) {
+            console.trace("vmMemoizer: %08X is pure, %u key word(s)\n",
+                          functions_[i].offset, (uint32_t)functions_[i].numKeys);
+        }
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_MEMOIZER_H
@@ -0,0 +1,832 @@
+
+#ifndef JLANG_VM_PREDECODER_H
+#define JLANG_VM_PREDECODER_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/lang/Error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <vector>
+
+namespace jlang {
+
+class vmStackMaps;
+
+//
+// The predecoded (internal) form of one bytecode instruction.
+//
+// All operands are decoded once at load time: the slot indexes are
+// sign-extended, the unaligned immediates are copied into aligned fields,
+// and the relative jump and call offsets are resolved to the absolute
+// target instruction.
+//
+struct vmDecodedInst {
+    void *          handler;    // Dispatch address, bound by the executor
+    vmDecodedInst * target;     // Jump or call target
+    uint16_t        opcode;     // OpCode::Type
+    uint16_t        aux;        // Local size (call, ret) or jump type (cmp)
+    uint32_t        offset;     // Bytecode offset of this instruction
+    int32_t         operand1;   // First slot index, or the bytes a tail call moves
+    uint32_t        operand2;   // Second slot index, immediate or return offset
+};
+
+class vmDecodedImage {
+private:
+    vmDecodedInst *         code_;
+    vmDecodedInst **        index_;
+    const unsigned char *   image_;
+    size_t                  imageSize_;
+    size_t                  count_;
+    vmDecodedInst *         entry_;
+    const void *            bindKey_;
+    const vmStackMaps *     stackMaps_;
+    bool                    verified_;
+
+public:
+    vmDecodedImage() : code_(nullptr), index_(nullptr), image_(nullptr),
+                       imageSize_(0), count_(0), entry_(nullptr),
+                       bindKey_(nullptr), stackMaps_(nullptr), verified_(false) {}
+    ~vmDecodedImage() {
+        destroy();
+    }
+
+    bool isInited() const { return (code_ != nullptr); }
+
+    vmDecodedInst * begin() const { return code_; }
+    vmDecodedInst * end() const { return (code_ + count_); }
+    vmDecodedInst * entry() const { return entry_; }
+
+    // The number of decoded instructions, exclude the exit sentinel.
+    size_t size() const { return count_; }
+
+    const unsigned char * getImage() const { return image_; }
+    size_t getImageSize() const { return imageSize_; }
+
+    // The stack maps of the collector, nullptr if it can't find the roots.
+    const vmStackMaps * getStackMaps() const { return stackMaps_; }
+    void setStackMaps(const vmStackMaps * stackMaps) { stackMaps_ = stackMaps; }
+
+    // The bytecode passed vmVerifier, it's run without the image limit check.
+    bool isVerified() const { return verified_; }
+    void setVerified(bool verified) { verified_ = verified; }
+
+    //
+    // Translate a bytecode address (e.g. a return IP saved in the frame)
+    // to the decoded instruction, return nullptr if it isn't the start
+    // of an instruction.
+    //
+    vmDecodedInst * at(const void * ip) const {
+        return index_[(const unsigned char *)ip - image_];
+    }
+
+    vmDecodedInst * atOffset(uint32_t offset) const {
+        return ((offset <= imageSize_) ? index_[offset] : nullptr);
+    }
+
+    void destroy() {
+        if (code_) {
+#if defined(_WIN32)
+            _aligned_free(code_);
+#else
+            free(code_);
+#endif
+            code_ = nullptr;
+        }
+        if (index_) {
+            free(index_);
+            index_ = nullptr;
+        }
+        image_ = nullptr;
+        imageSize_ = 0;
+        count_ = 0;
+        entry_ = nullptr;
+        bindKey_ = nullptr;
+        stackMaps_ = nullptr;
+        verified_ = false;
+    }
+
+    // The instructions of the collected objects.
+    static bool isObjectOp(uint32_t opcode) {
+        return (opcode == OpCode::new_obj || opcode == OpCode::ld_ref || opcode == OpCode::st_ref
+                || opcode == OpCode::ld_field || opcode == OpCode::st_field);
+    }
+
+    static bool isCallOp(uint32_t opcode) {
+        return (opcode == OpCode::call || opcode == OpCode::call_short
+                || opcode == OpCode::call_long || opcode == OpCode::fast_call_short
+                || opcode == OpCode::fast_tail_call_short);
+    }
+
+    // operand1 is a slot.
+    static bool hasSlot1(uint32_t opcode) {
+        switch (opcode) {
+        case OpCode::store:
+        case OpCode::move:
+        case OpCode::copy_from_eax:
+        case OpCode::cmp_i32:
+        case OpCode::cmp_u32:
+        case OpCode::cmp_imm_i32:
+        case OpCode::cmp_imm_u32:
+        case OpCode::inc:
+        case OpCode::dec:
+        case OpCode::add:
+        case OpCode::add_imm:
+        case OpCode::add_eax:
+        case OpCode::sub:
+        case OpCode::sub_imm:
+        case OpCode::sub_eax:
+        case OpCode::alloc:
+        case OpCode::free:
+        case OpCode::new_obj:
+        case OpCode::ld_ref:
+        case OpCode::st_ref:
+        case OpCode::ld_field:
+        case OpCode::st_field:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // operand2 is a slot.
+    static bool hasSlot2(uint32_t opcode) {
+        switch (opcode) {
+        case OpCode::move:
+        case OpCode::cmp_i32:
+        case OpCode::cmp_u32:
+        case OpCode::add:
+        case OpCode::sub:
+        case OpCode::ld_ref:
+        case OpCode::st_ref:
+        case OpCode::ld_field:
+        case OpCode::st_field:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    //
+    // Get the length of the instruction at ip, in bytes.
+    //
+    static uint32_t getInstLength(const unsigned char * ip) {
+        switch (*ip) {
+        case OpCode::move_to_eax:
+        case OpCode::cmp:
+        case OpCode::jl:
+        case OpCode::ret:
+        case OpCode::nop:
+        case OpCode::exit:
+            return 1;
+
+        case OpCode::copy_from_eax:
+        case OpCode::inc:
+        case OpCode::dec:
+        case OpCode::add_eax:
+        case OpCode::sub_eax:
+        case OpCode::free:
+            return (1 + sizeof(int8_t));
+
+        case OpCode::move:
+        case OpCode::cmp_i32:
+        case OpCode::cmp_u32:
+        case OpCode::add:
+        case OpCode::sub:
+            return (1 + sizeof(int8_t) * 2);
+
+        case OpCode::store:
+        case OpCode::cmp_imm_i32:
+        case OpCode::cmp_imm_u32:
+        case OpCode::add_imm:
+        case OpCode::sub_imm:
+        case OpCode::alloc:
+            return (1 + sizeof(int8_t) + sizeof(uint32_t));
+
+        case OpCode::new_obj:
+        case OpCode::ld_ref:
+        case OpCode::st_ref:
+        case OpCode::ld_field:
+        case OpCode::st_field:
+            return (1 + sizeof(int8_t) * 3);
+
+        case OpCode::load_eax:
+        case OpCode::add_eax_imm:
+        case OpCode::sub_eax_imm:
+        case OpCode::ret_eax:
+            return (1 + sizeof(uint32_t));
+
+        case OpCode::jl_near:
+        case OpCode::jmp_near:
+            return (1 + sizeof(int8_t));
+
+        case OpCode::jl_short:
+        case OpCode::jmp_short:
+            return (1 + sizeof(int16_t));
+
+        case OpCode::jl_long:
+        case OpCode::jmp_long:
+        case OpCode::jmp:
+            return (1 + sizeof(int32_t));
+
+        case OpCode::call:
+        case OpCode::call_long:
+            return (1 + sizeof(int32_t) + sizeof(uint16_t));
+
+        case OpCode::call_short:
+        case OpCode::fast_call_short:
+        case OpCode::fast_tail_call_short:
+            return (1 + sizeof(int16_t) + sizeof(uint16_t));
+
+        case OpCode::ret_n_sm:
+            return (1 + sizeof(uint8_t));
+
+        case OpCode::ret_n:
+            return (1 + sizeof(uint16_t));
+
+        case OpCode::ret_eax_n:
+            return (1 + sizeof(uint16_t) + sizeof(uint32_t));
+
+        case OpCode::nop_n:
+            return (1 + sizeof(uint8_t) + ip[1]);
+
+        default:
+            // error and the unknown opcodes
+            return 1;
+        }
+    }
+
+    //
+    // Decode the whole image, it's run once when the image is loaded.
+    //
+    int decode(const void * image, size_t imageSize, size_t entryOffset) {
+        destroy();
+
+        image_ = (const unsigned char *)image;
+        imageSize_ = imageSize;
+
+        index_ = (vmDecodedInst **)calloc(imageSize + 1, sizeof(vmDecodedInst *));
+        if (index_ == nullptr)
+            return Error::Predecode_Alloc_Failed;
+
+        // Pass 1: find all instruction boundaries.
+        size_t count = 0;
+        size_t offset = 0;
+        while (offset < imageSize) {
+            // The length of nop_n is its operand.
+            if (image_[offset] == OpCode::nop_n && offset + 1 >= imageSize) {
+                destroy();
+                return Error::Predecode_Truncated_Instruction;
+            }
+            uint32_t length = getInstLength(image_ + offset);
+            if (offset + length > imageSize) {
+                destroy();
+                return Error::Predecode_Truncated_Instruction;
+            }
+            offset += length;
+            count++;
+        }
+
+        // Plus the exit sentinel, so falling off the end of image is safe.
+        size_t allocSize = sizeof(vmDecodedInst) * (count + 1);
+#if defined(_WIN32)
+        code_ = (vmDecodedInst *)_aligned_malloc(allocSize, 64);
+#else
+        int ret = posix_memalign((void **)&code_, 64, allocSize);
+        if (ret != 0)
+            code_ = nullptr;
+#endif // _WIN32
+        if (code_ == nullptr) {
+            destroy();
+            return Error::Predecode_Alloc_Failed;
+        }
+        count_ = count;
+
+        offset = 0;
+        vmDecodedInst * inst = code_;
+        while (offset < imageSize) {
+            inst->offset = (uint32_t)offset;
+            index_[offset] = inst;
+            offset += getInstLength(image_ + offset);
+            inst++;
+        }
+
+        vmDecodedInst * sentinel = &code_[count];
+        memset((void *)sentinel, 0, sizeof(vmDecodedInst));
+        sentinel->opcode = OpCode::exit;
+        sentinel->offset = (uint32_t)imageSize;
+        index_[imageSize] = sentinel;
+
+        // Pass 2: decode the operands and resolve the branch targets.
+        for (size_t i = 0; i < count; i++) {
+            int ec = decodeInst(&code_[i]);
+            if (ec != Error::Ok) {
+                destroy();
+                return ec;
+            }
+        }
+
+        entry_ = atOffset((uint32_t)entryOffset);
+        if (entry_ == nullptr) {
+            destroy();
+            return Error::Predecode_Illegal_Branch_Target;
+        }
+
+        // Pass 3: the tail calls.
+        eliminateTailCalls();
+        return Error::Ok;
+    }
+
+    //
+    // Is it a fast_call_short that can reuse the frame of its caller:
+    //
+    //   fast_call_short X, L
+    //   ret_n L                   (the same local size)
+    //
+    // The ret_n of the callee pops the frame just as the ret_n after
+    // the call would, so the call can be rewritten to fast_tail_call_short
+    // (see eliminateTailCalls() for when it is).
+    //
+    bool isTailCall(const vmDecodedInst * inst) const {
+        if (inst->opcode != OpCode::fast_call_short && inst->opcode != OpCode::fast_tail_call_short)
+            return false;
+        const vmDecodedInst * next = inst + 1;
+        return ((next->opcode == OpCode::ret_n || next->opcode == OpCode::ret_n_sm)
+                && next->aux == inst->aux);
+    }
+
+    //
+    // Decode the instruction at the bytecode offset again, after its
+    // immediate was patched (see vmBinaryFile::setInput()).
+    //
+    int refresh(uint32_t offset) {
+        vmDecodedInst * inst = atOffset(offset);
+        if (inst == nullptr || inst == end())
+            return Error::Predecode_Illegal_Branch_Target;
+
+        void * handler = inst->handler;
+        uint16_t opcode = inst->opcode;
+        int32_t argSize = inst->operand1;
+        int ec = decodeInst(inst);
+        if (opcode == OpCode::fast_tail_call_short && isTailCall(inst)) {
+            inst->opcode = OpCode::fast_tail_call_short;
+            inst->operand1 = argSize;
+        }
+        if (inst->opcode == opcode)
+            inst->handler = handler;
+        else
+            bindKey_ = nullptr;
+        return ec;
+    }
+
+    //
+    // The handler addresses belong to one executor, the key tells which
+    // one they were bound for.
+    //
+    bool isBoundTo(const void * key) const {
+        return (bindKey_ == key);
+    }
+
+    void bind(void * const * dispatchTable, const void * key) {
+        for (size_t i = 0; i <= count_; i++) {
+            code_[i].handler = dispatchTable[code_[i].opcode];
+        }
+        bindKey_ = key;
+    }
+
+    void unbind() {
+        bindKey_ = nullptr;
+    }
+
+private:
+    // The most argument words a tail call moves down.
+    enum { kMaxArgWords = 32 };
+
+    template <typename U>
+    static U readValue(const unsigned char * ip) {
+        U value;
+        memcpy((void *)&value, (const void *)ip, sizeof(U));
+        return value;
+    }
+
+    //
+    // The instructions run after the one at index in its function, a call
+    // goes on at its return point. Returns how many, 0 after a return, a
+    // tail call or exit, -1 if a jump has no target.
+    //
+    int getSuccessors(size_t index, size_t * next) const {
+        const vmDecodedInst * inst = &code_[index];
+        switch (inst->opcode) {
+        case OpCode::ret:
+        case OpCode::ret_n_sm:
+        case OpCode::ret_n:
+        case OpCode::ret_eax:
+        case OpCode::ret_eax_n:
+        case OpCode::fast_tail_call_short:
+        case OpCode::exit:
+            return 0;
+
+        case OpCode::jmp:
+        case OpCode::jmp_near:
+        case OpCode::jmp_short:
+        case OpCode::jmp_long:
+            if (inst->target == nullptr)
+                return -1;
+            next[0] = (size_t)(inst->target - code_);
+            return 1;
+
+        case OpCode::jl_near:
+        case OpCode::jl_short:
+        case OpCode::jl_long:
+            if (inst->target == nullptr)
+                return -1;
+            next[0] = (size_t)(inst->target - code_);
+            next[1] = index + 1;
+            return 2;
+
+        default:
+            // The exit sentinel is after the last instruction.
+            next[0] = index + 1;
+            return 1;
+        }
+    }
+
+    //
+    // The argument words of the function at start: the top words of its
+    // caller's frame it reads or writes, down to its lowest argument slot,
+    // and all of the frame a fast_tail_call_short in it moves down.
+    // Returns -1 if it isn't known.
+    //
+    int32_t getArgWords(size_t start) const {
+        static const int32_t kHeader = (int32_t)(sizeof(void *) / sizeof(uint32_t));
+        std::vector<uint8_t> seen(count_ + 1, 0);
+        std::vector<size_t> work(1, start);
+        int32_t words = 0;
+        while (!work.empty()) {
+            size_t index = work.back();
+            work.pop_back();
+            if (seen[index])
+                continue;
+            seen[index] = 1;
+
+            const vmDecodedInst * inst = &code_[index];
+            int32_t lowest = 0;
+            if (hasSlot1(inst->opcode) && inst->operand1 < lowest)
+                lowest = inst->operand1;
+            if (hasSlot2(inst->opcode) && (int8_t)inst->operand2 < lowest)
+                lowest = (int8_t)inst->operand2;
+            if (-lowest - kHeader > words)
+                words = -lowest - kHeader;
+            if (inst->opcode == OpCode::fast_tail_call_short
+                && (int32_t)(inst->aux / sizeof(uint32_t)) > words)
+                words = (int32_t)(inst->aux / sizeof(uint32_t));
+
+            size_t next[2];
+            int n = getSuccessors(index, next);
+            if (n < 0)
+                return -1;
+            for (int i = 0; i < n; i++) {
+                work.push_back(next[i]);
+            }
+        }
+        return ((words <= kMaxArgWords) ? words : -1);
+    }
+
+    //
+    // How many top words of the caller's frame aren't read after the fast
+    // call at index returns, before they're written again. A call reads
+    // the words the arguments of its callee are in.
+    //
+    int32_t getDeadWords(size_t index, const std::vector<int32_t> & argWords) const {
+        int32_t top = (int32_t)(code_[index].aux / sizeof(uint32_t));
+        int32_t words = (top < kMaxArgWords) ? top : kMaxArgWords;
+        uint32_t all = (words < 32) ? ((1U << words) - 1) : 0xFFFFFFFFU;
+
+        // The words not written yet on a path to the instruction.
+        std::vector<uint32_t> unwritten(count_ + 1, 0);
+        std::vector<size_t> work(1, index + 1);
+        unwritten[index + 1] = all;
+        uint32_t read = 0;
+        while (!work.empty()) {
+            size_t current = work.back();
+            work.pop_back();
+            const vmDecodedInst * inst = &code_[current];
+            uint32_t live = unwritten[current];
+
+            uint32_t reads = 0, writes = 0;
+            if (hasSlot1(inst->opcode)) {
+                uint32_t bits = getWordBits(inst->operand1, inst->operand1 + 1, top, words);
+                if (inst->opcode == OpCode::store || inst->opcode == OpCode::move
+                    || inst->opcode == OpCode::copy_from_eax)
+                    writes |= bits;
+                else
+                    reads |= bits;
+            }
+            if (hasSlot2(inst->opcode))
+                reads |= getWordBits((int8_t)inst->operand2, (int8_t)inst->operand2 + 1, top, words);
+
+            int32_t end = (int32_t)(inst->aux / sizeof(uint32_t));
+            if (inst->opcode == OpCode::fast_tail_call_short) {
+                reads |= getWordBits(0, end, top, words);
+            }
+            else if (isCallOp(inst->opcode)) {
+                // All of them if the callee's arguments aren't known.
+                int32_t callee = -1;
+                if (inst->opcode == OpCode::fast_call_short && inst->target != nullptr)
+                    callee = argWords[inst->target - code_];
+                reads |= (callee >= 0) ? getWordBits(end - callee, end, top, words) : all;
+            }
+            read |= (reads & live);
+            live &= ~writes;
+
+            size_t next[2];
+            int n = getSuccessors(current, next);
+            if (n < 0)
+                return 0;
+            for (int i = 0; i < n; i++) {
+                if ((live & ~unwritten[next[i]]) != 0) {
+                    unwritten[next[i]] |= live;
+                    work.push_back(next[i]);
+                }
+            }
+        }
+
+        int32_t dead = 0;
+        while (dead < words && (read & (1U << dead)) == 0) {
+            dead++;
+        }
+        return dead;
+    }
+
+    // The bits of the slots first .. last - 1, bit j is the slot top - 1 - j.
+    static uint32_t getWordBits(int32_t first, int32_t last, int32_t top, int32_t words) {
+        uint32_t bits = 0;
+        for (int32_t slot = first; slot < last; slot++) {
+            if (slot >= top - words && slot < top)
+                bits |= (1U << (top - 1 - slot));
+        }
+        return bits;
+    }
+
+    //
+    // A tail call moves the arguments of its callee down over the
+    // arguments of its caller, the callee's frame takes the place of the
+    // caller's. It's rewritten only if the words it moves are:
+    //
+    //   - known: the lowest argument slot of the callee is known,
+    //   - in the caller's arguments, not in the other locals of its caller,
+    //   - not read by any caller of the caller after the call returns (a
+    //     tail call in the caller passes that on to the callers of it).
+    //
+    // The entry function was not entered by a fast_call, its caller's frame
+    // isn't there to be reused, so only the called functions are rewritten.
+    //
+    // Not in an image of collected objects: the collector finds a frame's
+    // caller by its return point, a tail call would leave the callee in the
+    // place of a frame it doesn't know.
+    //
+    void eliminateTailCalls() {
+        static const size_t kNoFunction = (size_t)-1;
+        for (size_t i = 0; i < count_; i++) {
+            if (isObjectOp(code_[i].opcode))
+                return;
+        }
+        size_t entry = (size_t)(entry_ - code_);
+
+        // The function starts, the entry and all call targets.
+        std::vector<uint8_t> isFunction(count_ + 1, 0);
+        for (size_t i = 0; i < count_; i++) {
+            const vmDecodedInst * inst = &code_[i];
+            if (inst->target != nullptr && isCallOp(inst->opcode))
+                isFunction[inst->target - code_] = 1;
+        }
+        isFunction[entry] = 1;
+
+        // The function of each instruction, and the tail calls.
+        std::vector<size_t> functionOf(count_ + 1, kNoFunction);
+        std::vector<uint8_t> isTailCallAt(count_ + 1, 0);
+        std::vector<size_t> tailCalls;
+        size_t function = kNoFunction;
+        for (size_t i = 0; i < count_; i++) {
+            if (isFunction[i])
+                function = i;
+            functionOf[i] = function;
+            if (function != kNoFunction && function != entry
+                && code_[i].opcode == OpCode::fast_call_short
+                && code_[i].target != nullptr && isTailCall(&code_[i])) {
+                isTailCallAt[i] = 1;
+                tailCalls.push_back(i);
+            }
+        }
+        if (tailCalls.empty())
+            return;
+
+        std::vector<int32_t> argWords(count_ + 1, -1);
+        for (size_t i = 0; i < count_; i++) {
+            if (isFunction[i])
+                argWords[i] = getArgWords(i);
+        }
+
+        // The dead top words of the frames of the callers of each function.
+        // A tail call returns where its caller returns, it takes the dead
+        // words of its caller.
+        std::vector<int32_t> deadWords(count_ + 1, kMaxArgWords);
+        std::vector<size_t> inherits;
+        deadWords[entry] = 0;
+        for (size_t i = 0; i < count_; i++) {
+            const vmDecodedInst * inst = &code_[i];
+            if (inst->target == nullptr || !isCallOp(inst->opcode))
+                continue;
+            if (inst->opcode == OpCode::fast_tail_call_short || isTailCallAt[i]) {
+                inherits.push_back(i);
+                continue;
+            }
+            size_t callee = (size_t)(inst->target - code_);
+            int32_t dead = (inst->opcode == OpCode::fast_call_short) ? getDeadWords(i, argWords) : 0;
+            if (dead < deadWords[callee])
+                deadWords[callee] = dead;
+        }
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            for (size_t i = 0; i < inherits.size(); i++) {
+                size_t caller = functionOf[inherits[i]];
+                size_t callee = (size_t)(code_[inherits[i]].target - code_);
+                int32_t dead = (caller != kNoFunction) ? deadWords[caller] : 0;
+                if (dead < deadWords[callee]) {
+                    deadWords[callee] = dead;
+                    changed = true;
+                }
+            }
+        }
+
+        for (size_t i = 0; i < tailCalls.size(); i++) {
+            vmDecodedInst * inst = &code_[tailCalls[i]];
+            size_t caller = functionOf[tailCalls[i]];
+            int32_t words = argWords[inst->target - code_];
+            if (words >= 0 && argWords[caller] >= 0 && words <= argWords[caller]
+                && words <= deadWords[caller]) {
+                inst->opcode = OpCode::fast_tail_call_short;
+                inst->operand1 = words * (int32_t)sizeof(uint32_t);
+            }
+        }
+    }
+
+    int resolveTarget(vmDecodedInst * inst, int64_t targetOffset) {
+        if (targetOffset < 0 || targetOffset >= (int64_t)imageSize_)
+            return Error::Predecode_Illegal_Branch_Target;
+        vmDecodedInst * target = index_[targetOffset];
+        if (target == nullptr)
+            return Error::Predecode_Illegal_Branch_Target;
+        inst->target = target;
+        return Error::Ok;
+    }
+
+    int decodeInst(vmDecodedInst * inst) {
+        const unsigned char * ip = image_ + inst->offset;
+        uint32_t nextOffset = inst->offset + getInstLength(ip);
+
+        inst->handler = nullptr;
+        inst->target = nullptr;
+        inst->opcode = *ip;
+        inst->aux = 0;
+        inst->operand1 = 0;
+        inst->operand2 = 0;
+
+        switch (*ip) {
+        case OpCode::copy_from_eax:
+        case OpCode::inc:
+        case OpCode::dec:
+        case OpCode::add_eax:
+        case OpCode::sub_eax:
+        case OpCode::free:
+            inst->operand1 = readValue<int8_t>(ip + 1);
+            break;
+
+        case OpCode::move:
+        case OpCode::cmp_i32:
+        case OpCode::cmp_u32:
+        case OpCode::add:
+        case OpCode::sub:
+            inst->operand1 = readValue<int8_t>(ip + 1);
+            inst->operand2 = (uint32_t)(int32_t)readValue<int8_t>(ip + 2);
+            if (*ip == OpCode::cmp_i32 || *ip == OpCode::cmp_u32) {
+                // The jump type of the following conditional jump.
+                inst->aux = (nextOffset < imageSize_) ? image_[nextOffset] : 0;
+            }
+            break;
+
+        case OpCode::store:
+        case OpCode::add_imm:
+        case OpCode::sub_imm:
+        case OpCode::alloc:
+            inst->operand1 = readValue<int8_t>(ip + 1);
+            inst->operand2 = readValue<uint32_t>(ip + 2);
+            break;
+
+        case OpCode::cmp_imm_i32:
+        case OpCode::cmp_imm_u32:
+            inst->operand1 = readValue<int8_t>(ip + 1);
+            inst->operand2 = readValue<uint32_t>(ip + 2);
+            inst->aux = (nextOffset < imageSize_) ? image_[nextOffset] : 0;
+            break;
+
+        case OpCode::load_eax:
+        case OpCode::add_eax_imm:
+        case OpCode::sub_eax_imm:
+        case OpCode::ret_eax:
+            inst->operand2 = readValue<uint32_t>(ip + 1);
+            break;
+
+        case OpCode::jl_near:
+        case OpCode::jmp_near:
+            return resolveTarget(inst, (int64_t)nextOffset + readValue<int8_t>(ip + 1));
+
+        case OpCode::jl_short:
+        case OpCode::jmp_short:
+            return resolveTarget(inst, (int64_t)nextOffset + readValue<int16_t>(ip + 1));
+
+        case OpCode::jl_long:
+        case OpCode::jmp_long:
+            return resolveTarget(inst, (int64_t)nextOffset + readValue<int32_t>(ip + 1));
+
+        case OpCode::jmp:
+            return resolveTarget(inst, (int64_t)readValue<uint32_t>(ip + 1));
+
+        case OpCode::call:
+            inst->aux = readValue<uint16_t>(ip + 5);
+            inst->operand2 = nextOffset;
+            return resolveTarget(inst, (int64_t)readValue<uint32_t>(ip + 1));
+
+        case OpCode::call_long:
+            inst->aux = readValue<uint16_t>(ip + 5);
+            inst->operand2 = nextOffset;
+            return resolveTarget(inst, (int64_t)nextOffset + readValue<int32_t>(ip + 1));
+
+        case OpCode::call_short:
+        case OpCode::fast_call_short:
+        case OpCode::fast_tail_call_short:
+            inst->aux = readValue<uint16_t>(ip + 3);
+            inst->operand2 = nextOffset;
+            // A fast_tail_call_short of the bytecode moves all of the frame.
+            if (*ip == OpCode::fast_tail_call_short)
+                inst->operand1 = (int32_t)inst->aux;
+            return resolveTarget(inst, (int64_t)nextOffset + readValue<int16_t>(ip + 1));
+
+        case OpCode::ret_n_sm:
+            inst->aux = readValue<uint8_t>(ip + 1);
+            break;
+
+        case OpCode::ret_n:
+            inst->aux = readValue<uint16_t>(ip + 1);
+            break;
+
+        case OpCode::ret_eax_n:
+            inst->aux = readValue<uint16_t>(ip + 1);
+            inst->operand2 = readValue<uint32_t>(ip + 3);
+            break;
+
+        case OpCode::new_obj: {
+            // The fields, and how many of them are references.
+            uint32_t fields = ip[2];
+            uint32_t refs = (ip[3] < fields) ? ip[3] : fields;
+            inst->operand1 = readValue<int8_t>(ip + 1);
+            inst->operand2 = fields | (refs << 8);
+            break;
+        }
+
+        case OpCode::ld_ref:
+        case OpCode::ld_field:
+            // dst, obj, index
+            inst->operand1 = readValue<int8_t>(ip + 1);
+            inst->operand2 = (uint32_t)(int32_t)readValue<int8_t>(ip + 2);
+            inst->aux = ip[3];
+            break;
+
+        case OpCode::st_ref:
+        case OpCode::st_field:
+            // obj, index, src
+            inst->operand1 = readValue<int8_t>(ip + 1);
+            inst->aux = ip[2];
+            inst->operand2 = (uint32_t)(int32_t)readValue<int8_t>(ip + 3);
+            break;
+
+        default:
+            break;
+        }
+        return Error::Ok;
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_PREDECODER_H
@@ -0,0 +1,448 @@
+
+#ifndef JLANG_VM_PROFILER_H
+#define JLANG_VM_PROFILER_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/vm/SuperInstruction.h"
+#include "jlang/vm/Memoizer.h"
+#include "jlang/lang/Error.h"
+#include "jlang/support/Console.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+namespace jlang {
+
+//
+// Counts exactly what the predecoded interpreter runs:
+//
+//   - the executions and the clock ticks of every opcode, the ticks
+//     from one dispatch to the next are charged to the instruction that
+//     was dispatched first,
+//   - the calls and the inclusive and exclusive ticks of every guest
+//     function, a recursive function's inclusive ticks are only counted
+//     for its outermost call,
+//   - the calls on every caller -> callee edge.
+//
+// Every instruction is dispatched through a counting stub while it's
+// attached, the stream runs at full speed again when it's not. The ticks
+// are the TSC on x86, and nanoseconds on the others.
+//
+class vmExecProfiler {
+public:
+    static const uint32_t kMaxOpcodes = 256;
+
+    struct FunctionStat {
+        uint64_t    calls;
+        uint64_t    inclusive;
+        uint64_t    exclusive;
+        uint32_t    active;
+    };
+
+private:
+    struct Frame {
+        uint32_t    function;
+        uint64_t    enter;
+        uint64_t    children;
+    };
+
+    static const uint32_t kNoFunction = 0xFFFFFFFFU;
+
+    vmDecodedImage *            decoded_;
+    uint64_t                    counts_[kMaxOpcodes];
+    uint64_t                    ticks_[kMaxOpcodes];
+    std::vector<FunctionStat>   functions_;
+    std::map<uint64_t, uint64_t> edges_;
+    std::vector<Frame>          frames_;
+
+    const vmDecodedInst *       pendingCall_;
+    uint32_t                    pendingCaller_;
+    uint32_t                    lastOpcode_;
+    bool                        hasLast_;
+    uint64_t                    lastTime_;
+    uint64_t                    startTime_;
+    uint64_t                    totalTicks_;
+    uint32_t                    runs_;
+
+public:
+    vmExecProfiler() : decoded_(nullptr) {
+        reset();
+    }
+    ~vmExecProfiler() {}
+
+    bool isAttached() const { return (decoded_ != nullptr); }
+
+    void attach(vmDecodedImage * decoded) {
+        decoded_ = decoded;
+        reset();
+    }
+
+    //
+    // Forget all the counters.
+    //
+    void reset() {
+        memset((void *)&counts_[0], 0, sizeof(counts_));
+        memset((void *)&ticks_[0], 0, sizeof(ticks_));
+        FunctionStat empty = { 0, 0, 0, 0 };
+        size_t count = (decoded_ != nullptr && decoded_->isInited()) ? decoded_->size() : 0;
+        functions_.assign(count + 1, empty);
+        edges_.clear();
+        frames_.clear();
+        pendingCall_ = nullptr;
+        pendingCaller_ = kNoFunction;
+        lastOpcode_ = 0;
+        hasLast_ = false;
+        lastTime_ = 0;
+        startTime_ = 0;
+        totalTicks_ = 0;
+        runs_ = 0;
+    }
+
+    static JM_FORCEINLINE uint64_t readClock() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+        return (uint64_t)__rdtsc();
+#else
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static const char * getClockName() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+        return "tsc";
+#else
+        return "ns";
+#endif
+    }
+
+    //
+    // A run starts at the entry function.
+    //
+    void start(const vmDecodedInst * entry) {
+        frames_.clear();
+        pendingCall_ = nullptr;
+        hasLast_ = false;
+        runs_++;
+        startTime_ = readClock();
+        enter(getIndex(entry), kNoFunction, startTime_);
+    }
+
+    //
+    // One instruction is dispatched.
+    //
+    JM_FORCEINLINE void count(const vmDecodedInst * pc) {
+        uint64_t now = readClock();
+        if (likely(hasLast_))
+            ticks_[lastOpcode_] += now - lastTime_;
+        lastOpcode_ = pc->opcode;
+        lastTime_ = now;
+        hasLast_ = true;
+        counts_[pc->opcode]++;
+
+        // A call enters its callee on the next dispatch, a memoized call
+        // that hit goes on from its return site instead.
+        if (pendingCall_ != nullptr) {
+            if (pc == pendingCall_->target)
+                enter(getIndex(pc), pendingCaller_, now);
+            pendingCall_ = nullptr;
+        }
+
+        uint32_t opcode = pc->opcode;
+        if (isCall(opcode)) {
+            pendingCall_ = pc;
+            pendingCaller_ = frames_.empty() ? kNoFunction : frames_.back().function;
+        }
+        else if (opcode == OpCode::fast_tail_call_short) {
+            // The callee takes the caller's place in the call stack.
+            pendingCall_ = pc;
+            pendingCaller_ = frames_.empty() ? kNoFunction : frames_.back().function;
+            leave(now);
+        }
+        else if (isReturn(opcode)) {
+            leave(now);
+        }
+    }
+
+    //
+    // The run is finished, the frames it didn't return from are closed.
+    //
+    void finish() {
+        uint64_t now = readClock();
+        if (hasLast_)
+            ticks_[lastOpcode_] += now - lastTime_;
+        hasLast_ = false;
+        pendingCall_ = nullptr;
+        while (!frames_.empty()) {
+            leave(now);
+        }
+        totalTicks_ += now - startTime_;
+    }
+
+    uint64_t getCount(uint32_t opcode) const { return counts_[opcode & (kMaxOpcodes - 1)]; }
+    uint64_t getTicks(uint32_t opcode) const { return ticks_[opcode & (kMaxOpcodes - 1)]; }
+
+    uint64_t getInstructionCount() const {
+        uint64_t total = 0;
+        for (uint32_t op = 0; op < kMaxOpcodes; op++) {
+            total += counts_[op];
+        }
+        return total;
+    }
+
+    static const char * getOpName(uint32_t opcode) {
+        if (opcode >= vmMemoOp::first && opcode < vmMemoOp::last)
+            return vmMemoOp::getName(opcode);
+        if (opcode >= vmFusedOp::first && opcode < vmFusedOp::last)
+            return vmFusedOp::getName(opcode);
+
+        switch (opcode) {
+        case OpCode::error:                 return "error";
+        case OpCode::load_eax:              return "load_eax";
+        case OpCode::store:                 return "store";
+        case OpCode::move:                  return "move";
+        case OpCode::move_to_eax:           return "move_to_eax";
+        case OpCode::copy_from_eax:         return "copy_from_eax";
+        case OpCode::cmp:                   return "cmp";
+        case OpCode::cmp_i32:               return "cmp_i32";
+        case OpCode::cmp_u32:               return "cmp_u32";
+        case OpCode::cmp_imm_i32:           return "cmp_imm_i32";
+        case OpCode::cmp_imm_u32:           return "cmp_imm_u32";
+        case OpCode::jl:                    return "jl";
+        case OpCode::jl_near:               return "jl_near";
+        case OpCode::jl_short:              return "jl_short";
+        case OpCode::jl_long:               return "jl_long";
+        case OpCode::jmp:                   return "jmp";
+        case OpCode::jmp_near:              return "jmp_near";
+        case OpCode::jmp_short:             return "jmp_short";
+        case OpCode::jmp_long:              return "jmp_long";
+        case OpCode::call:                  return "call";
+        case OpCode::call_short:            return "call_short";
+        case OpCode::call_long:             return "call_long";
+        case OpCode::fast_call_short:       return "fast_call_short";
+        case OpCode::fast_tail_call_short:  return "fast_tail_call_short";
+        case OpCode::ret:                   return "ret";
+        case OpCode::ret_n_sm:              return "ret_n_sm";
+        case OpCode::ret_n:                 return "ret_n";
+        case OpCode::ret_eax:               return "ret_eax";
+        case OpCode::ret_eax_n:             return "ret_eax_n";
+        case OpCode::nop:                   return "nop";
+        case OpCode::nop_n:                 return "nop_n";
+        case OpCode::inc:                   return "inc";
+        case OpCode::dec:                   return "dec";
+        case OpCode::add:                   return "add";
+        case OpCode::add_imm:               return "add_imm";
+        case OpCode::add_eax:               return "add_eax";
+        case OpCode::add_eax_imm:           return "add_eax_imm";
+        case OpCode::sub:                   return "sub";
+        case OpCode::sub_imm:               return "sub_imm";
+        case OpCode::sub_eax:               return "sub_eax";
+        case OpCode::sub_eax_imm:           return "sub_eax_imm";
+        case OpCode::alloc:                 return "alloc";
+        case OpCode::free:                  return "free";
+        case OpCode::new_obj:               return "new_obj";
+        case OpCode::ld_ref:                return "ld_ref";
+        case OpCode::st_ref:                return "st_ref";
+        case OpCode::ld_field:              return "ld_field";
+        case OpCode::st_field:              return "st_field";
+        case OpCode::exit:                  return "exit";
+        default:                            return "unknown";
+        }
+    }
+
+    //
+    // Print the hottest opcodes and the functions.
+    //
+    void dump() const {
+        std::vector<uint32_t> opcodes;
+        getSortedOpcodes(opcodes);
+        console.printf("  profile: %u run(s), %llu instruction(s), %llu %s tick(s)\n",
+                       runs_, (unsigned long long)getInstructionCount(),
+                       (unsigned long long)totalTicks_, getClockName());
+        for (size_t i = 0; i < opcodes.size() && i < 10; i++) {
+            uint32_t op = opcodes[i];
+            console.printf("    %-32s %12llu  %6.2f %%\n", getOpName(op),
+                           (unsigned long long)counts_[op],
+                           (totalTicks_ != 0) ? (100.0 * ticks_[op] / totalTicks_) : 0.0);
+        }
+        const vmDecodedInst * first = (decoded_ != nullptr) ? decoded_->begin() : nullptr;
+        for (size_t i = 0; i < functions_.size(); i++) {
+            const FunctionStat & func = functions_[i];
+            if (func.calls == 0)
+                continue;
+            console.printf("    %08X:  %llu call(s), inclusive %6.2f %%, exclusive %6.2f %%\n",
+                           first[i].offset, (unsigned long long)func.calls,
+                           (totalTicks_ != 0) ? (100.0 * func.inclusive / totalTicks_) : 0.0,
+                           (totalTicks_ != 0) ? (100.0 * func.exclusive / totalTicks_) : 0.0);
+        }
+    }
+
+    //
+    // The report as JSON: the opcodes (hottest first), the functions and
+    // the call edges, the functions are named by their bytecode offsets.
+    //
+    void toJson(std::string & json) const {
+        std::vector<uint32_t> opcodes;
+        getSortedOpcodes(opcodes);
+        const vmDecodedInst * first = (decoded_ != nullptr) ? decoded_->begin() : nullptr;
+
+        json = "{\n";
+        appendf(json, "  \"clock\": \"%s\",\n", getClockName());
+        appendf(json, "  \"runs\": %u,\n", runs_);
+        appendf(json, "  \"instructions\": %llu,\n", (unsigned long long)getInstructionCount());
+        appendf(json, "  \"ticks\": %llu,\n", (unsigned long long)totalTicks_);
+
+        json += "  \"opcodes\": [";
+        for (size_t i = 0; i < opcodes.size(); i++) {
+            uint32_t op = opcodes[i];
+            appendf(json, "%s\n    { \"name\": \"%s\", \"opcode\": %u, \"count\": %llu, \"ticks\": %llu }",
+                    (i == 0) ? "" : ",", getOpName(op), op,
+                    (unsigned long long)counts_[op], (unsigned long long)ticks_[op]);
+        }
+        json += "\n  ],\n";
+
+        json += "  \"functions\": [";
+        bool isFirst = true;
+        for (size_t i = 0; i < functions_.size(); i++) {
+            const FunctionStat & func = functions_[i];
+            if (func.calls == 0)
+                continue;
+            appendf(json, "%s\n    { \"offset\": %u, \"calls\": %llu, \"inclusive\": %llu, \"exclusive\": %llu }",
+                    isFirst ? "" : ",", first[i].offset, (unsigned long long)func.calls,
+                    (unsigned long long)func.inclusive, (unsigned long long)func.exclusive);
+            isFirst = false;
+        }
+        json += "\n  ],\n";
+
+        json += "  \"edges\": [";
+        isFirst = true;
+        for (std::map<uint64_t, uint64_t>::const_iterator iter = edges_.begin();
+             iter != edges_.end(); ++iter) {
+            uint32_t caller = (uint32_t)(iter->first >> 32);
+            uint32_t callee = (uint32_t)(iter->first & 0xFFFFFFFFU);
+            if (caller == kNoFunction)
+                continue;
+            appendf(json, "%s\n    { \"caller\": %u, \"callee\": %u, \"calls\": %llu }",
+                    isFirst ? "" : ",", first[caller].offset, first[callee].offset,
+                    (unsigned long long)iter->second);
+            isFirst = false;
+        }
+        json += "\n  ]\n}\n";
+    }
+
+    //
+    // Write the JSON report to the file, or to stdout if it's nullptr.
+    //
+    int writeReport(const char * filename) const {
+        std::string json;
+        toJson(json);
+        if (filename == nullptr) {
+            fwrite(json.c_str(), 1, json.size(), stdout);
+            return Error::Ok;
+        }
+        FILE * fp = fopen(filename, "wb");
+        if (fp == nullptr)
+            return Error::Profile_Write_Failed;
+        size_t written = fwrite(json.c_str(), 1, json.size(), fp);
+        fclose(fp);
+        return ((written == json.size()) ? Error::Ok : Error::Profile_Write_Failed);
+    }
+
+private:
+    uint32_t getIndex(const vmDecodedInst * inst) const {
+        return (uint32_t)(inst - decoded_->begin());
+    }
+
+    static bool isCall(uint32_t opcode) {
+        return (vmFusedOp::isCall(opcode) || opcode == vmMemoOp::memo_call
+                || opcode == vmMemoOp::memo_fast_call);
+    }
+
+    static bool isReturn(uint32_t opcode) {
+        return (opcode == OpCode::ret || opcode == OpCode::ret_n_sm || opcode == OpCode::ret_n
+                || opcode == OpCode::ret_eax || opcode == OpCode::ret_eax_n
+                || opcode == vmFusedOp::add_eax_ret_n
+                || (opcode >= vmMemoOp::memo_ret && opcode <= vmMemoOp::memo_ret_eax_n));
+    }
+
+    void enter(uint32_t function, uint32_t caller, uint64_t now) {
+        FunctionStat & func = functions_[function];
+        func.calls++;
+        func.active++;
+        edges_[((uint64_t)caller << 32) | function]++;
+
+        Frame frame;
+        frame.function = function;
+        frame.enter = now;
+        frame.children = 0;
+        frames_.push_back(frame);
+    }
+
+    void leave(uint64_t now) {
+        if (frames_.empty())
+            return;
+        Frame frame = frames_.back();
+        frames_.pop_back();
+
+        uint64_t elapsed = now - frame.enter;
+        FunctionStat & func = functions_[frame.function];
+        func.exclusive += elapsed - frame.children;
+        if (--func.active == 0)
+            func.inclusive += elapsed;
+        if (!frames_.empty())
+            frames_.back().children += elapsed;
+    }
+
+    void getSortedOpcodes(std::vector<uint32_t> & opcodes) const {
+        opcodes.clear();
+        for (uint32_t op = 0; op < kMaxOpcodes; op++) {
+            if (counts_[op] != 0)
+                opcodes.push_back(op);
+        }
+        for (size_t i = 1; i < opcodes.size(); i++) {
+            uint32_t op = opcodes[i];
+            size_t j = i;
+            while (j > 0 && ticks_[opcodes[j - 1]] < ticks_[op]) {
+                opcodes[j] = opcodes[j - 1];
+                j--;
+            }
+            opcodes[j] = op;
+        }
+    }
+
+    static void appendf(std::string & str, const char * fmt, ...) {
+        char buf[512];
+        va_list args;
+        va_start(args, fmt);
+        int len = vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        if (len > 0)
+            str.append(buf, ((size_t)len < sizeof(buf)) ? (size_t)len : (sizeof(buf) - 1));
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_PROFILER_H
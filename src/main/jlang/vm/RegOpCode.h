@@ -0,0 +1,216 @@
+
+#ifndef JLANG_VM_REGOPCODE_H
+#define JLANG_VM_REGOPCODE_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+namespace jlang {
+namespace v5 {
+
+//
+// The instructions of the register machine (v5).
+//
+// An instruction is a 32 bit word: [ opcode : 8 | a : 8 | b : 8 | c : 8 ],
+// a, b, c are register numbers of the current window, the immediates and
+// the branch targets (word index in the image) follow in the next words.
+//
+//   mov         rA, rB              rA = rB
+//   movi        rA, imm             rA = imm
+//   add         rA, rB, rC          rA = rB + rC
+//   addi        rA, rB, imm         rA = rB + imm
+//   sub         rA, rB, rC          rA = rB - rC
+//   subi        rA, rB, imm         rA = rB - imm
+//   cmp_br_lt   rA, rB, target      if (rA <  rB) goto target (int32)
+//   cmp_br_ge   rA, rB, target      if (rA >= rB) goto target (int32)
+//   cmp_br_lti  rA, imm, target     if (rA <  imm) goto target (int32)
+//   cmp_br_gei  rA, imm, target     if (rA >= imm) goto target (int32)
+//   jmp         target
+//   call        rA, target          the register window of the callee
+//                                   starts at rA, the arguments are
+//                                   in rA, rA + 1, ...
+//   ret         rA                  return rA, in the rA of the call
+//   reti        imm                 return imm, in the rA of the call
+//   exit                            stop, the result is r0
+//
+// The data memory is an array of 32-bit words the host gives the context
+// (see ExecutionContext::setData()), the vector registers v0 .. v15 are
+// eight 32-bit lanes (see VectorReg.h):
+//
+//   ld          rA, rB              rA = data[rB]
+//   st          rA, rB              data[rB] = rA
+//   vld         vA, rB              vA = data[rB .. rB + 7]
+//   vst         vA, rB              data[rB .. rB + 7] = vA
+//   vsplat      vA, rB              every lane of vA = rB
+//   vadd        vA, vB, vC          vA = vB + vC, by lane
+//   vmul        vA, vB, vC          vA = vB * vC, by lane
+//   vand        vA, vB, vC          vA = vB & vC
+//   vcmp_eq     vA, vB, vC          lane of vA = (vB == vC) ? -1 : 0
+//   vcmp_lt     vA, vB, vC          lane of vA = (vB <  vC) ? -1 : 0 (int32)
+//   vshuf       vA, vB, imm         lane i of vA = lane ((imm >> i * 3) & 7) of vB
+//   vsum        rA, vB              rA = the sum of the lanes of vB
+//
+struct RegOp {
+    enum Type {
+        nop,
+        mov,
+        movi,
+        add,
+        addi,
+        sub,
+        subi,
+        cmp_br_lt,
+        cmp_br_ge,
+        cmp_br_lti,
+        cmp_br_gei,
+        jmp,
+        call,
+        ret,
+        reti,
+        exit,
+        ld,
+        st,
+        vld,
+        vst,
+        vsplat,
+        vadd,
+        vmul,
+        vand,
+        vcmp_eq,
+        vcmp_lt,
+        vshuf,
+        vsum,
+        last
+    };
+
+    // The operands of an instruction, in the order they are written.
+    enum Format {
+        None,       // exit
+        R,          // ret rA
+        I,          // reti imm
+        L,          // jmp target
+        RR,         // mov rA, rB
+        RI,         // movi rA, imm
+        RL,         // call rA, target
+        RRR,        // add rA, rB, rC
+        RRI,        // addi rA, rB, imm
+        RRL,        // cmp_br_lt rA, rB, target
+        RIL,        // cmp_br_lti rA, imm, target
+        VR,         // vld vA, rB
+        VVV,        // vadd vA, vB, vC
+        VVI,        // vshuf vA, vB, imm
+        RV          // vsum rA, vB
+    };
+
+    // The register window of a function.
+    static const uint32_t kMaxRegs = 32;
+
+    static const char * getName(uint32_t op) {
+        static const char * s_names[] = {
+            "nop",
+            "mov",
+            "movi",
+            "add",
+            "addi",
+            "sub",
+            "subi",
+            "cmp_br_lt",
+            "cmp_br_ge",
+            "cmp_br_lti",
+            "cmp_br_gei",
+            "jmp",
+            "call",
+            "ret",
+            "reti",
+            "exit",
+            "ld",
+            "st",
+            "vld",
+            "vst",
+            "vsplat",
+            "vadd",
+            "vmul",
+            "vand",
+            "vcmp_eq",
+            "vcmp_lt",
+            "vshuf",
+            "vsum"
+        };
+        if (op < last)
+            return s_names[op];
+        else
+            return "unknown";
+    }
+
+    static uint32_t getFormat(uint32_t op) {
+        switch (op) {
+        case mov:           return RR;
+        case movi:          return RI;
+        case add:
+        case sub:           return RRR;
+        case addi:
+        case subi:          return RRI;
+        case cmp_br_lt:
+        case cmp_br_ge:     return RRL;
+        case cmp_br_lti:
+        case cmp_br_gei:    return RIL;
+        case jmp:           return L;
+        case call:          return RL;
+        case ret:           return R;
+        case reti:          return I;
+        case ld:
+        case st:            return RR;
+        case vld:
+        case vst:
+        case vsplat:        return VR;
+        case vadd:
+        case vmul:
+        case vand:
+        case vcmp_eq:
+        case vcmp_lt:       return VVV;
+        case vshuf:         return VVI;
+        case vsum:          return RV;
+        default:            return None;
+        }
+    }
+
+    // The number of words of an instruction.
+    static uint32_t getLength(uint32_t op) {
+        switch (getFormat(op)) {
+        case I:
+        case L:
+        case RI:
+        case RL:
+        case RRI:
+        case RRL:
+        case VVI:
+            return 2;
+        case RIL:
+            return 3;
+        default:
+            return 1;
+        }
+    }
+
+    static JM_FORCEINLINE uint32_t encode(uint32_t op, uint32_t a = 0,
+                                          uint32_t b = 0, uint32_t c = 0) {
+        return (op | (a << 8) | (b << 16) | (c << 24));
+    }
+
+    static JM_FORCEINLINE uint32_t getOp(uint32_t inst) { return (inst & 0xFFU); }
+    static JM_FORCEINLINE uint32_t getA(uint32_t inst)  { return ((inst >> 8) & 0xFFU); }
+    static JM_FORCEINLINE uint32_t getB(uint32_t inst)  { return ((inst >> 16) & 0xFFU); }
+    static JM_FORCEINLINE uint32_t getC(uint32_t inst)  { return (inst >> 24); }
+};
+
+} // namespace v5
+} // namespace jlang
+
+#endif // JLANG_VM_REGOPCODE_H
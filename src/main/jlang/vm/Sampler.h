@@ -0,0 +1,301 @@
+
+#ifndef JLANG_VM_SAMPLER_H
+#define JLANG_VM_SAMPLER_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/vm/SuperInstruction.h"
+#include "jlang/vm/Memoizer.h"
+#include "jlang/vm/SymbolTable.h"
+#include "jlang/lang/Error.h"
+#include "jlang/support/Console.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <assert.h>
+
+#if !defined(_WIN32)
+#include <sys/time.h>
+#endif
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+
+namespace jlang {
+
+//
+// A SIGPROF sampler of the guest call stacks.
+//
+// The timer signal only raises a flag, the interpreter tests it at its
+// calls and back edges, and the sample is taken there: the guest frames
+// are walked from the frame pointer and the return IPs that the calls
+// saved. So a sample costs nothing while no signal is pending, and the
+// signal handler doesn't touch the interpreter's state.
+//
+// The stacks are written in the folded format of the flame graph tools,
+// one line per stack, with the functions from the root to the leaf:
+//
+//   main;fibonacci32;fibonacci32:recur_exit 42
+//
+// The names come from the symbol table, the leaf has its label too.
+//
+class vmSampler {
+public:
+    static const uint32_t kDefaultIntervalUsec = 1000;
+    static const size_t   kMaxDepth = 1024;
+
+private:
+    typedef std::vector<uint32_t>           stack_type;
+    typedef std::map<stack_type, uint64_t>  sample_map;
+
+    vmDecodedImage *        decoded_;
+    const vmSymbolTable *   symbols_;
+    std::vector<uint32_t>   functionOf_;
+    sample_map              samples_;
+    stack_type              stack_;
+    uint64_t                sampleCount_;
+    uint64_t                truncated_;
+    bool                    running_;
+
+#if !defined(_WIN32)
+    struct sigaction        oldAction_;
+#endif
+
+public:
+    vmSampler() : decoded_(nullptr), symbols_(nullptr), sampleCount_(0),
+                  truncated_(0), running_(false) {}
+    ~vmSampler() {
+        stop();
+    }
+
+    bool isAttached() const { return (decoded_ != nullptr); }
+    bool isRunning() const { return running_; }
+
+    uint64_t getSampleCount() const { return sampleCount_; }
+
+    //
+    // The flag that the timer raises, process wide as SIGPROF is.
+    //
+    static volatile sig_atomic_t & pendingFlag() {
+        static volatile sig_atomic_t s_pending = 0;
+        return s_pending;
+    }
+
+    static JM_FORCEINLINE bool isPending() {
+        return (pendingFlag() != 0);
+    }
+
+    //
+    // Find the functions of the predecoded stream: the entry and the
+    // call targets, every instruction is in the function before it.
+    //
+    void attach(vmDecodedImage * decoded, const vmSymbolTable * symbols) {
+        decoded_ = decoded;
+        symbols_ = symbols;
+        reset();
+
+        size_t count = decoded->size();
+        std::vector<bool> isEntry(count + 1, false);
+        isEntry[decoded->entry() - decoded->begin()] = true;
+        for (const vmDecodedInst * inst = decoded->begin(); inst != decoded->end(); ++inst) {
+            if ((isCall(inst->opcode) || inst->opcode == OpCode::fast_tail_call_short)
+                && inst->target != nullptr) {
+                isEntry[inst->target - decoded->begin()] = true;
+            }
+        }
+
+        functionOf_.assign(count + 1, 0);
+        uint32_t function = 0;
+        for (size_t i = 0; i <= count; i++) {
+            if (isEntry[i])
+                function = (uint32_t)i;
+            functionOf_[i] = function;
+        }
+    }
+
+    void reset() {
+        samples_.clear();
+        sampleCount_ = 0;
+        truncated_ = 0;
+    }
+
+    //
+    // Start the timer, a sample is asked for every interval of the
+    // process's CPU time.
+    //
+    int start(uint32_t intervalUsec = kDefaultIntervalUsec) {
+#if !defined(_WIN32)
+        if (running_)
+            return Error::Ok;
+
+        struct sigaction action;
+        memset((void *)&action, 0, sizeof(action));
+        action.sa_handler = &vmSampler::onSignal;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGPROF, &action, &oldAction_) != 0)
+            return Error::Sampler_Not_Supported;
+
+        struct itimerval timer;
+        timer.it_interval.tv_sec = intervalUsec / 1000000;
+        timer.it_interval.tv_usec = intervalUsec % 1000000;
+        timer.it_value = timer.it_interval;
+        if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+            sigaction(SIGPROF, &oldAction_, nullptr);
+            return Error::Sampler_Not_Supported;
+        }
+        running_ = true;
+        return Error::Ok;
+#else
+        (void)intervalUsec;
+        return Error::Sampler_Not_Supported;
+#endif
+    }
+
+    void stop() {
+#if !defined(_WIN32)
+        if (!running_)
+            return;
+        struct itimerval timer;
+        memset((void *)&timer, 0, sizeof(timer));
+        setitimer(ITIMER_PROF, &timer, nullptr);
+        sigaction(SIGPROF, &oldAction_, nullptr);
+        pendingFlag() = 0;
+        running_ = false;
+#endif
+    }
+
+    //
+    // Take the sample at pc, fp is the guest frame pointer (forward stack).
+    //
+    JM_NOINLINE void sample(const vmDecodedInst * pc, const unsigned char * fp) {
+        pendingFlag() = 0;
+        if (decoded_ == nullptr)
+            return;
+
+        const vmDecodedInst * first = decoded_->begin();
+        const unsigned char * imageStart = decoded_->getImage();
+        const unsigned char * imageLimit = imageStart + decoded_->getImageSize();
+
+        // Walk from the leaf to the root, the leaf keeps its pc for the label.
+        stack_.clear();
+        stack_.push_back((uint32_t)(pc - first));
+        while (fp != nullptr) {
+            const unsigned char * returnIP = *(const unsigned char * const *)(fp - sizeof(void *));
+            if (returnIP == nullptr)
+                break;
+            if (returnIP <= imageStart || returnIP >= imageLimit
+                || stack_.size() >= kMaxDepth) {
+                truncated_++;
+                break;
+            }
+            // The call is the instruction before its return site, fusion
+            // leaves that slot as it is.
+            const vmDecodedInst * call = decoded_->at(returnIP) - 1;
+            if (isFullCall(call->opcode))
+                fp = *(const unsigned char * const *)(fp - 2 * sizeof(void *));
+            else
+                fp = fp - sizeof(void *) - call->aux;
+            stack_.push_back(functionOf_[call - first]);
+        }
+        std::reverse(stack_.begin(), stack_.end());
+
+        samples_[stack_]++;
+        sampleCount_++;
+    }
+
+    //
+    // Write the folded stacks to the file, or to stdout if it's nullptr.
+    //
+    int writeFolded(const char * filename) const {
+        FILE * fp = stdout;
+        if (filename != nullptr) {
+            fp = fopen(filename, "wb");
+            if (fp == nullptr)
+                return Error::Profile_Write_Failed;
+        }
+        std::string line;
+        for (sample_map::const_iterator iter = samples_.begin(); iter != samples_.end(); ++iter) {
+            const stack_type & stack = iter->first;
+            line.clear();
+            for (size_t i = 0; i < stack.size(); i++) {
+                if (i != 0)
+                    line += ';';
+                // The callers are functions, the leaf is the sampled pc.
+                if (i == stack.size() - 1)
+                    appendName(line, functionOf_[stack[i]], stack[i]);
+                else
+                    appendName(line, stack[i], stack[i]);
+            }
+            fprintf(fp, "%s %llu\n", line.c_str(), (unsigned long long)iter->second);
+        }
+        if (fp != stdout)
+            fclose(fp);
+        return Error::Ok;
+    }
+
+    void dump() const {
+        console.printf("  sampler: %llu sample(s), %u stack(s), %llu truncated\n",
+                       (unsigned long long)sampleCount_, (uint32_t)samples_.size(),
+                       (unsigned long long)truncated_);
+    }
+
+private:
+    static void onSignal(int signum) {
+        (void)signum;
+        pendingFlag() = 1;
+    }
+
+    static bool isCall(uint32_t opcode) {
+        return (vmFusedOp::isCall(opcode) || opcode == vmMemoOp::memo_call
+                || opcode == vmMemoOp::memo_fast_call);
+    }
+
+    // The calls that save the caller's frame pointer, see push_callstack().
+    static bool isFullCall(uint32_t opcode) {
+        return (opcode == OpCode::call || opcode == OpCode::call_short
+                || opcode == OpCode::call_long || opcode == vmMemoOp::memo_call);
+    }
+
+    //
+    // The function's name, and the label of pc if it's not the function's.
+    //
+    void appendName(std::string & line, uint32_t function, uint32_t pc) const {
+        const vmDecodedInst * first = decoded_->begin();
+        uint32_t entryOffset = first[function].offset;
+        const vmSymbolTable::Symbol * symbol = nullptr;
+        if (symbols_ != nullptr)
+            symbol = symbols_->findFunction(entryOffset);
+
+        char buf[32];
+        if (symbol != nullptr && symbol->offset == entryOffset) {
+            line += symbol->name;
+        }
+        else {
+            snprintf(buf, sizeof(buf), "sub_%08X", entryOffset);
+            line += buf;
+        }
+
+        if (pc != function && symbols_ != nullptr) {
+            const vmSymbolTable::Symbol * label = symbols_->findLabel(first[pc].offset);
+            if (label != nullptr && label->offset > entryOffset) {
+                line += ':';
+                line += label->name;
+            }
+        }
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_SAMPLER_H
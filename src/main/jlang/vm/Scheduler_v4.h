@@ -0,0 +1,306 @@
+
+#ifndef JLANG_VM_SCHEDULER_V4_H
+#define JLANG_VM_SCHEDULER_V4_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Interpreter_v4.h"
+#include "jlang/vm/TracePolicy.h"
+#include "jlang/jstd/ChaseLevDeque.h"
+#include "jlang/lang/Error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <system_error>
+
+namespace jlang {
+namespace v4 {
+
+//
+// A guest invocation: the image, the entry's offset and the arguments
+// (args[i] is the callee's argi). The image must be bound already, as
+// vmProcess::create() leaves it.
+//
+struct vmJob {
+    static const uint32_t kMaxArgs = 8;
+
+    vmBinaryFile *  binary;
+    uint32_t        entry;
+    uint32_t        argc;
+    uint32_t        args[kMaxArgs];
+
+    // Set when the job is done.
+    int             error;
+    uintptr_t       result;
+
+    vmJob() : binary(nullptr), entry(0), argc(0), error(Error::Ok), result(0) {}
+
+    void set(vmBinaryFile * _binary, uint32_t _entry, const uint32_t * _args, uint32_t _argc) {
+        assert(_argc <= kMaxArgs);
+        binary = _binary;
+        entry = _entry;
+        argc = (_argc <= kMaxArgs) ? _argc : kMaxArgs;
+        for (uint32_t i = 0; i < argc; i++) {
+            args[i] = _args[i];
+        }
+        error = Error::Ok;
+        result = 0;
+    }
+};
+
+//
+// A fixed pool of workers that run the jobs on their own execution
+// contexts, the contexts are created once and reused for every job.
+//
+// The jobs that are submitted go to a shared queue, a worker takes a
+// batch of them into its own Chase-Lev deque, and the idle workers steal
+// from the other workers' deques. A worker that finds no work spins for
+// a while, and sleeps until more jobs are submitted.
+//
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class vmScheduler {
+public:
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionContext<basic_type, trace_policy>  context_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef vmScheduler<basic_type, trace_policy>       this_type;
+
+    static const size_type kDefaultStackSize = 256 * 1024U;
+    static const uint32_t  kBatchSize = 32;
+    static const uint32_t  kSpinCount = 64;
+
+private:
+    struct Worker {
+        uint32_t                        index;
+        std::thread                     thread;
+        jstd::ChaseLevDeque<vmJob *>    deque;
+        context_type                    context;
+        vmBinaryFile *                  binary;
+        uint32_t                        seed;
+        uint64_t                        executed;
+        uint64_t                        stolen;
+    };
+
+    std::vector<Worker *>       workers_;
+    std::deque<vmJob *>         queue_;
+    std::mutex                  queueMutex_;
+    std::condition_variable     queueCond_;
+    std::atomic<size_t>         queued_;
+    std::atomic<size_t>         pending_;
+    std::mutex                  doneMutex_;
+    std::condition_variable     doneCond_;
+    std::atomic<bool>           stopping_;
+
+public:
+    vmScheduler() : queued_(0), pending_(0), stopping_(false) {}
+    ~vmScheduler() {
+        stop();
+    }
+
+    bool isRunning() const { return !workers_.empty(); }
+    size_t getWorkerCount() const { return workers_.size(); }
+
+    //
+    // Start the workers, each with its own context.
+    //
+    int start(uint32_t workerCount, size_type stackSize = kDefaultStackSize) {
+        if (isRunning())
+            return Error::Ok;
+        if (workerCount == 0)
+            workerCount = 1;
+
+        stopping_.store(false, std::memory_order_relaxed);
+        for (uint32_t i = 0; i < workerCount; i++) {
+            Worker * worker = new Worker();
+            worker->index = i;
+            worker->binary = nullptr;
+            worker->seed = i * 2654435761U + 1;
+            worker->executed = 0;
+            worker->stolen = 0;
+            worker->context.setId(i + 2);
+            worker->context.create(stackSize);
+            workers_.push_back(worker);
+        }
+        for (size_t i = 0; i < workers_.size(); i++) {
+            try {
+                workers_[i]->thread = std::thread(&this_type::workerProc, this, workers_[i]);
+            }
+            catch (const std::system_error &) {
+                stop();
+                return Error::Thread_Start_Failed;
+            }
+        }
+        return Error::Ok;
+    }
+
+    //
+    // Stop the workers when the jobs submitted so far are done.
+    //
+    void stop() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            stopping_.store(true, std::memory_order_release);
+        }
+        queueCond_.notify_all();
+        for (size_t i = 0; i < workers_.size(); i++) {
+            if (workers_[i]->thread.joinable())
+                workers_[i]->thread.join();
+        }
+        for (size_t i = 0; i < workers_.size(); i++) {
+            delete workers_[i];
+        }
+        workers_.clear();
+    }
+
+    void submit(vmJob * job) {
+        submit(&job, 1);
+    }
+
+    void submit(vmJob ** jobs, size_t count) {
+        pending_.fetch_add(count, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(queueMutex_);
+            for (size_t i = 0; i < count; i++) {
+                queue_.push_back(jobs[i]);
+            }
+            queued_.fetch_add(count, std::memory_order_release);
+        }
+        if (count == 1)
+            queueCond_.notify_one();
+        else
+            queueCond_.notify_all();
+    }
+
+    //
+    // Wait until every job submitted so far is done.
+    //
+    void wait() {
+        std::unique_lock<std::mutex> lock(doneMutex_);
+        while (pending_.load(std::memory_order_acquire) != 0) {
+            doneCond_.wait(lock);
+        }
+    }
+
+    uint64_t getExecutedCount() const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < workers_.size(); i++) {
+            total += workers_[i]->executed;
+        }
+        return total;
+    }
+
+    uint64_t getStolenCount() const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < workers_.size(); i++) {
+            total += workers_[i]->stolen;
+        }
+        return total;
+    }
+
+private:
+    void workerProc(Worker * worker) {
+        uint32_t idle = 0;
+        while (true) {
+            vmJob * job;
+            if (worker->deque.pop(job) || takeQueued(worker, job) || steal(worker, job)) {
+                execute(worker, job);
+                idle = 0;
+                continue;
+            }
+            if (stopping_.load(std::memory_order_acquire))
+                break;
+            if (idle < kSpinCount) {
+                idle++;
+                std::this_thread::yield();
+                continue;
+            }
+            // Sleep until there are jobs to take.
+            std::unique_lock<std::mutex> lock(queueMutex_);
+            while (queue_.empty() && !stopping_.load(std::memory_order_relaxed)) {
+                queueCond_.wait(lock);
+            }
+            idle = 0;
+        }
+    }
+
+    //
+    // Take a batch of the submitted jobs, run the first, the others are
+    // in the worker's deque for the thieves.
+    //
+    bool takeQueued(Worker * worker, vmJob *& job) {
+        if (queued_.load(std::memory_order_acquire) == 0)
+            return false;
+        std::lock_guard<std::mutex> lock(queueMutex_);
+        if (queue_.empty())
+            return false;
+        size_t share = queue_.size() / workers_.size();
+        size_t count = (share < 1) ? 1 : ((share > kBatchSize) ? kBatchSize : share);
+        job = queue_.front();
+        queue_.pop_front();
+        for (size_t i = 1; i < count; i++) {
+            worker->deque.push(queue_.front());
+            queue_.pop_front();
+        }
+        queued_.fetch_sub(count, std::memory_order_release);
+        return true;
+    }
+
+    bool steal(Worker * worker, vmJob *& job) {
+        size_t count = workers_.size();
+        if (count <= 1)
+            return false;
+        // Start at a random victim, so the thieves spread out.
+        worker->seed = worker->seed * 1103515245U + 12345U;
+        size_t first = (worker->seed >> 16) % count;
+        for (size_t i = 0; i < count; i++) {
+            Worker * victim = workers_[(first + i) % count];
+            if (victim != worker && victim->deque.steal(job)) {
+                worker->stolen++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void execute(Worker * worker, vmJob * job) {
+        context_type & context = worker->context;
+        if (worker->binary != job->binary) {
+            vmBinaryFile * binary = job->binary;
+            context.setImageInfo(binary->getImagePtr(), binary->getImageSize(),
+                                 binary->getImageEntry());
+            context.setDecodedImage(binary->getDecodedImage());
+            worker->binary = binary;
+        }
+
+        return_type retVal;
+        retVal.setDataType(return_type::Basic);
+        job->error = context.invoke(job->entry, job->args, job->argc, retVal);
+        job->result = retVal.getValue();
+        worker->executed++;
+
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(doneMutex_);
+            doneCond_.notify_all();
+        }
+    }
+};
+
+} // namespace v4
+} // namespace jlang
+
+#endif // JLANG_VM_SCHEDULER_V4_H
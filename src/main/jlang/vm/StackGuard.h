@@ -0,0 +1,156 @@
+
+#ifndef JLANG_VM_STACKGUARD_H
+#define JLANG_VM_STACKGUARD_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+
+#include <atomic>
+#include <mutex>
+
+namespace jlang {
+
+//
+// Turns a fault in the guard region of a guest stack into an error.
+//
+// An executor runs inside a Scope that lists the guards of its stacks.
+// When a push faults in one of them, the SIGSEGV handler jumps back to
+// the scope, and the executor returns Stack_Overflow: the guest frames
+// are dropped, the context can run again. Any other fault is passed on
+// to the handler that was there before.
+//
+// The scopes are per thread. Without signals (Windows) there's no jump,
+// an overflow faults as any bad access does.
+//
+class vmStackGuard {
+public:
+    static const size_t kMaxGuards = 4;
+
+#if !defined(_WIN32)
+    class Scope {
+    public:
+        sigjmp_buf              env;
+        // The address that faulted, set before the jump.
+        const unsigned char *   fault;
+
+    private:
+        const unsigned char *   guards_[kMaxGuards];
+        size_t                  sizes_[kMaxGuards];
+        size_t                  count_;
+        Scope *                 prev_;
+
+        friend class vmStackGuard;
+
+    public:
+        Scope() : fault(nullptr), count_(0) {
+            vmStackGuard::install();
+            prev_ = vmStackGuard::current();
+            vmStackGuard::current() = this;
+        }
+        ~Scope() {
+            vmStackGuard::current() = prev_;
+        }
+
+        template <typename StackTy>
+        void add(const StackTy & stack) {
+            if (stack.hasGuard() && count_ < kMaxGuards) {
+                guards_[count_] = stack.guard();
+                sizes_[count_] = StackTy::kGuardSize;
+                count_++;
+            }
+        }
+
+        bool contains(const unsigned char * addr) const {
+            for (size_t i = 0; i < count_; i++) {
+                if (addr >= guards_[i] && addr < guards_[i] + sizes_[i])
+                    return true;
+            }
+            return false;
+        }
+    };
+#else
+    class Scope {
+    public:
+        template <typename StackTy>
+        void add(const StackTy & stack) {
+            (void)stack;
+        }
+    };
+#endif // !_WIN32
+
+#if !defined(_WIN32)
+    static Scope *& current() {
+        static thread_local Scope * s_current = nullptr;
+        return s_current;
+    }
+
+    //
+    // Install the handler, once per process.
+    //
+    static void install() {
+        static std::atomic<bool> s_installed(false);
+        if (likely(s_installed.load(std::memory_order_acquire)))
+            return;
+        static std::mutex s_mutex;
+        std::lock_guard<std::mutex> lock(s_mutex);
+        if (s_installed.load(std::memory_order_relaxed))
+            return;
+
+        struct sigaction action;
+        memset((void *)&action, 0, sizeof(action));
+        action.sa_sigaction = &vmStackGuard::onSignal;
+        // No defer: the handler jumps out, the signal must not stay blocked.
+        action.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGSEGV, &action, &oldAction(SIGSEGV));
+        sigaction(SIGBUS, &action, &oldAction(SIGBUS));
+        s_installed.store(true, std::memory_order_release);
+    }
+
+private:
+    static struct sigaction & oldAction(int signum) {
+        static struct sigaction s_oldSegv;
+        static struct sigaction s_oldBus;
+        return ((signum == SIGBUS) ? s_oldBus : s_oldSegv);
+    }
+
+    static void onSignal(int signum, siginfo_t * info, void * ucontext) {
+        const unsigned char * addr = (const unsigned char *)info->si_addr;
+        for (Scope * scope = current(); scope != nullptr; scope = scope->prev_) {
+            if (scope->contains(addr)) {
+                // The scopes inside it are left without their destructors.
+                current() = scope;
+                scope->fault = addr;
+                siglongjmp(scope->env, 1);
+            }
+        }
+
+        // Not a guest stack, pass it on.
+        struct sigaction & old = oldAction(signum);
+        if ((old.sa_flags & SA_SIGINFO) != 0 && old.sa_sigaction != nullptr) {
+            old.sa_sigaction(signum, info, ucontext);
+        }
+        else if (old.sa_handler != SIG_DFL && old.sa_handler != SIG_IGN) {
+            old.sa_handler(signum);
+        }
+        else {
+            // The access faults again, and the default action is taken.
+            signal(signum, SIG_DFL);
+        }
+    }
+#endif // !_WIN32
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_STACKGUARD_H
@@ -0,0 +1,465 @@
+
+#ifndef JLANG_VM_STACKMAP_H
+#define JLANG_VM_STACKMAP_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/lang/Error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+#include <unordered_map>
+
+namespace jlang {
+
+//
+// The stack maps of an image that allocates collected objects: at each
+// new_obj, and at each return point of a call, the slots of the frame
+// that hold references. They're built once at load time.
+//
+// A slot is typed by the instruction that wrote it last: new_obj and
+// ld_ref write a reference, store 0 a null, move copies the type, the
+// others write a value. A slot the function didn't write yet holds what
+// the caller put there (Arg), the collector looks it up in the caller's
+// map. After a call, the argument slots have the types the callee left
+// in them, the summary of its returns.
+//
+// A slot that holds a reference on some paths and a value on the others
+// isn't a root. The image is refused if such a slot, or a value, is
+// used as an object, stored in a reference field, or passed to a callee
+// that does either with it.
+//
+class vmStackMaps {
+public:
+    static const uint8_t kRef = 1;
+    static const uint8_t kArg = 2;
+
+    struct Slot {
+        int8_t      index;      // The slot in the frame
+        int8_t      argIndex;   // kArg: the slot of the function's entry it holds
+        uint8_t     kind;
+        uint8_t     reserved;
+    };
+
+    struct Map {
+        uint32_t    first;      // The first of its slots
+        uint16_t    count;
+        uint16_t    callAux;    // The local size of the call, at a return point
+        uint8_t     isFastCall;
+    };
+
+private:
+    // The type of a slot in the analysis.
+    enum {
+        kBottom = 0,
+        kNull,
+        kInt,
+        kObject,
+        kConflict,
+        kArgBase = 0x100
+    };
+
+    static const int    kSlots = 256;
+    static const int    kMinSlot = -128;
+    static const int    kMaxPasses = 64;
+
+    typedef std::vector<int16_t>    State;
+
+    struct Summary {
+        bool                    returns;
+        State                   args;       // The slots -128 .. -1 at the returns
+        std::vector<uint8_t>    refArgs;    // The slots -128 .. -1 it uses as objects
+    };
+
+    std::vector<Slot>       slots_;
+    std::vector<Map>        maps_;
+    std::vector<int32_t>    safepoints_;
+    std::vector<int32_t>    returns_;
+    bool                    usesGc_;
+
+public:
+    vmStackMaps() : usesGc_(false) {}
+    ~vmStackMaps() {}
+
+    // The image has collected objects, the maps are there.
+    bool usesGc() const { return usesGc_; }
+
+    const Map * atSafepoint(uint32_t offset) const {
+        return ((offset < safepoints_.size() && safepoints_[offset] >= 0)
+                ? &maps_[safepoints_[offset]] : nullptr);
+    }
+
+    const Map * atReturn(uint32_t offset) const {
+        return ((offset < returns_.size() && returns_[offset] >= 0)
+                ? &maps_[returns_[offset]] : nullptr);
+    }
+
+    const Slot * getSlots(const Map * map) const {
+        return ((map->count != 0) ? &slots_[map->first] : nullptr);
+    }
+
+    void destroy() {
+        slots_.clear();
+        maps_.clear();
+        safepoints_.clear();
+        returns_.clear();
+        usesGc_ = false;
+    }
+
+    int build(const vmDecodedImage & decoded) {
+        destroy();
+        const vmDecodedInst * code = decoded.begin();
+        size_t count = decoded.size();
+        for (size_t i = 0; i < count; i++) {
+            if (vmDecodedImage::isObjectOp(code[i].opcode))
+                usesGc_ = true;
+        }
+        if (!usesGc_)
+            return Error::Ok;
+
+        // The functions: the entry and the call targets.
+        std::vector<int32_t> functionOf(count + 1, -1);
+        std::vector<size_t> functions;
+        addFunction(functionOf, functions, (size_t)(decoded.entry() - code));
+        for (size_t i = 0; i < count; i++) {
+            if (isCall(code[i].opcode) && code[i].target != nullptr)
+                addFunction(functionOf, functions, (size_t)(code[i].target - code));
+        }
+
+        // The summaries only grow, until none of them changes.
+        Summary none;
+        none.returns = false;
+        none.args.assign(-kMinSlot, (int16_t)kBottom);
+        none.refArgs.assign(-kMinSlot, 0);
+        std::vector<Summary> summaries(functions.size(), none);
+        for (int pass = 0; ; pass++) {
+            if (pass >= kMaxPasses)
+                return Error::StackMap_Bad_Call;
+            bool changed = false;
+            for (size_t f = 0; f < functions.size(); f++) {
+                Summary summary;
+                int ec = analyze(code, count, functions[f], functionOf, summaries,
+                                 summary, nullptr);
+                if (ec != Error::Ok)
+                    return ec;
+                if (summary.returns != summaries[f].returns || summary.args != summaries[f].args
+                    || summary.refArgs != summaries[f].refArgs) {
+                    summaries[f] = summary;
+                    changed = true;
+                }
+            }
+            if (!changed)
+                break;
+        }
+
+        // The last pass keeps the states of the safepoints.
+        std::unordered_map<size_t, State> points;
+        for (size_t f = 0; f < functions.size(); f++) {
+            Summary summary;
+            analyze(code, count, functions[f], functionOf, summaries, summary, &points);
+        }
+
+        size_t imageSize = decoded.getImageSize();
+        safepoints_.assign(imageSize + 1, -1);
+        returns_.assign(imageSize + 1, -1);
+        for (std::unordered_map<size_t, State>::const_iterator it = points.begin();
+             it != points.end(); ++it) {
+            const vmDecodedInst & inst = code[it->first];
+            Map map;
+            map.first = (uint32_t)slots_.size();
+            map.callAux = 0;
+            map.isFastCall = 0;
+            for (int k = 0; k < kSlots; k++) {
+                int16_t type = it->second[k];
+                Slot slot;
+                slot.index = (int8_t)(k + kMinSlot);
+                slot.argIndex = 0;
+                slot.reserved = 0;
+                if (type == kObject) {
+                    slot.kind = kRef;
+                    slots_.push_back(slot);
+                }
+                else if (isArg(type)) {
+                    slot.kind = kArg;
+                    slot.argIndex = argIndexOf(type);
+                    slots_.push_back(slot);
+                }
+            }
+            map.count = (uint16_t)(slots_.size() - map.first);
+            if (inst.opcode == OpCode::new_obj) {
+                safepoints_[inst.offset] = (int32_t)maps_.size();
+            }
+            else {
+                map.callAux = inst.aux;
+                map.isFastCall = (inst.opcode == OpCode::fast_call_short) ? 1 : 0;
+                returns_[inst.operand2] = (int32_t)maps_.size();
+            }
+            maps_.push_back(map);
+        }
+        return Error::Ok;
+    }
+
+private:
+    static bool isCall(uint32_t opcode) {
+        return (opcode == OpCode::call || opcode == OpCode::call_short
+                || opcode == OpCode::call_long || opcode == OpCode::fast_call_short
+                || opcode == OpCode::fast_tail_call_short);
+    }
+
+    static bool isReturn(uint32_t opcode) {
+        return (opcode == OpCode::ret || opcode == OpCode::ret_n_sm || opcode == OpCode::ret_n
+                || opcode == OpCode::ret_eax || opcode == OpCode::ret_eax_n);
+    }
+
+    static bool isJump(uint32_t opcode) {
+        return (opcode == OpCode::jmp || opcode == OpCode::jmp_near
+                || opcode == OpCode::jmp_short || opcode == OpCode::jmp_long);
+    }
+
+    static bool isArg(int16_t type) { return (type >= kArgBase); }
+    static int8_t argIndexOf(int16_t type) { return (int8_t)(uint8_t)(type - kArgBase); }
+    static int16_t argOf(int slot) { return (int16_t)(kArgBase + (uint8_t)(int8_t)slot); }
+
+    // Can the slot be used as an object (a null is checked at run time).
+    static bool canBeRef(int16_t type) {
+        return (type == kObject || type == kNull || isArg(type));
+    }
+
+    // The slot is used as an object, an argument of it must be one in the caller.
+    static bool useRef(int16_t type, std::vector<uint8_t> & refArgs) {
+        if (isArg(type))
+            refArgs[argIndexOf(type) - kMinSlot] = 1;
+        return canBeRef(type);
+    }
+
+    static int16_t merge(int16_t a, int16_t b) {
+        if (a == b || b == kBottom)
+            return a;
+        if (a == kBottom)
+            return b;
+        if (a == kNull && (b == kObject || b == kInt))
+            return b;
+        if (b == kNull && (a == kObject || a == kInt))
+            return a;
+        return kConflict;
+    }
+
+    static bool mergeInto(State & to, const State & from) {
+        bool changed = false;
+        for (size_t k = 0; k < to.size(); k++) {
+            int16_t type = merge(to[k], from[k]);
+            if (type != to[k]) {
+                to[k] = type;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    static void addFunction(std::vector<int32_t> & functionOf, std::vector<size_t> & functions,
+                            size_t index) {
+        if (functionOf[index] < 0) {
+            functionOf[index] = (int32_t)functions.size();
+            functions.push_back(index);
+        }
+    }
+
+    static void propagate(std::unordered_map<size_t, State> & states, std::vector<size_t> & work,
+                          size_t index, const State & state) {
+        std::unordered_map<size_t, State>::iterator it = states.find(index);
+        if (it == states.end()) {
+            states.insert(std::make_pair(index, state));
+            work.push_back(index);
+        }
+        else if (mergeInto(it->second, state)) {
+            work.push_back(index);
+        }
+    }
+
+    //
+    // The caller's frame after the call: the callee's frame starts shift
+    // slots above its own, the callee's slot j is its slot j + shift.
+    //
+    static bool applyCall(State & state, const vmDecodedInst & inst, const Summary & summary,
+                          std::vector<uint8_t> & refArgs) {
+        int hdr = (inst.opcode == OpCode::fast_call_short) ? (int)sizeof(void *)
+                                                            : (int)sizeof(void *) * 2;
+        int localSlots = inst.aux / (int)sizeof(uint32_t);
+        int shift = (inst.aux + hdr) / (int)sizeof(uint32_t);
+        State before = state;
+        for (int j = kMinSlot; j < 0; j++) {
+            if (summary.refArgs[j - kMinSlot] == 0)
+                continue;
+            int from = j + shift;
+            if (from >= localSlots || !useRef(before[from - kMinSlot], refArgs))
+                return false;
+        }
+        if (!summary.returns)
+            return true;
+        for (int k = 0; k < kSlots; k++) {
+            int slot = k + kMinSlot;
+            int calleeSlot = slot - shift;
+            if (slot >= localSlots) {
+                // The frame header, and the callee's frame.
+                state[k] = kInt;
+            }
+            else if (calleeSlot >= kMinSlot) {
+                int16_t type = summary.args[calleeSlot - kMinSlot];
+                if (isArg(type)) {
+                    int from = argIndexOf(type) + shift;
+                    type = (from < localSlots) ? before[from - kMinSlot] : (int16_t)kInt;
+                }
+                state[k] = type;
+            }
+        }
+        return true;
+    }
+
+    int analyze(const vmDecodedInst * code, size_t count, size_t entry,
+                const std::vector<int32_t> & functionOf, const std::vector<Summary> & summaries,
+                Summary & summary, std::unordered_map<size_t, State> * points) {
+        std::unordered_map<size_t, State> states;
+        std::vector<size_t> work;
+        std::vector<uint8_t> refArgs(-kMinSlot, 0);
+
+        State init(kSlots);
+        for (int k = 0; k < kSlots; k++) {
+            int slot = k + kMinSlot;
+            init[k] = (slot < 0) ? argOf(slot) : (int16_t)kInt;
+        }
+        propagate(states, work, entry, init);
+
+        while (!work.empty()) {
+            size_t index = work.back();
+            work.pop_back();
+            State state = states[index];
+            const vmDecodedInst & inst = code[index];
+            int slot1 = inst.operand1 - kMinSlot;
+            int slot2 = (int8_t)inst.operand2 - kMinSlot;
+
+            switch (inst.opcode) {
+            case OpCode::copy_from_eax:
+            case OpCode::inc:
+            case OpCode::dec:
+            case OpCode::add:
+            case OpCode::add_imm:
+            case OpCode::sub:
+            case OpCode::sub_imm:
+            case OpCode::alloc:
+                state[slot1] = kInt;
+                break;
+
+            case OpCode::store:
+                state[slot1] = (inst.operand2 == 0) ? (int16_t)kNull : (int16_t)kInt;
+                break;
+
+            case OpCode::move:
+                state[slot1] = state[slot2];
+                break;
+
+            case OpCode::new_obj:
+                state[slot1] = kObject;
+                break;
+
+            case OpCode::ld_ref:
+            case OpCode::ld_field:
+                if (!useRef(state[slot2], refArgs))
+                    return Error::StackMap_Bad_Reference;
+                state[slot1] = (inst.opcode == OpCode::ld_ref) ? (int16_t)kObject : (int16_t)kInt;
+                break;
+
+            case OpCode::st_ref:
+                if (!useRef(state[slot1], refArgs) || !useRef(state[slot2], refArgs))
+                    return Error::StackMap_Bad_Reference;
+                break;
+
+            case OpCode::st_field:
+                if (!useRef(state[slot1], refArgs))
+                    return Error::StackMap_Bad_Reference;
+                break;
+
+            case OpCode::free:
+                // The collector frees its own objects.
+                if (state[slot1] == kObject || state[slot1] == kConflict)
+                    return Error::StackMap_Bad_Reference;
+                break;
+
+            case OpCode::fast_tail_call_short:
+                return Error::StackMap_Bad_Call;
+
+            case OpCode::call:
+            case OpCode::call_short:
+            case OpCode::call_long:
+            case OpCode::fast_call_short: {
+                if (inst.target == nullptr || (inst.aux % sizeof(uint32_t)) != 0)
+                    return Error::StackMap_Bad_Call;
+                const Summary & callee = summaries[functionOf[inst.target - code]];
+                if (!applyCall(state, inst, callee, refArgs))
+                    return Error::StackMap_Bad_Reference;
+                if (!callee.returns)
+                    continue;
+                break;
+            }
+
+            default:
+                break;
+            }
+
+            if (isReturn(inst.opcode) || inst.opcode == OpCode::exit)
+                continue;
+            if (inst.target != nullptr && !isCall(inst.opcode)) {
+                propagate(states, work, (size_t)(inst.target - code), state);
+                if (isJump(inst.opcode))
+                    continue;
+            }
+            if (index + 1 < count)
+                propagate(states, work, index + 1, state);
+        }
+
+        summary.returns = false;
+        summary.args.assign(-kMinSlot, (int16_t)kBottom);
+        summary.refArgs = refArgs;
+        for (std::unordered_map<size_t, State>::const_iterator it = states.begin();
+             it != states.end(); ++it) {
+            const vmDecodedInst & inst = code[it->first];
+            const State & state = it->second;
+            if (isReturn(inst.opcode)) {
+                summary.returns = true;
+                for (int k = 0; k < -kMinSlot; k++) {
+                    summary.args[k] = merge(summary.args[k], state[k]);
+                }
+            }
+            else if (points != nullptr && (inst.opcode == OpCode::new_obj || isCall(inst.opcode))) {
+                State point = state;
+                if (inst.opcode == OpCode::new_obj) {
+                    // It's written once the object is there.
+                    point[inst.operand1 - kMinSlot] = kInt;
+                }
+                else {
+                    int localSlots = inst.aux / (int)sizeof(uint32_t);
+                    for (int k = 0; k < kSlots; k++) {
+                        if (k + kMinSlot >= localSlots)
+                            point[k] = kInt;
+                    }
+                }
+                std::unordered_map<size_t, State>::iterator found = points->find(it->first);
+                if (found == points->end())
+                    points->insert(std::make_pair(it->first, point));
+                else
+                    mergeInto(found->second, point);
+            }
+        }
+        return Error::Ok;
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_STACKMAP_H
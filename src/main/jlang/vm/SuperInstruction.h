@@ -0,0 +1,379 @@
+
+#ifndef JLANG_VM_SUPERINSTRUCTION_H
+#define JLANG_VM_SUPERINSTRUCTION_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/basic/inttypes.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/support/Console.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <vector>
+
+namespace jlang {
+
+//
+// The fused opcodes only exist in the predecoded instruction stream,
+// they take the unused top of the 256 opcode range.
+//
+class vmFusedOp {
+public:
+    enum Type {
+        first = 0xC0,
+
+        // cmp + jl (compare and branch)
+        cmp_i32_jl = first,
+        cmp_u32_jl,
+        cmp_imm_i32_jl,
+        cmp_imm_u32_jl,
+
+        // dec + fast_call_short
+        dec_fast_call,
+        // move + dec (the same slot)
+        move_dec,
+        // move + dec + fast_call_short
+        move_dec_fast_call,
+        // copy_from_eax + dec
+        copy_from_eax_dec,
+        // copy_from_eax + dec + fast_call_short
+        copy_from_eax_dec_fast_call,
+        // add_eax + ret_n
+        add_eax_ret_n,
+
+        last
+    };
+
+    static const char * getName(uint32_t fusedOp) {
+        static const char * s_names[] = {
+            "cmp_i32 + jl",
+            "cmp_u32 + jl",
+            "cmp_imm_i32 + jl",
+            "cmp_imm_u32 + jl",
+            "dec + fast_call",
+            "move + dec",
+            "move + dec + fast_call",
+            "copy_from_eax + dec",
+            "copy_from_eax + dec + fast_call",
+            "add_eax + ret_n"
+        };
+        if (fusedOp >= first && fusedOp < last)
+            return s_names[fusedOp - first];
+        else
+            return "unknown";
+    }
+
+    // The number of original instructions in a fused instruction.
+    static uint32_t getLength(uint32_t fusedOp) {
+        switch (fusedOp) {
+        case move_dec_fast_call:
+        case copy_from_eax_dec_fast_call:
+            return 3;
+        default:
+            return 2;
+        }
+    }
+
+    static bool isCall(uint32_t opcode) {
+        return (opcode == OpCode::call || opcode == OpCode::call_short
+             || opcode == OpCode::call_long || opcode == OpCode::fast_call_short
+             || opcode == vmFusedOp::dec_fast_call
+             || opcode == vmFusedOp::move_dec_fast_call
+             || opcode == vmFusedOp::copy_from_eax_dec_fast_call);
+    }
+
+    static bool isJumpLess(uint32_t opcode) {
+        return (opcode == OpCode::jl_near || opcode == OpCode::jl_short
+             || opcode == OpCode::jl_long);
+    }
+
+    static uint32_t matchPair(const vmDecodedInst * inst) {
+        const vmDecodedInst * next = inst + 1;
+        switch (inst->opcode) {
+        case OpCode::cmp_i32:
+            return (isJumpLess(next->opcode) ? vmFusedOp::cmp_i32_jl : 0);
+        case OpCode::cmp_u32:
+            return (isJumpLess(next->opcode) ? vmFusedOp::cmp_u32_jl : 0);
+        case OpCode::cmp_imm_i32:
+            return (isJumpLess(next->opcode) ? vmFusedOp::cmp_imm_i32_jl : 0);
+        case OpCode::cmp_imm_u32:
+            return (isJumpLess(next->opcode) ? vmFusedOp::cmp_imm_u32_jl : 0);
+        case OpCode::dec:
+            return ((next->opcode == OpCode::fast_call_short) ? vmFusedOp::dec_fast_call : 0);
+        case OpCode::move:
+            return ((next->opcode == OpCode::dec && next->operand1 == inst->operand1)
+                    ? vmFusedOp::move_dec : 0);
+        case OpCode::copy_from_eax:
+            return ((next->opcode == OpCode::dec) ? vmFusedOp::copy_from_eax_dec : 0);
+        case OpCode::add_eax:
+            return ((next->opcode == OpCode::ret_n) ? vmFusedOp::add_eax_ret_n : 0);
+        default:
+            return 0;
+        }
+    }
+
+    static uint32_t matchTriple(const vmDecodedInst * inst) {
+        uint32_t fusedOp = matchPair(inst);
+        if (inst[2].opcode == OpCode::fast_call_short) {
+            if (fusedOp == vmFusedOp::move_dec)
+                return vmFusedOp::move_dec_fast_call;
+            else if (fusedOp == vmFusedOp::copy_from_eax_dec)
+                return vmFusedOp::copy_from_eax_dec_fast_call;
+        }
+        return 0;
+    }
+
+    //
+    // Merge the operands of the sequence into its first slot, the slots
+    // after it are left as they are.
+    //
+    static void rewrite(vmDecodedInst * inst, uint32_t fusedOp) {
+        const vmDecodedInst * next = inst + 1;
+        switch (fusedOp) {
+        case vmFusedOp::cmp_i32_jl:
+        case vmFusedOp::cmp_u32_jl:
+        case vmFusedOp::cmp_imm_i32_jl:
+        case vmFusedOp::cmp_imm_u32_jl:
+            // The cmp operands, the jl target.
+            inst->target = next->target;
+            break;
+
+        case vmFusedOp::dec_fast_call:
+            // The dec slot, the call target and local size.
+            inst->target = next->target;
+            inst->aux = next->aux;
+            break;
+
+        case vmFusedOp::move_dec:
+            // The move slots (dec is on the destination).
+            break;
+
+        case vmFusedOp::copy_from_eax_dec:
+            // The copy slot, the dec slot.
+            inst->operand2 = (uint32_t)next->operand1;
+            break;
+
+        case vmFusedOp::move_dec_fast_call:
+            inst->target = inst[2].target;
+            inst->aux = inst[2].aux;
+            break;
+
+        case vmFusedOp::copy_from_eax_dec_fast_call:
+            inst->operand2 = (uint32_t)next->operand1;
+            inst->target = inst[2].target;
+            inst->aux = inst[2].aux;
+            break;
+
+        case vmFusedOp::add_eax_ret_n:
+            // The add_eax slot, the ret_n local size.
+            inst->aux = next->aux;
+            break;
+
+        default:
+            assert(false);
+            return;
+        }
+        inst->opcode = (uint16_t)fusedOp;
+    }
+};
+
+static_assert((uint32_t)OpCode::last <= (uint32_t)vmFusedOp::first,
+              "The fused opcodes overlap with the bytecode opcodes.");
+
+//
+// Profiles the adjacent instruction pairs and triples executed in the
+// predecoded stream, then rewrites the hottest sequences into fused
+// instructions (superinstructions).
+//
+// Only the first slot of a sequence is rewritten, the other slots keep
+// their original instructions, so a sequence is never fused when a jump
+// or a return can land in the middle of it.
+//
+class vmSuperInstProfiler {
+public:
+    static const uint32_t kDefaultProfileBudget = 65536;
+    static const uint32_t kMinHotCount = 64;
+
+private:
+    vmDecodedImage *        decoded_;
+    const vmDecodedInst *   last_;
+    const vmDecodedInst *   lastPrev_;
+    uint32_t                budget_;
+    uint32_t                samples_;
+    bool                    profiling_;
+
+    std::vector<uint32_t>   pairCounts_;
+    std::vector<uint32_t>   tripleCounts_;
+
+    struct FusionSite {
+        uint32_t    offset;
+        uint32_t    fusedOp;
+        uint32_t    hotCount;
+    };
+
+    std::vector<FusionSite> sites_;
+    uint32_t                fusedCounts_[vmFusedOp::last - vmFusedOp::first];
+    uint64_t                runCounts_[vmFusedOp::last - vmFusedOp::first];
+
+public:
+    vmSuperInstProfiler(uint32_t profileBudget = kDefaultProfileBudget)
+        : decoded_(nullptr), last_(nullptr), lastPrev_(nullptr),
+          budget_(profileBudget), samples_(0), profiling_(false) {
+        memset((void *)&fusedCounts_[0], 0, sizeof(fusedCounts_));
+        memset((void *)&runCounts_[0], 0, sizeof(runCounts_));
+    }
+    ~vmSuperInstProfiler() {}
+
+    bool isProfiling() const { return profiling_; }
+
+    vmDecodedImage * getDecodedImage() const { return decoded_; }
+
+    void attach(vmDecodedImage * decoded) {
+        decoded_ = decoded;
+        reset();
+    }
+
+    void reset() {
+        last_ = nullptr;
+        lastPrev_ = nullptr;
+        samples_ = 0;
+        sites_.clear();
+        memset((void *)&fusedCounts_[0], 0, sizeof(fusedCounts_));
+        memset((void *)&runCounts_[0], 0, sizeof(runCounts_));
+        if (decoded_ != nullptr && decoded_->isInited()) {
+            pairCounts_.assign(decoded_->size() + 1, 0);
+            tripleCounts_.assign(decoded_->size() + 1, 0);
+            profiling_ = true;
+        }
+        else {
+            pairCounts_.clear();
+            tripleCounts_.clear();
+            profiling_ = false;
+        }
+    }
+
+    //
+    // Record one dispatched instruction, return true when the profile
+    // budget is used up and the stream should be fused.
+    //
+    JM_FORCEINLINE bool sample(const vmDecodedInst * pc) {
+        if (last_ != nullptr && pc == last_ + 1) {
+            size_t index = (size_t)(last_ - decoded_->begin());
+            pairCounts_[index]++;
+            if (lastPrev_ != nullptr && last_ == lastPrev_ + 1) {
+                tripleCounts_[index - 1]++;
+            }
+        }
+        lastPrev_ = last_;
+        last_ = pc;
+        samples_++;
+        return (samples_ >= budget_);
+    }
+
+    //
+    // Record one run of a fused instruction, called by its handler.
+    //
+    JM_FORCEINLINE void countFused(uint32_t fusedOp) {
+        assert(fusedOp >= vmFusedOp::first && fusedOp < vmFusedOp::last);
+        runCounts_[fusedOp - vmFusedOp::first]++;
+    }
+
+    uint64_t getRunCount(uint32_t fusedOp) const {
+        assert(fusedOp >= vmFusedOp::first && fusedOp < vmFusedOp::last);
+        return runCounts_[fusedOp - vmFusedOp::first];
+    }
+
+    //
+    // Rewrite the hot sequences of the decoded stream into fused instructions.
+    //
+    size_t fuse() {
+        profiling_ = false;
+        if (decoded_ == nullptr || !decoded_->isInited())
+            return 0;
+
+        vmDecodedInst * code = decoded_->begin();
+        size_t count = decoded_->size();
+
+        // Mark the instructions a jump, call or return can land on.
+        std::vector<uint8_t> isLabel(count + 1, 0);
+        isLabel[decoded_->entry() - code] = 1;
+        for (size_t i = 0; i < count; i++) {
+            const vmDecodedInst * inst = &code[i];
+            if (inst->target != nullptr)
+                isLabel[inst->target - code] = 1;
+            if (vmFusedOp::isCall(inst->opcode))
+                isLabel[i + 1] = 1;
+        }
+
+        uint32_t hotCount = samples_ / 1024;
+        if (hotCount < kMinHotCount)
+            hotCount = kMinHotCount;
+
+        size_t fused = 0;
+        size_t i = 0;
+        while (i + 1 < count) {
+            uint32_t fusedOp = 0;
+            uint32_t seqCount = 0;
+            if (i + 2 < count && tripleCounts_[i] >= hotCount
+                && !isLabel[i + 1] && !isLabel[i + 2]) {
+                fusedOp = vmFusedOp::matchTriple(&code[i]);
+                seqCount = tripleCounts_[i];
+            }
+            if (fusedOp == 0 && pairCounts_[i] >= hotCount && !isLabel[i + 1]) {
+                fusedOp = vmFusedOp::matchPair(&code[i]);
+                seqCount = pairCounts_[i];
+            }
+            if (fusedOp != 0) {
+                vmFusedOp::rewrite(&code[i], fusedOp);
+                FusionSite site;
+                site.offset = code[i].offset;
+                site.fusedOp = fusedOp;
+                site.hotCount = seqCount;
+                sites_.push_back(site);
+                fusedCounts_[fusedOp - vmFusedOp::first]++;
+                fused++;
+                i += vmFusedOp::getLength(fusedOp);
+            }
+            else {
+                i++;
+            }
+        }
+
+        // The handlers must be bound again.
+        decoded_->unbind();
+        return fused;
+    }
+
+    //
+    // Print which fusions fired, and how many times each fused instruction ran.
+    //
+    void dump() const {
+        console.printf("  superinstructions: %u samples, %u sites fused\n",
+                       samples_, (uint32_t)sites_.size());
+        for (uint32_t op = vmFusedOp::first; op < vmFusedOp::last; op++) {
+            uint32_t fusedCount = fusedCounts_[op - vmFusedOp::first];
+            uint64_t runCount = runCounts_[op - vmFusedOp::first];
+            if (fusedCount != 0 || runCount != 0) {
+                console.printf("    %-34s %u site(s), %" PRIu64 " run(s)\n",
+                               vmFusedOp::getName(op), fusedCount, runCount);
+            }
+        }
+        for (size_t i = 0; i < sites_.size(); i++) {
+            console.printf("    %08X:  %-34s hot = %u\n", sites_[i].offset,
+                           vmFusedOp::getName(sites_[i].fusedOp), sites_[i].hotCount);
+        }
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_SUPERINSTRUCTION_H
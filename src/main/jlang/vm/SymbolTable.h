@@ -0,0 +1,137 @@
+
+#ifndef JLANG_VM_SYMBOLTABLE_H
+#define JLANG_VM_SYMBOLTABLE_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+namespace jlang {
+
+//
+// The function and label names of an image, by their bytecode offsets.
+// A label belongs to the function before it.
+//
+class vmSymbolTable {
+public:
+    struct Symbol {
+        uint32_t    offset;
+        bool        isFunction;
+        std::string name;
+
+        bool operator < (const Symbol & rhs) const {
+            return ((offset < rhs.offset) ||
+                    (offset == rhs.offset && isFunction && !rhs.isFunction));
+        }
+    };
+
+private:
+    std::vector<Symbol> symbols_;
+    bool                sorted_;
+
+public:
+    vmSymbolTable() : sorted_(true) {}
+    ~vmSymbolTable() {}
+
+    bool isEmpty() const { return symbols_.empty(); }
+    size_t size() const { return symbols_.size(); }
+
+    void clear() {
+        symbols_.clear();
+        sorted_ = true;
+    }
+
+    // The symbols in the order of their offsets.
+    const Symbol & operator [] (size_t index) const {
+        sort();
+        return symbols_[index];
+    }
+
+    void addFunction(uint32_t offset, const char * name) {
+        add(offset, true, name);
+    }
+
+    void addLabel(uint32_t offset, const char * name) {
+        add(offset, false, name);
+    }
+
+    //
+    // The function that the offset is in, or nullptr.
+    //
+    const Symbol * findFunction(uint32_t offset) const {
+        const Symbol * symbol = findLast(offset);
+        while (symbol != nullptr) {
+            if (symbol->isFunction)
+                return symbol;
+            symbol = (symbol != &symbols_[0]) ? (symbol - 1) : nullptr;
+        }
+        return nullptr;
+    }
+
+    //
+    // The function of the name, or nullptr.
+    //
+    const Symbol * findFunction(const char * name) const {
+        for (size_t i = 0; i < symbols_.size(); i++) {
+            if (symbols_[i].isFunction && symbols_[i].name == name)
+                return &symbols_[i];
+        }
+        return nullptr;
+    }
+
+    //
+    // The label that the offset is after, in the same function, or nullptr.
+    //
+    const Symbol * findLabel(uint32_t offset) const {
+        const Symbol * symbol = findLast(offset);
+        if (symbol != nullptr && !symbol->isFunction)
+            return symbol;
+        return nullptr;
+    }
+
+private:
+    void add(uint32_t offset, bool isFunction, const char * name) {
+        Symbol symbol;
+        symbol.offset = offset;
+        symbol.isFunction = isFunction;
+        symbol.name = name;
+        if (!symbols_.empty() && symbol < symbols_.back())
+            sorted_ = false;
+        symbols_.push_back(symbol);
+    }
+
+    void sort() const {
+        if (!sorted_) {
+            vmSymbolTable * self = const_cast<vmSymbolTable *>(this);
+            std::stable_sort(self->symbols_.begin(), self->symbols_.end());
+            self->sorted_ = true;
+        }
+    }
+
+    const Symbol * findLast(uint32_t offset) const {
+        sort();
+        // The last symbol at or before the offset.
+        size_t first = 0, last = symbols_.size();
+        while (first < last) {
+            size_t mid = (first + last) / 2;
+            if (symbols_[mid].offset <= offset)
+                first = mid + 1;
+            else
+                last = mid;
+        }
+        return ((first != 0) ? &symbols_[first - 1] : nullptr);
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_SYMBOLTABLE_H
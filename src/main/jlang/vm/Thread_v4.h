@@ -0,0 +1,248 @@
+
+#ifndef JLANG_VM_THREAD_V4_H
+#define JLANG_VM_THREAD_V4_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Interpreter_v4.h"
+#include "jlang/vm/SymbolTable.h"
+#include "jlang/vm/TracePolicy.h"
+#include "jlang/lang/Error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <system_error>
+
+namespace jlang {
+namespace v4 {
+
+//
+// A guest thread: an execution context with its own stacks, run on its
+// own OS thread. The image and its predecoded stream belong to the
+// process and are only read.
+//
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class vmThread {
+public:
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionContext<basic_type, trace_policy>  context_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef vmThread<basic_type, trace_policy>          this_type;
+
+    static const size_type kDefaultStackSize = 2 * 1048576U;
+
+private:
+    context_type            context_;
+    std::thread             thread_;
+    uint32_t                entryOffset_;
+    std::vector<uint32_t>   args_;
+    return_type             result_;
+    int                     error_;
+    std::atomic<bool>       running_;
+
+public:
+    vmThread() : entryOffset_(0), error_(Error::Ok), running_(false) {}
+    ~vmThread() {
+        destroy();
+    }
+
+    bool isInited() const { return context_.isInited(); }
+    bool isRunning() const { return running_.load(std::memory_order_acquire); }
+    bool isJoinable() const { return thread_.joinable(); }
+
+    vmThreadId getId() const { return context_.getId(); }
+
+    context_type & getContext() { return context_; }
+
+    //
+    // Share the process's image, the stacks are the thread's own.
+    //
+    vmThreadId create(vmBinaryFile * binary, vmThreadId id,
+                      size_type stackSize = kDefaultStackSize) {
+        context_.setId(id);
+        context_.setImageInfo(binary->getImagePtr(), binary->getImageSize(),
+                              binary->getImageEntry());
+        context_.setDecodedImage(binary->getDecodedImage());
+        context_.create(stackSize);
+        return (context_.isInited() ? id : 0);
+    }
+
+    void destroy() {
+        join();
+        context_.destroy();
+    }
+
+    void setEntry(uint32_t entryOffset, const uint32_t * args, uint32_t argc) {
+        entryOffset_ = entryOffset;
+        args_.assign(args, args + argc);
+    }
+
+    //
+    // Run the entry on a new OS thread.
+    //
+    int start() {
+        if (!isInited() || thread_.joinable())
+            return Error::Thread_Start_Failed;
+        running_.store(true, std::memory_order_release);
+        try {
+            thread_ = std::thread(&this_type::threadProc, this);
+        }
+        catch (const std::system_error &) {
+            running_.store(false, std::memory_order_release);
+            return Error::Thread_Start_Failed;
+        }
+        return Error::Ok;
+    }
+
+    //
+    // Wait for the entry to return, the result is ready then.
+    //
+    void join() {
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    const return_type & getResult() const { return result_; }
+    int getError() const { return error_; }
+
+private:
+    void threadProc() {
+        result_.setDataType(return_type::Basic);
+        error_ = context_.invoke(entryOffset_, (args_.empty() ? nullptr : &args_[0]),
+                                 (uint32_t)args_.size(), result_);
+        running_.store(false, std::memory_order_release);
+    }
+};
+
+//
+// A guest process: one loaded image, and the threads that run it.
+//
+// The image is loaded and predecoded once, and the stream is bound to
+// the executor before any thread starts, so the threads never write to
+// it. Only the predecoded executor is run on the threads, the tiers and
+// the profilers write to the stream and stay on the main context.
+//
+template <typename BasicType = uintptr_t, typename TracePolicy = vmDefaultTrace>
+class vmProcess {
+public:
+    typedef BasicType                                   basic_type;
+    typedef size_t                                      size_type;
+    typedef TracePolicy                                 trace_policy;
+    typedef ExecutionContext<basic_type, trace_policy>  context_type;
+    typedef vmThread<basic_type, trace_policy>          thread_type;
+    typedef vmReturn<basic_type>                        return_type;
+    typedef vmProcess<basic_type, trace_policy>         this_type;
+
+    static const size_type kDefaultStackSize = 64 * 1024U;
+
+private:
+    vmBinaryFile                binary_;
+    context_type                context_;
+    std::vector<thread_type *>  threads_;
+    vmThreadId                  nextId_;
+
+public:
+    vmProcess() : nextId_(2) {}
+    ~vmProcess() {
+        destroy();
+    }
+
+    bool isInited() const { return context_.isInited(); }
+
+    vmBinaryFile * getBinaryFile() { return &binary_; }
+    const vmSymbolTable * getSymbolTable() const { return binary_.getSymbolTable(); }
+
+    size_t getThreadCount() const { return threads_.size(); }
+    thread_type * getThread(size_t index) const { return threads_[index]; }
+
+    //
+    // Load the image file, or the built-in image when there's no filename.
+    //
+    int create(const char * filename = nullptr) {
+        int ec = (filename != nullptr) ? binary_.loadFromFile(filename)
+                                       : binary_.loadBuiltin();
+        if (ec <= 0) {
+            return Error::BinaryFile_Read_Failed;
+        }
+
+        context_.setImageInfo(binary_.getImagePtr(), binary_.getImageSize(),
+                              binary_.getImageEntry());
+        context_.setDecodedImage(binary_.getDecodedImage());
+        context_.create(kDefaultStackSize);
+        if (!context_.isInited()) {
+            return Error::MainProcess_Create_Failed;
+        }
+
+        return context_.prepare_predecoded();
+    }
+
+    void destroy() {
+        reap();
+        context_.destroy();
+        nextId_ = 2;
+    }
+
+    //
+    // The offset of the function, or -1 if it has no name.
+    //
+    int64_t getFunctionOffset(const char * name) const {
+        const vmSymbolTable::Symbol * symbol = binary_.getSymbolTable()->findFunction(name);
+        return ((symbol != nullptr) ? (int64_t)symbol->offset : -1);
+    }
+
+    //
+    // Start a thread that calls the function at the offset with the
+    // arguments, return nullptr if it can't be started.
+    //
+    thread_type * spawn(uint32_t entryOffset, const uint32_t * args, uint32_t argc,
+                        size_type stackSize = thread_type::kDefaultStackSize) {
+        if (!isInited())
+            return nullptr;
+        thread_type * thread = new thread_type();
+        if (thread->create(&binary_, nextId_, stackSize) == 0) {
+            delete thread;
+            return nullptr;
+        }
+        thread->setEntry(entryOffset, args, argc);
+        if (thread->start() != Error::Ok) {
+            delete thread;
+            return nullptr;
+        }
+        nextId_++;
+        threads_.push_back(thread);
+        return thread;
+    }
+
+    void joinAll() {
+        for (size_t i = 0; i < threads_.size(); i++) {
+            threads_[i]->join();
+        }
+    }
+
+    //
+    // Forget the threads that were joined, their results go with them.
+    //
+    void reap() {
+        joinAll();
+        for (size_t i = 0; i < threads_.size(); i++) {
+            delete threads_[i];
+        }
+        threads_.clear();
+    }
+};
+
+} // namespace v4
+} // namespace jlang
+
+#endif // JLANG_VM_THREAD_V4_H
@@ -0,0 +1,215 @@
+
+#ifndef JLANG_VM_TIERING_H
+#define JLANG_VM_TIERING_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/vm/JitCompiler.h"
+#include "jlang/lang/Error.h"
+#include "jlang/support/Console.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#include <vector>
+
+namespace jlang {
+
+//
+// Decides when the code run by the predecoded interpreter moves up to
+// the native code of the JIT (see JitCompiler.h).
+//
+//   - Every call counts on its target, a function is promoted when its
+//     count crosses the call threshold, then the calls to it are native.
+//   - Every backward jump counts on itself, when a loop crosses the
+//     back-edge threshold, the running frame is continued in native code
+//     from the loop head (on-stack replacement), so a single long call
+//     doesn't have to return to be upgraded.
+//
+// The native code uses the interpreter's frames, no state is converted
+// between the tiers, only the guest fp and eax are handed over.
+//
+class vmTierManager {
+public:
+    enum Tier {
+        Interpreted,
+        Native,
+        // It can't be entered natively, never count it again.
+        Pinned
+    };
+
+    static const uint32_t kDefaultCallThreshold = 1000;
+    static const uint32_t kDefaultBackEdgeThreshold = 10000;
+
+private:
+    vmDecodedImage *            decoded_;
+    vmJitCode *                 jit_;
+    bool                        jitFailed_;
+
+    uint32_t                    callThreshold_;
+    uint32_t                    backEdgeThreshold_;
+
+    std::vector<uint32_t>       callCounts_;
+    std::vector<uint32_t>       backEdgeCounts_;
+    std::vector<uint8_t>        tiers_;
+    std::vector<const void *>   nativeEntries_;
+
+    uint32_t                    promotions_;
+    uint32_t                    osrCount_;
+    uint64_t                    nativeCalls_;
+
+public:
+    vmTierManager(uint32_t callThreshold = kDefaultCallThreshold,
+                  uint32_t backEdgeThreshold = kDefaultBackEdgeThreshold)
+        : decoded_(nullptr), jit_(nullptr), jitFailed_(false),
+          callThreshold_(callThreshold), backEdgeThreshold_(backEdgeThreshold),
+          promotions_(0), osrCount_(0), nativeCalls_(0) {}
+    ~vmTierManager() {}
+
+    bool isAttached() const { return (decoded_ != nullptr && jit_ != nullptr); }
+
+    uint32_t getCallThreshold() const { return callThreshold_; }
+    void setCallThreshold(uint32_t threshold) {
+        callThreshold_ = threshold;
+    }
+
+    uint32_t getBackEdgeThreshold() const { return backEdgeThreshold_; }
+    void setBackEdgeThreshold(uint32_t threshold) {
+        backEdgeThreshold_ = threshold;
+    }
+
+    vmJitCode * getJitCode() const { return jit_; }
+
+    //
+    // The instruction stream the counters are kept for, and the native
+    // code it's promoted to, it's compiled the first time it's needed.
+    //
+    void attach(vmDecodedImage * decoded, vmJitCode * jit) {
+        decoded_ = decoded;
+        jit_ = jit;
+        jitFailed_ = false;
+        reset();
+    }
+
+    //
+    // Forget the counters and the promoted functions, it must be called
+    // when the native code is destroyed.
+    //
+    void reset() {
+        size_t count = (decoded_ != nullptr && decoded_->isInited()) ? decoded_->size() : 0;
+        callCounts_.assign(count + 1, 0);
+        backEdgeCounts_.assign(count + 1, 0);
+        tiers_.assign(count + 1, (uint8_t)Interpreted);
+        nativeEntries_.assign(count + 1, nullptr);
+        promotions_ = 0;
+        osrCount_ = 0;
+        nativeCalls_ = 0;
+    }
+
+    //
+    // A call to the target, return its native entry if the call should
+    // run natively.
+    //
+    JM_FORCEINLINE const void * onCall(const vmDecodedInst * target) {
+        size_t index = (size_t)(target - decoded_->begin());
+        if (likely(tiers_[index] == Native)) {
+            nativeCalls_++;
+            return nativeEntries_[index];
+        }
+        if (tiers_[index] == Interpreted) {
+            if (unlikely(++callCounts_[index] >= callThreshold_)) {
+                if (promote(index)) {
+                    promotions_++;
+                    nativeCalls_++;
+                    return nativeEntries_[index];
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    //
+    // A taken backward jump, return the native entry of its target if
+    // the running frame should be replaced there.
+    //
+    JM_FORCEINLINE const void * onBackEdge(const vmDecodedInst * jump) {
+        size_t index = (size_t)(jump - decoded_->begin());
+        if (tiers_[index] == Pinned)
+            return nullptr;
+        if (likely(++backEdgeCounts_[index] < backEdgeThreshold_))
+            return nullptr;
+
+        backEdgeCounts_[index] = 0;
+        size_t targetIndex = (size_t)(jump->target - decoded_->begin());
+        if (tiers_[targetIndex] == Native || promote(targetIndex)) {
+            osrCount_++;
+            return nativeEntries_[targetIndex];
+        }
+        // The loop head can't be entered, stop counting the jump.
+        tiers_[index] = (uint8_t)Pinned;
+        return nullptr;
+    }
+
+    uint32_t getPromotionCount() const { return promotions_; }
+    uint32_t getOsrCount() const { return osrCount_; }
+    uint64_t getNativeCallCount() const { return nativeCalls_; }
+
+    void dump() const {
+        console.printf("  tiers: call threshold = %u, back-edge threshold = %u%s\n",
+                       callThreshold_, backEdgeThreshold_,
+                       jitFailed_ ? ", the image can't be compiled" : "");
+        console.printf("    %u function(s) promoted, %u on-stack replacement(s), %u native call(s)\n",
+                       promotions_, osrCount_, (uint32_t)nativeCalls_);
+        if (decoded_ == nullptr || !decoded_->isInited())
+            return;
+        const vmDecodedInst * first = decoded_->begin();
+        for (size_t i = 0; i < decoded_->size(); i++) {
+            if (tiers_[i] == Native) {
+                console.printf("    %08X:  native, %u interpreted call(s)\n",
+                               first[i].offset, callCounts_[i]);
+            }
+        }
+    }
+
+private:
+    //
+    // Move the instruction to the native tier, the image is compiled
+    // when the first one is promoted.
+    //
+    bool promote(size_t index) {
+        if (jit_ == nullptr || jitFailed_) {
+            tiers_[index] = (uint8_t)Pinned;
+            return false;
+        }
+        if (!jit_->isCompiled()) {
+            int ec = vmJitCompiler::compile(decoded_->getImage(), decoded_->getImageSize(),
+                                            (size_t)(decoded_->entry()->offset), *jit_);
+            if (ec != Error::Ok) {
+                console.trace("vmTierManager: the image can't be compiled, ec = %d\n", ec);
+                jitFailed_ = true;
+                tiers_[index] = (uint8_t)Pinned;
+                return false;
+            }
+        }
+
+        const void * nativeEntry = jit_->getEntryPoint(decoded_->begin()[index].offset);
+        if (nativeEntry == nullptr) {
+            tiers_[index] = (uint8_t)Pinned;
+            return false;
+        }
+        nativeEntries_[index] = nativeEntry;
+        tiers_[index] = (uint8_t)Native;
+        console.trace("vmTierManager: %08X promoted\n", decoded_->begin()[index].offset);
+        return true;
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_TIERING_H
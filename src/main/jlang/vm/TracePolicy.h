@@ -0,0 +1,68 @@
+
+#ifndef JLANG_VM_TRACEPOLICY_H
+#define JLANG_VM_TRACEPOLICY_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/support/Console.h"
+
+#include <stdarg.h>
+
+namespace jlang {
+
+//
+// The trace output of an execution context is its policy, so a traced
+// and an untraced interpreter can be in the same binary:
+//
+//   vmNoTrace          nothing is traced
+//   vmConsoleTrace     every instruction is traced to the console
+//
+// The trace lines go through VM_TRACE(), which tests the policy's
+// kEnabled constant first, so with vmNoTrace the arguments of a trace
+// line are never evaluated, not even in an unoptimized build.
+//
+struct vmNoTrace {
+    static const bool kEnabled = false;
+
+    static void trace(const char * fmt, ...) {
+        (void)fmt;
+    }
+};
+
+struct vmConsoleTrace {
+    static const bool kEnabled = true;
+
+    static void trace(const char * fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        console.vtrace(fmt, args);
+        va_end(args);
+    }
+};
+
+//
+// The debug build traces by default, as console.trace() did.
+//
+#if USE_DEBUG_PRINT
+typedef vmConsoleTrace  vmDefaultTrace;
+#else
+typedef vmNoTrace       vmDefaultTrace;
+#endif
+
+} // namespace jlang
+
+//
+// Trace a line with the trace_policy of the enclosing context, the
+// arguments are only evaluated when the policy traces.
+//
+#define VM_TRACE(...) \
+    do { \
+        if (trace_policy::kEnabled) { \
+            trace_policy::trace(__VA_ARGS__); \
+        } \
+    } while (0)
+
+#endif // JLANG_VM_TRACEPOLICY_H
@@ -0,0 +1,235 @@
+
+#ifndef JLANG_VM_VECTORREG_H
+#define JLANG_VM_VECTORREG_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <assert.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace jlang {
+
+//
+// A vector register, eight 32-bit lanes (vmRegType::r256).
+//
+struct vmVector {
+    static const uint32_t kLanes = 8;
+
+    union {
+        int32_t     i32[kLanes];
+        uint32_t    u32[kLanes];
+    };
+};
+
+//
+// The vector operations: one AVX2 instruction when the target has it, two
+// SSE halves on the other x86-64 targets, else plain loops. The registers
+// and the memory needn't be aligned. A compare sets the lanes it's true in
+// to all ones, the others to 0.
+//
+struct vmVectorOps {
+    static const uint32_t kLanes = vmVector::kLanes;
+
+#if defined(__AVX2__)
+    static JM_FORCEINLINE __m256i get(const vmVector & v) {
+        return _mm256_loadu_si256((const __m256i *)&v.u32[0]);
+    }
+    static JM_FORCEINLINE void put(vmVector & v, __m256i value) {
+        _mm256_storeu_si256((__m256i *)&v.u32[0], value);
+    }
+
+    static JM_FORCEINLINE void load(vmVector & d, const uint32_t * src) {
+        put(d, _mm256_loadu_si256((const __m256i *)src));
+    }
+    static JM_FORCEINLINE void store(uint32_t * dest, const vmVector & a) {
+        _mm256_storeu_si256((__m256i *)dest, get(a));
+    }
+    static JM_FORCEINLINE void splat(vmVector & d, uint32_t value) {
+        put(d, _mm256_set1_epi32((int)value));
+    }
+
+    static JM_FORCEINLINE void add(vmVector & d, const vmVector & a, const vmVector & b) {
+        put(d, _mm256_add_epi32(get(a), get(b)));
+    }
+    static JM_FORCEINLINE void mul(vmVector & d, const vmVector & a, const vmVector & b) {
+        put(d, _mm256_mullo_epi32(get(a), get(b)));
+    }
+    static JM_FORCEINLINE void and_(vmVector & d, const vmVector & a, const vmVector & b) {
+        put(d, _mm256_and_si256(get(a), get(b)));
+    }
+    static JM_FORCEINLINE void cmp_eq(vmVector & d, const vmVector & a, const vmVector & b) {
+        put(d, _mm256_cmpeq_epi32(get(a), get(b)));
+    }
+    static JM_FORCEINLINE void cmp_lt(vmVector & d, const vmVector & a, const vmVector & b) {
+        put(d, _mm256_cmpgt_epi32(get(b), get(a)));
+    }
+
+    // Lane i of d is lane ((order >> (i * 3)) & 7) of a.
+    static JM_FORCEINLINE void shuffle(vmVector & d, const vmVector & a, uint32_t order) {
+        const __m256i shift = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+        __m256i index = _mm256_srlv_epi32(_mm256_set1_epi32((int)order), shift);
+        put(d, _mm256_permutevar8x32_epi32(get(a), index));
+    }
+
+    static JM_FORCEINLINE uint32_t sum(const vmVector & a) {
+        __m256i v = get(a);
+        __m128i x = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+        x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+        return (uint32_t)_mm_cvtsi128_si32(x);
+    }
+
+#elif defined(__SSE2__) || defined(_M_X64)
+    static JM_FORCEINLINE __m128i get(const vmVector & v, uint32_t half) {
+        return _mm_loadu_si128((const __m128i *)&v.u32[half * 4]);
+    }
+    static JM_FORCEINLINE void put(vmVector & v, uint32_t half, __m128i value) {
+        _mm_storeu_si128((__m128i *)&v.u32[half * 4], value);
+    }
+
+    static JM_FORCEINLINE void load(vmVector & d, const uint32_t * src) {
+        put(d, 0, _mm_loadu_si128((const __m128i *)src));
+        put(d, 1, _mm_loadu_si128((const __m128i *)(src + 4)));
+    }
+    static JM_FORCEINLINE void store(uint32_t * dest, const vmVector & a) {
+        _mm_storeu_si128((__m128i *)dest, get(a, 0));
+        _mm_storeu_si128((__m128i *)(dest + 4), get(a, 1));
+    }
+    static JM_FORCEINLINE void splat(vmVector & d, uint32_t value) {
+        __m128i v = _mm_set1_epi32((int)value);
+        put(d, 0, v);
+        put(d, 1, v);
+    }
+
+#define VM_VECTOR_HALVES(name, expr)                                                    \
+    static JM_FORCEINLINE void name(vmVector & d, const vmVector & a, const vmVector & b) { \
+        for (uint32_t half = 0; half < 2; half++) {                                     \
+            __m128i x = get(a, half), y = get(b, half);                                 \
+            put(d, half, (expr));                                                       \
+        }                                                                               \
+    }
+
+    VM_VECTOR_HALVES(add,       _mm_add_epi32(x, y))
+    VM_VECTOR_HALVES(and_,      _mm_and_si128(x, y))
+    VM_VECTOR_HALVES(cmp_eq,    _mm_cmpeq_epi32(x, y))
+    VM_VECTOR_HALVES(cmp_lt,    _mm_cmplt_epi32(x, y))
+#if defined(__SSE4_1__)
+    VM_VECTOR_HALVES(mul,       _mm_mullo_epi32(x, y))
+#else
+    // SSE2 has no 32-bit low multiply, the even and the odd lanes are two
+    // 32 x 32 -> 64 multiplies.
+    VM_VECTOR_HALVES(mul,       _mm_unpacklo_epi32(
+        _mm_shuffle_epi32(_mm_mul_epu32(x, y), _MM_SHUFFLE(0, 0, 2, 0)),
+        _mm_shuffle_epi32(_mm_mul_epu32(_mm_srli_si128(x, 4), _mm_srli_si128(y, 4)),
+                          _MM_SHUFFLE(0, 0, 2, 0))))
+#endif
+#undef VM_VECTOR_HALVES
+
+    static JM_FORCEINLINE void shuffle(vmVector & d, const vmVector & a, uint32_t order) {
+        vmVector t = a;
+        for (uint32_t i = 0; i < kLanes; i++) {
+            d.u32[i] = t.u32[(order >> (i * 3)) & 7];
+        }
+    }
+
+    static JM_FORCEINLINE uint32_t sum(const vmVector & a) {
+        __m128i x = _mm_add_epi32(get(a, 0), get(a, 1));
+        x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+        x = _mm_add_epi32(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+        return (uint32_t)_mm_cvtsi128_si32(x);
+    }
+
+#else
+    static JM_FORCEINLINE void load(vmVector & d, const uint32_t * src) {
+        memcpy(&d.u32[0], src, sizeof(d.u32));
+    }
+    static JM_FORCEINLINE void store(uint32_t * dest, const vmVector & a) {
+        memcpy(dest, &a.u32[0], sizeof(a.u32));
+    }
+    static JM_FORCEINLINE void splat(vmVector & d, uint32_t value) {
+        for (uint32_t i = 0; i < kLanes; i++) {
+            d.u32[i] = value;
+        }
+    }
+
+#define VM_VECTOR_LANES(name, expr)                                                     \
+    static JM_FORCEINLINE void name(vmVector & d, const vmVector & a, const vmVector & b) { \
+        for (uint32_t i = 0; i < kLanes; i++) {                                         \
+            uint32_t x = a.u32[i], y = b.u32[i];                                        \
+            d.u32[i] = (uint32_t)(expr);                                                \
+        }                                                                               \
+    }
+
+    VM_VECTOR_LANES(add,        x + y)
+    VM_VECTOR_LANES(mul,        x * y)
+    VM_VECTOR_LANES(and_,       x & y)
+    VM_VECTOR_LANES(cmp_eq,     (x == y) ? 0xFFFFFFFFU : 0)
+    VM_VECTOR_LANES(cmp_lt,     ((int32_t)x < (int32_t)y) ? 0xFFFFFFFFU : 0)
+#undef VM_VECTOR_LANES
+
+    static JM_FORCEINLINE void shuffle(vmVector & d, const vmVector & a, uint32_t order) {
+        vmVector t = a;
+        for (uint32_t i = 0; i < kLanes; i++) {
+            d.u32[i] = t.u32[(order >> (i * 3)) & 7];
+        }
+    }
+
+    static JM_FORCEINLINE uint32_t sum(const vmVector & a) {
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < kLanes; i++) {
+            total += a.u32[i];
+        }
+        return total;
+    }
+#endif // __AVX2__
+};
+
+//
+// The vector register file, v0 .. v15. The vector registers aren't in the
+// register windows, a call doesn't save them.
+//
+class vmVectorFile {
+public:
+    static const uint32_t kMaxRegs = 16;
+
+private:
+    vmVector regs_[kMaxRegs];
+
+public:
+    vmVectorFile() {
+        clear();
+    }
+    ~vmVectorFile() {}
+
+    void clear() {
+        memset((void *)&regs_[0], 0, sizeof(regs_));
+    }
+
+    vmVector & operator [] (uint32_t index) {
+        assert(index < kMaxRegs);
+        return regs_[index];
+    }
+
+    const vmVector & operator [] (uint32_t index) const {
+        assert(index < kMaxRegs);
+        return regs_[index];
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_VECTORREG_H
@@ -0,0 +1,258 @@
+
+#ifndef JLANG_VM_VERIFIER_H
+#define JLANG_VM_VERIFIER_H
+
+#if defined(_MSC_VER) && (_MSC_VER >= 1020)
+#pragma once
+#endif
+
+#include "jlang/basic/stddef.h"
+#include "jlang/vm/Interpreter.h"
+#include "jlang/vm/Predecoder.h"
+#include "jlang/lang/Error.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+namespace jlang {
+
+//
+// The load-time verifier of an image, run on its predecoded form. An
+// image it accepts can be run without the image limit check per
+// instruction (see ExecutionContext::execute()).
+//
+// The decoder already put every branch and call target on the start of
+// an instruction. The verifier walks the code each function reaches,
+// from the entry and from every call target, and checks that:
+//
+//   - every opcode is one the executors know,
+//   - the code doesn't fall off the end of the image, the last
+//     instruction of every path is a jump, a return, a tail call or exit,
+//     and a call isn't the last instruction (its return point),
+//   - the stack depth is the same on all paths: the frame a function is
+//     called with (a fast frame of its local size, or a full frame) is
+//     the same at all of its call sites, every instruction is reached
+//     with one frame only, and each return pops the frame it's in,
+//   - the slots are in the frame: not in the frame header (the return
+//     IP and the saved frame pointer), and an argument is in the locals
+//     of every caller. The entry has no caller, it has no arguments.
+//   - a call's locals, the callee's frame header and its highest slot
+//     fit in the guard region of the stack, so a push can't step over it.
+//
+class vmVerifier {
+private:
+    // The frame of an instruction, a fast frame is its local size.
+    enum {
+        kNone = -3,
+        kEntry = -2,
+        kFull = -1
+    };
+
+    static const int kFastHeader = (int)(sizeof(void *) / sizeof(uint32_t));
+    static const int kFullHeader = (int)(sizeof(void *) * 2 / sizeof(uint32_t));
+
+    // The highest slot a function can address, a slot index is an int8.
+    static const int kMaxSlot = 127;
+
+public:
+    static int verify(const vmDecodedImage & decoded) {
+        const vmDecodedInst * code = decoded.begin();
+        size_t count = decoded.size();
+        if (decoded.entry() == nullptr || decoded.entry() == decoded.end())
+            return Error::Verify_Falls_Off_End;
+        size_t entry = (size_t)(decoded.entry() - code);
+
+        // Pass 1: the opcodes, and the frames the call sites push.
+        std::vector<int32_t> frameOf(count, kNone);
+        std::vector<int32_t> lowestOf(count, 0);
+        std::vector<size_t> functions;
+        frameOf[entry] = kEntry;
+        functions.push_back(entry);
+        for (size_t i = 0; i < count; i++) {
+            const vmDecodedInst & inst = code[i];
+            if (!isKnown(inst.opcode))
+                return Error::Verify_Unknown_Opcode;
+            if (!isCall(inst.opcode))
+                continue;
+            if (inst.target == nullptr || inst.target == decoded.end()
+                || (inst.aux % sizeof(uint32_t)) != 0
+                || (size_t)inst.aux + (kFullHeader + kMaxSlot + 1) * sizeof(uint32_t)
+                   >= (size_t)vmStack<uintptr_t>::kGuardSize)
+                return Error::Verify_Bad_Call;
+
+            size_t callee = (size_t)(inst.target - code);
+            int32_t frame = isFastCall(inst.opcode) ? (int32_t)inst.aux : (int32_t)kFull;
+            int header = isFastCall(inst.opcode) ? kFastHeader : kFullHeader;
+            // The callee's slot j is the caller's slot j + shift.
+            int32_t lowest = -(int32_t)(inst.aux / sizeof(uint32_t)) - header;
+            if (frameOf[callee] == kNone) {
+                frameOf[callee] = frame;
+                lowestOf[callee] = lowest;
+                functions.push_back(callee);
+            }
+            else if (frameOf[callee] != frame) {
+                return Error::Verify_Stack_Mismatch;
+            }
+            else if (lowest > lowestOf[callee]) {
+                lowestOf[callee] = lowest;
+            }
+        }
+
+        // Pass 2: the code of each function.
+        std::vector<int32_t> depth(count, kNone);
+        std::vector<uint32_t> seen(count, 0);
+        std::vector<size_t> work;
+        for (size_t f = 0; f < functions.size(); f++) {
+            uint32_t mark = (uint32_t)(f + 1);
+            int32_t frame = frameOf[functions[f]];
+            int header = (frame >= 0) ? kFastHeader : kFullHeader;
+            int32_t lowest = (frame == kEntry) ? 0 : lowestOf[functions[f]];
+
+            work.push_back(functions[f]);
+            while (!work.empty()) {
+                size_t index = work.back();
+                work.pop_back();
+                if (seen[index] == mark)
+                    continue;
+                seen[index] = mark;
+
+                if (depth[index] == kNone)
+                    depth[index] = frame;
+                else if (depth[index] != frame)
+                    return Error::Verify_Stack_Mismatch;
+
+                const vmDecodedInst & inst = code[index];
+                if ((vmDecodedImage::hasSlot1(inst.opcode)
+                     && !isInFrame(inst.operand1, header, lowest))
+                    || (vmDecodedImage::hasSlot2(inst.opcode)
+                        && !isInFrame((int8_t)inst.operand2, header, lowest)))
+                    return Error::Verify_Bad_Slot;
+
+                switch (inst.opcode) {
+                case OpCode::ret:
+                case OpCode::ret_eax:
+                    if (frame != kFull && frame != kEntry)
+                        return Error::Verify_Stack_Mismatch;
+                    continue;
+
+                case OpCode::ret_n_sm:
+                case OpCode::ret_n:
+                case OpCode::ret_eax_n:
+                    // The entry's return IP is null, it's done.
+                    if (frame != (int32_t)inst.aux && frame != kEntry)
+                        return Error::Verify_Stack_Mismatch;
+                    continue;
+
+                case OpCode::fast_tail_call_short:
+                    // The callee returns to this frame's caller.
+                    if (frame != (int32_t)inst.aux)
+                        return Error::Verify_Stack_Mismatch;
+                    continue;
+
+                case OpCode::exit:
+                    continue;
+
+                case OpCode::jmp:
+                case OpCode::jmp_near:
+                case OpCode::jmp_short:
+                case OpCode::jmp_long:
+                    work.push_back((size_t)(inst.target - code));
+                    continue;
+
+                case OpCode::jl_near:
+                case OpCode::jl_short:
+                case OpCode::jl_long:
+                    work.push_back((size_t)(inst.target - code));
+                    break;
+
+                default:
+                    break;
+                }
+
+                // The next instruction, or the return point of a call.
+                if (index + 1 >= count)
+                    return Error::Verify_Falls_Off_End;
+                work.push_back(index + 1);
+            }
+        }
+        return Error::Ok;
+    }
+
+private:
+    static bool isKnown(uint32_t opcode) {
+        switch (opcode) {
+        case OpCode::load_eax:
+        case OpCode::store:
+        case OpCode::move:
+        case OpCode::move_to_eax:
+        case OpCode::copy_from_eax:
+        case OpCode::cmp:
+        case OpCode::cmp_i32:
+        case OpCode::cmp_u32:
+        case OpCode::cmp_imm_i32:
+        case OpCode::cmp_imm_u32:
+        case OpCode::jl:
+        case OpCode::jl_near:
+        case OpCode::jl_short:
+        case OpCode::jl_long:
+        case OpCode::jmp:
+        case OpCode::jmp_near:
+        case OpCode::jmp_short:
+        case OpCode::jmp_long:
+        case OpCode::call:
+        case OpCode::call_short:
+        case OpCode::call_long:
+        case OpCode::fast_call_short:
+        case OpCode::fast_tail_call_short:
+        case OpCode::ret:
+        case OpCode::ret_n_sm:
+        case OpCode::ret_n:
+        case OpCode::ret_eax:
+        case OpCode::ret_eax_n:
+        case OpCode::nop:
+        case OpCode::nop_n:
+        case OpCode::inc:
+        case OpCode::dec:
+        case OpCode::add:
+        case OpCode::add_imm:
+        case OpCode::add_eax:
+        case OpCode::add_eax_imm:
+        case OpCode::sub:
+        case OpCode::sub_imm:
+        case OpCode::sub_eax:
+        case OpCode::sub_eax_imm:
+        case OpCode::alloc:
+        case OpCode::free:
+        case OpCode::new_obj:
+        case OpCode::ld_ref:
+        case OpCode::st_ref:
+        case OpCode::ld_field:
+        case OpCode::st_field:
+        case OpCode::exit:
+            return true;
+
+        default:
+            // error and the unknown opcodes
+            return false;
+        }
+    }
+
+    static bool isCall(uint32_t opcode) {
+        return (opcode == OpCode::call || opcode == OpCode::call_short
+                || opcode == OpCode::call_long || isFastCall(opcode));
+    }
+
+    static bool isFastCall(uint32_t opcode) {
+        return (opcode == OpCode::fast_call_short || opcode == OpCode::fast_tail_call_short);
+    }
+
+    static bool isInFrame(int32_t slot, int header, int32_t lowest) {
+        return (slot >= 0 || (slot < -header && slot >= lowest));
+    }
+};
+
+} // namespace jlang
+
+#endif // JLANG_VM_VERIFIER_H
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include <time.h>
 
 #include <iostream>
@@ -145,8 +146,16 @@ void test_Fibonacci64()
     printf("\n");
 }
 
+//
+// Run fibonacci(n) with one of the run methods of the interpreter. The
+// dump function prints what the mode collected, it gets the error code
+// of the run and the report file.
+//
 template <typename InterpreterTy>
-void test_Interpreter(const std::string & name)
+void test_Interpreter(const std::string & name,
+                      int (InterpreterTy::*run)(vmReturn<> &) = &InterpreterTy::run,
+                      void (*dump)(InterpreterTy &, int, const char *) = nullptr,
+                      const char * reportFile = nullptr)
 {
     printf("--------------------------------------------\n");
     printf("  test_%s()\n", name.c_str());
@@ -178,7 +187,7 @@ void test_Interpreter(const std::string & name)
     int ec = interpreter.create();
 
     sw.start();
-    ec = interpreter.run(retVal);
+    ec = (interpreter.*run)(retVal);
     if (ec >= 0) {
         sw.stop();
         if (retVal.isValid()) {
@@ -190,13 +199,245 @@ void test_Interpreter(const std::string & name)
     double elapsed_time = sw.getElapsedMillisec();
     printf("  elapsed time:  %0.3f ms\n", elapsed_time);
     printf("\n");
+
+    if (dump != nullptr) {
+        dump(interpreter, ec, reportFile);
+    }
+}
+
+template <typename InterpreterTy>
+void dump_SuperInstructions(InterpreterTy & interpreter, int ec, const char * reportFile)
+{
+    interpreter.dumpSuperInstructions();
+    printf("\n");
+}
+
+template <typename InterpreterTy>
+void dump_ExecPlan(InterpreterTy & interpreter, int ec, const char * reportFile)
+{
+    interpreter.dumpExecPlan();
+    printf("\n");
+}
+
+template <typename InterpreterTy>
+void dump_JitCode(InterpreterTy & interpreter, int ec, const char * reportFile)
+{
+    interpreter.dumpJitCode();
+    printf("\n");
 }
 
 template <typename InterpreterTy>
-void test_Interpreter_inline(const std::string & name)
+void dump_Tiers(InterpreterTy & interpreter, int ec, const char * reportFile)
+{
+    interpreter.dumpTiers();
+    printf("\n");
+}
+
+template <typename InterpreterTy>
+void dump_Memoizer(InterpreterTy & interpreter, int ec, const char * reportFile)
+{
+    interpreter.dumpMemoizer();
+    printf("\n");
+}
+
+template <typename InterpreterTy>
+void dump_Profile(InterpreterTy & interpreter, int ec, const char * reportFile)
+{
+    interpreter.dumpProfile();
+    printf("\n");
+
+    ec = interpreter.writeProfile(reportFile);
+    if (ec == Error::Ok) {
+        if (reportFile != nullptr)
+            printf("  profile report: %s\n\n", reportFile);
+    }
+    else {
+        printf("  profile report: can't write to %s\n\n", reportFile);
+    }
+}
+
+template <typename InterpreterTy>
+void dump_Sampler(InterpreterTy & interpreter, int ec, const char * reportFile)
+{
+    if (ec == Error::Sampler_Not_Supported) {
+        printf("  sampler: not supported on this platform\n\n");
+        return;
+    }
+
+    interpreter.dumpSampler();
+    printf("\n");
+
+    ec = interpreter.writeSamples(reportFile);
+    if (ec == Error::Ok) {
+        if (reportFile != nullptr)
+            printf("  folded stacks: %s\n\n", reportFile);
+    }
+    else {
+        printf("  folded stacks: can't write to %s\n\n", reportFile);
+    }
+}
+
+void test_Interpreter_v1()
+{
+    test_Interpreter<v1::Interpreter<>>("Interpreter_v1");
+}
+
+void test_Interpreter_v2()
+{
+    test_Interpreter<v2::Interpreter<>>("Interpreter_v2");
+}
+
+void test_Interpreter_v3()
+{
+    test_Interpreter<v3::Interpreter<>>("Interpreter_v3");
+}
+
+void test_Interpreter_v3_inline()
+{
+    test_Interpreter<v3::Interpreter<>>("Interpreter_v3_inline", &v3::Interpreter<>::run_inline);
+}
+
+void test_Interpreter_v4()
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4");
+}
+
+void test_Interpreter_v4_inline()
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_inline", &v4::Interpreter<>::run_inline);
+}
+
+void test_Interpreter_v4_threaded()
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_threaded", &v4::Interpreter<>::run_threaded);
+}
+
+void test_Interpreter_v4_predecoded()
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_predecoded",
+                                        &v4::Interpreter<>::run_predecoded);
+}
+
+//
+// The same interpreter with every instruction traced, use a small n.
+//
+void test_Interpreter_v4_traced()
+{
+    typedef v4::Interpreter<uintptr_t, vmConsoleTrace> TracedInterpreter;
+    test_Interpreter<TracedInterpreter>("Interpreter_v4_traced", &TracedInterpreter::run_predecoded);
+}
+
+void test_Interpreter_v4_fused()
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_fused", &v4::Interpreter<>::run_fused,
+                                        &dump_SuperInstructions<v4::Interpreter<>>);
+}
+
+void test_Interpreter_v4_specialized()
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_specialized",
+                                        &v4::Interpreter<>::run_specialized,
+                                        &dump_ExecPlan<v4::Interpreter<>>);
+}
+
+void test_Interpreter_v4_jit()
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_jit", &v4::Interpreter<>::run_jit,
+                                        &dump_JitCode<v4::Interpreter<>>);
+}
+
+void test_Interpreter_v4_tiered()
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_tiered", &v4::Interpreter<>::run_tiered,
+                                        &dump_Tiers<v4::Interpreter<>>);
+
+    // fibonacci() has no backward jump, the loop of sum(n) is entered
+    // natively from the interpreter by an on-stack replacement. n is the
+    // caller's var0, slot -4 of the callee.
+    static const uint32_t kSumN = 50000;
+    static const uintptr_t kSum = (uintptr_t)kSumN * (kSumN + 1) / 2;
+    static const unsigned char sumLoop[] = {
+        // 00000000:    store var0, 50000
+        OpCode::store, 0x00, 0x50, 0xC3, 0x00, 0x00,
+        // 00000006:    fast_call 0x00000010, 8; ret_n 8
+        OpCode::fast_call_short, 0x05, 0x00, 0x08, 0x00,
+        OpCode::ret_n, 0x08, 0x00,
+        // 0000000E:    nop; nop;
+        OpCode::nop, OpCode::nop,
+        // 00000010:    load_eax 0
+        OpCode::load_eax, 0x00, 0x00, 0x00, 0x00,
+        // 00000015:    add eax, n; dec n
+        OpCode::add_eax, (unsigned char)-4,
+        OpCode::dec, (unsigned char)-4,
+        // 00000019:    cmp_imm_u32 n, 1; jl_near 0x00000023
+        OpCode::cmp_imm_u32, (unsigned char)-4, 0x01, 0x00, 0x00, 0x00,
+        OpCode::jl_near, 0x02,
+        // 00000021:    jmp_near 0x00000015
+        OpCode::jmp_near, 0xF2,
+        // 00000023:    ret_n 8
+        OpCode::ret_n, 0x08, 0x00,
+        // 00000026:    exit
+        OpCode::exit
+    };
+
+    v4::vmBinaryFile binary;
+    int ec = binary.loadFromMemory(sumLoop, sizeof(sumLoop), 0);
+    if (ec <= 0) {
+        printf("  sum(%u): load failed, ec = %d (failed)\n\n", kSumN, ec);
+        return;
+    }
+
+    v4::ExecutionContext<> context;
+    context.setImageInfo(binary.getImagePtr(), binary.getImageSize(),
+                         binary.getImageEntry());
+    context.setDecodedImage(binary.getDecodedImage());
+    context.create(v4::vmContextPool<>::kDefaultStackSize);
+#if USE_FORWARD_STACK_PTR
+    context.setTierManager(binary.getTierManager());
+
+    vmReturn<> retVal;
+    ec = context.run_tiered(retVal);
+    uint32_t osrCount = binary.getTierManager()->getOsrCount();
+    printf("  sum(%u) = %" PRIuPTR ", ec = %d, %u on-stack replacement(s)%s\n\n",
+           kSumN, retVal.getValue(), ec, osrCount,
+           ((ec == Error::Ok && retVal.getValue() == kSum && osrCount > 0) ? "" : " (failed)"));
+#endif
+}
+
+void test_Interpreter_v4_memoized()
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_memoized", &v4::Interpreter<>::run_memoized,
+                                        &dump_Memoizer<v4::Interpreter<>>);
+}
+
+//
+// The predecoded interpreter with every instruction counted, the JSON
+// report goes to the file, or to stdout if there's none.
+//
+void test_Interpreter_v4_profiled(const char * reportFile)
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_profiled", &v4::Interpreter<>::run_profiled,
+                                        &dump_Profile<v4::Interpreter<>>, reportFile);
+}
+
+//
+// The predecoded interpreter with the guest call stacks sampled, the
+// folded stacks go to the file, or to stdout if there's none.
+//
+void test_Interpreter_v4_sampled(const char * reportFile)
+{
+    test_Interpreter<v4::Interpreter<>>("Interpreter_v4_sampled", &v4::Interpreter<>::run_sampled,
+                                        &dump_Sampler<v4::Interpreter<>>, reportFile);
+}
+
+//
+// N concurrent fibonacci(n) runs on the threads of one v4 process, the
+// image is shared by all of them.
+//
+void test_Interpreter_v4_threads()
 {
     printf("--------------------------------------------\n");
-    printf("  test_%s()\n", name.c_str());
+    printf("  test_Interpreter_v4_threads()\n");
     printf("--------------------------------------------\n\n");
 
     uint32_t n = 1;
@@ -215,58 +456,1275 @@ void test_Interpreter_inline(const std::string & name)
     // Run the code in a loop for a while, to warm up the CPU.
     cpu_warmup(kWarmupMillsecs);
 
+    v4::vmProcess<> process;
+    int ec = process.create();
+    int64_t entry = process.getFunctionOffset("fibonacci32");
+    if (ec != Error::Ok || entry < 0) {
+        printf("  vmProcess: create failed.\n\n");
+        return;
+    }
+
+    // fibonacci32(n) reads its n from args.1.
+    uint32_t args[2] = { 0, n };
+
+    uint32_t cores = std::thread::hardware_concurrency();
+    if (cores == 0)
+        cores = 1;
+    printf("  fibonacci(%u), %u hardware thread(s)\n\n", n, cores);
+
+    double baseRate = 0.0;
+    for (uint32_t threads = 1; threads <= cores * 2; threads *= 2) {
+        StopWatch sw;
+        sw.start();
+        for (uint32_t i = 0; i < threads; i++) {
+            process.spawn((uint32_t)entry, args, 2);
+        }
+        process.joinAll();
+        sw.stop();
+
+        uintptr_t result = 0;
+        bool agreed = (process.getThreadCount() == threads);
+        for (size_t i = 0; i < process.getThreadCount(); i++) {
+            const v4::vmThread<> * thread = process.getThread(i);
+            if (thread->getError() < 0 || !thread->getResult().isValid())
+                agreed = false;
+            else if (i == 0)
+                result = thread->getResult().getValue();
+            else if (thread->getResult().getValue() != result)
+                agreed = false;
+        }
+        process.reap();
+
+        double elapsed_time = sw.getElapsedMillisec();
+        double rate = (elapsed_time > 0.0) ? (threads * 1000.0 / elapsed_time) : 0.0;
+        if (threads == 1)
+            baseRate = rate;
+        printf("  threads = %-3u  fibonacci(%u) = %" PRIuPTR "%s  elapsed time: %9.3f ms"
+               "  runs/sec: %8.2f  speedup: %5.2f\n",
+               threads, n, result, (agreed ? "" : " (mismatch)"), elapsed_time,
+               rate, (baseRate > 0.0) ? (rate / baseRate) : 0.0);
+    }
+    printf("\n");
+}
+
+//
+// Short fibonacci(n) jobs on the work-stealing scheduler, against an
+// ExecutionEngine created for every job.
+//
+void test_Interpreter_v4_scheduler()
+{
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_scheduler()\n");
+    printf("--------------------------------------------\n\n");
+
+    static const uint32_t kJobN = 12;
+    static const uint32_t kJobCount = 20000;
+    static const uint32_t kEngineJobCount = 100;
+
+    v4::vmProcess<> process;
+    int ec = process.create();
+    int64_t entry = process.getFunctionOffset("fibonacci32");
+    if (ec != Error::Ok || entry < 0) {
+        printf("  vmProcess: create failed.\n\n");
+        return;
+    }
+
+    // fibonacci32(n) reads its n from args.1.
+    uint32_t args[2] = { 0, kJobN };
+    std::vector<v4::vmJob> jobs(kJobCount);
+    std::vector<v4::vmJob *> jobPtrs(kJobCount);
+    for (uint32_t i = 0; i < kJobCount; i++) {
+        jobs[i].set(process.getBinaryFile(), (uint32_t)entry, args, 2);
+        jobPtrs[i] = &jobs[i];
+    }
+
+    uint32_t cores = std::thread::hardware_concurrency();
+    if (cores == 0)
+        cores = 1;
+    printf("  %u x fibonacci(%u), %u hardware thread(s)\n\n", kJobCount, kJobN, cores);
+
+    // One engine per job, it loads, predecodes and allocates every time.
     StopWatch sw;
+    uintptr_t expected = 0;
+    sw.start();
+    for (uint32_t i = 0; i < kEngineJobCount; i++) {
+        v4::Interpreter<> interpreter;
+        vmReturn<> retVal;
+        retVal.setDataType(vmReturn<>::Basic);
+        retVal.setValue(kJobN);
+        interpreter.create();
+        interpreter.run_predecoded(retVal);
+        expected = retVal.getValue();
+    }
+    sw.stop();
+    double elapsed_time = sw.getElapsedMillisec();
+    printf("  engine per job:  jobs = %-6u  elapsed time: %9.3f ms  jobs/sec: %10.0f\n",
+           kEngineJobCount, elapsed_time,
+           (elapsed_time > 0.0) ? (kEngineJobCount * 1000.0 / elapsed_time) : 0.0);
 
-    InterpreterTy interpreter;
+    double baseRate = 0.0;
+    for (uint32_t threads = 1; threads <= cores * 2; threads *= 2) {
+        v4::vmScheduler<> scheduler;
+        scheduler.start(threads);
+
+        sw.start();
+        scheduler.submit(&jobPtrs[0], kJobCount);
+        scheduler.wait();
+        sw.stop();
+
+        bool agreed = true;
+        for (uint32_t i = 0; i < kJobCount; i++) {
+            if (jobs[i].error < 0 || jobs[i].result != expected)
+                agreed = false;
+        }
+        uint64_t stolen = scheduler.getStolenCount();
+        scheduler.stop();
+
+        elapsed_time = sw.getElapsedMillisec();
+        double rate = (elapsed_time > 0.0) ? (kJobCount * 1000.0 / elapsed_time) : 0.0;
+        if (threads == 1)
+            baseRate = rate;
+        printf("  workers = %-3u   jobs = %-6u  elapsed time: %9.3f ms  jobs/sec: %10.0f"
+               "  speedup: %5.2f  stolen: %" PRIu64 "%s\n",
+               threads, kJobCount, elapsed_time, rate,
+               (baseRate > 0.0) ? (rate / baseRate) : 0.0, stolen,
+               (agreed ? "" : " (mismatch)"));
+    }
+    printf("\n");
+}
+
+void test_Interpreter_v4_fibers()
+{
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_fibers()\n");
+    printf("--------------------------------------------\n\n");
+
+    static const uint32_t kShortN = 12;
+    static const uint32_t kLongN = 30;
+    static const uint32_t kFiberCount = 2000;
+
+    v4::vmProcess<> process;
+    int ec = process.create();
+    int64_t entry = process.getFunctionOffset("fibonacci32");
+    if (ec != Error::Ok || entry < 0) {
+        printf("  vmProcess: create failed.\n\n");
+        return;
+    }
+
+    uintptr_t expected[2];
+    uint32_t n[2] = { kShortN, kLongN };
+    for (uint32_t i = 0; i < 2; i++) {
+        v4::Interpreter<> interpreter;
+        vmReturn<> retVal;
+        retVal.setDataType(vmReturn<>::Basic);
+        retVal.setValue(n[i]);
+        interpreter.create();
+        interpreter.run_predecoded(retVal);
+        expected[i] = retVal.getValue();
+    }
+
+    printf("  1 x fibonacci(%u) + %u x fibonacci(%u), one OS thread\n\n",
+           kLongN, kFiberCount, kShortN);
+
+    struct Config {
+        uint32_t    mode;
+        int64_t     budget;
+        const char * name;
+    };
+    static const Config configs[] = {
+        { v4::vmSliceMode::Instructions, 1000,       "instructions" },
+        { v4::vmSliceMode::Instructions, 100000,     "instructions" },
+        { v4::vmSliceMode::BackEdges,    100,        "back edges  " },
+        { v4::vmSliceMode::Instructions, INT64_MAX,  "unlimited   " }
+    };
+
+    StopWatch sw;
+    for (size_t c = 0; c < sizeof(configs) / sizeof(configs[0]); c++) {
+        v4::vmFiberScheduler<> scheduler;
+        scheduler.create(process.getBinaryFile(), configs[c].mode, configs[c].budget);
+
+        // fibonacci32(n) reads its n from args.1, the long one goes first.
+        uint32_t args[2] = { 0, kLongN };
+        v4::vmFiber<> * longFiber = scheduler.spawn((uint32_t)entry, args, 2);
+        args[1] = kShortN;
+        for (uint32_t i = 0; i < kFiberCount; i++) {
+            scheduler.spawn((uint32_t)entry, args, 2);
+        }
+
+        // The switches after which the short fibers and the long one are done.
+        uint64_t shortDone = 0, longDone = 0;
+        sw.start();
+        while (scheduler.runOnce()) {
+            if (longDone == 0 && longFiber->isDone())
+                longDone = scheduler.getSwitchCount();
+            if (shortDone == 0 && scheduler.getReadyCount() <= (longDone == 0 ? 1U : 0U))
+                shortDone = scheduler.getSwitchCount();
+        }
+        sw.stop();
+
+        bool agreed = (longFiber->getResult() == expected[1]);
+        for (size_t i = 1; i < scheduler.getFiberCount(); i++) {
+            v4::vmFiber<> * fiber = scheduler.getFiber(i);
+            if (fiber->getError() != Error::Ok || fiber->getResult() != expected[0])
+                agreed = false;
+        }
+
+        double elapsed_time = sw.getElapsedMillisec();
+        uint64_t switches = scheduler.getSwitchCount();
+        char budget[32];
+        if (configs[c].budget == INT64_MAX)
+            snprintf(budget, sizeof(budget), "-");
+        else
+            snprintf(budget, sizeof(budget), "%" PRId64, configs[c].budget);
+        printf("  %s budget = %-7s  elapsed time: %9.3f ms  switches: %-8" PRIu64
+               "  done at switch: short %-8" PRIu64 " long %-8" PRIu64 "%s\n",
+               configs[c].name, budget, elapsed_time, switches,
+               (shortDone != 0) ? shortDone : switches, longDone,
+               (agreed ? "" : " (mismatch)"));
+    }
+    printf("\n");
+}
+
+void test_Interpreter_v4_pool()
+{
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_pool()\n");
+    printf("--------------------------------------------\n\n");
+
+    static const uint32_t kRunN = 12;
+    static const uint32_t kEngineRunCount = 100;
+    static const uint32_t kFreshRunCount = 2000;
+    static const uint32_t kPoolRunCount = 20000;
+
+    v4::vmProcess<> process;
+    int ec = process.create();
+    int64_t entry = process.getFunctionOffset("fibonacci32");
+    if (ec != Error::Ok || entry < 0) {
+        printf("  vmProcess: create failed.\n\n");
+        return;
+    }
+    v4::vmBinaryFile * binary = process.getBinaryFile();
+
+    // fibonacci32(n) reads its n from args.1.
+    uint32_t args[2] = { 0, kRunN };
+    printf("  fibonacci(%u) per run\n\n", kRunN);
+
+    // One engine per run, it loads, predecodes and maps the stacks every time.
+    StopWatch sw;
+    uintptr_t expected = 0;
+    sw.start();
+    for (uint32_t i = 0; i < kEngineRunCount; i++) {
+        v4::Interpreter<> interpreter;
+        vmReturn<> retVal;
+        retVal.setDataType(vmReturn<>::Basic);
+        retVal.setValue(kRunN);
+        interpreter.create();
+        interpreter.run_predecoded(retVal);
+        expected = retVal.getValue();
+    }
+    sw.stop();
+    double elapsed_time = sw.getElapsedMillisec();
+    printf("  engine per run:   runs = %-6u  elapsed time: %9.3f ms  us/run: %8.2f\n",
+           kEngineRunCount, elapsed_time, elapsed_time * 1000.0 / kEngineRunCount);
+
+    // One new context per run, on the shared image.
+    bool agreed = true;
+    sw.start();
+    for (uint32_t i = 0; i < kFreshRunCount; i++) {
+        v4::ExecutionContext<> context;
+        context.setImageInfo(binary->getImagePtr(), binary->getImageSize(),
+                             binary->getImageEntry());
+        context.setDecodedImage(binary->getDecodedImage());
+        context.create(v4::vmContextPool<>::kDefaultStackSize);
+        vmReturn<> retVal;
+        context.invoke((uint32_t)entry, args, 2, retVal);
+        if (retVal.getValue() != expected)
+            agreed = false;
+    }
+    sw.stop();
+    elapsed_time = sw.getElapsedMillisec();
+    printf("  context per run:  runs = %-6u  elapsed time: %9.3f ms  us/run: %8.2f%s\n",
+           kFreshRunCount, elapsed_time, elapsed_time * 1000.0 / kFreshRunCount,
+           (agreed ? "" : " (mismatch)"));
+
+    uint32_t cores = std::thread::hardware_concurrency();
+    if (cores == 0)
+        cores = 1;
+    for (uint32_t threads = 1; threads <= cores * 2; threads *= 2) {
+        v4::vmContextPool<> pool;
+        pool.create(binary);
+
+        std::atomic<bool> allAgreed(true);
+        std::vector<std::thread> workers;
+        sw.start();
+        for (uint32_t t = 0; t < threads; t++) {
+            workers.push_back(std::thread([&pool, &allAgreed, entry, &args, expected, threads]() {
+                for (uint32_t i = 0; i < kPoolRunCount / threads; i++) {
+                    vmReturn<> retVal;
+                    pool.invoke((uint32_t)entry, args, 2, retVal);
+                    if (retVal.getValue() != expected)
+                        allAgreed.store(false);
+                }
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); t++) {
+            workers[t].join();
+        }
+        sw.stop();
+
+        elapsed_time = sw.getElapsedMillisec();
+        printf("  pool, threads = %-2u runs = %-6u  elapsed time: %9.3f ms  us/run: %8.2f"
+               "  contexts: %" PRIu64 "%s\n",
+               threads, kPoolRunCount, elapsed_time, elapsed_time * 1000.0 / kPoolRunCount,
+               pool.getCreatedCount(), (allAgreed.load() ? "" : " (mismatch)"));
+    }
+    printf("\n");
+}
+
+void test_Interpreter_v4_heap()
+{
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_heap()\n");
+    printf("--------------------------------------------\n\n");
+
+    static const uint32_t kLoopCount = 1000000;
+    static const uint32_t kAllocsPerLoop = 3;
+    static const uint32_t kHeapLoopEntry = 0x00000010;
+
+    v4::vmBinaryFile binary;
+    int ec = binary.loadFromMemory(&v4::heapLoopBinary32[0], sizeof(v4::heapLoopBinary32), 0);
+    if (ec <= 0) {
+        printf("  vmBinaryFile: load failed.\n\n");
+        return;
+    }
+
+    v4::ExecutionContext<> context;
+    context.setImageInfo(binary.getImagePtr(), binary.getImageSize(),
+                         binary.getImageEntry());
+    context.setDecodedImage(binary.getDecodedImage());
+    context.create(v4::vmContextPool<>::kDefaultStackSize);
+
+    // heap_loop(n) reads its n from args.1.
+    uint32_t args[2] = { 0, kLoopCount };
+    uint32_t allocCount = kLoopCount * kAllocsPerLoop;
+
+    StopWatch sw;
+    vmReturn<> retVal;
+    sw.start();
+    ec = context.invoke(kHeapLoopEntry, args, 2, retVal);
+    sw.stop();
+    double elapsed_time = sw.getElapsedMillisec();
+    vmHeapStats stats = context.getHeapStats();
+    bool agreed = (ec == Error::Ok && stats.allocs == allocCount && stats.frees == allocCount &&
+                   stats.liveBytes == 0 && stats.badFrees == 0 && stats.failedAllocs == 0);
+    printf("  guest heap:   allocs = %-8u  elapsed time: %9.3f ms  ns/alloc: %6.2f%s\n",
+           allocCount, elapsed_time, elapsed_time * 1000000.0 / allocCount,
+           (agreed ? "" : " (mismatch)"));
+
+    // The same sizes and order on the host allocator, for reference.
+    sw.start();
+    for (uint32_t i = 0; i < kLoopCount; i++) {
+        void * volatile small = malloc(0x18);
+        void * volatile medium = malloc(0x64);
+        void * volatile large = malloc(0x5DC);
+        free(small);
+        free(large);
+        free(medium);
+    }
+    sw.stop();
+    double host_time = sw.getElapsedMillisec();
+    printf("  malloc/free:  allocs = %-8u  elapsed time: %9.3f ms  ns/alloc: %6.2f\n\n",
+           allocCount, host_time, host_time * 1000000.0 / allocCount);
+
+    printf("  allocs = %" PRIuPTR ", large = %" PRIuPTR ", peak = %" PRIuPTR " bytes, "
+           "arenas = %" PRIuPTR " bytes, committed = %" PRIuPTR " KB\n\n",
+           (uintptr_t)stats.allocs, (uintptr_t)stats.largeAllocs, (uintptr_t)stats.peakBytes,
+           (uintptr_t)stats.arenaBytes, (uintptr_t)(stats.committedBytes / 1024));
+}
+
+void test_Interpreter_v4_gc()
+{
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_gc()\n");
+    printf("--------------------------------------------\n\n");
+
+    static const uint32_t kLoopCount = 2000000;
+    static const uint32_t kObjectsPerLoop = 3;
+    static const uint32_t kChunkSize = 0x4000;
+    static const uint32_t kGcChurnEntry = 0x00000010;
+
+    v4::vmBinaryFile binary;
+    int ec = binary.loadFromMemory(&v4::gcChurnBinary32[0], sizeof(v4::gcChurnBinary32), 0);
+    if (ec <= 0) {
+        printf("  vmBinaryFile: load failed.\n\n");
+        return;
+    }
+
+    v4::ExecutionContext<> context;
+    context.setImageInfo(binary.getImagePtr(), binary.getImageSize(),
+                         binary.getImageEntry());
+    context.setDecodedImage(binary.getDecodedImage());
+    context.create(v4::vmContextPool<>::kDefaultStackSize);
+
+    // gc_churn(n) reads its n from args.1, the nodes of the last chunk are summed.
+    uint32_t args[2] = { 0, kLoopCount };
+    uint32_t left = kLoopCount % kChunkSize;
+    uint32_t sum = (uint32_t)((uint64_t)left * (left + 1) / 2);
+
+    StopWatch sw;
     vmReturn<> retVal;
     retVal.setDataType(vmReturn<>::Basic);
-    retVal.setValue(n);
-    
-    int ec = interpreter.create();
+    sw.start();
+    ec = context.invoke(kGcChurnEntry, args, 2, retVal);
+    sw.stop();
+    double elapsed_time = sw.getElapsedMillisec();
+    vmGcStats stats = context.getGcStats();
+    bool agreed = (ec == Error::Ok && (uint32_t)retVal.getValue() == sum &&
+                   stats.allocs == (uint64_t)kLoopCount * kObjectsPerLoop &&
+                   stats.failedAllocs == 0 && stats.badAccesses == 0);
+    double gc_time = stats.totalPauseNs / 1000000.0;
+    printf("  gc_churn:     objects = %-8u  elapsed time: %9.3f ms  ns/object: %6.2f%s\n",
+           kLoopCount * kObjectsPerLoop, elapsed_time,
+           elapsed_time * 1000000.0 / (kLoopCount * kObjectsPerLoop),
+           (agreed ? "" : " (mismatch)"));
+    printf("  allocated = %0.1f MB (%0.1f MB/s), gc time = %0.3f ms (%0.1f %%)\n\n",
+           stats.allocatedBytes / 1048576.0,
+           stats.allocatedBytes / 1048576.0 / (elapsed_time / 1000.0),
+           gc_time, (elapsed_time > 0.0) ? (gc_time * 100.0 / elapsed_time) : 0.0);
+
+    printf("  minor = %" PRIuPTR ", survived = %" PRIuPTR " KB, promoted = %" PRIuPTR " KB, "
+           "major = %" PRIuPTR " (mark slices = %" PRIuPTR ", sweep slices = %" PRIuPTR "), "
+           "freed = %" PRIuPTR " KB, old = %" PRIuPTR " KB\n",
+           (uintptr_t)stats.minorCollections, (uintptr_t)(stats.survivedBytes / 1024),
+           (uintptr_t)(stats.promotedBytes / 1024), (uintptr_t)stats.majorCycles,
+           (uintptr_t)stats.markSlices, (uintptr_t)stats.sweepSlices,
+           (uintptr_t)(stats.freedBytes / 1024), (uintptr_t)(stats.oldBytes / 1024));
+    printf("  pauses = %" PRIuPTR ", mean = %0.1f us, max = %0.1f us, "
+           "<10us: %" PRIuPTR ", <100us: %" PRIuPTR ", <1ms: %" PRIuPTR ", <10ms: %" PRIuPTR
+           ", longer: %" PRIuPTR "\n\n",
+           (uintptr_t)stats.pauses,
+           (stats.pauses != 0) ? (stats.totalPauseNs / 1000.0 / stats.pauses) : 0.0,
+           stats.maxPauseNs / 1000.0,
+           (uintptr_t)stats.pauseHistogram[0], (uintptr_t)stats.pauseHistogram[1],
+           (uintptr_t)stats.pauseHistogram[2], (uintptr_t)stats.pauseHistogram[3],
+           (uintptr_t)stats.pauseHistogram[4]);
+}
 
+void test_Interpreter_v4_image()
+{
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_image()\n");
+    printf("--------------------------------------------\n\n");
+
+    static const uint32_t kImageCount = 256;
+    static const uint32_t kRunN = 20;
+    static const char * kImageFile = "fibonacci.jlbc";
+
+    v4::vmProcess<> process;
+    int ec = process.create();
+    int64_t entry = process.getFunctionOffset("fibonacci32");
+    if (ec != Error::Ok || entry < 0) {
+        printf("  vmProcess: create failed.\n\n");
+        return;
+    }
+    v4::vmBinaryFile * builtin = process.getBinaryFile();
+    ec = builtin->saveToFile(kImageFile);
+    if (ec <= 0) {
+        printf("  vmBinaryFile: save failed.\n\n");
+        return;
+    }
+
+    // The same file loaded again and again, as the scripts are at startup.
+    std::vector<v4::vmBinaryFile *> binaries(kImageCount);
+    bool loaded = true;
+    StopWatch sw;
     sw.start();
-    ec = interpreter.run_inline(retVal);
-    if (ec >= 0) {
-        sw.stop();
-        if (retVal.isValid()) {
-            printf("  fibonacci(%u) = %" PRIuPTR "\n", n, retVal.getValue());
+    for (uint32_t i = 0; i < kImageCount; i++) {
+        binaries[i] = new v4::vmBinaryFile();
+        if (binaries[i]->loadFromFile(kImageFile) <= 0 || !binaries[i]->isMapped())
+            loaded = false;
+    }
+    sw.stop();
+    double file_time = sw.getElapsedMillisec();
+    printf("  loadFromFile:    images = %-6u  elapsed time: %9.3f ms  us/image: %8.2f%s\n",
+           kImageCount, file_time, file_time * 1000.0 / kImageCount,
+           (loaded ? "" : " (mismatch)"));
+
+    // And copied from memory, for reference.
+    std::vector<v4::vmBinaryFile *> copies(kImageCount);
+    sw.start();
+    for (uint32_t i = 0; i < kImageCount; i++) {
+        copies[i] = new v4::vmBinaryFile();
+        copies[i]->loadFromMemory(builtin->getImagePtr(), builtin->getImageSize(), 0);
+    }
+    sw.stop();
+    double memory_time = sw.getElapsedMillisec();
+    printf("  loadFromMemory:  images = %-6u  elapsed time: %9.3f ms  us/image: %8.2f\n\n",
+           kImageCount, memory_time, memory_time * 1000.0 / kImageCount);
+
+    // fibonacci32(n) of a loaded image, by the symbol of the file.
+    v4::vmBinaryFile * binary = binaries[kImageCount - 1];
+    const vmSymbolTable::Symbol * symbol = binary->getSymbolTable()->findFunction("fibonacci32");
+    uint32_t args[2] = { 0, kRunN };
+    uintptr_t values[2] = { 0, 0 };
+    int errors[2] = { Error::Failed, Error::Failed };
+    for (int i = 0; i < 2; i++) {
+        v4::vmBinaryFile * image = (i == 0) ? builtin : binary;
+        v4::ExecutionContext<> context;
+        context.setImageInfo(image->getImagePtr(), image->getImageSize(),
+                             image->getImageEntry());
+        context.setDecodedImage(image->getDecodedImage());
+        context.create(v4::vmContextPool<>::kDefaultStackSize);
+        vmReturn<> retVal;
+        retVal.setDataType(vmReturn<>::Basic);
+        uint32_t offset = (i == 0 || symbol == nullptr) ? (uint32_t)entry : symbol->offset;
+        errors[i] = context.invoke(offset, args, 2, retVal);
+        values[i] = retVal.getValue();
+    }
+    bool agreed = (symbol != nullptr && errors[0] == Error::Ok && errors[1] == Error::Ok &&
+                   values[0] == values[1]);
+    printf("  image file: code = %" PRIuPTR " bytes, symbols = %" PRIuPTR ", "
+           "fibonacci(%u) = %" PRIuPTR "%s\n\n",
+           (uintptr_t)binary->getImageSize(), (uintptr_t)binary->getSymbolTable()->size(),
+           kRunN, values[1], (agreed ? "" : " (mismatch)"));
+
+    // The input is patched into the mapped code, its page gets a copy.
+    {
+        v4::ExecutionContext<> context;
+        context.setImageInfo(binary->getImagePtr(), binary->getImageSize(),
+                             binary->getImageEntry());
+        context.setDecodedImage(binary->getDecodedImage());
+        context.create(v4::vmContextPool<>::kDefaultStackSize);
+        vmReturn<> retVal;
+        ec = binary->setInput(kRunN);
+        if (ec == Error::Ok)
+            ec = context.run(retVal);
+        printf("  mapped image: setInput(%u), fibonacci(%u) = %" PRIuPTR ", ec = %d%s\n\n",
+               kRunN, kRunN, retVal.getValue(), ec,
+               ((ec == Error::Ok && retVal.getValue() == values[0]) ? "" : " (failed)"));
+    }
+
+    for (uint32_t i = 0; i < kImageCount; i++) {
+        delete binaries[i];
+        delete copies[i];
+    }
+    remove(kImageFile);
+}
+
+void test_Interpreter_v4_verify()
+{
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_verify()\n");
+    printf("--------------------------------------------\n\n");
+
+    static const uint32_t kRunN = 32;
+    static const uint32_t kRunCount = 5;
+
+    v4::vmBinaryFile binary;
+    int ec = binary.loadBuiltin();
+    if (ec <= 0 || !binary.getDecodedImage()->isVerified()) {
+        printf("  vmBinaryFile: load failed.\n\n");
+        return;
+    }
+    ec = binary.setInput(kRunN);
+    if (ec != Error::Ok) {
+        printf("  vmBinaryFile: setInput() failed, ec = %d (failed)\n\n", ec);
+        return;
+    }
+
+    // The same image, with and without the image limit check.
+    uintptr_t values[2] = { 0, 0 };
+    for (int checked = 1; checked >= 0; checked--) {
+        v4::ExecutionContext<> context;
+        context.setImageInfo(binary.getImagePtr(), binary.getImageSize(),
+                             binary.getImageEntry());
+        context.setDecodedImage(checked ? nullptr : binary.getDecodedImage());
+        context.create(v4::vmContextPool<>::kDefaultStackSize);
+
+        double best_time = 0.0;
+        StopWatch sw;
+        for (uint32_t i = 0; i < kRunCount; i++) {
+            vmReturn<> retVal;
+            sw.start();
+            context.run(retVal);
+            sw.stop();
+            double elapsed_time = sw.getElapsedMillisec();
+            if (i == 0 || elapsed_time < best_time)
+                best_time = elapsed_time;
+            values[checked] = retVal.getValue();
         }
+        printf("  %s  fibonacci(%u) = %-8" PRIuPTR "  elapsed time: %9.3f ms%s\n",
+               (checked ? "checked:  " : "verified: "), kRunN, values[checked], best_time,
+               ((checked || values[0] == values[1]) ? "" : " (mismatch)"));
     }
     printf("\n");
 
-    double elapsed_time = sw.getElapsedMillisec();
-    printf("  elapsed time:  %0.3f ms\n", elapsed_time);
+    // The images it refuses, slot 0 is var0, -1 and -2 are the return IP
+    // of a fast frame.
+    static const unsigned char fallsOff[] = {
+        OpCode::store, 0x00, 0x01, 0x00, 0x00, 0x00,
+        OpCode::inc, 0x00
+    };
+    static const unsigned char unknownOpcode[] = {
+        OpCode::inc, 0x00,
+        OpCode::error,
+        OpCode::exit
+    };
+    static const unsigned char headerSlot[] = {
+        OpCode::fast_call_short, 0x03, 0x00, 0x08, 0x00,
+        OpCode::ret_n, 0x08, 0x00,
+        // The return IP of the callee's frame.
+        OpCode::inc, (unsigned char)-1,
+        OpCode::ret_n, 0x08, 0x00
+    };
+    static const unsigned char callerSlot[] = {
+        OpCode::fast_call_short, 0x03, 0x00, 0x08, 0x00,
+        OpCode::ret_n, 0x08, 0x00,
+        // Below the 8 bytes of locals of its caller.
+        OpCode::move, 0x00, (unsigned char)-5,
+        OpCode::ret_n, 0x08, 0x00
+    };
+    static const unsigned char returnMismatch[] = {
+        OpCode::fast_call_short, 0x03, 0x00, 0x08, 0x00,
+        OpCode::ret_n, 0x08, 0x00,
+        OpCode::ret_n, 0x10, 0x00
+    };
+    static const unsigned char mergeMismatch[] = {
+        OpCode::fast_call_short, 0x08, 0x00, 0x08, 0x00,
+        OpCode::fast_call_short, 0x05, 0x00, 0x10, 0x00,
+        OpCode::ret_n, 0x08, 0x00,
+        OpCode::jmp_near, 0x03,
+        OpCode::jmp_near, 0x01,
+        OpCode::nop,
+        // Reached in the frames of 8 and 16 bytes.
+        OpCode::ret_n, 0x08, 0x00
+    };
+    static const unsigned char badCall[] = {
+        OpCode::fast_call_short, 0x03, 0x00, 0x06, 0x00,
+        OpCode::ret_n, 0x08, 0x00,
+        OpCode::ret_n, 0x06, 0x00
+    };
+    // The largest local size, the frame would step over the stack guard.
+    static const unsigned char hugeFrame[] = {
+        OpCode::fast_call_short, 0x03, 0x00, 0xFC, 0xFF,
+        OpCode::ret_n, 0x08, 0x00,
+        OpCode::ret_n, 0xFC, 0xFF
+    };
+
+    struct BadImage {
+        const char *            name;
+        const unsigned char *   code;
+        size_t                  size;
+        int                     error;
+    };
+    static const BadImage kBadImages[] = {
+        { "falls off the end",  fallsOff,       sizeof(fallsOff),       Error::Verify_Falls_Off_End  },
+        { "unknown opcode",     unknownOpcode,  sizeof(unknownOpcode),  Error::Verify_Unknown_Opcode },
+        { "frame header slot",  headerSlot,     sizeof(headerSlot),     Error::Verify_Bad_Slot       },
+        { "caller's slot",      callerSlot,     sizeof(callerSlot),     Error::Verify_Bad_Slot       },
+        { "wrong return size",  returnMismatch, sizeof(returnMismatch), Error::Verify_Stack_Mismatch },
+        { "two frames merge",   mergeMismatch,  sizeof(mergeMismatch),  Error::Verify_Stack_Mismatch },
+        { "call local size",    badCall,        sizeof(badCall),        Error::Verify_Bad_Call       },
+        { "largest frame",      hugeFrame,      sizeof(hugeFrame),      Error::Verify_Bad_Call       }
+    };
+    for (size_t i = 0; i < sizeof(kBadImages) / sizeof(kBadImages[0]); i++) {
+        const BadImage & image = kBadImages[i];
+        v4::vmBinaryFile bad;
+        ec = bad.loadFromMemory(image.code, image.size, 0);
+        printf("  %-20s  ec = %d%s\n", image.name, ec, ((ec == image.error) ? "" : " (mismatch)"));
+    }
     printf("\n");
 }
 
-void test_Interpreter_v1()
+//
+// The tail call moves the callee's arguments only, a local of the
+// caller's caller lives across it. Every mode must give what the raw
+// bytecode gives, it isn't rewritten.
+//
+void test_Interpreter_v4_tailcall()
 {
-    test_Interpreter<v1::Interpreter<>>("Interpreter_v1");
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_tailcall()\n");
+    printf("--------------------------------------------\n\n");
+
+    // The callee has no arguments, var1 of the entry is read after the call.
+    static const unsigned char noArgs[] = {
+        // 00000000:    store var0, 5; store var1, 100
+        OpCode::store, 0x00, 0x05, 0x00, 0x00, 0x00,
+        OpCode::store, 0x01, 0x64, 0x00, 0x00, 0x00,
+        // 0000000C:    fast_call 0x00000016, 8
+        OpCode::fast_call_short, 0x05, 0x00, 0x08, 0x00,
+        // 00000011:    add eax, var1; ret_n 8
+        OpCode::add_eax, 0x01,
+        OpCode::ret_n, 0x08, 0x00,
+        // 00000016:    store var1, 999; fast_call 0x00000024, 8; ret_n 8
+        OpCode::store, 0x01, 0xE7, 0x03, 0x00, 0x00,
+        OpCode::fast_call_short, 0x03, 0x00, 0x08, 0x00,
+        OpCode::ret_n, 0x08, 0x00,
+        // 00000024:    ret eax 8, 1
+        OpCode::ret_eax_n, 0x08, 0x00, 0x01, 0x00, 0x00, 0x00
+    };
+    // The callee reads arg1, the tail call at 00000025 moves one word. The
+    // entry reads var0 after the call (or var1, the word it's moved to).
+    static const unsigned char oneArg[] = {
+        // 00000000:    store var0, 5; store var1, 100
+        OpCode::store, 0x00, 0x05, 0x00, 0x00, 0x00,
+        OpCode::store, 0x01, 0x64, 0x00, 0x00, 0x00,
+        // 0000000C:    fast_call 0x00000016, 8
+        OpCode::fast_call_short, 0x05, 0x00, 0x08, 0x00,
+        // 00000011:    add eax, var0; ret_n 8
+        OpCode::add_eax, 0x00,
+        OpCode::ret_n, 0x08, 0x00,
+        // 00000016:    store var1, 999; add var1, arg1; store var0, 7
+        OpCode::store, 0x01, 0xE7, 0x03, 0x00, 0x00,
+        OpCode::add, 0x01, (unsigned char)-3,
+        OpCode::store, 0x00, 0x07, 0x00, 0x00, 0x00,
+        // 00000025:    fast_call 0x0000002D, 8; ret_n 8
+        OpCode::fast_call_short, 0x03, 0x00, 0x08, 0x00,
+        OpCode::ret_n, 0x08, 0x00,
+        // 0000002D:    load_eax 0; add eax, arg1; ret_n 8
+        OpCode::load_eax, 0x00, 0x00, 0x00, 0x00,
+        OpCode::add_eax, (unsigned char)-3,
+        OpCode::ret_n, 0x08, 0x00
+    };
+    unsigned char liveArg[sizeof(oneArg)];
+    memcpy(liveArg, oneArg, sizeof(oneArg));
+    liveArg[0x12] = 0x01;
+
+    struct TailImage {
+        const char *            name;
+        const unsigned char *   code;
+        size_t                  size;
+        uint32_t                tailCall;
+        bool                    rewritten;
+    };
+    const TailImage kImages[] = {
+        { "no arguments",   noArgs,  sizeof(noArgs),  0x1C, true  },
+        { "dead argument",  oneArg,  sizeof(oneArg),  0x25, true  },
+        { "live argument",  liveArg, sizeof(liveArg), 0x25, false }
+    };
+    static const char * const kModes[] = {
+        "run", "threaded", "predecoded", "specialized", "tiered", "jit"
+    };
+    static const uint32_t kRunCount = 3;
+
+    for (size_t i = 0; i < sizeof(kImages) / sizeof(kImages[0]); i++) {
+        const TailImage & image = kImages[i];
+        v4::vmBinaryFile binary;
+        int ec = binary.loadFromMemory(image.code, image.size, 0);
+        if (ec <= 0) {
+            printf("  %-15s  load failed, ec = %d\n", image.name, ec);
+            continue;
+        }
+        const vmDecodedInst * call = binary.getDecodedImage()->atOffset(image.tailCall);
+        bool rewritten = (call->opcode == OpCode::fast_tail_call_short);
+        printf("  %-15s  tail call: %-3s%s\n", image.name, (rewritten ? "yes" : "no"),
+               ((rewritten == image.rewritten) ? "" : " (failed)"));
+
+        uintptr_t expected = 0;
+        for (size_t mode = 0; mode < sizeof(kModes) / sizeof(kModes[0]); mode++) {
+            v4::ExecutionContext<> context;
+            context.setImageInfo(binary.getImagePtr(), binary.getImageSize(),
+                                 binary.getImageEntry());
+            context.setDecodedImage(binary.getDecodedImage());
+            context.setExecPlan(binary.getExecPlan());
+            context.create(v4::vmContextPool<>::kDefaultStackSize);
+#if USE_FORWARD_STACK_PTR
+            context.setTierManager(binary.getTierManager());
+#endif
+
+            vmReturn<> retVal;
+            for (uint32_t n = 0; n < kRunCount; n++) {
+                switch (mode) {
+                case 0: ec = context.run(retVal);               break;
+                case 1: ec = context.run_threaded(retVal);      break;
+                case 2: ec = context.run_predecoded(retVal);    break;
+                case 3: ec = context.run_specialized(retVal);   break;
+                case 4: ec = context.run_tiered(retVal);        break;
+                default:
+#if USE_FORWARD_STACK_PTR
+                    if (binary.getJitCode() != nullptr) {
+                        ec = context.run_jit(binary.getJitCode(), retVal);
+                        break;
+                    }
+#endif
+                    ec = context.run_predecoded(retVal);
+                    break;
+                }
+            }
+            if (mode == 0)
+                expected = retVal.getValue();
+            printf("    %-12s  = %-6" PRIuPTR "  ec = %d%s\n", kModes[mode], retVal.getValue(), ec,
+                   ((ec == Error::Ok && retVal.getValue() == expected) ? "" : " (failed)"));
+        }
+        printf("\n");
+    }
 }
 
-void test_Interpreter_v2()
+//
+// An overflow of the guest stack returns Stack_Overflow in every mode,
+// and the same context runs again.
+//
+void test_Interpreter_v4_overflow()
 {
-    test_Interpreter<v2::Interpreter<>>("Interpreter_v2");
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_overflow()\n");
+    printf("--------------------------------------------\n\n");
+
+    static const uint32_t kDeepN = 5000000;
+    static const uint32_t kRunN = 25;
+    static const uintptr_t kFibN = 75025;
+
+    v4::vmBinaryFile binary;
+    int ec = binary.loadBuiltin();
+    if (ec <= 0) {
+        printf("  vmBinaryFile: load failed.\n\n");
+        return;
+    }
+
+    static const char * const kModes[] = {
+        "run", "threaded", "predecoded", "specialized", "tiered", "jit"
+    };
+    std::string trace;
+    for (size_t mode = 0; mode < sizeof(kModes) / sizeof(kModes[0]); mode++) {
+        v4::ExecutionContext<> context;
+        context.setImageInfo(binary.getImagePtr(), binary.getImageSize(),
+                             binary.getImageEntry());
+        context.setDecodedImage(binary.getDecodedImage());
+        context.setExecPlan(binary.getExecPlan());
+        context.create(64 * 1024);
+#if USE_FORWARD_STACK_PTR
+        context.setTierManager(binary.getTierManager());
+#endif
+
+        int results[2];
+        vmReturn<> retVal;
+        for (int i = 0; i < 2; i++) {
+            results[i] = binary.setInput((i == 0) ? kDeepN : kRunN);
+            if (results[i] != Error::Ok)
+                continue;
+            switch (mode) {
+            case 0: results[i] = context.run(retVal);               break;
+            case 1: results[i] = context.run_threaded(retVal);      break;
+            case 2: results[i] = context.run_predecoded(retVal);    break;
+            case 3: results[i] = context.run_specialized(retVal);   break;
+            case 4: results[i] = context.run_tiered(retVal);        break;
+            default:
+#if USE_FORWARD_STACK_PTR
+                if (binary.getJitCode() != nullptr) {
+                    results[i] = context.run_jit(binary.getJitCode(), retVal);
+                    break;
+                }
+#endif
+                results[i] = context.run_predecoded(retVal);
+                break;
+            }
+            if (i == 0 && mode == 0)
+                context.backtrace(trace, binary.getSymbolTable());
+        }
+
+        // The guest frames of the overflow: fibonacci32 calls itself at
+        // 0x1D. They're only counted if the walk got down to the entry.
+        const vmCallStack & frames = context.getOverflowStack();
+        const vmSymbolTable::Symbol * innermost = nullptr;
+        if (!frames.isEmpty() && frames[0].callIP != nullptr) {
+            uint32_t offset = (uint32_t)(frames[0].callIP - (unsigned char *)binary.getImagePtr());
+            innermost = binary.getSymbolTable()->findFunction(offset);
+        }
+        bool traced = (context.getOverflowDepth() > frames.size() && innermost != nullptr
+                       && innermost->name == "fibonacci32");
+
+        bool passed = (results[0] == Error::Stack_Overflow && results[1] == Error::Ok
+                       && retVal.getValue() == kFibN && traced);
+        printf("  %-12s  fibonacci(%u): ec = %d, %u frames,  fibonacci(%u) = %-6" PRIuPTR "%s\n",
+               kModes[mode], kDeepN, results[0], (uint32_t)context.getOverflowDepth(),
+               kRunN, retVal.getValue(), (passed ? "" : " (failed)"));
+    }
+    printf("\n");
+    printf("  run: the guest stack of the overflow\n\n%s\n", trace.c_str());
+
+    // The guest stack is larger than the host stack, a guest call of the
+    // native code takes host stack too, and reaches its limit first.
+    static const size_t kLargeStackSize = 64 * 1024 * 1024;
+    static const char * const kNativeModes[] = { "predecoded", "tiered", "jit" };
+    for (size_t mode = 0; mode < sizeof(kNativeModes) / sizeof(kNativeModes[0]); mode++) {
+        v4::ExecutionContext<> context;
+        context.setImageInfo(binary.getImagePtr(), binary.getImageSize(),
+                             binary.getImageEntry());
+        context.setDecodedImage(binary.getDecodedImage());
+        context.create(kLargeStackSize);
+#if USE_FORWARD_STACK_PTR
+        context.setTierManager(binary.getTierManager());
+#endif
+
+        int results[2];
+        vmReturn<> retVal;
+        for (int i = 0; i < 2; i++) {
+            results[i] = binary.setInput((i == 0) ? kDeepN : kRunN);
+            if (results[i] != Error::Ok)
+                continue;
+            switch (mode) {
+            case 0: results[i] = context.run_predecoded(retVal);    break;
+            case 1: results[i] = context.run_tiered(retVal);        break;
+            default:
+#if USE_FORWARD_STACK_PTR
+                if (binary.getJitCode() != nullptr) {
+                    results[i] = context.run_jit(binary.getJitCode(), retVal);
+                    break;
+                }
+#endif
+                results[i] = context.run_predecoded(retVal);
+                break;
+            }
+        }
+        bool passed = (results[0] == Error::Stack_Overflow && results[1] == Error::Ok
+                       && retVal.getValue() == kFibN);
+        printf("  %-12s  64 MB stack, fibonacci(%u): ec = %d,  fibonacci(%u) = %-6" PRIuPTR "%s\n",
+               kNativeModes[mode], kDeepN, results[0], kRunN, retVal.getValue(),
+               (passed ? "" : " (failed)"));
+    }
+    printf("\n");
 }
 
-void test_Interpreter_v3()
+void test_Interpreter_v4_batch()
 {
-    test_Interpreter<v3::Interpreter<>>("Interpreter_v3");
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v4_batch()\n");
+    printf("--------------------------------------------\n\n");
+
+    static const uint32_t kInputCount = 2048;
+    static const uint32_t kMinN = 14;
+    static const uint32_t kMaxN = 18;
+
+    v4::vmProcess<> process;
+    int ec = process.create();
+    int64_t entry = process.getFunctionOffset("fibonacci32");
+    if (ec != Error::Ok || entry < 0) {
+        printf("  vmProcess: create failed.\n\n");
+        return;
+    }
+    v4::vmBinaryFile * binary = process.getBinaryFile();
+
+    v4::vmContextPool<> pool;
+    v4::vmBatchExecutor<> batch;
+    pool.create(binary);
+    if (batch.create(binary) != Error::Ok) {
+        printf("  vmBatchExecutor: create failed.\n\n");
+        return;
+    }
+
+    printf("  %u x fibonacci(n), %u lanes%s\n\n", kInputCount, v4::vmBatchExecutor<>::kLanes,
+#if defined(__AVX2__)
+           " (AVX2)"
+#else
+           ""
+#endif
+           );
+
+    // fibonacci32(n) reads its n from args.1.
+    std::vector<uint32_t> args(kInputCount * 2);
+    std::vector<uintptr_t> expected(kInputCount), results(kInputCount);
+    for (uint32_t mixed = 0; mixed <= 1; mixed++) {
+        for (uint32_t i = 0; i < kInputCount; i++) {
+            args[i * 2 + 0] = 0;
+            args[i * 2 + 1] = mixed ? (kMinN + (i * 7) % (kMaxN - kMinN + 1)) : kMaxN;
+        }
+        const char * inputs = mixed ? "mixed  " : "uniform";
+
+        // The best of kRepeats runs, each.
+        static const int kRepeats = 3;
+        StopWatch sw;
+        double scalar_time = 0.0;
+        for (int r = 0; r < kRepeats; r++) {
+            sw.start();
+            for (uint32_t i = 0; i < kInputCount; i++) {
+                vmReturn<> retVal;
+                pool.invoke((uint32_t)entry, &args[i * 2], 2, retVal);
+                expected[i] = retVal.getValue();
+            }
+            sw.stop();
+            if (r == 0 || sw.getElapsedMillisec() < scalar_time)
+                scalar_time = sw.getElapsedMillisec();
+        }
+        printf("  %s  scalar:  elapsed time: %9.3f ms\n", inputs, scalar_time);
+
+        static const uint32_t kOccupancy[] = { 0, 50 };
+        for (size_t k = 0; k < sizeof(kOccupancy) / sizeof(kOccupancy[0]); k++) {
+            batch.setOccupancy(kOccupancy[k]);
+            double elapsed_time = 0.0;
+            for (int r = 0; r < kRepeats; r++) {
+                batch.resetCounters();
+                sw.start();
+                batch.run((uint32_t)entry, &args[0], 2, kInputCount, &results[0]);
+                sw.stop();
+                if (r == 0 || sw.getElapsedMillisec() < elapsed_time)
+                    elapsed_time = sw.getElapsedMillisec();
+            }
+
+            bool agreed = true;
+            for (uint32_t i = 0; i < kInputCount; i++) {
+                if (results[i] != expected[i])
+                    agreed = false;
+            }
+            printf("  %s  batch:   elapsed time: %9.3f ms  speedup: %5.2f  occupancy: %6.2f %%"
+                   "  limit: %2u %%  handed off: %-5" PRIu64 "  scalar runs: %-5" PRIu64 "%s\n",
+                   inputs, elapsed_time, scalar_time / elapsed_time, batch.getOccupancy(),
+                   kOccupancy[k], batch.getHandOffCount(), batch.getFallbackCount(),
+                   (agreed ? "" : " (mismatch)"));
+        }
+    }
+    printf("\n");
 }
 
-void test_Interpreter_v3_inline()
+void test_vmFrame_ops()
 {
-    test_Interpreter_inline<v3::Interpreter<>>("Interpreter_v3_inline");
+    printf("--------------------------------------------\n");
+    printf("  test_vmFrame_ops()\n");
+    printf("--------------------------------------------\n\n");
+
+    typedef vmFrame<uintptr_t> frame_type;
+    frame_type frame;
+
+    // A reg_t is the register's width (vmRegType) and index.
+    reg_t al  = (reg_t)(vmRegType::r8 * vmReg::kMaxRegs + 2);
+    reg_t ah  = (reg_t)(vmRegType::r8_high * vmReg::kMaxRegs + 2);
+    reg_t ax  = (reg_t)(vmRegType::r16 * vmReg::kMaxRegs + 2);
+    reg_t ebx = (reg_t)(vmRegType::r32 * vmReg::kMaxRegs + 3);
+    reg_t ecx = (reg_t)(vmRegType::r32 * vmReg::kMaxRegs + 4);
+
+    bool results[9];
+    frame.setRegValue(ebx, (uintptr_t)0xFFFFFFFFUL);
+    results[0] = (frame.incRegValue(ebx) == 0 && frame.getRegValue32(3) == 0);
+
+    frame.setRegValue(al, 0x7F);
+    frame.setRegValue(ah, 0x12);
+    results[1] = (frame.addRegValue_ri(al, 1) == 0x80 && frame.getRegValue(ax) == 0x1280);
+
+    frame.setRegValue(ebx, (uintptr_t)(uint32_t)-1);
+    frame.setRegValue(ecx, 1);
+    results[2] = frame.condCmp_rr(ebx, ecx, vmDataType::Int32, OpCode::jl);
+    results[3] = !frame.condCmp_rr(ebx, ecx, vmDataType::UInt32, OpCode::jl);
+    results[4] = (frame.condCmp_ri(al, 0, vmDataType::Int8, OpCode::jl)
+                  && frame.condCmp_ri(al, 0, vmDataType::UInt8, OpCode::jg));
+
+#if defined(WIN64) || defined(_WIN64) || defined(_M_X64) || defined(_M_AMD64) \
+ || defined(__amd64__) || defined(__x86_64__) || defined(__aarch64__)
+    reg_t rdx = (reg_t)(vmRegType::r64 * vmReg::kMaxRegs + 5);
+    frame.setRegValue(rdx, (uintptr_t)0x100000000ULL);
+    results[5] = (frame.mulRegValue_ri(rdx, 3) == (uintptr_t)0x300000000ULL
+                  && frame.condCmp_ri(rdx, (uintptr_t)0x200000000ULL, vmDataType::Int64, OpCode::jg));
+#else
+    results[5] = true;
+#endif
+
+    // The immediates: written, read back and skipped by their data type.
+    unsigned char code[16] = { 0 };
+    frame.setting(code, sizeof(code), code);
+    frame.setValue(vmDataType::Int16, (uintptr_t)-2);
+    results[6] = (frame.getValue(vmDataType::Int16) == (uintptr_t)-2
+                  && frame.getValue(vmDataType::UInt16) == 0xFFFE);
+    frame.nextValue(vmDataType::Int16);
+    frame.nextValueByReg(vmRegType::r32);
+    results[7] = (frame.getFPOffset() == 6);
+
+    // The width resolved by the caller: a kept handler number and a template.
+    uint32_t sub16 = vmRegOp::make(vmRegOp::sub_ri, vmRegType::r16);
+    frame.setRegValue(ax, 0x1200);
+    results[8] = (frame.runRegOp(sub16, 2, 1) == 0x11FF
+                  && frame.runRegOp<vmRegOp_add_ri, vmRegType::r8_high>(2, 1) == 0x12
+                  && frame.getRegValue(ax) == 0x12FF);
+
+    static const char * const kNames[] = {
+        "inc r32 wraps", "add_ri r8, ah kept", "jl Int32", "jl UInt32",
+        "jl/jg 8-bit imm", "mul_ri/jg 64-bit", "imm Int16", "imm sizes",
+        "width bound once"
+    };
+    for (size_t i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+        printf("  %-20s  %s\n", kNames[i], (results[i] ? "ok" : "failed"));
+    }
+    printf("\n");
 }
 
-void test_Interpreter_v4()
+void test_vmCallStack()
 {
-    test_Interpreter<v4::Interpreter<>>("Interpreter_v4");
+    printf("--------------------------------------------\n");
+    printf("  test_vmCallStack()\n");
+    printf("--------------------------------------------\n\n");
+
+    v4::vmBinaryFile binary;
+    int ec = binary.loadBuiltin();
+    if (ec <= 0) {
+        printf("  vmBinaryFile: load failed.\n\n");
+        return;
+    }
+    unsigned char * image = (unsigned char *)binary.getImagePtr();
+
+    // main calls fibonacci32, which calls itself.
+    vmCallStack callStack;
+    callStack.create(3);
+    callStack.push(nullptr, nullptr, nullptr);
+    callStack.push(image + 0x05, image + 0x0A, nullptr);
+    callStack.push(image + 0x24, image + 0x29, nullptr);
+    bool overflowed = !callStack.push(image + 0x24, image + 0x29, nullptr);
+
+    std::string trace;
+    callStack.backtrace(trace, image, binary.getSymbolTable());
+    printf("%s\n", trace.c_str());
+    printf("  depth = %u, overflow %s\n", (uint32_t)callStack.size(),
+           (overflowed ? "detected" : "missed (failed)"));
+    printf("  pop = %s\n\n", ((callStack.pop() == image + 0x29) ? "ok" : "failed"));
 }
 
-void test_Interpreter_v4_inline()
+void test_Interpreter_v5()
+{
+    test_Interpreter<v5::Interpreter<>>("Interpreter_v5");
+}
+
+//
+// Run v5 code from source on a copy of data, the data is written back.
+//
+static int run_v5_source(const char * source, std::vector<uint32_t> & data,
+                         uint32_t & result, double & elapsed_time)
+{
+    RegAssembler assembler(source);
+    int ec = assembler.parse();
+    if (ec != Error::Ok)
+        return ec;
+
+    v5::ExecutionContext<> context;
+    context.setCode(assembler.getCode().data(), assembler.getCode().size(),
+                    (uint32_t)assembler.getLabel("main"));
+    context.create(1024, 64);
+    context.setData(data.data(), data.size());
+
+    vmReturn<> retVal;
+    StopWatch sw;
+    sw.start();
+    ec = context.run(retVal);
+    sw.stop();
+    elapsed_time = sw.getElapsedMillisec();
+
+    result = (uint32_t)retVal.getValue();
+    data.assign(context.getData(), context.getData() + context.getDataSize());
+    return ec;
+}
+
+void test_Interpreter_v5_vector()
 {
-    test_Interpreter_inline<v4::Interpreter<>>("Interpreter_v4_inline");
+    printf("--------------------------------------------\n");
+    printf("  test_Interpreter_v5_vector()\n");
+    printf("--------------------------------------------\n\n");
+
+    // c[i] = a[i] + b[i], a at 0, b at n, c at 2n.
+    static const uint32_t kCount = 1U << 20;
+    static const char * const kScalarSource =
+        "main:\n"
+        "    mov         r1, 0           ; i\n"
+        "    mov         r2, %u          ; n\n"
+        "    mov         r7, %u          ; the offset of b\n"
+        "    mov         r8, %u          ; the offset of c\n"
+        "loop:\n"
+        "    ld          r3, r1          ; a[i]\n"
+        "    add         r4, r1, r7\n"
+        "    ld          r5, r4          ; b[i]\n"
+        "    add         r3, r3, r5\n"
+        "    add         r6, r1, r8\n"
+        "    st          r3, r6          ; c[i] = a[i] + b[i]\n"
+        "    add         r1, r1, 1\n"
+        "    cmp_br_lt   r1, r2, loop\n"
+        "    exit\n";
+    static const char * const kVectorSource =
+        "main:\n"
+        "    mov         r1, 0           ; i\n"
+        "    mov         r2, %u          ; n\n"
+        "    mov         r7, %u          ; the offset of b\n"
+        "    mov         r8, %u          ; the offset of c\n"
+        "loop:\n"
+        "    vld         v0, r1          ; a[i .. i + 7]\n"
+        "    add         r4, r1, r7\n"
+        "    vld         v1, r4          ; b[i .. i + 7]\n"
+        "    vadd        v0, v0, v1\n"
+        "    add         r6, r1, r8\n"
+        "    vst         v0, r6          ; c[i .. i + 7] = a + b\n"
+        "    add         r1, r1, 8\n"
+        "    cmp_br_lt   r1, r2, loop\n"
+        "    exit\n";
+
+    std::vector<uint32_t> input(kCount * 3, 0);
+    for (uint32_t i = 0; i < kCount; i++) {
+        input[i] = i * 7 + 1;
+        input[kCount + i] = i ^ 0x5A5A;
+    }
+
+    char source[1024];
+    double times[2] = { 0.0, 0.0 };
+    std::vector<uint32_t> outputs[2];
+    const char * const sources[2] = { kScalarSource, kVectorSource };
+    for (int i = 0; i < 2; i++) {
+        snprintf(source, sizeof(source), sources[i], kCount, kCount, kCount * 2);
+        outputs[i] = input;
+        uint32_t result = 0;
+        int ec = run_v5_source(source, outputs[i], result, times[i]);
+        if (ec != Error::Ok) {
+            printf("  v5 %s: error %d\n\n", (i == 0 ? "scalar" : "vector"), ec);
+            return;
+        }
+    }
+    bool same = true;
+    for (uint32_t i = 0; i < kCount; i++) {
+        uint32_t c = input[i] + input[kCount + i];
+        if (outputs[0][kCount * 2 + i] != c || outputs[1][kCount * 2 + i] != c) {
+            same = false;
+            break;
+        }
+    }
+    printf("  c[i] = a[i] + b[i], n = %u\n\n", kCount);
+    printf("  scalar  elapsed time: %9.3f ms\n", times[0]);
+    printf("  vector  elapsed time: %9.3f ms  (%.1fx)%s\n\n", times[1],
+           ((times[1] > 0.0) ? (times[0] / times[1]) : 0.0), (same ? "" : " (failed)"));
+
+    // The other vector opcodes on x = { -3 .. 4 }.
+    static const char * const kOpsSource =
+        "main:\n"
+        "    mov         r1, 0\n"
+        "    mov         r2, 3\n"
+        "    mov         r3, 8\n"
+        "    mov         r4, 16\n"
+        "    vld         v0, r1          ; x\n"
+        "    vsplat      v1, r2\n"
+        "    vmul        v2, v0, v1\n"
+        "    vst         v2, r3          ; data[8 ..] = x * 3\n"
+        "    vshuf       v5, v0, 0x053977\n"
+        "    vst         v5, r4          ; data[16 ..] = x, reversed\n"
+        "    vcmp_lt     v3, v0, v1\n"
+        "    vand        v4, v3, v0\n"
+        "    vcmp_eq     v6, v0, v0\n"
+        "    vsum        r5, v6          ; -8\n"
+        "    vsum        r0, v4          ; the sum of x < 3\n"
+        "    add         r0, r0, r5\n"
+        "    exit\n";
+    std::vector<uint32_t> data(24, 0);
+    for (uint32_t i = 0; i < 8; i++) {
+        data[i] = (uint32_t)((int32_t)i - 3);
+    }
+    uint32_t result = 0;
+    double elapsed_time = 0.0;
+    int ec = run_v5_source(kOpsSource, data, result, elapsed_time);
+    bool ok = (ec == Error::Ok && result == (uint32_t)(-3 - 8));
+    for (uint32_t i = 0; i < 8 && ok; i++) {
+        ok = (data[8 + i] == (uint32_t)(((int32_t)i - 3) * 3) && data[16 + i] == data[7 - i]);
+    }
+    printf("  vmul/vshuf/vcmp/vand/vsum   %s\n", (ok ? "ok" : "failed"));
+
+    // A vector that doesn't fit in the data memory.
+    static const char * const kRangeSource =
+        "main:\n"
+        "    mov         r1, 20\n"
+        "    vld         v0, r1\n"
+        "    exit\n";
+    ec = run_v5_source(kRangeSource, data, result, elapsed_time);
+    printf("  vld out of the data memory  ec = %d%s\n\n", ec,
+           ((ec == Error::Data_Out_Of_Range) ? "" : " (failed)"));
 }
 
 void test_Assembler()
@@ -321,6 +1779,24 @@ int main(int argc, char * argv[])
 {
     print_version();
 
+    // jlang-vm --trace: run the traced interpreter only.
+    if (argc > 1 && strcmp(argv[1], "--trace") == 0) {
+        test_Interpreter_v4_traced();
+        return 0;
+    }
+
+    // jlang-vm --profile [file]: run the profiled interpreter only.
+    if (argc > 1 && strcmp(argv[1], "--profile") == 0) {
+        test_Interpreter_v4_profiled((argc > 2) ? argv[2] : nullptr);
+        return 0;
+    }
+
+    // jlang-vm --sample [file]: run the sampled interpreter only.
+    if (argc > 1 && strcmp(argv[1], "--sample") == 0) {
+        test_Interpreter_v4_sampled((argc > 2) ? argv[2] : nullptr);
+        return 0;
+    }
+
 #if 0
     jasm::Initializer initializer;
     test_Assembler();
@@ -338,6 +1814,28 @@ int main(int argc, char * argv[])
     //test_Interpreter_v4_inline();
     test_Interpreter_v3_inline();
     test_Interpreter_v4();
+    test_Interpreter_v4_threaded();
+    test_Interpreter_v4_predecoded();
+    test_Interpreter_v4_fused();
+    test_Interpreter_v4_specialized();
+    test_Interpreter_v4_jit();
+    test_Interpreter_v4_tiered();
+    test_Interpreter_v4_memoized();
+    test_Interpreter_v4_threads();
+    test_Interpreter_v4_scheduler();
+    test_Interpreter_v4_fibers();
+    test_Interpreter_v4_pool();
+    test_Interpreter_v4_batch();
+    test_Interpreter_v4_heap();
+    test_Interpreter_v4_gc();
+    test_Interpreter_v4_image();
+    test_Interpreter_v4_verify();
+    test_Interpreter_v4_tailcall();
+    test_Interpreter_v4_overflow();
+    test_vmFrame_ops();
+    test_vmCallStack();
+    test_Interpreter_v5();
+    test_Interpreter_v5_vector();
     test_Interpreter_v3();
     //test_Interpreter_v2();
     //test_Interpreter_v1();